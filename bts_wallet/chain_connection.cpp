@@ -21,6 +21,9 @@ const chain_message_type subscribe_message::type = chain_message_type::subscribe
 const chain_message_type block_message::type = chain_message_type::block_msg;
 const chain_message_type trx_message::type = chain_message_type::trx_msg;
 const chain_message_type trx_err_message::type = chain_message_type::trx_err_msg;
+const chain_message_type get_address_filters_message::type = chain_message_type::get_address_filters_msg;
+const chain_message_type address_filters_message::type = chain_message_type::address_filters_msg;
+const chain_message_type chain_info_message::type = chain_message_type::chain_info_msg;
 
   namespace detail
   {
@@ -285,12 +288,25 @@ const chain_message_type trx_err_message::type = chain_message_type::trx_err_msg
                 while( cur_block_num < int32_t(my->chain->head_block_num())  )
                 {
                     cur_block_num++;
-                    block_message blk_msg;
-                    blk_msg.block_data = my->chain->fetch_trx_block( cur_block_num );
+
+                    // the stored block is already packed, a block_message is the packed
+                    // trx_block followed by the packed sigs so there is nothing to re-serialize
+                    mail::message msg;
+                    msg.type = block_message::type;
+                    msg.data = my->chain->fetch_packed_block( cur_block_num );
+
+                    // the header is the prefix of the packed trx_block
+                    bts::blockchain::block_header header;
+                    fc::datastream<const char*> ds( msg.data.data(), msg.data.size() );
+                    fc::raw::unpack( ds, header );
+
                     // TODO: sign it..
-                    ilog( "sending block ${n} ${c}", ("n",cur_block_num)("c",blk_msg.block_data.id()) );
-                    send( mail::message(blk_msg) );
-                    my->_last_block_id = blk_msg.block_data.id();
+                    msg.data.push_back( 0 ); // empty sigs
+                    msg.size = msg.data.size();
+
+                    ilog( "sending block ${n} ${c}", ("n",cur_block_num)("c",header.id()) );
+                    send( msg );
+                    my->_last_block_id = header.id();
                     fc::usleep( fc::microseconds( 1000*100 ) );
                 }
                 ilog( "all synced up, no blocks left to send" );
@@ -2,6 +2,7 @@
 #include <fc/reflect/reflect.hpp>
 #include <bts/blockchain/block.hpp>
 #include <bts/blockchain/transaction.hpp>
+#include <bts/blockchain/address_filter.hpp>
 #include <set>
 
 enum chain_message_type
@@ -9,10 +10,12 @@ enum chain_message_type
     subscribe_msg = 1,
     block_msg     = 2,
     trx_msg       = 3,
-    trx_err_msg   = 4
-
+    trx_err_msg   = 4,
+    get_address_filters_msg = 5,
+    address_filters_msg     = 6,
+    chain_info_msg          = 7
 };
-FC_REFLECT_ENUM( chain_message_type, (subscribe_msg)(block_msg)(trx_msg)(trx_err_msg) )
+FC_REFLECT_ENUM( chain_message_type, (subscribe_msg)(block_msg)(trx_msg)(trx_err_msg)(get_address_filters_msg)(address_filters_msg)(chain_info_msg) )
 
 struct subscribe_message
 {
@@ -50,3 +53,43 @@ struct trx_err_message
    std::string                            err;
 };
 FC_REFLECT( trx_err_message, (signed_trx)(err) )
+
+/**
+ *  Requests the address filters of count blocks starting at from_block_num so
+ *  that a client can decide which blocks it needs without downloading them.
+ */
+struct get_address_filters_message
+{
+   static const chain_message_type type;
+   get_address_filters_message():from_block_num(0),count(0){}
+
+   uint32_t                        from_block_num;
+   uint32_t                        count;
+};
+FC_REFLECT( get_address_filters_message, (from_block_num)(count) )
+
+/** filters[i] is the filter of block from_block_num + i, fewer than requested may be sent */
+struct address_filters_message
+{
+   static const chain_message_type type;
+   address_filters_message():from_block_num(0){}
+
+   uint32_t                                         from_block_num;
+   std::vector<bts::blockchain::address_filter>     filters;
+};
+FC_REFLECT( address_filters_message, (from_block_num)(filters) )
+
+/**
+ *  Sent by the server in reply to a subscribe_message, before any blocks, so
+ *  that a client can tell whether the server is able to bring it up to date.
+ */
+struct chain_info_message
+{
+   static const chain_message_type type;
+   chain_info_message():head_block_num(0),first_full_block(0){}
+
+   uint32_t                        head_block_num;
+   /** blocks before this have been pruned and can not be sent, 0 for an archive */
+   uint32_t                        first_full_block;
+};
+FC_REFLECT( chain_info_message, (head_block_num)(first_full_block) )
@@ -6,6 +6,8 @@
 #include <mail/message.hpp>
 #include <mail/stcp_socket.hpp>
 #include <bts/blockchain/blockchain_db.hpp>
+#include <bts/blockchain/mempool.hpp>
+#include <bts/config.hpp>
 #include <bts/db/level_map.hpp>
 #include <fc/time.hpp>
 #include <fc/network/tcp_socket.hpp>
@@ -102,7 +104,7 @@ namespace detail
    {
       public:
         chain_server_impl()
-        :ser_del(nullptr)
+        :ser_del(nullptr),pending(chain)
         {}
 
         ~chain_server_impl()
@@ -143,7 +145,6 @@ namespace detail
                                                                                             
         fc::future<void>                                                                     accept_loop_complete;
        // fc::future<void>                                                                     block_gen_loop_complete;
-        std::unordered_map<bts::blockchain::transaction_id_type,bts::blockchain::signed_transaction> pending;
 
 
        /* void block_gen_loop()
@@ -229,6 +230,12 @@ namespace detail
              {
                 auto sm = m.as<subscribe_message>();
                 ilog( "recv: ${m}", ("m",sm) );
+
+                chain_info_message info;
+                info.head_block_num   = chain.head_block_num();
+                info.first_full_block = chain.first_full_block();
+                c.send( message( info ) );
+
                 c.set_last_block_id( sm.last_block );
                 c.exec_sync_loop();
              }
@@ -237,10 +244,7 @@ namespace detail
                 try {
                    auto blk = m.as<block_message>();
                    chain.push_block( blk.block_data );
-                   for( auto itr = blk.block_data.trxs.begin(); itr != blk.block_data.trxs.end(); ++itr )
-                   {
-                      pending.erase( itr->id() );
-                   }
+                   pending.on_push_block( blk.block_data );
                    broadcast_block( blk.block_data );
                 }
                 catch ( const fc::exception& e )
@@ -252,14 +256,29 @@ namespace detail
                    c.close();
                 }
              }
+             else if( m.type == get_address_filters_message::type )
+             {
+                auto req = m.as<get_address_filters_message>();
+                address_filters_message reply;
+                // the filters of pruned blocks have been discarded
+                reply.from_block_num = std::max( req.from_block_num, chain.first_full_block() );
+
+                uint32_t head  = chain.head_block_num();
+                uint32_t count = std::min<uint32_t>( req.count, MAX_ADDRESS_FILTERS_PER_MESSAGE );
+                for( uint32_t n = reply.from_block_num; 
+                     head != INVALID_BLOCK_NUM && n <= head && reply.filters.size() < count; ++n )
+                {
+                   reply.filters.push_back( chain.fetch_address_filter( n ) );
+                }
+                c.send( message( reply ) );
+             }
              else if( m.type == chain_message_type::trx_msg )
              {
                 auto trx = m.as<trx_message>();
                 ilog( "recv: ${m}", ("m",trx) );
                 try 
                 {
-                   chain.evaluate_signed_transaction( trx.signed_trx ); // throws exception if invalid trx.
-                   if( pending.insert( std::make_pair(trx.signed_trx.id(),trx.signed_trx) ).second )
+                   if( pending.add( trx.signed_trx ) ) // throws exception if invalid trx.
                    {
                       fc::async( [=]() { broadcast( m ); } );
                    }
@@ -375,6 +394,7 @@ namespace detail
            }
         }
         bts::blockchain::blockchain_db chain;
+        bts::blockchain::mempool       pending;
    };
 }
 
@@ -404,7 +424,7 @@ void chain_server::configure( const chain_server::config& c )
      my->accept_loop_complete = fc::async( [=](){ my->accept_loop(); } ); 
     // my->block_gen_loop_complete = fc::async( [=](){ my->block_gen_loop(); } ); 
      
-     my->chain.open( "chain" );
+     my->chain.open( "chain", true, false, c.prune_depth );
      if( my->chain.head_block_num() == uint32_t(-1) )
      {
          auto genesis = create_test_genesis_block();
@@ -46,8 +46,9 @@
         struct config
         {
             config()
-            :port(0){}
+            :port(0),prune_depth(0){}
             uint16_t                 port;  ///< the port to listen for incoming connections on.
+            uint32_t                 prune_depth; ///< see blockchain_db::open(), 0 keeps every block
             std::vector<std::string> blacklist;  // host's that are blocked from connecting
             std::vector<fc::ip::endpoint> mirrors;  // host's that are blocked from connecting
         };
@@ -79,4 +80,4 @@
   };
   typedef std::shared_ptr<chain_server> chain_server_ptr;
 
-FC_REFLECT( chain_server::config, (port)(mirrors) )
+FC_REFLECT( chain_server::config, (port)(mirrors)(prune_depth) )
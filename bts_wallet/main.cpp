@@ -4,6 +4,10 @@
 #include <fc/filesystem.hpp>
 #include <bts/momentum.hpp>
 #include <bts/blockchain/blockchain_wallet.hpp>
+#include <bts/blockchain/mempool.hpp>
+#include <bts/blockchain/block_template_builder.hpp>
+#include <bts/blockchain/blockchain_market_db.hpp>
+#include <bts/blockchain/worker_threads.hpp>
 #include <fc/thread/thread.hpp>
 #include <fc/reflect/variant.hpp>
 #include <fc/log/file_appender.hpp>
@@ -104,7 +108,6 @@ class client : public chain_connection_delegate
       fc::path                                      _datadir;
       std::unordered_set<fc::rpc::json_connection*> _login_set;
       client_config                                 _config;
-      std::unordered_map<bts::blockchain::transaction_id_type,bts::blockchain::signed_transaction> pending;
 
       fc::signal<void()>                            _exit_signal;
       void wait_for_quit()
@@ -240,6 +243,16 @@ class client : public chain_connection_delegate
             return fc::variant(data);
          });
 
+         con->add_method( "getorderbook", [=]( const fc::variants& params ) -> fc::variant 
+         {
+            FC_ASSERT( _chain_connected );
+            FC_ASSERT( params.size() == 3 );
+
+            order_book book = chain.get_order_book( params[0].as<asset::type>(), params[1].as<asset::type>(), 
+                                                    params[2].as<uint32_t>() );
+            return fc::variant(book);
+         });
+
          con->add_method( "getnewaddress", [=]( const fc::variants& params ) -> fc::variant 
          {
              check_login( capture_con );
@@ -271,6 +284,26 @@ class client : public chain_connection_delegate
              return fc::variant( chain.get_market_history( quote, base, from, to, blocks_per_point ) );
          });
 
+         /**
+          *  @param quote
+          *  @param base
+          *  @param resolution - seconds per candle: 3600, 14400, 86400 or 604800
+          *  @param from 
+          *  @param to 
+          */
+         con->add_method( "market_candles", [=]( const fc::variants& params ) -> fc::variant 
+         {
+             FC_ASSERT( _chain_connected );
+             FC_ASSERT( params.size() == 5 );
+
+             auto quote      = params[0].as<bts::blockchain::asset::type>();
+             auto base       = params[1].as<bts::blockchain::asset::type>();
+             auto resolution = params[2].as<uint64_t>();
+             auto from       = params[3].as<fc::time_point_sec>();
+             auto to         = params[4].as<fc::time_point_sec>();
+             return fc::variant( chain.get_market_candles( quote, base, uint32_t(resolution), from, to ) );
+         });
+
          con->add_method( "transfer", [=]( const fc::variants& params ) -> fc::variant 
          {
              FC_ASSERT( _chain_connected );
@@ -355,7 +388,14 @@ class client : public chain_connection_delegate
          con->add_method( "get_block", [=]( const fc::variants& params ) -> fc::variant 
          {
              FC_ASSERT( params.size() == 1 );
-             return fc::variant( chain.fetch_block( params[0].as_int64() )  ); 
+             return fc::variant( chain.fetch_block( params[0].as_int64() )  );
+         });
+
+         con->add_method( "get_utxo_commitment", [=]( const fc::variants& params ) -> fc::variant
+         {
+             if( params.size() == 0 )
+                return fc::variant( chain.get_utxo_commitment() );
+             return fc::variant( chain.fetch_utxo_commitment( params[0].as<uint32_t>() ) );
          });
 
          con->add_method( "getinfo", [=]( const fc::variants& params ) -> fc::variant 
@@ -418,7 +458,7 @@ class client : public chain_connection_delegate
              _wallet.import_key( private_key );
              if( rescan )
              {
-               _wallet.scan_chain(chain);
+               _wallet.parallel_scan_chain(chain);
              }
              return fc::variant( true );
          });
@@ -438,7 +478,7 @@ class client : public chain_connection_delegate
              _wallet.import_key( private_key );
              if( rescan )
              {
-               _wallet.scan_chain(chain);
+               _wallet.parallel_scan_chain(chain);
              }
              return fc::variant( true );
          });
@@ -453,17 +493,14 @@ class client : public chain_connection_delegate
          }
       }
 
-      client():_chain_con(this),_chain_connected(false){}
+      client():_chain_con(this),_chain_connected(false),pending(chain),_block_template(chain,pending){}
       virtual void on_connection_message( chain_connection& c, const message& m )
       {
          if( m.type == chain_message_type::block_msg )
          {
             auto blkmsg = m.as<block_message>();
             chain.push_block( blkmsg.block_data );
-            for( auto itr = blkmsg.block_data.trxs.begin(); itr != blkmsg.block_data.trxs.end(); ++itr )
-            {
-               pending.erase( itr->id() );
-            }
+            pending.on_push_block( blkmsg.block_data );
             _wallet.set_stake( chain.get_stake(), chain.head_block_num() );
             _wallet.set_fee_rate( chain.get_fee_rate() );
             if( _wallet.scan_chain( chain, blkmsg.block_data.block_num ) )
@@ -477,13 +514,24 @@ class client : public chain_connection_delegate
          else if( m.type == trx_message::type )
          {
             auto trx_msg = m.as<trx_message>();
-            chain.evaluate_signed_transaction( trx_msg.signed_trx ); // throws exception if invalid trx.
-            if( pending.insert( std::make_pair(trx_msg.signed_trx.id(),trx_msg.signed_trx) ).second )
+            if( pending.add( trx_msg.signed_trx ) ) // throws exception if invalid trx.
             {
+               _block_template.on_new_transaction( trx_msg.signed_trx.id() );
                // reset the mining thread...
                _new_trx = true;
             }
          }
+         else if( m.type == chain_info_message::type )
+         {
+            auto info = m.as<chain_info_message>();
+            uint32_t next = chain.head_block_num() + 1; // 0 before the genesis block
+            if( next < info.first_full_block )
+            {
+               std::cerr<<"the server has pruned blocks "<<next<<" to "<<info.first_full_block-1
+                        <<" and can not bring this chain up to date\n";
+               wlog( "server has pruned the blocks we need: ${info}", ("info",info)("next",next) );
+            }
+         }
          else if( m.type == trx_err_message::type )
          {
             auto errmsg = m.as<trx_err_message>();
@@ -495,7 +543,7 @@ class client : public chain_connection_delegate
       void open( const fc::path& datadir )
       { try {
           _datadir = datadir;
-          chain.open( datadir / "chain" );
+          chain.open( datadir / "chain", true, true /* index addresses for wallet rescans */ );
           ilog( "opening ${d}", ("d", datadir/"wallet.bts") );
           //_wallet.open( datadir / "wallet.bts" );
 
@@ -820,14 +868,8 @@ class client : public chain_connection_delegate
             {
                 fc::usleep( fc::seconds( 20 ) );
                 ilog( "buliding block..." );
-                std::vector<bts::blockchain::signed_transaction> new_trxs;
-                for( auto itr = pending.begin(); itr != pending.end(); ++itr )
-                {
-                   new_trxs.push_back(itr->second);
-                }
-
                 _new_trx   = false;
-                auto block_template = chain.generate_next_block( new_trxs );
+                auto block_template = _block_template.get_template();
                 if( block_template.trxs.size() == 0 )
                 {
                    ilog( "no transactions to process" );
@@ -915,12 +957,7 @@ class client : public chain_connection_delegate
       void mine()
       {
           ilog( "mine" );
-          std::vector<bts::blockchain::signed_transaction> new_trxs;
-          for( auto itr = pending.begin(); itr != pending.end(); ++itr )
-          {
-             new_trxs.push_back(itr->second);
-          }
-          auto block_template = chain.generate_next_block( new_trxs );
+          auto block_template = _block_template.get_template();
           std::cout<<"block template\n" << fc::json::to_pretty_string(block_template)<<"\n";
           auto req = block_template.get_required_difficulty( chain.current_difficulty(), chain.available_coindays() );
           if( block_template.trxs.size() == 0 )
@@ -963,6 +1000,8 @@ class client : public chain_connection_delegate
 
 
       bts::blockchain::blockchain_db    chain;
+      bts::blockchain::mempool          pending;
+      bts::blockchain::block_template_builder _block_template;
       bts::blockchain::wallet           _wallet;
       fc::future<void>                  sim_loop_complete;
       fc::future<void>                  chain_connect_loop_complete;
@@ -1053,7 +1092,7 @@ void process_commands( fc::thread* main_thread, std::shared_ptr<client> c )
                if( rescan == "rescan" )
                {
                   std::cout<<"rescanning chain...\n";
-                  c->_wallet.scan_chain(c->chain);
+                  c->_wallet.parallel_scan_chain(c->chain);
                }
                std::cout<<"import complete\n";
                c->print_balances();
@@ -1315,7 +1354,7 @@ void process_commands( fc::thread* main_thread, std::shared_ptr<client> c )
              main_thread->async( [=]() {
                                     c->_wallet.import_bitcoin_wallet( fc::path(wallet_dat), password );
                                     std::cout<<"rescanning chain...\n";
-                                    c->_wallet.scan_chain(c->chain);
+                                    c->_wallet.parallel_scan_chain(c->chain);
                                  } ).wait();
          }
          else if( command == "lock" )
@@ -1446,7 +1485,9 @@ int main( int argc, char** argv )
    catch ( const fc::exception& e )
    {
       std::cerr<< e.to_string() << "\n";
+      shutdown_worker_threads();
       return -1;
    }
+   shutdown_worker_threads();
    return 0;
 }
@@ -2,6 +2,8 @@
 #include <fc/thread/thread.hpp>
 #include <fc/log/logger_config.hpp>
 
+#include <stdlib.h>
+
 int main( int argc, char** argv )
 {
    try {
@@ -10,6 +12,11 @@ int main( int argc, char** argv )
        chain_server cserv;
        chain_server::config cfg;
        cfg.port = 4567;
+       if( argc >= 2 )
+       {
+          // keep only the last PRUNE_DEPTH blocks in full, see blockchain_db::open()
+          cfg.prune_depth = atoi( argv[1] );
+       }
        cserv.configure(cfg);
        ilog( "sleep..." );
        fc::usleep( fc::seconds( 60*60*24*365 ) );
@@ -0,0 +1,33 @@
+#pragma once
+#include <bts/blockchain/address_index.hpp>
+
+#include <vector>
+
+namespace bts { namespace blockchain {
+
+  /**
+   *  Bloom filter of the addresses a block touched, the owners of the outputs
+   *  it created and of the outputs it spent.  A wallet only has to fetch the
+   *  blocks whose filter may contain one of its addresses.
+   *
+   *  A filter with no bits may contain anything, this is what is returned for
+   *  blocks stored before filters were kept.
+   */
+  struct address_filter
+  {
+     address_filter():num_hashes(0){}
+
+     /** sized for about a 1% false positive rate with num_addresses inserted */
+     explicit address_filter( uint32_t num_addresses );
+
+     void insert( const output_owner& owner );
+     bool may_contain( const output_owner& owner )const;
+     bool may_contain_any( const std::vector<output_owner>& owners )const;
+
+     uint8_t            num_hashes;
+     std::vector<char>  bits;
+  };
+
+} } // bts::blockchain
+
+FC_REFLECT( bts::blockchain::address_filter, (num_hashes)(bits) )
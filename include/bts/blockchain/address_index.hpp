@@ -0,0 +1,128 @@
+#pragma once
+#include <bts/blockchain/utxo_index.hpp>
+#include <bts/address.hpp>
+#include <bts/pts_address.hpp>
+#include <fc/array.hpp>
+#include <fc/filesystem.hpp>
+
+#include <memory>
+#include <vector>
+
+namespace bts { namespace blockchain {
+
+  namespace detail { class address_index_impl; }
+
+  /**
+   *  The address that owns an output, bts and pts addresses are kept apart
+   *  by type so that a pts address can not alias a bts address.
+   */
+  struct output_owner
+  {
+     enum owner_type
+     {
+        bts_address = 0,
+        pts_address = 1
+     };
+
+     output_owner():type(bts_address){ memset( addr.data, 0, sizeof(addr.data) ); }
+     output_owner( const bts::address& a );
+     output_owner( const bts::pts_address& a );
+
+     uint8_t             type;
+     fc::array<char,25>  addr; ///< a bts::address is zero padded
+
+     friend bool operator < ( const output_owner& a, const output_owner& b )
+     {
+        return a.type == b.type ? memcmp( a.addr.data, b.addr.data, sizeof(a.addr.data) ) < 0 : a.type < b.type;
+     }
+     friend bool operator == ( const output_owner& a, const output_owner& b )
+     {
+        return a.type == b.type && memcmp( a.addr.data, b.addr.data, sizeof(a.addr.data) ) == 0;
+     }
+  };
+
+  /**
+   *  @return false if out is not a claim type that carries an owner address,
+   *          bids and shorts are owned by their pay_address.
+   */
+  bool get_output_owner( const trx_output& out, output_owner& owner );
+
+  /** every output owned by owner is stored in chain order under owner */
+  struct address_output_key
+  {
+     address_output_key(){}
+     address_output_key( const output_owner& o, const output_location& l )
+     :owner(o),location(l){}
+
+     output_owner     owner;
+     output_location  location;
+
+     friend bool operator < ( const address_output_key& a, const address_output_key& b )
+     {
+        return a.owner == b.owner ? a.location < b.location : a.owner < b.owner;
+     }
+     friend bool operator == ( const address_output_key& a, const address_output_key& b )
+     {
+        return a.owner == b.owner && a.location == b.location;
+     }
+  };
+
+  /**
+   *  Maps owner addresses to the location of every output they were paid,
+   *  spent or not, so that a wallet can find its outputs by looking up its
+   *  addresses rather than reading every transaction in the chain.
+   */
+  class address_index
+  {
+     public:
+        address_index();
+        ~address_index();
+
+        void open( const fc::path& dir, bool create = true, bts::db::write_journal* journal = nullptr );
+        void close();
+        bool is_open()const;
+
+        /** @see bts::db::level_map::begin_batch() */
+        void begin_batch();
+        void commit_batch( bool sync = false );
+        void abort_batch();
+
+        /** indexes every output of trx that has an owner */
+        void add( const trx_num& source, const signed_transaction& trx );
+        /** reverts add() */
+        void remove( const trx_num& source, const signed_transaction& trx );
+
+        /** @return the outputs paid to owner in blocks from_block_num and later, in chain order */
+        std::vector<output_location> fetch( const output_owner& owner, uint32_t from_block_num = 0 );
+
+     private:
+        std::unique_ptr<detail::address_index_impl> my;
+  };
+
+} } // bts::blockchain
+
+FC_REFLECT( bts::blockchain::output_owner, (type)(addr) )
+FC_REFLECT( bts::blockchain::address_output_key, (owner)(location) )
+
+namespace bts { namespace db {
+   template<>
+   struct key_codec<bts::blockchain::address_output_key>
+   {
+      static const bool   is_order_preserving = true;
+      static const size_t encoded_size        = 1 + 25 + key_codec<bts::blockchain::output_location>::encoded_size;
+
+      static void encode( const bts::blockchain::address_output_key& k, char* out )
+      {
+         key_encoding::encode_uint8( k.owner.type, out );
+         key_encoding::encode_bytes( k.owner.addr.data, sizeof(k.owner.addr.data), out );
+         key_codec<bts::blockchain::output_location>::encode( k.location, out );
+      }
+      static void decode( const char* in, bts::blockchain::address_output_key& k )
+      {
+         k.owner.type = key_encoding::decode_uint8( in );
+         memcpy( k.owner.addr.data, in, sizeof(k.owner.addr.data) );
+         in += sizeof(k.owner.addr.data);
+         key_codec<bts::blockchain::output_location>::decode( in, k.location );
+      }
+   };
+} } // bts::db
@@ -0,0 +1,55 @@
+#pragma once
+#include <fc/filesystem.hpp>
+
+#include <memory>
+#include <vector>
+
+namespace bts { namespace blockchain {
+
+   namespace detail { class block_store_impl; }
+
+   /**
+    *  Append only storage of packed blocks.
+    *
+    *  Every block is written contiguously to blocks.dat and its offset and size
+    *  are written to blocks.idx at a fixed position for its block number, so
+    *  fetching a block is one seek and one sequential read with no lookups.
+    *
+    *  The store holds a contiguous range of blocks that need not start at the
+    *  genesis block, the first block number is kept in a header at the start of
+    *  blocks.idx.  A pruned database drops the blocks it no longer serves with
+    *  discard_before().
+    */
+   class block_store
+   {
+      public:
+         block_store();
+         ~block_store();
+
+         void open( const fc::path& dir );
+         void close();
+
+         /** @return the first block stored, blocks first_block() to end_block()-1 are stored */
+         uint32_t first_block()const;
+         /** @return one past the last block stored */
+         uint32_t end_block()const;
+         bool     empty()const;
+         bool     contains( uint32_t block_num )const;
+
+         /** @pre block_num == end_block() unless the store is empty, in which case it starts at block_num */
+         void append( uint32_t block_num, const std::vector<char>& packed_block );
+
+         /** discards block_num and every block after it */
+         void truncate( uint32_t block_num );
+
+         /** discards every block before block_num, this rewrites the blocks that are kept */
+         void discard_before( uint32_t block_num );
+
+         /** @pre contains( block_num ) */
+         std::vector<char> fetch( uint32_t block_num );
+
+      private:
+         std::unique_ptr<detail::block_store_impl> my;
+   };
+
+} } // bts::blockchain
@@ -0,0 +1,39 @@
+#pragma once
+#include <bts/blockchain/mempool.hpp>
+
+#include <memory>
+
+namespace bts { namespace blockchain {
+
+   namespace detail { class block_template_builder_impl; }
+
+   /**
+    *  Maintains the next block to mine so that a miner can ask for a fresh
+    *  template without evaluating the pending transactions again.
+    *
+    *  The market transactions, the selected pending transactions, their sizes,
+    *  fees, consumed outputs and ids are cached.  A new pending transaction is
+    *  appended if it fits, and the template is rebuilt from the mempool's cached
+    *  evaluations only when the head block changes, a transaction leaves the
+    *  pool or a new transaction does not fit.
+    */
+   class block_template_builder
+   {
+      public:
+         block_template_builder( blockchain_db& db, mempool& pool );
+         ~block_template_builder();
+
+         /** call after pool.add( trx ) returns true */
+         void on_new_transaction( const transaction_id_type& trx_id );
+
+         /** @return a block following the current head with the timestamp set to now */
+         trx_block get_template();
+
+         /** forces the next call to get_template() to rebuild */
+         void invalidate();
+
+      private:
+         std::unique_ptr<detail::block_template_builder_impl> my;
+   };
+
+} } // bts::blockchain
@@ -1,10 +1,15 @@
 #pragma once
 #include <bts/blockchain/block.hpp>
 #include <bts/blockchain/transaction.hpp>
+#include <bts/db/key_codec.hpp>
+
+#include <map>
+#include <string>
 
 namespace fc 
 {
    class path;
+   class mutex;
 };
 
 namespace bts { namespace blockchain {
@@ -12,6 +17,11 @@ namespace bts { namespace blockchain {
 
     namespace detail  { class blockchain_db_impl; }
 
+    struct output_owner;
+    struct output_location;
+    struct address_filter;
+    struct order_book;
+
     struct price_point
     {
         price_point():from_block(0),to_block(0){}
@@ -101,6 +111,10 @@ namespace bts { namespace blockchain {
     /**
      *  Caches output information used by inputs while
      *  evaluating a transaction.
+     *
+     *  The claim_data of unspent signature, pts, bid, long and cover
+     *  outputs is left empty, their claims are read with
+     *  blockchain_db::fetch_claim() instead of being packed and unpacked.
      */
     struct meta_trx_input
     {
@@ -179,9 +193,33 @@ namespace bts { namespace blockchain {
           blockchain_db();
           ~blockchain_db();
 
-          void open( const fc::path& dir, bool create = true );
+          /**
+           *  @param index_addresses - maintain the address index used by fetch_outputs(),
+           *         once it has been created it is maintained on every open.
+           *  @param prune_depth - if not 0, transactions whose outputs were all spent
+           *         more than prune_depth blocks below the head are discarded along
+           *         with the undo records and address filters of those blocks.  Only
+           *         headers, transaction ids and unspent outputs are kept below that
+           *         depth.  A database that has been pruned can not be opened without
+           *         pruning and pruning can not be combined with the address index.
+           */
+          void open( const fc::path& dir, bool create = true, bool index_addresses = false,
+                     uint32_t prune_depth = 0 );
           void close();
 
+          /**
+           *  @return the oldest block whose transactions are all stored, blocks from
+           *          here to the head can be served by fetch_trx_block(), 0 unless
+           *          the database has been pruned
+           */
+          uint32_t      first_full_block()const;
+
+          /**
+           *  @return the bytes of keys and values committed to each database since open(),
+           *          by database name, not counting what leveldb adds to write them
+           */
+          std::map<std::string,uint64_t> bytes_written()const;
+
           uint64_t      total_shares()const;
           uint32_t      head_block_num()const;
           block_id_type head_block_id()const;
@@ -196,33 +234,94 @@ namespace bts { namespace blockchain {
           std::vector<price_point> get_market_history( asset::type quote, asset::type base, 
                                                       fc::time_point_sec from, fc::time_point_sec to, 
                                                       uint32_t blocks_per_point = 1 );
+          /** @param resolution - seconds per candle, see market_db::get_candles() */
+          std::vector<price_point> get_market_candles( asset::type quote, asset::type base, uint32_t resolution,
+                                                       fc::time_point_sec from, fc::time_point_sec to );
 
          /**
           *  Validates that trx could be included in a future block, that
           *  all inputs are unspent, that it is valid for the current time,
           *  and that all inputs have proper signatures and input data.
           *
+          *  @param signers - trx.get_signed_addresses() if it is already known
+          *
           *  @return any trx fees that would be paid if this trx were included
           *          in the next block.
           *
           *  @throw exception if trx can not be applied to the current chain state.
           */
-         trx_eval   evaluate_signed_transaction( const signed_transaction& trx, bool ignore_fees = false, bool is_market = false );       
+         trx_eval   evaluate_signed_transaction( const signed_transaction& trx, bool ignore_fees = false, bool is_market = false,
+                                                 const std::unordered_set<address>* signers = nullptr );       
          trx_eval   evaluate_signed_transactions( const std::vector<signed_transaction>& trxs, uint64_t ignore_first_n = 0 );
 
          std::vector<signed_transaction> match_orders( std::vector<price_point>* order_stats = nullptr );
+
+         /**
+          *  Forgets which pairs failed to match when their books were last seen, so the
+          *  next match_orders() evaluates every pair.  Only useful to measure its full cost.
+          */
+         void       clear_match_cache();
+
          trx_block  generate_next_block( const std::vector<signed_transaction>& trx );
 
+         /**
+          *  Builds the next block from transactions that have already been evaluated
+          *  against the current head block, see mempool::select().  Transactions are
+          *  included in the order given after the market transactions, skipping any
+          *  that conflict with an earlier one, until the block is full.
+          */
+         trx_block  generate_next_block( const std::vector<signed_transaction>& trxs, const std::vector<trx_eval>& evals );
+
+         /**
+          *  @return the header of a block following the head block that contains
+          *          transactions with the given totals, trx_mroot is not set.
+          */
+         block_header generate_next_block_header( const trx_eval& totals );
+
          trx_num    fetch_trx_num( const uint160& trx_id );
          meta_trx   fetch_trx( const trx_num& t );
 
          signed_transaction          fetch_transaction( const transaction_id_type& trx_id );
          std::vector<meta_trx_input> fetch_inputs( const std::vector<trx_input>& inputs, uint32_t head = INVALID_BLOCK_NUM );
+         /** fills rtn, reusing its capacity */
+         void                        fetch_inputs( const std::vector<trx_input>& inputs, uint32_t head, std::vector<meta_trx_input>& rtn );
+
+         /** @see utxo_index::fetch_claim() */
+         bool fetch_claim( const output_reference& ref, claim_by_signature_output& claim )const;
+         bool fetch_claim( const output_reference& ref, claim_by_pts_output& claim )const;
+         bool fetch_claim( const output_reference& ref, claim_by_bid_output& claim )const;
+         bool fetch_claim( const output_reference& ref, claim_by_long_output& claim )const;
+         bool fetch_claim( const output_reference& ref, claim_by_cover_output& claim )const;
 
          uint32_t     fetch_block_num( const block_id_type& block_id );
          block_header fetch_block( uint32_t block_num );
          full_block   fetch_full_block( uint32_t block_num );
+         /** @pre block_num >= first_full_block() */
          trx_block    fetch_trx_block( uint32_t block_num );
+         /** @return fc::raw::pack( fetch_trx_block( block_num ) ) read with a single seek from the block store */
+         std::vector<char> fetch_packed_block( uint32_t block_num );
+
+         /**
+          *  @return the filter of the addresses touched by block_num, blocks stored
+          *          before filters were kept return a filter that matches everything
+          */
+         address_filter fetch_address_filter( uint32_t block_num );
+
+         /** @see utxo_index::commitment(), nodes with the same unspent outputs return the same value */
+         fc::sha256     get_utxo_commitment()const;
+         /**
+          *  @return the utxo commitment after block_num was applied
+          *  @throw if block_num was stored before commitments were recorded
+          */
+         fc::sha256     fetch_utxo_commitment( uint32_t block_num );
+
+         bool has_address_index()const;
+         /**
+          *  @pre has_address_index()
+          *  @return every output paid to owner in blocks from_block_num and later,
+          *          spent or not, in chain order
+          */
+         std::vector<output_location> fetch_outputs( const output_owner& owner, uint32_t from_block_num = 0 );
 
          uint64_t   current_bitshare_supply();
          
@@ -233,16 +332,44 @@ namespace bts { namespace blockchain {
 
          /**
           *  Removes the top block from the stack and marks all spent outputs as 
-          *  unspent.
+          *  unspent.  The undo record written by push_block() is replayed so the
+          *  cost is proportional to the size of the block.
+          *
+          *  @param b    - the block that was removed
+          *  @param trxs - the transactions of b in block order
           */
          void pop_block( full_block& b, std::vector<signed_transaction>& trxs );
 
+         /**
+          *  Pops blocks until the head is the parent of fork.front() and then
+          *  pushes every block in fork.  If any block in fork is rejected the
+          *  original chain is restored and the exception is rethrown.
+          *
+          *  @param orphaned_trxs - the transactions of every popped block in
+          *                         chain order, including the market and mining
+          *                         trxs, so the caller can return them to its pending set.
+          */
+         void reorganize_to( const std::vector<trx_block>& fork, std::vector<signed_transaction>& orphaned_trxs );
+
+         /**
+          *  Held by push_block(), pop_block() and reorganize_to() while they change the
+          *  chain.  Lock it to read the chain from other threads without racing a block
+          *  that is applied while the reading task waits, see wallet::parallel_scan_chain().
+          */
+         fc::mutex&  block_mutex();
+
          std::string dump_market( asset::type quote, asset::type base );
 
          market_data get_market( asset::type quote, asset::type base );
 
+         /** up to levels bids and asks of the pair summed by price, see market_db::get_order_book() */
+         order_book  get_order_book( asset::type quote, asset::type base, uint32_t levels );
+
        private:
          void   store_trx( const signed_transaction& trx, const trx_num& t );
+         /** push_block() and pop_block() for callers that already hold block_mutex() */
+         void   do_push_block( const trx_block& b );
+         void   do_pop_block( full_block& b, std::vector<signed_transaction>& trxs );
          std::unique_ptr<detail::blockchain_db_impl> my;          
     };
 
@@ -266,3 +393,24 @@ FC_REFLECT( bts::blockchain::price_point, (from_time)(to_time)
                                           (open_bid)(high_bid)(low_bid)(close_bid)
                                           (open_ask)(high_ask)(low_ask)(close_ask)
                                           (quote_volume)(base_volume) )
+
+namespace bts { namespace db {
+   /** block_num then trx_idx, so meta_trxs iterates in chain order */
+   template<>
+   struct key_codec<bts::blockchain::trx_num>
+   {
+      static const bool   is_order_preserving = true;
+      static const size_t encoded_size        = 6;
+
+      static void encode( const bts::blockchain::trx_num& k, char* out )
+      {
+         key_encoding::encode_uint32( k.block_num, out );
+         key_encoding::encode_uint16( k.trx_idx, out );
+      }
+      static void decode( const char* in, bts::blockchain::trx_num& k )
+      {
+         k.block_num = key_encoding::decode_uint32( in );
+         k.trx_idx   = key_encoding::decode_uint16( in );
+      }
+   };
+} } // bts::db
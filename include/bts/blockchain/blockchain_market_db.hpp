@@ -1,13 +1,17 @@
 #pragma once
 #include <bts/blockchain/block.hpp>
+#include <bts/blockchain/blockchain_db.hpp>
 #include <bts/blockchain/asset.hpp>
 #include <fc/optional.hpp>
 #include <fc/filesystem.hpp>
+#include <bts/db/key_codec.hpp>
+#include <bts/db/write_journal.hpp>
+
+#include <functional>
 
 namespace bts { namespace blockchain {
 
   namespace detail { class market_db_impl; }
-  struct price_point;
 
  /**
   *   Bids:  (offers to buy Base Unit with Quote Unit)
@@ -31,15 +35,98 @@ namespace bts { namespace blockchain {
   bool operator < ( const market_order& a, const market_order& b );
   bool operator == ( const market_order& a, const market_order& b );
 
+  /** the total of the orders at one price */
+  struct price_level
+  {
+     price_level():amount(0),orders(0){}
+
+     price    level_price;
+     uint64_t amount;
+     uint32_t orders;
+  };
+
+  /** the best price levels of a pair, bids from the highest and asks from the lowest */
+  struct order_book
+  {
+     std::vector<price_level> bids;
+     std::vector<price_level> asks;
+  };
+
   struct margin_call
   {
      margin_call( const price& callp, const output_reference& loc ):call_price(callp),location(loc){}
+     margin_call(){}
 
      price            call_price;
      output_reference location;
   };
   bool operator < ( const margin_call& a, const margin_call& b );
   bool operator == ( const margin_call& a, const margin_call& b );
+
+  struct order_undo
+  {
+     /** the amount of undo records written before order amounts were kept */
+     static const uint64_t unknown_amount = uint64_t(-1);
+
+     order_undo():existed(false),amount(0){}
+     order_undo( const market_order& o, bool e, uint64_t a = 0 ):order(o),existed(e),amount(a){}
+
+     market_order order;
+     bool         existed;
+     uint64_t     amount; ///< valid if existed
+  };
+
+  struct call_undo
+  {
+     call_undo():existed(false){}
+     call_undo( const margin_call& c, bool e ):call(c),existed(e){}
+
+     margin_call call;
+     bool        existed;
+  };
+
+  struct depth_undo
+  {
+     depth_undo():existed(false),bid_depth(0),ask_depth(0){}
+
+     asset_type quote_unit;
+     bool       existed;
+     uint64_t   bid_depth;
+     uint64_t   ask_depth;
+  };
+
+  struct history_undo
+  {
+     asset_type         quote_unit;
+     asset_type         base_unit;
+     fc::time_point_sec from_time;
+  };
+
+  struct candle_undo
+  {
+     candle_undo():resolution(0),existed(false){}
+
+     asset_type         quote_unit;
+     asset_type         base_unit;
+     uint32_t           resolution;
+     fc::time_point_sec bucket;
+     bool               existed;
+     price_point        candle; ///< valid if existed
+  };
+
+  /**
+   *  The prior state of every entry changed while a batch was open, in the
+   *  order they were changed.  market_db::undo() restores them.
+   */
+  struct market_undo
+  {
+     std::vector<order_undo>    bids;
+     std::vector<order_undo>    asks;
+     std::vector<call_undo>     calls;
+     std::vector<depth_undo>    depth;
+     std::vector<history_undo>  history; ///< price points added by the batch
+     std::vector<candle_undo>   candles;
+  };
   
   /**
    *  Manages the current state of the market to enable effecient
@@ -51,9 +138,41 @@ namespace bts { namespace blockchain {
        market_db();
        ~market_db();
 
-       void open( const fc::path& db_dir );
+       /** @return the amount of an order read from its output, as passed to insert_bid() or insert_ask() */
+       typedef std::function<uint64_t( const market_order& )> order_amount_func;
+
+       /**
+        *  @param journal   - if given, every database is added to it before the books are loaded
+        *  @param amount_of - looks up the amount of orders stored before amounts were kept,
+        *                     for the books and for undo records with order_undo::unknown_amount
+        */
+       void open( const fc::path& db_dir, bts::db::write_journal* journal = nullptr,
+                  const order_amount_func& amount_of = order_amount_func() );
+
+       /**
+        *  Stages all changes to the order book, depth and price history until
+        *  commit_batch(), see bts::db::level_map::begin_batch()
+        */
+       void begin_batch();
+       void commit_batch( bool sync = false );
+       void abort_batch();
+
+       /** @return the changes made since begin_batch(), call before commit_batch() */
+       const market_undo& batch_undo()const;
+
+       /** reverts the changes recorded in u, changes are staged in the current batch */
+       void undo( const market_undo& u );
+
        std::vector<market_order> get_bids( asset::type quote_unit, asset::type base_unit )const;
        std::vector<market_order> get_asks( asset::type quote_unit, asset::type base_unit )const;
+
+       /** up to levels price levels on each side of the pair, without reading any order */
+       order_book                get_order_book( asset::type quote_unit, asset::type base_unit, uint32_t levels )const;
+
+       /** 
+        *  The margin calls of call_price.quote_unit triggered at call_price, those with
+        *  a call price at or above it, highest first.  O(log n + k) for k triggered calls.
+        */
        std::vector<margin_call>  get_calls( price call_price )const;
 
        
@@ -70,11 +189,29 @@ namespace bts { namespace blockchain {
         */
        uint64_t get_depth( asset::type quote_unit );
 
-       /** @param depth - the amount of bts backing the order used to
+       /**
+        *  Incremented every time a bid, ask or margin call of the pair is inserted,
+        *  removed or restored, including by abort_batch() and undo().  The book of
+        *  a pair has not changed if its revision has not.  Revisions are not
+        *  persisted and start at 0 when the process starts.
+        */
+       uint64_t get_revision( asset::type quote, asset::type base )const;
+
+       /**
+        *  The (quote, base) pairs that have at least one bid, ask or margin call,
+        *  ordered by base and then by quote.  Pairs without orders have nothing
+        *  to match, so only these need to be visited each block.
+        */
+       std::vector< std::pair<asset::type,asset::type> > get_active_markets()const;
+
+       /** 
+        * @param amount - the size of the order summed into its price level, bids
+        * are counted in quote units and asks in base units.
+        * @param depth - the amount of bts backing the order used to
         * track minimum market depth to facilitate trading.
         */
-       void insert_bid( const market_order& m, uint64_t depth );
-       void insert_ask( const market_order& m, uint64_t depth );
+       void insert_bid( const market_order& m, uint64_t amount, uint64_t depth );
+       void insert_ask( const market_order& m, uint64_t amount, uint64_t depth );
        void remove_bid( const market_order& m, uint64_t depth );
        void remove_ask( const market_order& m, uint64_t depth );
        void insert_call( const margin_call& c, uint64_t depth );
@@ -85,6 +222,10 @@ namespace bts { namespace blockchain {
        /** @pre quote > base  */
        fc::optional<market_order> get_lowest_ask( asset::type quote, asset::type base );
 
+       /**
+        *  Records the price point of one block and adds it to the candles of
+        *  the 1 hour, 4 hour, 1 day and 1 week resolutions that contain it.
+        */
        void push_price_point( const price_point& pt );
 
        /**
@@ -92,6 +233,15 @@ namespace bts { namespace blockchain {
         */
        std::vector<price_point> get_history( asset::type quote, asset::type base, fc::time_point_sec from, fc::time_point_sec to, uint32_t blocks_per_point = 1 );
 
+       /**
+        *  Returns the candles of the pair that overlap [from, to], each the sum of the 
+        *  price points in one period of resolution seconds.  
+        *
+        *  @param resolution - 3600, 14400, 86400 or 604800
+        */
+       std::vector<price_point> get_candles( asset::type quote, asset::type base, uint32_t resolution, 
+                                             fc::time_point_sec from, fc::time_point_sec to );
+
      private:
        std::unique_ptr<detail::market_db_impl> my;
   };
@@ -100,4 +250,66 @@ namespace bts { namespace blockchain {
 
 FC_REFLECT( bts::blockchain::market_order, (base_unit)(quote_unit)(ratio)(location) );
 FC_REFLECT( bts::blockchain::margin_call, (call_price)(location) )
+FC_REFLECT( bts::blockchain::price_level, (level_price)(amount)(orders) )
+FC_REFLECT( bts::blockchain::order_book, (bids)(asks) )
+FC_REFLECT( bts::blockchain::order_undo, (order)(existed)(amount) )
+FC_REFLECT( bts::blockchain::call_undo, (call)(existed) )
+FC_REFLECT( bts::blockchain::depth_undo, (quote_unit)(existed)(bid_depth)(ask_depth) )
+FC_REFLECT( bts::blockchain::history_undo, (quote_unit)(base_unit)(from_time) )
+FC_REFLECT( bts::blockchain::candle_undo, (quote_unit)(base_unit)(resolution)(bucket)(existed)(candle) )
+FC_REFLECT( bts::blockchain::market_undo, (bids)(asks)(calls)(depth)(history)(candles) )
+
+namespace bts { namespace db {
+   /** base_unit, quote_unit, ratio, location */
+   template<>
+   struct key_codec<bts::blockchain::market_order>
+   {
+      static const bool   is_order_preserving = true;
+      static const size_t encoded_size        = 1 + 1 + 16 + sizeof(fc::uint160) + 1;
+
+      static void encode( const bts::blockchain::market_order& k, char* out )
+      {
+         key_encoding::encode_uint8( k.base_unit.value, out );
+         key_encoding::encode_uint8( k.quote_unit.value, out );
+         key_encoding::encode_uint128( k.ratio, out );
+         key_codec<bts::blockchain::output_reference>::encode( k.location, out );
+         out += key_codec<bts::blockchain::output_reference>::encoded_size;
+      }
+      static void decode( const char* in, bts::blockchain::market_order& k )
+      {
+         k.base_unit  = bts::blockchain::asset::type( key_encoding::decode_uint8( in ) );
+         k.quote_unit = bts::blockchain::asset::type( key_encoding::decode_uint8( in ) );
+         k.ratio      = key_encoding::decode_uint128( in );
+         key_codec<bts::blockchain::output_reference>::decode( in, k.location );
+         in += key_codec<bts::blockchain::output_reference>::encoded_size;
+      }
+   };
+
+   /** 
+    *  quote_unit, ratio, location as compared by operator<, the base_unit is
+    *  appended so that the call price can be recovered from the key.
+    */
+   template<>
+   struct key_codec<bts::blockchain::margin_call>
+   {
+      static const bool   is_order_preserving = true;
+      static const size_t encoded_size        = 1 + 16 + sizeof(fc::uint160) + 1 + 1;
 
+      static void encode( const bts::blockchain::margin_call& k, char* out )
+      {
+         key_encoding::encode_uint8( k.call_price.quote_unit.value, out );
+         key_encoding::encode_uint128( k.call_price.ratio, out );
+         key_codec<bts::blockchain::output_reference>::encode( k.location, out );
+         out += key_codec<bts::blockchain::output_reference>::encoded_size;
+         key_encoding::encode_uint8( k.call_price.base_unit.value, out );
+      }
+      static void decode( const char* in, bts::blockchain::margin_call& k )
+      {
+         k.call_price.quote_unit = bts::blockchain::asset::type( key_encoding::decode_uint8( in ) );
+         k.call_price.ratio      = key_encoding::decode_uint128( in );
+         key_codec<bts::blockchain::output_reference>::decode( in, k.location );
+         in += key_codec<bts::blockchain::output_reference>::encoded_size;
+         k.call_price.base_unit  = bts::blockchain::asset::type( key_encoding::decode_uint8( in ) );
+      }
+   };
+} } // bts::db
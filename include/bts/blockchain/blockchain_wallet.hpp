@@ -138,6 +138,16 @@ namespace bts { namespace blockchain {
 
            void sign_transaction( signed_transaction& trx, const bts::address& addr );
            bool scan_chain( blockchain_db& chain, uint32_t from_block_num = 0,  scan_progress_callback cb = scan_progress_callback() );
+           /**
+            *  Gives the same result as scan_chain() but splits the blocks into ranges
+            *  that are read and matched against the wallet's addresses on worker
+            *  threads, the matches are then applied in block order.  cb is called as
+            *  each range is applied.
+            *
+            *  Blocks are not pushed or popped until this returns, it holds
+            *  chain.block_mutex() while the worker threads read the chain.
+            */
+           bool parallel_scan_chain( blockchain_db& chain, uint32_t from_block_num = 0, scan_progress_callback cb = scan_progress_callback() );
            void mark_as_spent( const output_reference& r );
            void dump();
 
@@ -0,0 +1,112 @@
+#pragma once
+#include <bts/config.hpp>
+#include <bts/blockchain/blockchain_db.hpp>
+#include <fc/optional.hpp>
+
+#include <memory>
+#include <vector>
+
+namespace bts { namespace blockchain {
+
+   namespace detail { class mempool_impl; }
+
+   /** a pending transaction and the cached results of evaluating it */
+   struct pending_transaction
+   {
+      pending_transaction():size(0){}
+
+      signed_transaction   trx;
+      transaction_id_type  id;
+      uint32_t             size; ///< serialized size
+      trx_eval             eval;
+   };
+
+   /**
+    *  Holds the valid transactions that have not been included in a block yet.
+    *
+    *  Transactions are evaluated once when they are added and their size and fees
+    *  are cached.  They are kept ordered by fee per byte so that block generation
+    *  is a walk of the highest paying transactions, and every output a pending
+    *  transaction spends is indexed so conflicts are found without evaluation.
+    *
+    *  When a block is pushed only the pending transactions that spend an output
+    *  the block spent are removed, everything else is left in place.
+    */
+   class mempool
+   {
+      public:
+         mempool( blockchain_db& db, uint64_t max_size = MAX_MEMPOOL_TRXS_SIZE );
+         ~mempool();
+
+         /**
+          *  A transaction that spends the same output as a pending transaction
+          *  replaces it only if it pays a higher fee per byte.  When the pool is
+          *  larger than max_size the lowest paying transactions are evicted.
+          *
+          *  @return false if trx is already pending or was evicted immediately
+          *  @throw  if trx is invalid or loses a conflict with a pending transaction
+          */
+         bool add( const signed_transaction& trx );
+         void remove( const transaction_id_type& id );
+         bool contains( const transaction_id_type& id )const;
+
+         /** removes the transactions in b and any that spend the same outputs */
+         void on_push_block( const trx_block& b );
+
+         /**
+          *  Removes transactions that spend outputs created by trxs and then
+          *  returns trxs to the pool, transactions that are no longer valid
+          *  (market and mining transactions) are ignored.
+          */
+         void on_pop_block( const std::vector<signed_transaction>& trxs );
+
+         /**
+          *  Switches the chain to fork with blockchain_db::reorganize_to() and brings
+          *  the pool in line with it: transactions that conflict with the fork are
+          *  removed and the orphaned transactions the fork did not include are
+          *  returned with on_pop_block().
+          */
+         void reorganize_to( const std::vector<trx_block>& fork );
+
+         /**
+          *  Walks the pool from the highest fee per byte down, stopping at the first
+          *  transaction that does not pay the current fee rate or once max_size is
+          *  reached.  Transactions that were evaluated against an older head are
+          *  evaluated again, so the results may be passed directly to
+          *  blockchain_db::generate_next_block().
+          *
+          *  Coindays destroyed and the stake change with every block for every
+          *  pending transaction, so nothing can be skipped by tracking inputs.
+          *  Instead only transactions that fit in the remaining space are
+          *  evaluated, so a call evaluates at most max_size bytes of transactions
+          *  plus any that turn out to be invalid, while the rest of the walk is a
+          *  comparison per entry.  A transaction whose fees changed is moved to
+          *  its new place in the order once the walk is done.
+          */
+         void select( std::vector<signed_transaction>& trxs, std::vector<trx_eval>& evals,
+                      uint64_t max_size = MAX_BLOCK_TRXS_SIZE );
+         void select( std::vector<pending_transaction>& selected, uint64_t max_size = MAX_BLOCK_TRXS_SIZE );
+
+         /** @return the cached evaluation of id if it is pending and was evaluated against the current head */
+         fc::optional<pending_transaction> get_pending( const transaction_id_type& id )const;
+
+         /** all pending transactions, highest fee per byte first */
+         std::vector<signed_transaction> get_transactions()const;
+
+         uint32_t size()const;
+         /** total serialized size of all pending transactions */
+         uint64_t bytes()const;
+
+         /** 
+          *  Incremented every time a transaction leaves the pool for any reason,
+          *  a selection made when it had a different value may be stale.
+          */
+         uint64_t removal_count()const;
+
+      private:
+         std::unique_ptr<detail::mempool_impl> my;
+   };
+
+} } // bts::blockchain
+
+FC_REFLECT( bts::blockchain::pending_transaction, (trx)(id)(size)(eval) )
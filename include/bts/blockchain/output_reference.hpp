@@ -1,6 +1,7 @@
 #pragma once
 #include <fc/crypto/ripemd160.hpp>
 #include <fc/crypto/city.hpp>
+#include <bts/db/key_codec.hpp>
 namespace bts { namespace blockchain {
 
 /**
@@ -29,6 +30,27 @@ struct output_reference
 };
 }} 
 
+namespace bts { namespace db {
+   /** trx_hash then output_idx, so all outputs of a transaction are adjacent */
+   template<>
+   struct key_codec<bts::blockchain::output_reference>
+   {
+      static const bool   is_order_preserving = true;
+      static const size_t encoded_size        = sizeof(fc::uint160) + 1;
+
+      static void encode( const bts::blockchain::output_reference& k, char* out )
+      {
+         key_encoding::encode_bytes( &k.trx_hash, sizeof(k.trx_hash), out );
+         key_encoding::encode_uint8( k.output_idx, out );
+      }
+      static void decode( const char* in, bts::blockchain::output_reference& k )
+      {
+         key_encoding::decode_bytes( in, &k.trx_hash, sizeof(k.trx_hash) );
+         k.output_idx = key_encoding::decode_uint8( in );
+      }
+   };
+} } // bts::db
+
 #include <unordered_map>
 namespace std {
   /**
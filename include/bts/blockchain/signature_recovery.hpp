@@ -0,0 +1,21 @@
+#pragma once
+#include <bts/blockchain/transaction.hpp>
+#include <fc/optional.hpp>
+
+namespace bts { namespace blockchain {
+
+   typedef std::unordered_set<address> signer_set;
+
+   /**
+    *  Recovers the addresses that signed each transaction in trxs, spreading the
+    *  ECDSA public key recovery over a pool of worker threads.  This has no
+    *  dependency on chain state so it can run before the sequential apply of a
+    *  block or batch of transactions.
+    *
+    *  result[i] is equal to trxs[i].get_signed_addresses(), or empty if
+    *  recovery threw in which case the caller should recover the signatures
+    *  itself to report the error in context.
+    */
+   std::vector< fc::optional<signer_set> > recover_signed_addresses( const std::vector<signed_transaction>& trxs );
+
+} } // bts::blockchain
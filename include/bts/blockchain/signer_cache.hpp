@@ -0,0 +1,46 @@
+#pragma once
+#include <bts/address.hpp>
+#include <bts/pts_address.hpp>
+#include <fc/crypto/sha256.hpp>
+#include <fc/crypto/elliptic.hpp>
+
+#include <memory>
+#include <vector>
+
+namespace bts { namespace blockchain {
+
+   namespace detail { class signer_cache_impl; }
+
+   /**
+    *  Caches the result of recovering the signer of a compact signature over a
+    *  transaction digest.  A transaction is normally recovered when it is admitted
+    *  to the pending pool, again when a block is generated and again when the
+    *  block is pushed, with the cache only the first of these does any EC math.
+    *
+    *  The cache is bounded, least recently used entries are evicted first, and
+    *  may be used from multiple threads at once.
+    */
+   class signer_cache
+   {
+      public:
+         /** the process wide cache used by signed_transaction */
+         static signer_cache& instance();
+
+         signer_cache( uint32_t max_entries = 64*1024 );
+         ~signer_cache();
+
+         address                  get_address( const fc::sha256& digest, const fc::ecc::compact_signature& sig );
+         /** all compressed/uncompressed and version 56/0 forms of the signing key */
+         std::vector<pts_address> get_pts_addresses( const fc::sha256& digest, const fc::ecc::compact_signature& sig );
+
+         void     set_max_entries( uint32_t max_entries );
+         uint32_t size()const;
+         uint64_t hits()const;
+         uint64_t misses()const;
+         void     clear();
+
+      private:
+         std::unique_ptr<detail::signer_cache_impl> my;
+   };
+
+} } // bts::blockchain
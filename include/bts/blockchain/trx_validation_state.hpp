@@ -24,21 +24,43 @@ namespace bts { namespace blockchain {
             * @param head_idx - the head index to evaluate this
             * transaction against.  This should be the prior block
             * before the one t will be included in.
+            *
+            * @param signers - the result of t.get_signed_addresses() if it has
+            * already been computed, see recover_signed_addresses()
             */
            trx_validation_state( const signed_transaction& t, 
                                 blockchain_db* d, 
                                 bool enforce_unspent_in = true,
-                                uint32_t  head_idx = -1
+                                uint32_t  head_idx = -1,
+                                const std::unordered_set<address>* signers = nullptr
                                 );
            bool allow_short_long_matching;
 
-           trx_validation_state() : trx(signed_transaction()) {}
+           trx_validation_state()
+           :allow_short_long_matching(false),trx(nullptr),total_cdd(0),uncounted_cdd(0),
+            prev_block_id1(0),prev_block_id2(0),db(nullptr),enforce_unspent(true),ref_head(0){}
+
+           /**
+            *  Prepares the state to validate t as if it had just been constructed with
+            *  these arguments.  The containers are cleared rather than released so one
+            *  state can validate many transactions without reallocating them.
+            */
+           void reset( const signed_transaction& t, 
+                       blockchain_db* d, 
+                       bool enforce_unspent_in = true,
+                       uint32_t  head_idx = -1,
+                       const std::unordered_set<address>* signers = nullptr
+                       );
            
            /** tracks the sum of all inputs and outputs for a particular
             * asset type in the balance_sheet 
             */
            struct asset_balance
            {
+              asset_balance( asset::type unit = asset::bts )
+              :in(unit),collat_in(asset::bts),neg_in(unit),
+               out(unit),collat_out(asset::bts),neg_out(unit){}
+
               asset in;
               asset collat_in;
               asset neg_in; 
@@ -68,12 +90,10 @@ namespace bts { namespace blockchain {
                  //return ((in - neg_in) - (out - neg_out)).amount >= fc::uint128(0); }
            };
 
-           /** this is cost because validation shouldn't modify the trx and
-            * is captured by value rather than reference just in case we need 
-            * thread safety of some kind... for performance see if we can
-            * capture it by reference later.
+           /** the transaction being validated, it must outlive validate()
+            * and is not copied so that reset() does not allocate.
             */
-           const signed_transaction            trx; // TODO make reference?
+           const signed_transaction*           trx;
            uint64_t total_cdd;
            uint64_t uncounted_cdd;
 
@@ -81,7 +101,13 @@ namespace bts { namespace blockchain {
            uint32_t prev_block_id2; // block ids that count for CDD
            std::vector<meta_trx_input>         inputs;
                                              
-           std::vector<asset_balance>          balance_sheet; // validate 0 sum 
+           /** only the assets the transaction touches have an entry, in the order first touched */
+           std::vector< std::pair<asset::type,asset_balance> > balance_sheet; // validate 0 sum 
+
+           /** the entry for unit, created on first use */
+           asset_balance& balance( asset::type unit );
+           /** the entry for unit or a zero balance if the trx did not touch it */
+           asset_balance  get_balance( asset::type unit )const;
        //    std::vector<asset_issuance>         issue_sheet; // update backing info
 
 
@@ -122,12 +148,16 @@ namespace bts { namespace blockchain {
            uint16_t find_unused_long_output( const claim_by_long_output& b );
            uint16_t find_unused_cover_output( const claim_by_cover_output& b, uint64_t min_collat );
 
-           void validate_input( const meta_trx_input& );
-           void validate_signature( const meta_trx_input& );
-           void validate_pts( const meta_trx_input& );
-           void validate_bid( const meta_trx_input& );
-           void validate_long( const meta_trx_input& );
-           void validate_cover( const meta_trx_input& );
+           /** the claim of in, read from the utxo index unless in is already spent */
+           template<typename ClaimType>
+           ClaimType input_claim( const trx_input& ref, const meta_trx_input& in )const;
+
+           void validate_input( const trx_input& ref, const meta_trx_input& in );
+           void validate_signature( const meta_trx_input&, const claim_by_signature_output& );
+           void validate_pts( const meta_trx_input&, const claim_by_pts_output& );
+           void validate_bid( const meta_trx_input&, const claim_by_bid_output& );
+           void validate_long( const meta_trx_input&, const claim_by_long_output& );
+           void validate_cover( const meta_trx_input&, const claim_by_cover_output& );
            void validate_opt( const meta_trx_input& );
            void validate_multi_sig( const meta_trx_input& );
            void validate_escrow( const meta_trx_input& );
@@ -148,7 +178,6 @@ namespace bts { namespace blockchain {
 } } // bts::blockchain
 FC_REFLECT( bts::blockchain::trx_validation_state::asset_balance, (in)(neg_in)(collat_in)(out)(neg_out)(collat_out) )
 FC_REFLECT( bts::blockchain::trx_validation_state, 
-    (trx)
     (inputs)
     (ref_head)
     //(dividends)
@@ -0,0 +1,201 @@
+#pragma once
+#include <bts/blockchain/blockchain_db.hpp>
+#include <bts/db/write_journal.hpp>
+#include <fc/crypto/sha256.hpp>
+#include <fc/filesystem.hpp>
+#include <fc/optional.hpp>
+
+namespace bts { namespace blockchain {
+
+  namespace detail { class utxo_index_impl; }
+
+  /**
+   *  Identifies an output by its position in the chain rather than by
+   *  the id of the transaction that created it.
+   */
+  struct output_location
+  {
+     output_location( const trx_num& t = trx_num(), uint8_t idx = 0 )
+     :source(t),output_idx(idx){}
+
+     trx_num source;
+     uint8_t output_idx;
+
+     friend bool operator < ( const output_location& a, const output_location& b )
+     {
+        return a.source == b.source ? a.output_idx < b.output_idx : a.source < b.source;
+     }
+     friend bool operator == ( const output_location& a, const output_location& b )
+     {
+        return a.source == b.source && a.output_idx == b.output_idx;
+     }
+  };
+
+  /**
+   *  Fixed size summary of an unspent output, this is what is kept in
+   *  memory for every unspent output in the chain.
+   */
+  struct utxo_entry
+  {
+     static const uint32_t no_claim = uint32_t(-1);
+
+     utxo_entry():claim_func(null_claim_type),claim_idx(no_claim){}
+
+     bool is_valid()const { return source.block_num != trx_num::invalid_block_id; }
+
+     output_reference  ref;
+     trx_num           source;
+     asset             amount;
+     uint8_t           claim_func;
+     uint32_t          claim_idx; ///< slot in the claim pool of claim_func, or no_claim
+     fc::sha256        hash;      ///< what the output adds to the commitment, so removing it needs no output
+  };
+
+  /**
+   *  An unspent output as it is persisted, including the claim data that
+   *  is required to validate inputs that spend it.
+   */
+  struct unspent_output
+  {
+     unspent_output(){}
+     unspent_output( const trx_num& s, const trx_output& o )
+     :source(s),output(o){}
+
+     trx_num    source;
+     trx_output output;
+  };
+
+  /**
+   *  Tracks the set of unspent outputs so that validating an input or marking
+   *  it spent does not require loading and rewriting the transaction that
+   *  created it.
+   *
+   *  Every unspent output has a utxo_entry in an in memory open addressing
+   *  hash table which is loaded when the index is opened.  The full output
+   *  is stored in a LevelDB database keyed by output_reference and where each
+   *  output was spent is stored in a second database keyed by output_location.
+   *
+   *  The claims of signature, pts, bid, long and cover outputs are fixed size,
+   *  they are decoded once when the output is added and kept in a pool per
+   *  claim type, fetch_claim() copies them out without touching the database.
+   *  fetch_output() has to pack the claim into a new trx_output, so code that
+   *  only needs the claim should use fetch_claim().  Each entry also keeps the
+   *  hash it added to the commitment, spending it never rebuilds the output.
+   *
+   *  The table and the pools are flat, so they can be written to a snapshot
+   *  and mapped back in at startup instead of reading every unspent output.
+   */
+  class utxo_index
+  {
+     public:
+        utxo_index();
+        ~utxo_index();
+
+        /**
+         *  @param load_outputs if false the index is left empty for load() or load_snapshot()
+         *  @param journal      if given, the databases are added to it before anything is loaded
+         */
+        void open( const fc::path& dir, bool create = true, bool load_outputs = true,
+                   bts::db::write_journal* journal = nullptr );
+        void close();
+        bool is_open()const;
+
+        /** loads every unspent output from the database */
+        void load();
+
+        /**
+         *  Loads the in memory state from a snapshot instead of the database.  The
+         *  snapshot was taken after block height, the caller must sync() every output
+         *  created or spent by later blocks.
+         *
+         *  @return false if there is no usable snapshot, the index is left empty
+         */
+        bool load_snapshot( const fc::path& file, uint32_t& height, block_id_type& head_id );
+        void save_snapshot( const fc::path& file, uint32_t height, const block_id_type& head_id )const;
+
+        /** brings the in memory entry of ref in line with the database */
+        void sync( const output_reference& ref );
+
+        /**
+         *  Order independent commitment to the unspent output set, the sum modulo 2^256
+         *  of the sha256 of every (ref, source, output) read as a big endian integer, so
+         *  it is the same on every platform.  It is updated in O(1) as outputs
+         *  are added and spent, two indexes holding the same set agree on it.
+         */
+        fc::sha256        commitment()const;
+
+        /** @see bts::db::level_map::begin_batch() */
+        void begin_batch();
+        void commit_batch( bool sync = false );
+        void abort_batch();
+
+        void add( const output_reference& ref, const trx_num& source, const trx_output& out );
+
+        /**
+         *  Removes ref from the unspent set and records the input that spent it.
+         *  @return the entry that was removed
+         */
+        utxo_entry spend( const output_reference& ref, const meta_trx_output& spent_by );
+
+        /** reverts add(), ref must still be unspent */
+        void remove( const output_reference& ref );
+
+        /** reverts spend(), restoring the output and forgetting where it was spent */
+        void unspend( const output_reference& ref, const trx_num& source, const trx_output& out );
+
+        /** @return nullptr if ref is not an unspent output */
+        const utxo_entry* find( const output_reference& ref )const;
+        bool              is_unspent( const output_reference& ref )const { return find(ref) != nullptr; }
+
+        /** @pre is_unspent(ref) */
+        trx_output        fetch_output( const output_reference& ref );
+
+        /** @return false if ref is not unspent or is not claimed by the type of claim */
+        bool              fetch_claim( const output_reference& ref, claim_by_signature_output& claim )const;
+        bool              fetch_claim( const output_reference& ref, claim_by_pts_output& claim )const;
+        bool              fetch_claim( const output_reference& ref, claim_by_bid_output& claim )const;
+        bool              fetch_claim( const output_reference& ref, claim_by_long_output& claim )const;
+        bool              fetch_claim( const output_reference& ref, claim_by_cover_output& claim )const;
+
+        /**
+         *  Overwrites the entries of meta_outputs that have been spent since
+         *  the transaction at source was stored.
+         */
+        void              fetch_spends( const trx_num& source, std::vector<meta_trx_output>& meta_outputs );
+
+        /** forgets where the outputs of the transaction at source were spent, used when it is pruned */
+        void              remove_spends( const trx_num& source, uint16_t num_outputs );
+
+        uint64_t          size()const;
+
+     private:
+        std::unique_ptr<detail::utxo_index_impl> my;
+  };
+
+} } // bts::blockchain
+
+FC_REFLECT( bts::blockchain::output_location, (source)(output_idx) )
+FC_REFLECT( bts::blockchain::utxo_entry, (ref)(source)(amount)(claim_func)(claim_idx)(hash) )
+FC_REFLECT( bts::blockchain::unspent_output, (source)(output) )
+
+namespace bts { namespace db {
+   template<>
+   struct key_codec<bts::blockchain::output_location>
+   {
+      static const bool   is_order_preserving = true;
+      static const size_t encoded_size        = key_codec<bts::blockchain::trx_num>::encoded_size + 1;
+
+      static void encode( const bts::blockchain::output_location& k, char* out )
+      {
+         key_codec<bts::blockchain::trx_num>::encode( k.source, out );
+         out += key_codec<bts::blockchain::trx_num>::encoded_size;
+         key_encoding::encode_uint8( k.output_idx, out );
+      }
+      static void decode( const char* in, bts::blockchain::output_location& k )
+      {
+         key_codec<bts::blockchain::trx_num>::decode( in, k.source );
+         in += key_codec<bts::blockchain::trx_num>::encoded_size;
+         k.output_idx = key_encoding::decode_uint8( in );
+      }
+   };
+} } // bts::db
@@ -0,0 +1,19 @@
+#pragma once
+#include <vector>
+
+namespace fc { class thread; }
+
+namespace bts { namespace blockchain {
+
+   /**
+    *  One fc::thread per core shared by the CPU bound work that is spread out
+    *  in parallel, recover_signed_addresses() and wallet::parallel_scan_chain().
+    *  The pool is created by the first call, concurrent first calls wait for
+    *  it rather than creating threads of their own.
+    */
+   const std::vector<fc::thread*>& worker_threads();
+
+   /** quits and joins the worker threads, call before main() returns */
+   void shutdown_worker_threads();
+
+} } // bts::blockchain
@@ -27,6 +27,7 @@
 #define BITNAME_BLOCK_INTERVAL_SEC       (2*60)  // 2 minutes
 #define BITNAME_TIMEKEEPER_WINDOW        (64)    // blocks used for estimating time
 #define BITNAME_BLOCK_FETCH_TIMEOUT_SEC  (60)
+#define BITNAME_SNAPSHOT_INTERVAL        (720)   // blocks between snapshots of the header ids, 1 day
 #define RPC_DEFAULT_PORT                 (0) // (NETWORK_DEFAULT_PORT+1)
 #define WALLET_INVALID_INDEX             (uint32_t(-1))
 #define COIN                          (100000000ll)
@@ -48,6 +49,9 @@
 
 
 #define COINBASE_WAIT_PERIOD          (BLOCKS_PER_HOUR*8) // blocks before a coinbase can be spent
+#define SNAPSHOT_INTERVAL             (BLOCKS_PER_DAY)    // blocks between snapshots of the in memory chain state
+#define MIN_PRUNE_DEPTH               (BLOCKS_PER_DAY)    // blocks below the head that are never pruned, bounds the deepest reorg
+#define JOURNAL_CHECKPOINT_INTERVAL   (BLOCKS_PER_HOUR)   // blocks between syncs of every chain database, the journal covers the rest
 #define DESIRED_PEER_COUNT            (8)                 // number of nodes to connect to
 #define BITCHAT_CHANNEL_SIZE          (512*1024*1024)     // 512 MB of history... 
 #define BITCHAT_CACHE_WINDOW_SEC      (60*60*24*30)       // 1 month
@@ -73,6 +77,18 @@
  */
 #define MAX_BLOCK_TRXS_SIZE           (1024*1024 - 2*sizeof( bts::blockchain::block_header)  )
 
+/**
+ *  How much space pending transactions may consume before the lowest paying
+ *  transactions are dropped.
+ */
+#define MAX_MEMPOOL_TRXS_SIZE         (16*1024*1024)
+
+/**
+ *  The most block address filters a chain server will send in reply to
+ *  a single request.
+ */
+#define MAX_ADDRESS_FILTERS_PER_MESSAGE (2000)
+
 
 #define BLOCKCHAIN_TIMEKEEPER_MIN_BACK_SEC (60*60) // 60 minutes
 #define BITNAME_TIME_TOLLERANCE_SEC        (60*60) // 60 minutes
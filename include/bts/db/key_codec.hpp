@@ -0,0 +1,229 @@
+#pragma once
+#include <fc/time.hpp>
+#include <fc/uint128.hpp>
+#include <fc/crypto/ripemd160.hpp>
+#include <fc/io/raw.hpp>
+#include <fc/exception/exception.hpp>
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+namespace bts { namespace db {
+
+  /**
+   *  @brief defines an order preserving binary encoding for a database key
+   *
+   *  If key_codec<Key> is specialized then level_map and level_pod_map store
+   *  the encoded key and let LevelDB use its builtin bytewise comparator, which
+   *  means comparisons become a memcmp() rather than two fc::raw::unpack calls.
+   *
+   *  The encoding must satisfy:  memcmp( encode(a), encode(b) ) < 0  <=>  a < b
+   *  and must round trip every field of Key (level_pod_map rebuilds the whole
+   *  key from the database).
+   *
+   *  Specializations provide:
+   *
+   *     static const bool   is_order_preserving = true;
+   *     static const size_t encoded_size;
+   *     static void encode( const Key& k, char* out );
+   *     static void decode( const char* in, Key& k );
+   *
+   *  Keys without a specialization keep the legacy reflection based comparator.
+   */
+  template<typename Key>
+  struct key_codec
+  {
+     static const bool is_order_preserving = false;
+  };
+
+  /**
+   *  Helpers for writing key_codec specializations, all integers are written
+   *  big endian so that the most significant byte is compared first.
+   */
+  namespace key_encoding
+  {
+     inline void encode_uint8( uint8_t v, char*& out )
+     {
+        *out++ = char(v);
+     }
+     inline void encode_uint16( uint16_t v, char*& out )
+     {
+        *out++ = char(v >> 8);
+        *out++ = char(v);
+     }
+     inline void encode_uint32( uint32_t v, char*& out )
+     {
+        for( int i = 3; i >= 0; --i )
+        {
+           *out++ = char(v >> (8*i));
+        }
+     }
+     inline void encode_uint64( uint64_t v, char*& out )
+     {
+        for( int i = 7; i >= 0; --i )
+        {
+           *out++ = char(v >> (8*i));
+        }
+     }
+     /** flips the sign bit so that negative values sort before positive values */
+     inline void encode_int64( int64_t v, char*& out )
+     {
+        encode_uint64( uint64_t(v) ^ (uint64_t(1) << 63), out );
+     }
+     inline void encode_uint128( const fc::uint128& v, char*& out )
+     {
+        encode_uint64( v.high_bits(), out );
+        encode_uint64( v.low_bits(), out );
+     }
+     /** for types whose operator< is already a memcmp() of their bytes (hashes, keys) */
+     inline void encode_bytes( const void* data, size_t len, char*& out )
+     {
+        memcpy( out, data, len );
+        out += len;
+     }
+
+     inline uint8_t decode_uint8( const char*& in )
+     {
+        return uint8_t(*in++);
+     }
+     inline uint16_t decode_uint16( const char*& in )
+     {
+        uint16_t v = uint16_t(uint8_t(*in++)) << 8;
+        v |= uint8_t(*in++);
+        return v;
+     }
+     inline uint32_t decode_uint32( const char*& in )
+     {
+        uint32_t v = 0;
+        for( int i = 0; i < 4; ++i )
+        {
+           v = (v << 8) | uint8_t(*in++);
+        }
+        return v;
+     }
+     inline uint64_t decode_uint64( const char*& in )
+     {
+        uint64_t v = 0;
+        for( int i = 0; i < 8; ++i )
+        {
+           v = (v << 8) | uint8_t(*in++);
+        }
+        return v;
+     }
+     inline int64_t decode_int64( const char*& in )
+     {
+        return int64_t( decode_uint64( in ) ^ (uint64_t(1) << 63) );
+     }
+     inline fc::uint128 decode_uint128( const char*& in )
+     {
+        uint64_t high = decode_uint64( in );
+        uint64_t low  = decode_uint64( in );
+        return fc::uint128( high, low );
+     }
+     inline void decode_bytes( const char*& in, void* data, size_t len )
+     {
+        memcpy( data, in, len );
+        in += len;
+     }
+  } // namespace key_encoding
+
+  template<>
+  struct key_codec<uint32_t>
+  {
+     static const bool   is_order_preserving = true;
+     static const size_t encoded_size        = 4;
+
+     static void encode( const uint32_t& k, char* out ) { key_encoding::encode_uint32( k, out ); }
+     static void decode( const char* in, uint32_t& k )  { k = key_encoding::decode_uint32( in );  }
+  };
+
+  template<>
+  struct key_codec<fc::time_point>
+  {
+     static const bool   is_order_preserving = true;
+     static const size_t encoded_size        = 8;
+
+     static void encode( const fc::time_point& k, char* out )
+     {
+        key_encoding::encode_int64( k.time_since_epoch().count(), out );
+     }
+     static void decode( const char* in, fc::time_point& k )
+     {
+        k = fc::time_point( fc::microseconds( key_encoding::decode_int64( in ) ) );
+     }
+  };
+
+  template<>
+  struct key_codec<fc::ripemd160>
+  {
+     static const bool   is_order_preserving = true;
+     static const size_t encoded_size        = sizeof(fc::ripemd160);
+
+     static void encode( const fc::ripemd160& k, char* out ) { key_encoding::encode_bytes( &k, sizeof(k), out ); }
+     static void decode( const char* in, fc::ripemd160& k )  { key_encoding::decode_bytes( in, &k, sizeof(k) );  }
+  };
+
+  namespace detail
+  {
+     /**
+      *  Converts keys to and from the bytes stored in LevelDB by level_map.  Keys
+      *  without a key_codec are stored with fc::raw.
+      */
+     template<typename Key, bool OrderPreserving = key_codec<Key>::is_order_preserving>
+     struct packed_key_format
+     {
+        static std::vector<char> pack( const Key& k )
+        {
+           return fc::raw::pack( k );
+        }
+        static void unpack( const char* data, size_t size, Key& k )
+        {
+           fc::datastream<const char*> ds( data, size );
+           fc::raw::unpack( ds, k );
+        }
+     };
+
+     /**
+      *  Converts keys to and from the bytes stored in LevelDB by level_pod_map.  Keys
+      *  without a key_codec are stored as their in memory representation.
+      */
+     template<typename Key, bool OrderPreserving = key_codec<Key>::is_order_preserving>
+     struct pod_key_format
+     {
+        static std::vector<char> pack( const Key& k )
+        {
+           return std::vector<char>( (const char*)&k, (const char*)&k + sizeof(k) );
+        }
+        static void unpack( const char* data, size_t size, Key& k )
+        {
+           FC_ASSERT( size == sizeof(Key) );
+           memcpy( (char*)&k, data, sizeof(Key) );
+        }
+     };
+
+     template<typename Key>
+     struct encoded_key_format
+     {
+        static std::vector<char> pack( const Key& k )
+        {
+           std::vector<char> encoded( key_codec<Key>::encoded_size );
+           key_codec<Key>::encode( k, encoded.data() );
+           return encoded;
+        }
+        static void unpack( const char* data, size_t size, Key& k )
+        {
+           FC_ASSERT( size == key_codec<Key>::encoded_size );
+           key_codec<Key>::decode( data, k );
+        }
+     };
+
+     template<typename Key>
+     struct packed_key_format<Key,true> : public encoded_key_format<Key>{};
+
+     template<typename Key>
+     struct pod_key_format<Key,true> : public encoded_key_format<Key>{};
+
+  } // namespace detail
+
+} } // bts::db
@@ -1,16 +1,21 @@
 #pragma once
 #include <leveldb/db.h>
 #include <leveldb/comparator.h>
+#include <leveldb/write_batch.h>
 
 #include <fc/filesystem.hpp>
 
 #include <fc/reflect/reflect.hpp>
 #include <fc/io/raw.hpp>
 #include <fc/exception/exception.hpp>
+#include <fc/optional.hpp>
 
 #include <fc/log/logger.hpp>
 
 #include "upgrade_leveldb.hpp"
+#include "key_codec.hpp"
+
+#include <map>
 
 namespace bts { namespace db {
 
@@ -19,16 +24,23 @@ namespace bts { namespace db {
   /**
    *  @brief implements a high-level API on top of Level DB that stores items using fc::raw / reflection
    *
+   *  Keys with a key_codec specialization are stored in their order preserving encoding
+   *  and compared with LevelDB's bytewise comparator, all other keys are stored with 
+   *  fc::raw and compared by unpacking them.
    */
   template<typename Key, typename Value>
   class level_map
   {
+        typedef detail::packed_key_format<Key> key_format;
      public:
         void open( const fc::path& dir, bool create = true )
         {
            ldb::Options opts;
            opts.create_if_missing = create;
-           opts.comparator = & _comparer;
+           if( !key_codec<Key>::is_order_preserving )
+           {
+              opts.comparator = & _comparer;
+           }
 
            /// \waring Given path must exist to succeed toNativeAnsiPath
            fc::create_directories(dir);
@@ -37,6 +49,16 @@ namespace bts { namespace db {
 
            ldb::DB* ndb = nullptr;
            auto ntrxstat = ldb::DB::Open( opts, ldbPath.c_str(), &ndb );
+           if( !ntrxstat.ok() && key_codec<Key>::is_order_preserving )
+           {
+              // databases created before Key had a key_codec were sorted by key_compare
+              ldb::Options legacy_opts = opts;
+              legacy_opts.comparator = & _comparer;
+              if( UpgradeDbKeysIfNecessary( dir, ntrxstat, legacy_opts, &level_map::upgrade_key ) )
+              {
+                 ntrxstat = ldb::DB::Open( opts, ldbPath.c_str(), &ndb );
+              }
+           }
            if( !ntrxstat.ok() )
            {
                FC_THROW_EXCEPTION( db_in_use_exception, "Unable to open database ${db}\n\t${msg}", 
@@ -50,24 +72,100 @@ namespace bts { namespace db {
 
         void close()
         {
+          _batch.reset();
           _db.reset();
         }
 
-        Value fetch( const Key& k )
+        /**
+         *  Stages every following store() and remove() in a single leveldb::WriteBatch
+         *  until commit_batch() or abort_batch() is called.  fetch() sees the staged
+         *  writes, iterators only see what has been committed.
+         */
+        void begin_batch()
+        {
+           FC_ASSERT( !_batch, "a batch is already in progress" );
+           _batch.reset( new pending_batch() );
+        }
+
+        /** @param sync - wait for the write to reach disk before returning */
+        void commit_batch( bool sync = false )
         {
           try {
-             std::vector<char> kslice = fc::raw::pack( k );
-             ldb::Slice ks( kslice.data(), kslice.size() );
-             std::string value;
-             auto status = _db->Get( ldb::ReadOptions(), ks, &value );
-             if( status.IsNotFound() )
+             FC_ASSERT( _batch, "no batch in progress" );
+             ldb::WriteOptions opts;
+             opts.sync = sync;
+             auto status = _db->Write( opts, &_batch->batch );
+             _batch.reset();
+             if( !status.ok() )
              {
-               FC_THROW_EXCEPTION( key_not_found_exception, "unable to find key ${key}", ("key",k) );
+                 FC_THROW_EXCEPTION( exception, "database error: ${msg}", ("msg", status.ToString() ) );
              }
+          } FC_RETHROW_EXCEPTIONS( warn, "error committing batch" );
+        }
+
+        void abort_batch()
+        {
+          _batch.reset();
+        }
+
+        bool in_batch()const { return !!_batch; }
+
+        /** @return the raw writes staged since begin_batch(), or nullptr outside of a batch */
+        const std::map<std::string, fc::optional<std::string> >* staged_writes()const
+        {
+           return _batch ? &_batch->writes : nullptr;
+        }
+
+        /** writes raw values returned by staged_writes() in one synced WriteBatch */
+        void apply_writes( const std::map<std::string, fc::optional<std::string> >& writes )
+        {
+          try {
+             FC_ASSERT( !_batch, "a batch is in progress" );
+             ldb::WriteBatch batch;
+             for( auto itr = writes.begin(); itr != writes.end(); ++itr )
+             {
+                if( itr->second )
+                {
+                   batch.Put( itr->first, *itr->second );
+                }
+                else
+                {
+                   batch.Delete( itr->first );
+                }
+             }
+             ldb::WriteOptions opts;
+             opts.sync = true;
+             auto status = _db->Write( opts, &batch );
              if( !status.ok() )
              {
                  FC_THROW_EXCEPTION( exception, "database error: ${msg}", ("msg", status.ToString() ) );
              }
+          } FC_RETHROW_EXCEPTIONS( warn, "error applying ${n} writes", ("n",writes.size()) );
+        }
+
+        Value fetch( const Key& k )
+        {
+          try {
+             fc::optional<Value> tmp = fetch_optional( k );
+             if( !tmp )
+             {
+               FC_THROW_EXCEPTION( key_not_found_exception, "unable to find key ${key}", ("key",k) );
+             }
+             return *tmp;
+          } FC_RETHROW_EXCEPTIONS( warn, "error fetching key ${key}", ("key",k) );
+        }
+
+        /** @return an empty optional rather than throwing if k is not found */
+        fc::optional<Value> fetch_optional( const Key& k )
+        {
+          try {
+             std::vector<char> kslice = key_format::pack( k );
+             ldb::Slice ks( kslice.data(), kslice.size() );
+             std::string value;
+             if( !read( ks, value ) )
+             {
+               return fc::optional<Value>();
+             }
              fc::datastream<const char*> ds(value.c_str(), value.size());
              Value tmp;
              fc::raw::unpack(ds, tmp);
@@ -87,8 +185,7 @@ namespace bts { namespace db {
              Key key()const
              {
                  Key tmp_key;
-                 fc::datastream<const char*> ds2( _it->key().data(), _it->key().size() );
-                 fc::raw::unpack( ds2, tmp_key );
+                 key_format::unpack( _it->key().data(), _it->key().size(), tmp_key );
                  return tmp_key;
              }
 
@@ -133,7 +230,7 @@ namespace bts { namespace db {
 
         iterator find( const Key& key )
         { try {
-           std::vector<char> kslice = fc::raw::pack( key );
+           std::vector<char> kslice = key_format::pack( key );
            ldb::Slice key_slice( kslice.data(), kslice.size() );
            iterator itr( _db->NewIterator( ldb::ReadOptions() ) );
            itr._it->Seek( key_slice );
@@ -146,7 +243,8 @@ namespace bts { namespace db {
 
         iterator lower_bound( const Key& key )
         { try {
-           ldb::Slice key_slice( (char*)&key, sizeof(key) );
+           std::vector<char> kslice = key_format::pack( key );
+           ldb::Slice key_slice( kslice.data(), kslice.size() );
            iterator itr( _db->NewIterator( ldb::ReadOptions() ) );
            itr._it->Seek( key_slice );
            if( itr.valid()  ) 
@@ -167,8 +265,7 @@ namespace bts { namespace db {
              {
                return false;
              }
-             fc::datastream<const char*> ds2( it->key().data(), it->key().size() );
-             fc::raw::unpack( ds2, k );
+             key_format::unpack( it->key().data(), it->key().size(), k );
              return true;
           } FC_RETHROW_EXCEPTIONS( warn, "error reading last item from database" );
         }
@@ -186,8 +283,7 @@ namespace bts { namespace db {
            fc::datastream<const char*> ds( it->value().data(), it->value().size() );
            fc::raw::unpack( ds, v );
 
-           fc::datastream<const char*> ds2( it->key().data(), it->key().size() );
-           fc::raw::unpack( ds2, k );
+           key_format::unpack( it->key().data(), it->key().size(), k );
            return true;
           } FC_RETHROW_EXCEPTIONS( warn, "error reading last item from database" );
         }
@@ -196,12 +292,18 @@ namespace bts { namespace db {
         {
           try
           {
-             std::vector<char> kslice = fc::raw::pack( k );
+             std::vector<char> kslice = key_format::pack( k );
              ldb::Slice ks( kslice.data(), kslice.size() );
 
              auto vec = fc::raw::pack(v);
              ldb::Slice vs( vec.data(), vec.size() );
              
+             if( _batch )
+             {
+                _batch->batch.Put( ks, vs );
+                _batch->writes[ks.ToString()] = vs.ToString();
+                return;
+             }
              auto status = _db->Put( ldb::WriteOptions(), ks, vs );
              if( !status.ok() )
              {
@@ -210,17 +312,20 @@ namespace bts { namespace db {
           } FC_RETHROW_EXCEPTIONS( warn, "error storing ${key} = ${value}", ("key",k)("value",v) );
         }
 
+        /** removing a key that is not in the database is not an error, with or without a batch */
         void remove( const Key& k )
         {
           try
           {
-             std::vector<char> kslice = fc::raw::pack( k );
+             std::vector<char> kslice = key_format::pack( k );
              ldb::Slice ks( kslice.data(), kslice.size() );
-             auto status = _db->Delete( ldb::WriteOptions(), ks );
-             if( status.IsNotFound() )
+             if( _batch )
              {
-               FC_THROW_EXCEPTION( key_not_found_exception, "unable to find key ${key}", ("key",k) );
+                _batch->batch.Delete( ks );
+                _batch->writes[ks.ToString()] = fc::optional<std::string>();
+                return;
              }
+             auto status = _db->Delete( ldb::WriteOptions(), ks );
              if( !status.ok() )
              {
                  FC_THROW_EXCEPTION( exception, "database error: ${msg}", ("msg", status.ToString() ) );
@@ -230,6 +335,49 @@ namespace bts { namespace db {
         
 
      private:
+        /** reads the raw value stored at key, staged writes take precedence over the database */
+        bool read( const ldb::Slice& key, std::string& value )
+        {
+           if( _batch )
+           {
+              auto itr = _batch->writes.find( key.ToString() );
+              if( itr != _batch->writes.end() )
+              {
+                 if( !itr->second )
+                 {
+                    return false;
+                 }
+                 value = *itr->second;
+                 return true;
+              }
+           }
+           auto status = _db->Get( ldb::ReadOptions(), key, &value );
+           if( status.IsNotFound() )
+           {
+              return false;
+           }
+           if( !status.ok() )
+           {
+               FC_THROW_EXCEPTION( exception, "database error: ${msg}", ("msg", status.ToString() ) );
+           }
+           return true;
+        }
+
+        struct pending_batch
+        {
+           ldb::WriteBatch                                    batch;
+           std::map<std::string, fc::optional<std::string> >  writes; // empty optional marks a removed key
+        };
+
+        /** converts a key stored by key_compare into the key_codec encoding */
+        static std::string upgrade_key( const ldb::Slice& legacy_key )
+        {
+           Key k;
+           detail::packed_key_format<Key,false>::unpack( legacy_key.data(), legacy_key.size(), k );
+           std::vector<char> encoded = key_format::pack( k );
+           return std::string( encoded.data(), encoded.size() );
+        }
+
         class key_compare : public leveldb::Comparator
         {
           public:
@@ -252,6 +400,7 @@ namespace bts { namespace db {
         };
 
         key_compare                  _comparer;
+        std::unique_ptr<pending_batch> _batch;
 public: //DLNFIX temporary, remove this
         std::unique_ptr<leveldb::DB> _db;
         
@@ -1,13 +1,18 @@
 #pragma once
 #include <leveldb/db.h>
 #include <leveldb/comparator.h>
+#include <leveldb/write_batch.h>
 #include <fc/filesystem.hpp>
 #include <fc/reflect/reflect.hpp>
 #include <fc/io/raw.hpp>
 #include <fc/exception/exception.hpp>
 #include <fc/crypto/aes.hpp>
+#include <fc/optional.hpp>
 
 #include "upgrade_leveldb.hpp"
+#include "key_codec.hpp"
+
+#include <map>
 
 namespace bts { namespace db {
 
@@ -18,10 +23,15 @@ namespace bts { namespace db {
    *
    *
    *  @note Key must be a POD type
+   *
+   *  Keys with a key_codec specialization are stored in their order preserving encoding
+   *  and compared with LevelDB's bytewise comparator, all other keys are stored as raw
+   *  memory and compared with Key::operator<.
    */
   template<typename Key, typename Value>
   class level_pod_map
   {
+        typedef detail::pod_key_format<Key> key_format;
      public:
         void open( const fc::path& dir, bool create = true )
         {
@@ -32,8 +42,10 @@ namespace bts { namespace db {
           _encrypt_key = encrypt_key;
            ldb::Options opts;
            opts.create_if_missing = create;
-           opts.comparator = & _comparer;
-           
+           if( !key_codec<Key>::is_order_preserving )
+           {
+              opts.comparator = & _comparer;
+           }
 
            /// \waring Given path must exist to succeed toNativeAnsiPath
            fc::create_directories(dir);
@@ -42,6 +54,16 @@ namespace bts { namespace db {
 
            ldb::DB* ndb = nullptr;
            auto ntrxstat = ldb::DB::Open( opts, ldb_path.c_str(), &ndb );
+           if( !ntrxstat.ok() && key_codec<Key>::is_order_preserving )
+           {
+              // databases created before Key had a key_codec were sorted by key_compare
+              ldb::Options legacy_opts = opts;
+              legacy_opts.comparator = & _comparer;
+              if( UpgradeDbKeysIfNecessary( dir, ntrxstat, legacy_opts, &level_pod_map::upgrade_key ) )
+              {
+                 ntrxstat = ldb::DB::Open( opts, ldb_path.c_str(), &ndb );
+              }
+           }
            if( !ntrxstat.ok() )
            {
                FC_THROW_EXCEPTION( db_in_use_exception, "Unable to open database ${db}\n\t${msg}", 
@@ -55,23 +77,100 @@ namespace bts { namespace db {
 
         void close()
         {
+          _batch.reset();
           _db.reset();
         }
 
-        Value fetch( const Key& key )
+        /**
+         *  Stages every following store() and remove() in a single leveldb::WriteBatch
+         *  until commit_batch() or abort_batch() is called.  fetch() sees the staged
+         *  writes, iterators only see what has been committed.
+         */
+        void begin_batch()
+        {
+           FC_ASSERT( !_batch, "a batch is already in progress" );
+           _batch.reset( new pending_batch() );
+        }
+
+        /** @param sync - wait for the write to reach disk before returning */
+        void commit_batch( bool sync = false )
         {
           try {
-             ldb::Slice key_slice( (char*)&key, sizeof(key) );
-             std::string value_string;
-             auto status = _db->Get( ldb::ReadOptions(), key_slice, &value_string );
-             if( status.IsNotFound() )
+             FC_ASSERT( _batch, "no batch in progress" );
+             ldb::WriteOptions opts;
+             opts.sync = sync;
+             auto status = _db->Write( opts, &_batch->batch );
+             _batch.reset();
+             if( !status.ok() )
              {
-               FC_THROW_EXCEPTION( key_not_found_exception, "unable to find key ${key}", ("key",key) );
+                 FC_THROW_EXCEPTION( exception, "database error: ${msg}", ("msg", status.ToString() ) );
              }
+          } FC_RETHROW_EXCEPTIONS( warn, "error committing batch" );
+        }
+
+        void abort_batch()
+        {
+          _batch.reset();
+        }
+
+        bool in_batch()const { return !!_batch; }
+
+        /** @return the raw writes staged since begin_batch(), or nullptr outside of a batch */
+        const std::map<std::string, fc::optional<std::string> >* staged_writes()const
+        {
+           return _batch ? &_batch->writes : nullptr;
+        }
+
+        /** writes raw values returned by staged_writes() in one synced WriteBatch */
+        void apply_writes( const std::map<std::string, fc::optional<std::string> >& writes )
+        {
+          try {
+             FC_ASSERT( !_batch, "a batch is in progress" );
+             ldb::WriteBatch batch;
+             for( auto itr = writes.begin(); itr != writes.end(); ++itr )
+             {
+                if( itr->second )
+                {
+                   batch.Put( itr->first, *itr->second );
+                }
+                else
+                {
+                   batch.Delete( itr->first );
+                }
+             }
+             ldb::WriteOptions opts;
+             opts.sync = true;
+             auto status = _db->Write( opts, &batch );
              if( !status.ok() )
              {
                  FC_THROW_EXCEPTION( exception, "database error: ${msg}", ("msg", status.ToString() ) );
              }
+          } FC_RETHROW_EXCEPTIONS( warn, "error applying ${n} writes", ("n",writes.size()) );
+        }
+
+        Value fetch( const Key& key )
+        {
+          try {
+             fc::optional<Value> tmp = fetch_optional( key );
+             if( !tmp )
+             {
+               FC_THROW_EXCEPTION( key_not_found_exception, "unable to find key ${key}", ("key",key) );
+             }
+             return *tmp;
+          } FC_RETHROW_EXCEPTIONS( warn, "error fetching key ${key}", ("key",key) );
+        }
+
+        /** @return an empty optional rather than throwing if key is not found */
+        fc::optional<Value> fetch_optional( const Key& key )
+        {
+          try {
+             std::vector<char> kslice = key_format::pack( key );
+             ldb::Slice key_slice( kslice.data(), kslice.size() );
+             std::string value_string;
+             if( !read( key_slice, value_string ) )
+             {
+               return fc::optional<Value>();
+             }
              std::vector<char> value(value_string.begin(),value_string.end());
              if (_encrypt_key)
                value = fc::aes_decrypt( *_encrypt_key, value );
@@ -94,8 +193,9 @@ namespace bts { namespace db {
 
              Key key()const
              {
-                 FC_ASSERT( sizeof(Key) == _it->key().size() );
-                 return *((Key*)_it->key().data());
+                 Key tmp_key;
+                 key_format::unpack( _it->key().data(), _it->key().size(), tmp_key );
+                 return tmp_key;
              }
 
              Value value()const
@@ -144,7 +244,8 @@ namespace bts { namespace db {
 
         iterator find( const Key& key )
         { try {
-           ldb::Slice key_slice( (char*)&key, sizeof(key) );
+           std::vector<char> kslice = key_format::pack( key );
+           ldb::Slice key_slice( kslice.data(), kslice.size() );
            iterator itr( _db->NewIterator( ldb::ReadOptions() ), this );
            itr._it->Seek( key_slice );
            if( itr.valid() && itr.key() == key ) 
@@ -156,7 +257,8 @@ namespace bts { namespace db {
 
         iterator lower_bound( const Key& key )
         { try {
-           ldb::Slice key_slice( (char*)&key, sizeof(key) );
+           std::vector<char> kslice = key_format::pack( key );
+           ldb::Slice key_slice( kslice.data(), kslice.size() );
            iterator itr( _db->NewIterator( ldb::ReadOptions() ), this );
            itr._it->Seek( key_slice );
            if( itr.valid()  ) 
@@ -177,8 +279,7 @@ namespace bts { namespace db {
              {
                return false;
              }
-             FC_ASSERT( sizeof( Key) == it->key().size() );
-             k = *((Key*)it->key().data());
+             key_format::unpack( it->key().data(), it->key().size(), k );
              return true;
           } FC_RETHROW_EXCEPTIONS( warn, "error reading last item from database" );
         }
@@ -200,8 +301,7 @@ namespace bts { namespace db {
            fc::datastream<const char*> ds( packed_value.data(), packed_value.size() );
            fc::raw::unpack( ds, v );
 
-           FC_ASSERT( sizeof( Key) == it->key().size() );
-           k = *((Key*)it->key().data());
+           key_format::unpack( it->key().data(), it->key().size(), k );
            return true;
           } FC_RETHROW_EXCEPTIONS( warn, "error reading last item from database" );
         }
@@ -210,11 +310,18 @@ namespace bts { namespace db {
         {
           try
           {
-             ldb::Slice ks( (char*)&k, sizeof(k) );
+             std::vector<char> kslice = key_format::pack( k );
+             ldb::Slice ks( kslice.data(), kslice.size() );
              auto vec = fc::raw::pack(v);
              if (_encrypt_key)
               vec = fc::aes_encrypt( *_encrypt_key, vec );
              ldb::Slice vs( vec.data(), vec.size() );             
+             if( _batch )
+             {
+                _batch->batch.Put( ks, vs );
+                _batch->writes[ks.ToString()] = vs.ToString();
+                return;
+             }
              auto status = _db->Put( ldb::WriteOptions(), ks, vs );
              if( !status.ok() )
              {
@@ -223,17 +330,20 @@ namespace bts { namespace db {
           } FC_RETHROW_EXCEPTIONS( warn, "error storing ${key} = ${value}", ("key",k)("value",v) );
         }
 
+        /** removing a key that is not in the database is not an error, with or without a batch */
         void remove( const Key& k )
         {
           try
           {
-            ldb::Slice ks( (char*)&k, sizeof(k) );
-            auto status = _db->Delete( ldb::WriteOptions(), ks );
-
-            if( status.IsNotFound() )
+            std::vector<char> kslice = key_format::pack( k );
+            ldb::Slice ks( kslice.data(), kslice.size() );
+            if( _batch )
             {
-              FC_THROW_EXCEPTION( key_not_found_exception, "unable to find key ${key}", ("key",k) );
+               _batch->batch.Delete( ks );
+               _batch->writes[ks.ToString()] = fc::optional<std::string>();
+               return;
             }
+            auto status = _db->Delete( ldb::WriteOptions(), ks );
             if( !status.ok() )
             {
                 FC_THROW_EXCEPTION( exception, "database error: ${msg}", ("msg", status.ToString() ) );
@@ -243,6 +353,49 @@ namespace bts { namespace db {
         
 
      private:
+        /** reads the raw value stored at key, staged writes take precedence over the database */
+        bool read( const ldb::Slice& key, std::string& value )
+        {
+           if( _batch )
+           {
+              auto itr = _batch->writes.find( key.ToString() );
+              if( itr != _batch->writes.end() )
+              {
+                 if( !itr->second )
+                 {
+                    return false;
+                 }
+                 value = *itr->second;
+                 return true;
+              }
+           }
+           auto status = _db->Get( ldb::ReadOptions(), key, &value );
+           if( status.IsNotFound() )
+           {
+              return false;
+           }
+           if( !status.ok() )
+           {
+               FC_THROW_EXCEPTION( exception, "database error: ${msg}", ("msg", status.ToString() ) );
+           }
+           return true;
+        }
+
+        struct pending_batch
+        {
+           ldb::WriteBatch                                    batch;
+           std::map<std::string, fc::optional<std::string> >  writes; // empty optional marks a removed key
+        };
+
+        /** converts a key stored by key_compare into the key_codec encoding */
+        static std::string upgrade_key( const ldb::Slice& legacy_key )
+        {
+           Key k;
+           detail::pod_key_format<Key,false>::unpack( legacy_key.data(), legacy_key.size(), k );
+           std::vector<char> encoded = key_format::pack( k );
+           return std::string( encoded.data(), encoded.size() );
+        }
+
         class key_compare : public leveldb::Comparator
         {
           public:
@@ -262,6 +415,7 @@ namespace bts { namespace db {
         };
 
         key_compare                  _comparer;
+        std::unique_ptr<pending_batch> _batch;
         std::unique_ptr<leveldb::DB> _db;
         fc::optional<fc::uint512>    _encrypt_key;
         
@@ -0,0 +1,116 @@
+#pragma once
+#include <fc/filesystem.hpp>
+#include <fc/exception/exception.hpp>
+
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include <string.h>
+
+namespace bts { namespace db {
+
+  namespace detail { class snapshot_reader_impl; }
+
+  /** flushes the entries of dir so that files created, renamed or removed in it survive a power loss */
+  void sync_directory( const fc::path& dir );
+
+  /** flushes the contents of the open file fd to disk, @return false on failure */
+  bool sync_file( int fd );
+
+  /**
+   *  A snapshot is a flat image of in memory state that can be mapped back
+   *  in at startup instead of rebuilding the state from the databases.
+   *
+   *  The file starts with a header holding a magic number, the format
+   *  version of the caller, the height the image was taken at and a
+   *  checksum of everything after the header.  The body is a sequence of
+   *  sections, each an array of fixed size elements that are copied with
+   *  memcpy, so only trivially copyable types may be written.
+   *
+   *  Sections are written to a temporary file that is synced and renamed over
+   *  the snapshot on commit(), and the directory is synced after the rename,
+   *  so a crash or power loss leaves either the last snapshot or the new one.
+   */
+  class snapshot_writer
+  {
+     public:
+        snapshot_writer( const fc::path& file, uint32_t version, uint32_t height );
+        ~snapshot_writer();
+
+        template<typename T>
+        void write( const std::vector<T>& items )
+        {
+           static_assert( std::is_trivially_copyable<T>::value, "snapshot sections are copied with memcpy" );
+           write_section( items.size() ? (const char*)&items.front() : nullptr, sizeof(T), items.size() );
+        }
+
+        template<typename T>
+        void write_value( const T& item )
+        {
+           static_assert( std::is_trivially_copyable<T>::value, "snapshot sections are copied with memcpy" );
+           write_section( (const char*)&item, sizeof(T), 1 );
+        }
+
+        void write_section( const char* data, uint32_t element_size, uint64_t count );
+
+        /** replaces the snapshot with what has been written */
+        void commit();
+
+     private:
+        fc::path          _file;
+        uint32_t          _version;
+        uint32_t          _height;
+        std::vector<char> _body;
+  };
+
+  /**
+   *  Maps a snapshot written by snapshot_writer and reads its sections
+   *  back in the order they were written.
+   */
+  class snapshot_reader
+  {
+     public:
+        snapshot_reader();
+        ~snapshot_reader();
+
+        /**
+         *  @return false if the file does not exist, is of another version or
+         *          fails its checksum, in which case the state must be rebuilt.
+         */
+        bool     open( const fc::path& file, uint32_t version );
+        void     close();
+
+        uint32_t height()const;
+
+        template<typename T>
+        void read( std::vector<T>& items )
+        {
+           static_assert( std::is_trivially_copyable<T>::value, "snapshot sections are copied with memcpy" );
+           uint64_t    count = 0;
+           const char* data  = read_section( sizeof(T), count );
+           items.resize( count );
+           if( count )
+           {
+              memcpy( (char*)&items.front(), data, count * sizeof(T) );
+           }
+        }
+
+        template<typename T>
+        void read_value( T& item )
+        {
+           static_assert( std::is_trivially_copyable<T>::value, "snapshot sections are copied with memcpy" );
+           uint64_t    count = 0;
+           const char* data  = read_section( sizeof(T), count );
+           FC_ASSERT( count == 1 );
+           memcpy( (char*)&item, data, sizeof(T) );
+        }
+
+        /** @return a pointer into the mapped file to count elements of element_size */
+        const char* read_section( uint32_t element_size, uint64_t& count );
+
+     private:
+        std::unique_ptr<detail::snapshot_reader_impl> my;
+  };
+
+} } // bts::db
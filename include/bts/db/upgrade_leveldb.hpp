@@ -23,8 +23,10 @@
 // that only one new copy constructor typically needs to be written to support
 // upgrading any previous version of the object when an object type is modified.
 
-//*Database versioning is only supported for changes to database value types
-// (databases with modified key types cannot currently be upgraded).
+//*Database versioning of values is only supported for changes to database value types.
+// Changes to the key encoding (e.g. a key type gaining a bts::db::key_codec) are handled
+// separately by UpgradeDbKeysIfNecessary, because LevelDB refuses to open a database
+// with a comparator other than the one it was created with.
 //*The database versioning code requires that fc::get_typename is defined for
 // all value types which are to be versioned.
 
@@ -115,4 +117,16 @@ void UpgradeDb ## TYPE ## VERSIONNUM(leveldb::DB* dbase, fc::optional<fc::uint51
 static int dummyResult ## TYPE ## VERSIONNUM  = \
   TUpgradeDbMapper::Instance()->Add(fc::get_typename<TYPE ## VERSIONNUM>::name(), UpgradeDb ## TYPE ## VERSIONNUM);
 
-void UpgradeDbIfNecessary(fc::path dir, leveldb::DB* dbase, const char* record_type, size_t record_type_size, fc::optional<fc::uint512> encrypt_key);
\ No newline at end of file
+void UpgradeDbIfNecessary(fc::path dir, leveldb::DB* dbase, const char* record_type, size_t record_type_size, fc::optional<fc::uint512> encrypt_key);
+
+typedef std::function<std::string(const leveldb::Slice&)> TUpgradeDbKeyFunction;
+
+/**
+ *  Called when opening dir failed with open_status.  If the failure is a comparator mismatch
+ *  the database is opened with legacy_options, every key is rewritten with convert_key into a
+ *  new database that uses the default bytewise comparator, and the new database replaces the
+ *  old one.  Values and the RECORD_TYPE file are carried over unchanged.
+ *
+ *  @return true if the database was upgraded and should be opened again
+ */
+bool UpgradeDbKeysIfNecessary(fc::path dir, const leveldb::Status& open_status, const leveldb::Options& legacy_options, TUpgradeDbKeyFunction convert_key);
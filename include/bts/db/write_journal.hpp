@@ -0,0 +1,83 @@
+#pragma once
+#include <fc/filesystem.hpp>
+#include <fc/optional.hpp>
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+
+namespace bts { namespace db {
+
+  namespace detail { class write_journal_impl; }
+
+  /** the raw key/value writes staged by a level_map batch, an empty value marks a removed key */
+  typedef std::map<std::string, fc::optional<std::string> > staged_writes;
+
+  /**
+   *  Makes a set of batches on separate databases commit atomically and durably
+   *  with one fsync per commit.
+   *
+   *  write() appends the staged writes of every registered database to a
+   *  journal file and syncs it before any of them are committed, after which
+   *  the databases can be committed without a sync.  The journal keeps every
+   *  commit until clear() is called at a point where every database has been
+   *  committed with a sync.  If the process dies or the power is lost in
+   *  between, the journal is still there on the next open() and the final
+   *  value of every key it holds is written again as each database is
+   *  registered with add().  That is safe because a database only ever holds
+   *  a prefix of the journaled commits.  A record that was never completely
+   *  written is ignored, none of the databases had been touched for it yet.
+   */
+  class write_journal
+  {
+     public:
+        write_journal();
+        ~write_journal();
+
+        /** loads the writes left behind since the last clear(), if any */
+        void open( const fc::path& file );
+
+        /**
+         *  Registers a level_map or level_pod_map under name, recovered writes for it
+         *  are applied immediately so it must be called before any state is loaded
+         *  from the database.
+         */
+        template<typename Map>
+        void add( const std::string& name, Map& db )
+        {
+           add_database( name, [&db]() { return db.staged_writes(); },
+                               [&db]( const staged_writes& w ) { db.apply_writes( w ); } );
+        }
+
+        /** call once every database has been added, discards the recovered journal */
+        void end_recovery();
+
+        /**
+         *  Appends the staged writes of every database to the journal and syncs it,
+         *  call before committing any of them.  The directory is synced as well when
+         *  this creates the journal file.
+         */
+        void write();
+
+        /** call after every database has committed the writes of the last write() */
+        void committed();
+
+        /** @return the number of commits written since the last clear() */
+        uint32_t size()const;
+
+        /** call once every database has been committed with a sync, removes the journal */
+        void clear();
+
+        /** the bytes of keys and values written by every commit since open(), by database name */
+        const std::map<std::string, uint64_t>& bytes_written()const;
+
+     private:
+        void add_database( const std::string& name,
+                           std::function<const staged_writes*()> pending,
+                           std::function<void( const staged_writes& )> apply );
+
+        std::unique_ptr<detail::write_journal_impl> my;
+  };
+
+} } // bts::db
@@ -149,7 +149,7 @@ class client
             
               _accept_loop_complete = fc::async( [=]{ accept_loop(); } );
 
-              chain.open( cfg.datadir / "blockchain" );
+              chain.open( cfg.datadir / "blockchain", true, true /* index addresses for wallet rescans */ );
               wallet.open( cfg.datadir / "wallet.dat" );
 
 
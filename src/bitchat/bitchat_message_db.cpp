@@ -3,6 +3,8 @@
 #include <fc/exception/exception.hpp>
 #include <bts/db/level_pod_map.hpp>
 
+#include <limits>
+
 
 
 
@@ -31,6 +33,51 @@ namespace bts { namespace bitchat {
             a.digest == b.digest;
             // TODO: compare the rest of it...
   }
+} } // bts::bitchat
+
+namespace bts { namespace db {
+   /**
+    *  type, received_time, to_key, from_key, digest identify the message and come
+    *  first, the remaining fields follow so that the whole header can be recovered
+    *  from the index key.
+    */
+   template<>
+   struct key_codec<bts::bitchat::message_header>
+   {
+      static const bool   is_order_preserving = true;
+      static const size_t encoded_size        = 4 + 8 + 33 + 33 + sizeof(fc::uint256) + 1 + 65 + 8 + 8 + 1;
+
+      static void encode( const bts::bitchat::message_header& k, char* out )
+      {
+         key_encoding::encode_uint32( uint32_t(k.type.value), out );
+         key_encoding::encode_int64( k.received_time.time_since_epoch().count(), out );
+         key_encoding::encode_bytes( k.to_key.data, sizeof(k.to_key.data), out );
+         key_encoding::encode_bytes( k.from_key.data, sizeof(k.from_key.data), out );
+         key_encoding::encode_bytes( &k.digest, sizeof(k.digest), out );
+         key_encoding::encode_uint8( uint8_t(k.status.value), out );
+         key_encoding::encode_bytes( k.from_sig.data, sizeof(k.from_sig.data), out );
+         key_encoding::encode_int64( k.from_sig_time.time_since_epoch().count(), out );
+         key_encoding::encode_int64( k.ack_time.time_since_epoch().count(), out );
+         key_encoding::encode_uint8( k.state_mark, out );
+      }
+      static void decode( const char* in, bts::bitchat::message_header& k )
+      {
+         k.type          = bts::bitchat::private_message_type( key_encoding::decode_uint32( in ) );
+         k.received_time = fc::time_point( fc::microseconds( key_encoding::decode_int64( in ) ) );
+         key_encoding::decode_bytes( in, k.to_key.data, sizeof(k.to_key.data) );
+         key_encoding::decode_bytes( in, k.from_key.data, sizeof(k.from_key.data) );
+         key_encoding::decode_bytes( in, &k.digest, sizeof(k.digest) );
+         k.status        = bts::bitchat::message_status( key_encoding::decode_uint8( in ) );
+         key_encoding::decode_bytes( in, k.from_sig.data, sizeof(k.from_sig.data) );
+         k.from_sig_time = fc::time_point( fc::microseconds( key_encoding::decode_int64( in ) ) );
+         k.ack_time      = fc::time_point( fc::microseconds( key_encoding::decode_int64( in ) ) );
+         k.state_mark    = key_encoding::decode_uint8( in );
+      }
+   };
+} } // bts::db
+
+namespace bts { namespace bitchat {
+
   namespace detail 
   {
      class message_db_impl
@@ -39,6 +86,32 @@ namespace bts { namespace bitchat {
           db::level_pod_map<message_header,uint32_t>    _index;
           db::level_pod_map<fc::uint256,std::vector<char> > _digest_to_data;
           db::level_pod_map<fc::uint256, message_header>    _digest_to_header;
+
+          /**
+           *  The index key contains every field of the header, so an entry stored before
+           *  state_mark/status/ack_time changed has to be found by the identifying fields.
+           */
+          void remove_index( const message_header& h )
+          {
+             message_header first;
+             first.type          = h.type;
+             first.received_time = h.received_time;
+             first.to_key        = h.to_key;
+             first.from_key      = h.from_key;
+             first.digest        = h.digest;
+             first.status        = message_status( 0 );
+             memset( first.from_sig.data, 0, sizeof(first.from_sig.data) );
+             first.from_sig_time = fc::time_point( fc::microseconds( std::numeric_limits<int64_t>::min() ) );
+             first.ack_time      = first.from_sig_time;
+             first.state_mark    = 0;
+
+             auto itr = _index.lower_bound( first );
+             while( itr.valid() && itr.key() == h )
+             {
+                _index.remove( itr.key() );
+                ++itr;
+             }
+          }
      };
 
   } // namespace detail
@@ -62,7 +135,7 @@ namespace bts { namespace bitchat {
                                            const message_header* previous_msg_header )
   { try {
       if (previous_msg_header)
-        my->_index.remove(*previous_msg_header);
+        my->remove_index(*previous_msg_header);
   
       FC_ASSERT( msg.from_sig    );
       FC_ASSERT( msg.from_key    );
@@ -87,7 +160,7 @@ namespace bts { namespace bitchat {
   //remove entire message (msg_header and message contents)
   void message_db::remove_message(const message_header& msg_header)
   {
-      my->_index.remove(msg_header);    
+      my->remove_index(msg_header);
       my->_digest_to_data.remove(msg_header.digest);
       my->_digest_to_header.remove(msg_header.digest);
   }
@@ -96,13 +169,14 @@ namespace bts { namespace bitchat {
   //used for equivalence, you need to first remove the unmodified form of the msg_header.
   void message_db::store_message_header(const message_header& msg_header)
   {
+      my->remove_index(msg_header);
       my->_index.store(msg_header,0);
       my->_digest_to_header.store(msg_header.digest, msg_header);
   } 
 
   void message_db::remove_message_header(const message_header& msg_header)
   {
-      my->_index.remove(msg_header);
+      my->remove_index(msg_header);
       my->_digest_to_header.remove(msg_header.digest);
   } 
 
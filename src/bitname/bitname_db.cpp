@@ -6,6 +6,7 @@
 #include <bts/config.hpp>
 #include <bts/db/level_map.hpp>
 #include <bts/db/level_pod_map.hpp>
+#include <bts/db/snapshot.hpp>
 #include <fc/io/raw.hpp>
 #include <fc/io/fstream.hpp>
 #include <fc/reflect/variant.hpp>
@@ -38,6 +39,8 @@ namespace bts { namespace bitname {
    
     namespace detail 
     {
+       const uint32_t header_ids_snapshot_version = 1;
+
        class name_db_impl 
        {
           public:
@@ -72,6 +75,9 @@ namespace bts { namespace bitname {
               **/
              std::unordered_map<fc::sha224,uint32_t>   _id_to_block_num;
 
+             /** _header_ids and _chain_difficulty saved every BITNAME_SNAPSHOT_INTERVAL blocks */
+             fc::path                                   _header_ids_file;
+
 
              name_location find_name( uint64_t name )
              {
@@ -97,29 +103,75 @@ namespace bts { namespace bitname {
 
              void load_indexes( const fc::path& db_dir )
              {
-                ilog( "load indexes" );
-                 bool rebuild_header_ids = true;
-                 if( fc::exists( db_dir / "header_ids" ) )
+                 ilog( "load indexes" );
+                 _header_ids_file = db_dir / "header_ids";
+                 uint32_t snapshot_size = load_header_ids();
+
+                 // only the headers after the snapshot have to be read and hashed
+                 auto itr = _block_num_to_header.lower_bound( snapshot_size );
+                 while( itr.valid() )
                  {
-                   //  fc::ifstream in( db_dir / "header_ids", fc::ifstream::binary );
-                    // fc::raw::unpack( in, _header_ids );
-                 
-                     // TODO: validate integrety
-                 
-                     // rebuild_header_ids = false;
-                     // TODO: load chain difficulty here as well.
+                   push_header_id( itr.value().id() );
+                   ++itr;
                  }
-                 
-                 if( rebuild_header_ids )
+                 if( _header_ids.size() != snapshot_size )
                  {
-                    ilog( "load indexes" );
-                    auto itr = _block_num_to_header.begin();
-                    while( itr.valid() )
+                    save_header_ids();
+                 }
+             }
+
+             /** @return the number of header ids restored from the snapshot */
+             uint32_t load_header_ids()
+             {
+                 db::snapshot_reader in;
+                 if( !in.open( _header_ids_file, header_ids_snapshot_version ) )
+                 {
+                    return 0;
+                 }
+                 try
+                 {
+                    std::vector<fc::sha224> ids;
+                    uint64_t                chain_difficulty = 0;
+                    in.read( ids );
+                    in.read_value( chain_difficulty );
+
+                    // a head that has since been popped invalidates the snapshot
+                    auto head = ids.size() ? _block_num_to_header.fetch_optional( ids.size() - 1 ) : fc::optional<name_header>();
+                    if( !head || head->id() != ids.back() )
+                    {
+                       wlog( "header id snapshot of ${n} blocks is not on this chain", ("n",ids.size()) );
+                       return 0;
+                    }
+
+                    _header_ids       = std::move(ids);
+                    _chain_difficulty = chain_difficulty;
+                    _id_to_block_num.reserve( _header_ids.size() );
+                    for( uint32_t i = 0; i < _header_ids.size(); ++i )
                     {
-                      push_header_id( itr.value().id() );
-                      ++itr;
+                       _id_to_block_num[_header_ids[i]] = i;
                     }
-                    // TODO: save to disk
+                    ilog( "loaded ${n} header ids from the snapshot", ("n",_header_ids.size()) );
+                    return _header_ids.size();
+                 }
+                 catch ( const fc::exception& e )
+                 {
+                    wlog( "unable to load header id snapshot\n${e}", ("e",e.to_detail_string()) );
+                    return 0;
+                 }
+             }
+
+             void save_header_ids()
+             {
+                 try
+                 {
+                    db::snapshot_writer out( _header_ids_file, header_ids_snapshot_version, _header_ids.size() );
+                    out.write( _header_ids );
+                    out.write_value( _chain_difficulty );
+                    out.commit();
+                 }
+                 catch ( const fc::exception& e )
+                 {
+                    wlog( "unable to save header id snapshot\n${e}", ("e",e.to_detail_string()) );
                  }
              }
 
@@ -225,7 +277,10 @@ namespace bts { namespace bitname {
 
     void name_db::close()
     { try {
-       // TODO: save _header_ids to disk
+       if( my->_header_ids.size() )
+       {
+          my->save_header_ids();
+       }
        my->_block_num_to_header.close();
        my->_block_num_to_name_trxs.close();
        my->_name_hash_to_locs.close();
@@ -334,6 +389,11 @@ namespace bts { namespace bitname {
        }
        my->index_trx( name_location( next_num, max_trx_num ), next_block.name_hash );
        my->_timekeeper.push( next_num, next_block.utc_sec, next_block.difficulty() );
+
+       if( next_num % BITNAME_SNAPSHOT_INTERVAL == 0 )
+       {
+          my->save_header_ids();
+       }
     } FC_RETHROW_EXCEPTIONS( warn, "unable to push block ${next_block}", ("next_block", next_block) ) } 
 
 
@@ -0,0 +1,83 @@
+#include <bts/blockchain/address_filter.hpp>
+#include <fc/crypto/city.hpp>
+
+#include <algorithm>
+
+namespace bts { namespace blockchain {
+
+  namespace detail
+  {
+     const uint32_t address_filter_bits_per_address = 10;
+     const uint8_t  address_filter_num_hashes       = 7;
+
+     /** the i'th bit probed for owner, derived from two halves of one hash */
+     struct address_filter_probe
+     {
+        address_filter_probe( const output_owner& owner, uint64_t num_bits )
+        :_num_bits(num_bits)
+        {
+           char data[sizeof(owner.type) + sizeof(owner.addr.data)];
+           data[0] = char(owner.type);
+           memcpy( data + 1, owner.addr.data, sizeof(owner.addr.data) );
+           fc::uint128 h = fc::city_hash128( data, sizeof(data) );
+           _h1 = h.high_bits();
+           _h2 = h.low_bits() | 1;
+        }
+
+        uint64_t bit( uint8_t i )const { return (_h1 + i * _h2) % _num_bits; }
+
+        uint64_t _num_bits;
+        uint64_t _h1;
+        uint64_t _h2;
+     };
+  } // namespace detail
+
+  address_filter::address_filter( uint32_t num_addresses )
+  :num_hashes( detail::address_filter_num_hashes )
+  {
+     uint64_t num_bits = std::max<uint64_t>( 64, uint64_t(num_addresses) * detail::address_filter_bits_per_address );
+     bits.resize( (num_bits + 7) / 8 );
+  }
+
+  void address_filter::insert( const output_owner& owner )
+  {
+     FC_ASSERT( bits.size() > 0 );
+     detail::address_filter_probe probe( owner, bits.size() * 8 );
+     for( uint8_t i = 0; i < num_hashes; ++i )
+     {
+        uint64_t b = probe.bit( i );
+        bits[b/8] |= char(1 << (b%8));
+     }
+  }
+
+  bool address_filter::may_contain( const output_owner& owner )const
+  {
+     if( bits.size() == 0 )
+     {
+        return true;
+     }
+     detail::address_filter_probe probe( owner, bits.size() * 8 );
+     for( uint8_t i = 0; i < num_hashes; ++i )
+     {
+        uint64_t b = probe.bit( i );
+        if( !(bits[b/8] & char(1 << (b%8))) )
+        {
+           return false;
+        }
+     }
+     return true;
+  }
+
+  bool address_filter::may_contain_any( const std::vector<output_owner>& owners )const
+  {
+     for( auto itr = owners.begin(); itr != owners.end(); ++itr )
+     {
+        if( may_contain( *itr ) )
+        {
+           return true;
+        }
+     }
+     return false;
+  }
+
+} } // bts::blockchain
@@ -0,0 +1,145 @@
+#include <bts/blockchain/address_index.hpp>
+#include <bts/blockchain/outputs.hpp>
+#include <bts/db/level_map.hpp>
+#include <fc/reflect/variant.hpp>
+#include <fc/log/logger.hpp>
+
+namespace bts { namespace blockchain {
+
+  output_owner::output_owner( const bts::address& a )
+  :type(bts_address)
+  {
+     memset( addr.data, 0, sizeof(addr.data) );
+     memcpy( addr.data, a.addr.data, sizeof(a.addr.data) );
+  }
+
+  output_owner::output_owner( const bts::pts_address& a )
+  :type(pts_address)
+  {
+     memcpy( addr.data, a.addr.data, sizeof(addr.data) );
+  }
+
+  bool get_output_owner( const trx_output& out, output_owner& owner )
+  {
+     switch( out.claim_func )
+     {
+        case claim_by_signature:
+           owner = output_owner( out.as<claim_by_signature_output>().owner );
+           return true;
+        case claim_by_pts:
+           owner = output_owner( out.as<claim_by_pts_output>().owner );
+           return true;
+        case claim_by_bid:
+           owner = output_owner( out.as<claim_by_bid_output>().pay_address );
+           return true;
+        case claim_by_long:
+           owner = output_owner( out.as<claim_by_long_output>().pay_address );
+           return true;
+        case claim_by_cover:
+           owner = output_owner( out.as<claim_by_cover_output>().owner );
+           return true;
+        default:
+           return false;
+     }
+  }
+
+  namespace detail
+  {
+     class address_index_impl
+     {
+        public:
+           address_index_impl():_open(false){}
+
+           bool                                            _open;
+           /** the value is the claim_func of the output */
+           bts::db::level_map<address_output_key,uint8_t>  _outputs;
+     };
+
+  } // namespace detail
+
+  address_index::address_index()
+  :my( new detail::address_index_impl() )
+  {
+  }
+
+  address_index::~address_index(){}
+
+  void address_index::open( const fc::path& dir, bool create, bts::db::write_journal* journal )
+  { try {
+     my->_outputs.open( dir, create );
+     if( journal )
+     {
+        journal->add( "address_index", my->_outputs );
+     }
+     my->_open = true;
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("dir",dir) ) }
+
+  void address_index::close()
+  {
+     my->_outputs.close();
+     my->_open = false;
+  }
+
+  bool address_index::is_open()const
+  {
+     return my->_open;
+  }
+
+  void address_index::begin_batch()
+  {
+     my->_outputs.begin_batch();
+  }
+
+  void address_index::commit_batch( bool sync )
+  {
+     my->_outputs.commit_batch( sync );
+  }
+
+  void address_index::abort_batch()
+  {
+     my->_outputs.abort_batch();
+  }
+
+  void address_index::add( const trx_num& source, const signed_transaction& trx )
+  { try {
+     output_owner owner;
+     for( uint16_t i = 0; i < trx.outputs.size(); ++i )
+     {
+        if( get_output_owner( trx.outputs[i], owner ) )
+        {
+           my->_outputs.store( address_output_key( owner, output_location( source, i ) ),
+                               uint8_t(trx.outputs[i].claim_func) );
+        }
+     }
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("source",source) ) }
+
+  void address_index::remove( const trx_num& source, const signed_transaction& trx )
+  { try {
+     output_owner owner;
+     for( uint16_t i = 0; i < trx.outputs.size(); ++i )
+     {
+        if( get_output_owner( trx.outputs[i], owner ) )
+        {
+           my->_outputs.remove( address_output_key( owner, output_location( source, i ) ) );
+        }
+     }
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("source",source) ) }
+
+  std::vector<output_location> address_index::fetch( const output_owner& owner, uint32_t from_block_num )
+  { try {
+     std::vector<output_location> locs;
+     auto itr = my->_outputs.lower_bound( address_output_key( owner, output_location( trx_num( from_block_num, 0 ), 0 ) ) );
+     while( itr.valid() )
+     {
+        address_output_key key = itr.key();
+        if( !(key.owner == owner) )
+        {
+           break;
+        }
+        locs.push_back( key.location );
+        ++itr;
+     }
+     return locs;
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("owner",owner)("from_block_num",from_block_num) ) }
+
+} } // bts::blockchain
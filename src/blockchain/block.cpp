@@ -50,33 +50,46 @@ namespace bts { namespace blockchain  {
   }
 
 
-  uint160 trx_block::calculate_merkle_root()const
+  namespace detail
   {
-     if( trxs.size() == 0 ) return uint160();
-     if( trxs.size() == 1 ) return trxs.front().id();
+     uint160 calculate_merkle_root( std::vector<uint160> layer_one )
+     {
+        if( layer_one.size() == 0 ) return uint160();
 
+        std::vector<uint160> layer_two;
+        while( layer_one.size() > 1 )
+        {
+           if( layer_one.size() % 2 == 1 )
+           {
+             layer_one.push_back( uint160() );
+           }
+
+           static_assert( sizeof(uint160[2]) == 40, "validate there is no padding between array items" );
+           for( uint32_t i = 0; i < layer_one.size(); i += 2 )
+           {
+               layer_two.push_back(  small_hash( (char*)&layer_one[i], 2*sizeof(uint160) ) );
+           }
+
+           layer_one = std::move(layer_two);
+        }
+        return layer_one.front();
+     }
+  }
+
+  uint160 trx_block::calculate_merkle_root()const
+  {
      std::vector<uint160> layer_one;
+     layer_one.reserve( trxs.size() );
      for( auto itr = trxs.begin(); itr != trxs.end(); ++itr )
      {
        layer_one.push_back(itr->id());
      }
-     std::vector<uint160> layer_two;
-     while( layer_one.size() > 1 )
-     {
-        if( layer_one.size() % 2 == 1 )
-        {
-          layer_one.push_back( uint160() );
-        }
-
-        static_assert( sizeof(uint160[2]) == 40, "validate there is no padding between array items" );
-        for( uint32_t i = 0; i < layer_one.size(); i += 2 )
-        {
-            layer_two.push_back(  small_hash( (char*)&layer_one[i], 2*sizeof(uint160) ) );
-        }
+     return detail::calculate_merkle_root( std::move(layer_one) );
+  }
 
-        layer_one = std::move(layer_two);
-     }
-     return layer_one.front();
+  uint160 full_block::calculate_merkle_root()const
+  {
+     return detail::calculate_merkle_root( trx_ids );
   }
 
   uint64_t block_header::get_missing_cdd( uint64_t prev_avail_cdays )const
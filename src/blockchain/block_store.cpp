@@ -0,0 +1,325 @@
+#include <bts/blockchain/block_store.hpp>
+#include <fc/exception/exception.hpp>
+#include <fc/log/logger.hpp>
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <fstream>
+
+namespace bts { namespace blockchain {
+
+   namespace detail
+   {
+      /** written in place of the size of the header entry, anything else is not a block store index */
+      const uint64_t block_store_version = 1;
+
+      /**
+       *  The position of a block in blocks.dat, stored in blocks.idx at
+       *  (block_num - first + 1) * sizeof(index_entry).  The entry at the start of
+       *  blocks.idx is a header whose offset is the first block stored.
+       */
+      struct index_entry
+      {
+         index_entry():offset(0),size(0){}
+
+         uint64_t offset;
+         uint64_t size;
+      };
+
+      class block_store_impl
+      {
+         public:
+            block_store_impl():_first(0),_size(0),_data_size(0){}
+
+            fc::path       _data_path;
+            fc::path       _index_path;
+            std::fstream   _data;
+            std::fstream   _index;
+            uint32_t       _first;
+            uint32_t       _size;
+            uint64_t       _data_size;
+
+            fc::path tmp_path( const fc::path& p )const
+            {
+               return p.generic_string() + ".tmp";
+            }
+
+            void open_streams()
+            {
+               auto mode = std::ios::in | std::ios::out | std::ios::binary;
+               _data.open( _data_path.to_native_ansi_path().c_str(), mode );
+               _index.open( _index_path.to_native_ansi_path().c_str(), mode );
+               FC_ASSERT( _data.good() && _index.good(), "unable to open block store" );
+            }
+
+            void close_streams()
+            {
+               if( _data.is_open() )  { _data.close();  }
+               if( _index.is_open() ) { _index.close(); }
+            }
+
+            index_entry read_entry( uint32_t block_num )
+            {
+               index_entry e;
+               _index.clear();
+               _index.seekg( uint64_t(block_num - _first + 1) * sizeof(index_entry) );
+               _index.read( (char*)&e, sizeof(e) );
+               FC_ASSERT( _index.good(), "unable to read block store index", ("block_num",block_num) );
+               return e;
+            }
+
+            void write_header()
+            {
+               index_entry header;
+               header.offset = _first;
+               header.size   = block_store_version;
+               _index.clear();
+               _index.seekp( 0 );
+               _index.write( (const char*)&header, sizeof(header) );
+               _index.flush();
+               FC_ASSERT( _index.good(), "unable to write block store index" );
+            }
+
+            /** truncates both files to hold exactly num_blocks blocks starting at _first */
+            void resize( uint32_t num_blocks, uint64_t data_size )
+            {
+               close_streams();
+               boost::filesystem::resize_file( _index_path, uint64_t(num_blocks + 1) * sizeof(index_entry) );
+               boost::filesystem::resize_file( _data_path, data_size );
+               _size      = num_blocks;
+               _data_size = data_size;
+               open_streams();
+               write_header();
+            }
+      };
+
+   } // namespace detail
+
+   block_store::block_store()
+   :my( new detail::block_store_impl() )
+   {
+   }
+
+   block_store::~block_store()
+   {
+      close();
+   }
+
+   void block_store::open( const fc::path& dir )
+   { try {
+      if( !fc::exists( dir ) )
+      {
+         fc::create_directories( dir );
+      }
+      my->_data_path  = dir / "blocks.dat";
+      my->_index_path = dir / "blocks.idx";
+
+      // left behind by an interrupted discard_before(), which had not yet replaced anything
+      if( fc::exists( my->tmp_path( my->_data_path ) ) )  { fc::remove( my->tmp_path( my->_data_path ) );  }
+      if( fc::exists( my->tmp_path( my->_index_path ) ) ) { fc::remove( my->tmp_path( my->_index_path ) ); }
+
+      // std::fstream will not create a file opened for reading and writing
+      if( !fc::exists( my->_data_path ) )
+      {
+         std::ofstream( my->_data_path.to_native_ansi_path().c_str(), std::ios::binary );
+      }
+      if( !fc::exists( my->_index_path ) )
+      {
+         std::ofstream( my->_index_path.to_native_ansi_path().c_str(), std::ios::binary );
+      }
+      my->open_streams();
+
+      uint64_t index_size = boost::filesystem::file_size( my->_index_path );
+      uint64_t data_size  = boost::filesystem::file_size( my->_data_path );
+
+      detail::index_entry header;
+      if( index_size >= sizeof(header) )
+      {
+         my->_index.seekg( 0 );
+         my->_index.read( (char*)&header, sizeof(header) );
+      }
+      if( index_size < sizeof(header) || !my->_index.good() || header.size != detail::block_store_version )
+      {
+         if( index_size > 0 )
+         {
+            wlog( "discarding a block store index without a valid header" );
+         }
+         my->_first = 0;
+         my->resize( 0, 0 );
+         return;
+      }
+      my->_first = header.offset;
+      uint32_t num_blocks = index_size / sizeof(detail::index_entry) - 1;
+
+      // a crash may leave a partial index entry or an entry without its block
+      while( num_blocks > 0 )
+      {
+         auto e = my->read_entry( my->_first + num_blocks - 1 );
+         if( e.offset + e.size <= data_size )
+         {
+            break;
+         }
+         --num_blocks;
+      }
+      uint64_t used = 0;
+      if( num_blocks > 0 )
+      {
+         auto e = my->read_entry( my->_first + num_blocks - 1 );
+         used = e.offset + e.size;
+      }
+      if( (num_blocks + 1) * sizeof(detail::index_entry) != index_size || used != data_size )
+      {
+         wlog( "truncating block store to ${n} blocks", ("n",num_blocks) );
+         my->resize( num_blocks, used );
+      }
+      my->_size      = num_blocks;
+      my->_data_size = used;
+   } FC_RETHROW_EXCEPTIONS( warn, "unable to open block store", ("dir",dir) ) }
+
+   void block_store::close()
+   {
+      my->close_streams();
+      my->_first     = 0;
+      my->_size      = 0;
+      my->_data_size = 0;
+   }
+
+   uint32_t block_store::first_block()const
+   {
+      return my->_first;
+   }
+
+   uint32_t block_store::end_block()const
+   {
+      return my->_first + my->_size;
+   }
+
+   bool block_store::empty()const
+   {
+      return my->_size == 0;
+   }
+
+   bool block_store::contains( uint32_t block_num )const
+   {
+      return block_num >= my->_first && block_num - my->_first < my->_size;
+   }
+
+   void block_store::append( uint32_t block_num, const std::vector<char>& packed_block )
+   { try {
+      FC_ASSERT( empty() || block_num == end_block() );
+      FC_ASSERT( packed_block.size() > 0 );
+
+      if( empty() && block_num != my->_first )
+      {
+         my->_first = block_num;
+         my->write_header();
+      }
+
+      detail::index_entry e;
+      e.offset = my->_data_size;
+      e.size   = packed_block.size();
+
+      // the block is written before its index entry so open() can detect a partial write
+      my->_data.clear();
+      my->_data.seekp( e.offset );
+      my->_data.write( packed_block.data(), packed_block.size() );
+      my->_data.flush();
+      FC_ASSERT( my->_data.good(), "unable to write block" );
+
+      my->_index.clear();
+      my->_index.seekp( uint64_t(block_num - my->_first + 1) * sizeof(e) );
+      my->_index.write( (const char*)&e, sizeof(e) );
+      my->_index.flush();
+      FC_ASSERT( my->_index.good(), "unable to write block store index" );
+
+      my->_data_size += e.size;
+      ++my->_size;
+   } FC_RETHROW_EXCEPTIONS( warn, "", ("block_num",block_num) ) }
+
+   void block_store::truncate( uint32_t block_num )
+   { try {
+      if( block_num >= end_block() )
+      {
+         return;
+      }
+      if( block_num <= my->_first )
+      {
+         my->resize( 0, 0 );
+         return;
+      }
+      my->resize( block_num - my->_first, my->read_entry( block_num ).offset );
+   } FC_RETHROW_EXCEPTIONS( warn, "", ("block_num",block_num) ) }
+
+   void block_store::discard_before( uint32_t block_num )
+   { try {
+      if( block_num <= my->_first )
+      {
+         return;
+      }
+      if( block_num >= end_block() )
+      {
+         my->_first = block_num;
+         my->resize( 0, 0 );
+         return;
+      }
+
+      uint32_t keep = end_block() - block_num;
+      uint64_t base = my->read_entry( block_num ).offset;
+      auto     tmp_data  = my->tmp_path( my->_data_path );
+      auto     tmp_index = my->tmp_path( my->_index_path );
+      {
+         std::ofstream index_out( tmp_index.to_native_ansi_path().c_str(), std::ios::binary );
+         detail::index_entry header;
+         header.offset = block_num;
+         header.size   = detail::block_store_version;
+         index_out.write( (const char*)&header, sizeof(header) );
+         for( uint32_t n = block_num; n < end_block(); ++n )
+         {
+            auto e = my->read_entry( n );
+            e.offset -= base;
+            index_out.write( (const char*)&e, sizeof(e) );
+         }
+         index_out.flush();
+         FC_ASSERT( index_out.good(), "unable to write block store index" );
+
+         std::ofstream data_out( tmp_data.to_native_ansi_path().c_str(), std::ios::binary );
+         std::vector<char> buf( 1024*1024 );
+         my->_data.clear();
+         my->_data.seekg( base );
+         for( uint64_t left = my->_data_size - base; left > 0; )
+         {
+            size_t n = size_t( std::min<uint64_t>( left, buf.size() ) );
+            my->_data.read( buf.data(), n );
+            FC_ASSERT( my->_data.good(), "unable to read block" );
+            data_out.write( buf.data(), n );
+            left -= n;
+         }
+         data_out.flush();
+         FC_ASSERT( data_out.good(), "unable to write block" );
+      }
+
+      // without blocks.idx the store opens empty, so a crash between the renames only loses the cache
+      my->close_streams();
+      fc::remove( my->_index_path );
+      fc::rename( tmp_data, my->_data_path );
+      fc::rename( tmp_index, my->_index_path );
+      my->_first      = block_num;
+      my->_size       = keep;
+      my->_data_size -= base;
+      my->open_streams();
+   } FC_RETHROW_EXCEPTIONS( warn, "", ("block_num",block_num) ) }
+
+   std::vector<char> block_store::fetch( uint32_t block_num )
+   { try {
+      FC_ASSERT( contains( block_num ) );
+      auto e = my->read_entry( block_num );
+
+      std::vector<char> packed( e.size );
+      my->_data.clear();
+      my->_data.seekg( e.offset );
+      my->_data.read( packed.data(), packed.size() );
+      FC_ASSERT( my->_data.good(), "unable to read block" );
+      return packed;
+   } FC_RETHROW_EXCEPTIONS( warn, "", ("block_num",block_num) ) }
+
+} } // bts::blockchain
@@ -0,0 +1,177 @@
+#include <bts/blockchain/block_template_builder.hpp>
+#include <bts/config.hpp>
+#include <fc/reflect/variant.hpp>
+#include <fc/log/logger.hpp>
+
+#include <unordered_set>
+
+namespace bts { namespace blockchain {
+
+   namespace detail
+   {
+      class block_template_builder_impl
+      {
+         public:
+            block_template_builder_impl( blockchain_db& db, mempool& pool )
+            :_db(db),_pool(pool),_removal_count(0),_fee_rate(0),_size(0),
+             _valid(false),_header_valid(false),_mroot_valid(false){}
+
+            blockchain_db&                        _db;
+            mempool&                              _pool;
+
+            /** the state the template was built from */
+            block_id_type                         _head_id;
+            uint64_t                              _removal_count;
+            uint64_t                              _fee_rate;
+
+            std::vector<signed_transaction>       _market_trxs;
+            std::vector<pending_transaction>      _selected;
+            std::vector<uint160>                  _trx_ids; ///< market trxs then selected trxs
+            std::unordered_set<output_reference>  _consumed;
+            trx_eval                              _totals;
+            uint64_t                              _size;    ///< size of the selected trxs
+
+            block_header                          _header;
+            uint160                               _mroot;
+            bool                                  _valid;
+            bool                                  _header_valid;
+            bool                                  _mroot_valid;
+
+            bool is_stale()const
+            {
+               return !_valid ||
+                      _head_id != _db.head_block_id() ||
+                      _removal_count != _pool.removal_count();
+            }
+
+            /** @return false if the trx conflicts with the template or does not fit */
+            bool append( const pending_transaction& p )
+            {
+               for( auto in = p.trx.inputs.begin(); in != p.trx.inputs.end(); ++in )
+               {
+                  if( _consumed.find( in->output_ref ) != _consumed.end() )
+                  {
+                     return false;
+                  }
+               }
+               if( _size + p.size > MAX_BLOCK_TRXS_SIZE )
+               {
+                  return false;
+               }
+               for( auto in = p.trx.inputs.begin(); in != p.trx.inputs.end(); ++in )
+               {
+                  _consumed.insert( in->output_ref );
+               }
+               _size   += p.size;
+               _totals += p.eval;
+               _trx_ids.push_back( p.id );
+               _selected.push_back( p );
+
+               _header_valid = false;
+               _mroot_valid  = false;
+               return true;
+            }
+
+            void rebuild()
+            { try {
+               _head_id  = _db.head_block_id();
+               _fee_rate = _db.get_fee_rate().get_rounded_amount();
+
+               _market_trxs = _db.match_orders();
+               _selected.clear();
+               _trx_ids.clear();
+               _consumed.clear();
+               _totals = trx_eval();
+               _size   = 0;
+
+               for( auto trx = _market_trxs.begin(); trx != _market_trxs.end(); ++trx )
+               {
+                  for( auto in = trx->inputs.begin(); in != trx->inputs.end(); ++in )
+                  {
+                     FC_ASSERT( _consumed.insert( in->output_ref ).second,
+                                "output can only be referenced once", ("output_ref",in->output_ref) );
+                  }
+                  _trx_ids.push_back( trx->id() );
+               }
+
+               std::vector<pending_transaction> selected;
+               _pool.select( selected );
+               for( auto itr = selected.begin(); itr != selected.end(); ++itr )
+               {
+                  append( *itr );
+               }
+
+               // select() drops trxs that are no longer valid
+               _removal_count = _pool.removal_count();
+               _header_valid  = false;
+               _mroot_valid   = false;
+               _valid         = true;
+            } FC_RETHROW_EXCEPTIONS( warn, "unable to build block template" ) }
+      };
+
+   } // namespace detail
+
+   block_template_builder::block_template_builder( blockchain_db& db, mempool& pool )
+   :my( new detail::block_template_builder_impl( db, pool ) )
+   {
+   }
+
+   block_template_builder::~block_template_builder(){}
+
+   void block_template_builder::on_new_transaction( const transaction_id_type& trx_id )
+   {
+      if( my->is_stale() )
+      {
+         return; // the next get_template() will select it
+      }
+
+      auto p = my->_pool.get_pending( trx_id );
+      if( !p || p->eval.fees.get_rounded_amount() < my->_fee_rate * p->size )
+      {
+         return;
+      }
+
+      if( !my->append( *p ) )
+      {
+         // it may pay more than something already in the template
+         my->_valid = false;
+      }
+   }
+
+   trx_block block_template_builder::get_template()
+   { try {
+      if( my->is_stale() )
+      {
+         my->rebuild();
+      }
+      if( !my->_header_valid )
+      {
+         my->_header       = my->_db.generate_next_block_header( my->_totals );
+         my->_header_valid = true;
+      }
+      if( !my->_mroot_valid )
+      {
+         full_block ids;
+         ids.trx_ids     = my->_trx_ids;
+         my->_mroot       = ids.calculate_merkle_root();
+         my->_mroot_valid = true;
+      }
+
+      trx_block blk( my->_header );
+      blk.timestamp = fc::time_point::now();
+      blk.trx_mroot = my->_mroot;
+      blk.trxs.reserve( my->_market_trxs.size() + my->_selected.size() );
+      blk.trxs.insert( blk.trxs.end(), my->_market_trxs.begin(), my->_market_trxs.end() );
+      for( auto itr = my->_selected.begin(); itr != my->_selected.end(); ++itr )
+      {
+         blk.trxs.push_back( itr->trx );
+      }
+      return blk;
+   } FC_RETHROW_EXCEPTIONS( warn, "" ) }
+
+   void block_template_builder::invalidate()
+   {
+      my->_valid = false;
+   }
+
+} } // bts::blockchain
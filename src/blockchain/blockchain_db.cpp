@@ -2,26 +2,116 @@
 #include <bts/blockchain/trx_validation_state.hpp>
 #include <bts/blockchain/blockchain_db.hpp>
 #include <bts/blockchain/blockchain_market_db.hpp>
+#include <bts/blockchain/utxo_index.hpp>
+#include <bts/blockchain/signature_recovery.hpp>
+#include <bts/blockchain/block_store.hpp>
+#include <bts/blockchain/address_index.hpp>
+#include <bts/blockchain/address_filter.hpp>
 #include <bts/blockchain/asset.hpp>
 #include <leveldb/db.h>
 #include <bts/db/level_pod_map.hpp>
 #include <bts/db/level_map.hpp>
+#include <bts/db/write_journal.hpp>
 #include <fc/io/enum_type.hpp>
 #include <fc/reflect/variant.hpp>
 #include <fc/io/raw.hpp>
 #include <fc/interprocess/mmap_struct.hpp>
 
 #include <fc/filesystem.hpp>
+#include <fc/thread/mutex.hpp>
+#include <fc/thread/scoped_lock.hpp>
 #include <fc/log/logger.hpp>
 #include <fc/io/json.hpp>
 
 #include <algorithm>
+#include <map>
 #include <sstream>
 
 namespace fc {
   template<> struct get_typename<std::vector<uint160>>    { static const char* name()  { return "std::vector<uint160>";  } };
 } // namespace fc
 
+namespace bts { namespace blockchain { namespace detail {
+
+   struct spent_output
+   {
+      spent_output(){}
+      spent_output( const output_reference& r, const trx_num& s, const trx_output& o )
+      :ref(r),source(s),output(o){}
+
+      output_reference ref;
+      trx_num          source;
+      trx_output       output;
+   };
+
+   /** undo records written before order amounts and candles were kept */
+   struct order_undo0
+   {
+      order_undo0():existed(false){}
+
+      market_order order;
+      bool         existed;
+   };
+
+   struct market_undo0
+   {
+      std::vector<order_undo0>   bids;
+      std::vector<order_undo0>   asks;
+      std::vector<call_undo>     calls;
+      std::vector<depth_undo>    depth;
+      std::vector<history_undo>  history;
+   };
+
+   struct block_undo0
+   {
+      block_id_type              prev_head_id;
+      std::vector<spent_output>  spent_outputs;
+      market_undo0               market;
+   };
+
+   /**
+    *  Everything push_block() changed that can not be recovered from the block
+    *  itself, pop_block() replays it backward.
+    */
+   struct block_undo1
+   {
+      block_undo1(){}
+
+      /** the amounts of the orders are looked up by market_db::undo() */
+      block_undo1( const block_undo0& u )
+      :prev_head_id(u.prev_head_id),spent_outputs(u.spent_outputs)
+      {
+         for( auto itr = u.market.bids.begin(); itr != u.market.bids.end(); ++itr )
+         {
+            market.bids.push_back( order_undo( itr->order, itr->existed, order_undo::unknown_amount ) );
+         }
+         for( auto itr = u.market.asks.begin(); itr != u.market.asks.end(); ++itr )
+         {
+            market.asks.push_back( order_undo( itr->order, itr->existed, order_undo::unknown_amount ) );
+         }
+         market.calls   = u.market.calls;
+         market.depth   = u.market.depth;
+         market.history = u.market.history;
+      }
+
+      block_id_type              prev_head_id;
+      std::vector<spent_output>  spent_outputs; ///< in the order they were spent
+      market_undo                market;
+   };
+   typedef block_undo1 block_undo;
+
+} } } // bts::blockchain::detail
+
+FC_REFLECT( bts::blockchain::detail::spent_output, (ref)(source)(output) )
+FC_REFLECT( bts::blockchain::detail::order_undo0, (order)(existed) )
+FC_REFLECT( bts::blockchain::detail::market_undo0, (bids)(asks)(calls)(depth)(history) )
+FC_REFLECT( bts::blockchain::detail::block_undo0, (prev_head_id)(spent_outputs)(market) )
+FC_REFLECT( bts::blockchain::detail::block_undo1, (prev_head_id)(spent_outputs)(market) )
+
+namespace bts { namespace blockchain { namespace detail {
+REGISTER_DB_OBJECT(block_undo,0)
+} } }
+
 struct trx_stat
 {
    uint16_t trx_idx;
@@ -43,7 +133,7 @@ namespace bts { namespace blockchain {
       class blockchain_db_impl
       {
          public:
-            blockchain_db_impl(){}
+            blockchain_db_impl():_prune_depth(0),_first_full_block(0){}
 
             //std::unique_ptr<ldb::DB> blk_id2num;  // maps blocks to unique IDs
             bts::db::level_map<block_id_type,uint32_t>          blk_id2num;
@@ -51,33 +141,75 @@ namespace bts { namespace blockchain {
             bts::db::level_map<trx_num,meta_trx>                meta_trxs;
             bts::db::level_map<uint32_t,block_header>           blocks;
             bts::db::level_map<uint32_t,std::vector<uint160> >  block_trxs; 
+            bts::db::level_map<uint32_t,block_undo>             block_undos;
+            bts::db::level_map<uint32_t,address_filter>         block_filters;
+            /** utxo_index::commitment() after each block was applied */
+            bts::db::level_map<uint32_t,fc::sha256>             utxo_commitments;
+            /** number of transactions discarded from every block that has been pruned */
+            bts::db::level_map<uint32_t,uint32_t>               pruned_blocks;
 
             market_db                                           _market_db;
+            utxo_index                                          _utxos;
+            /** every block packed contiguously, indexed by block number */
+            block_store                                         _block_store;
+            /** only open if the address index was requested */
+            address_index                                       _addresses;
+            /** holds the writes of a block until every database has committed them */
+            bts::db::write_journal                              _journal;
+            /** see blockchain_db::block_mutex() */
+            fc::mutex                                           _block_mutex;
+
+            /** image of _utxos taken every SNAPSHOT_INTERVAL blocks and on close */
+            fc::path                                            _utxo_snapshot;
+
+            /** 0 for an archive, see blockchain_db::open() */
+            uint32_t                                            _prune_depth;
+            /** one past the last key of pruned_blocks */
+            uint32_t                                            _first_full_block;
 
             /** cache this information because it is required in many calculations  */
             trx_block                                           head_block;
             block_id_type                                       head_block_id;
 
-            void mark_spent( const output_reference& o, const trx_num& intrx, uint16_t in )
+            /** undo record of the block being pushed */
+            block_undo                                          _block_undo;
+
+            /** 
+             *  A pair whose last match produced no transaction, and its stats, will not
+             *  produce one until its order book changes.  Keyed by (quote, base).
+             */
+            struct idle_market
             {
-               auto tid    = trx_id2num.fetch( o.trx_hash );
-               meta_trx   mtrx   = meta_trxs.fetch( tid );
-               FC_ASSERT( mtrx.meta_outputs.size() > o.output_idx );
+               idle_market():revision(0){}
 
-               mtrx.meta_outputs[o.output_idx].trx_id    = intrx;
-               mtrx.meta_outputs[o.output_idx].input_num = in;
+               uint64_t     revision; ///< market_db::get_revision() when it was matched
+               price_point  stats;
+            };
+            std::map<std::pair<asset::type,asset::type>,idle_market> _idle_markets;
 
-               meta_trxs.store( tid, mtrx );
-               remove_market_orders( o );
+            /** reset for every transaction evaluated so that its buffers are reused */
+            trx_validation_state                                _validation_state;
+
+            void mark_spent( const output_reference& o, const trx_num& intrx, uint16_t in )
+            {
+               auto trx_out = get_output( o );
+               remove_market_orders( o, trx_out );
+
+               meta_trx_output spent_by;
+               spent_by.trx_id    = intrx;
+               spent_by.input_num = in;
+               utxo_entry spent = _utxos.spend( o, spent_by );
+               _block_undo.spent_outputs.push_back( spent_output( o, spent.source, trx_out ) );
             }
 
 
-            void remove_market_orders( const output_reference& o )
+            /** @pre o is unspent, its claim is read from the utxo claim pools */
+            void remove_market_orders( const output_reference& o, const trx_output& trx_out )
             {
-               auto trx_out = get_output( o );
                if( trx_out.claim_func == claim_by_bid )
                {
-                  auto cbb = trx_out.as<claim_by_bid_output>();
+                  claim_by_bid_output cbb;
+                  FC_ASSERT( _utxos.fetch_claim( o, cbb ) );
                   market_order order( cbb.ask_price, o );
                   _market_db.remove_bid( order, 0 );
                   if( trx_out.amount.unit == asset::bts )
@@ -88,13 +220,15 @@ namespace bts { namespace blockchain {
 
                if( trx_out.claim_func == claim_by_long )
                {
-                  auto cbl = trx_out.as<claim_by_long_output>();
+                  claim_by_long_output cbl;
+                  FC_ASSERT( _utxos.fetch_claim( o, cbl ) );
                   market_order order( cbl.ask_price, o );
                   _market_db.remove_bid( order, trx_out.amount.get_rounded_amount() );
                }
                if( trx_out.claim_func == claim_by_cover )
                {
-                  auto cbc = trx_out.as<claim_by_cover_output>();
+                  claim_by_cover_output cbc;
+                  FC_ASSERT( _utxos.fetch_claim( o, cbc ) );
                   margin_call order( cbc.get_call_price( trx_out.amount ), o );
                   _market_db.remove_call( order, trx_out.amount.get_rounded_amount() );
                }
@@ -103,11 +237,42 @@ namespace bts { namespace blockchain {
 
             trx_output get_output( const output_reference& ref )
             { try {
+               if( _utxos.is_unspent( ref ) )
+               {
+                  return _utxos.fetch_output( ref );
+               }
                auto tid    = trx_id2num.fetch( ref.trx_hash );
                meta_trx   mtrx   = meta_trxs.fetch( tid );
                FC_ASSERT( mtrx.outputs.size() > ref.output_idx );
                return mtrx.outputs[ref.output_idx];
             } FC_RETHROW_EXCEPTIONS( warn, "", ("ref",ref) ) }
+
+            /** sets claim if out is claimed by ClaimType, copying it from the utxo claim pool when ref is unspent */
+            template<typename ClaimType>
+            void fetch_order_claim( const output_reference& ref, const trx_output& out, ClaimType& claim )
+            {
+               if( out.claim_func == ClaimType::type && !_utxos.fetch_claim( ref, claim ) )
+               {
+                  claim = out.as<ClaimType>();
+               }
+            }
+
+            /**
+             *  The amount store() passes to market_db for order m, read from its transaction
+             *  because the utxo index may not be loaded yet.  Only needed for books and undo
+             *  records written before market_db kept order amounts.
+             */
+            uint64_t fetch_order_amount( const market_order& m )
+            { try {
+               meta_trx mtrx = meta_trxs.fetch( trx_id2num.fetch( m.location.trx_hash ) );
+               FC_ASSERT( mtrx.outputs.size() > m.location.output_idx );
+               const trx_output& out = mtrx.outputs[m.location.output_idx];
+               if( out.claim_func == claim_by_long )
+               {
+                  return (out.amount * out.as<claim_by_long_output>().ask_price).get_rounded_amount();
+               }
+               return out.amount.get_rounded_amount();
+            } FC_RETHROW_EXCEPTIONS( warn, "", ("order",m) ) }
             
             /**
              *   Stores a transaction and updates the spent status of all 
@@ -124,38 +289,56 @@ namespace bts { namespace blockchain {
                {
                   mark_spent( t.inputs[i].output_ref, tn, i ); 
                }
+
+               auto trx_id = t.id();
+               for( uint16_t i = 0; i < t.outputs.size(); ++i )
+               {
+                  _utxos.add( output_reference( trx_id, i ), tn, t.outputs[i] );
+               }
+               if( _addresses.is_open() )
+               {
+                  _addresses.add( tn, t );
+               }
                
+               // the claims were decoded into the utxo claim pools by _utxos.add()
                for( uint16_t i = 0; i < t.outputs.size(); ++i )
                {
+                  output_reference ref( trx_id, i );
                   if( t.outputs[i].claim_func == claim_by_bid )
                   {
-                     claim_by_bid_output cbb = t.outputs[i].as<claim_by_bid_output>();
+                     claim_by_bid_output cbb;
+                     FC_ASSERT( _utxos.fetch_claim( ref, cbb ) );
                      if( cbb.is_bid(t.outputs[i].amount.unit) )
                      {
-                        elog( "Insert Bid: ${bid}", ("bid",market_order(cbb.ask_price, output_reference( t.id(), i )) ) );
-                        _market_db.insert_bid( market_order(cbb.ask_price, output_reference( t.id(), i )), 0 );
+                        elog( "Insert Bid: ${bid}", ("bid",market_order(cbb.ask_price, ref) ) );
+                        _market_db.insert_bid( market_order(cbb.ask_price, ref), 
+                                               t.outputs[i].amount.get_rounded_amount(), 0 );
                      }
                      else
                      {
-                        elog( "Insert Ask: ${bid}", ("bid",market_order(cbb.ask_price, output_reference( t.id(), i )) ) );
-                        _market_db.insert_ask( market_order(cbb.ask_price, output_reference( t.id(), i )), 
+                        elog( "Insert Ask: ${bid}", ("bid",market_order(cbb.ask_price, ref) ) );
+                        _market_db.insert_ask( market_order(cbb.ask_price, ref), 
+                                               t.outputs[i].amount.get_rounded_amount(),
                                                t.outputs[i].amount.get_rounded_amount() );
                      }
                   }
                   else if( t.outputs[i].claim_func == claim_by_long )
                   {
-                    auto cbl = t.outputs[i].as<claim_by_long_output>();
-                    elog( "Insert Short Ask: ${bid}", ("bid",market_order(cbl.ask_price, output_reference( t.id(), i )) ) );
+                    claim_by_long_output cbl;
+                    FC_ASSERT( _utxos.fetch_claim( ref, cbl ) );
+                    elog( "Insert Short Ask: ${bid}", ("bid",market_order(cbl.ask_price, ref) ) );
 
                     /// TODO: should I divide the depth amount by the margin ratio to keep things weighted fairly?
-                    _market_db.insert_bid( market_order(cbl.ask_price, output_reference( t.id(), i )), 
+                    _market_db.insert_bid( market_order(cbl.ask_price, ref), 
+                                           (t.outputs[i].amount * cbl.ask_price).get_rounded_amount(),
                                            t.outputs[i].amount.get_rounded_amount() );
                   }
                   else if( t.outputs[i].claim_func == claim_by_cover )
                   {
                     /// TODO: should I divide the depth amount by the margin ratio to keep things weighted fairly?
-                     auto cbc = t.outputs[i].as<claim_by_cover_output>();
-                     _market_db.insert_call( margin_call( cbc.get_call_price(t.outputs[i].amount), output_reference( t.id(), i ) ),
+                     claim_by_cover_output cbc;
+                     FC_ASSERT( _utxos.fetch_claim( ref, cbc ) );
+                     _market_db.insert_call( margin_call( cbc.get_call_price(t.outputs[i].amount), ref ),
                                              t.outputs[i].amount.get_rounded_amount() );
                   }
                }
@@ -169,17 +352,375 @@ namespace bts { namespace blockchain {
                    store( b.trxs[t], trx_num( b.block_num, t) );
                    trxs_ids.push_back( b.trxs[t].id() );
                 }
-                head_block    = b;
-                head_block_id = b.id();
 
                 blocks.store( b.block_num, b );
                 block_trxs.store( b.block_num, trxs_ids );
+                block_filters.store( b.block_num, build_address_filter( b ) );
+                utxo_commitments.store( b.block_num, _utxos.commitment() );
+            }
+
+            /** every owner of an output b created or spent, spends are taken from the undo record */
+            address_filter build_address_filter( const trx_block& b )
+            {
+                std::vector<output_owner> owners;
+                output_owner owner;
+                for( auto trx = b.trxs.begin(); trx != b.trxs.end(); ++trx )
+                {
+                   for( auto out = trx->outputs.begin(); out != trx->outputs.end(); ++out )
+                   {
+                      if( get_output_owner( *out, owner ) )
+                      {
+                         owners.push_back( owner );
+                      }
+                   }
+                }
+                for( auto s = _block_undo.spent_outputs.begin(); s != _block_undo.spent_outputs.end(); ++s )
+                {
+                   if( get_output_owner( s->output, owner ) )
+                   {
+                      owners.push_back( owner );
+                   }
+                }
+
+                address_filter filter( owners.size() );
+                for( auto itr = owners.begin(); itr != owners.end(); ++itr )
+                {
+                   filter.insert( *itr );
+                }
+                return filter;
+            }
+
+            /**
+             *  Reverts store( trx_block ) using the undo record written with it, 
+             *  transactions are reverted last to first so that outputs created 
+             *  and spent within the block are restored in the right order.
+             */
+            void undo( const full_block& b, const std::vector<signed_transaction>& trxs, const block_undo& u )
+            {
+               FC_ASSERT( trxs.size() == b.trx_ids.size() );
+               _market_db.undo( u.market );
+
+               size_t spent = u.spent_outputs.size();
+               for( uint32_t t = trxs.size(); t > 0; --t )
+               {
+                  const signed_transaction& trx = trxs[t-1];
+                  for( uint16_t i = 0; i < trx.outputs.size(); ++i )
+                  {
+                     _utxos.remove( output_reference( b.trx_ids[t-1], i ) );
+                  }
+
+                  FC_ASSERT( spent >= trx.inputs.size(), "undo record does not match block ${n}", ("n",b.block_num) );
+                  for( uint32_t i = trx.inputs.size(); i > 0; --i )
+                  {
+                     const spent_output& s = u.spent_outputs[--spent];
+                     FC_ASSERT( s.ref == trx.inputs[i-1].output_ref, "undo record does not match block ${n}", ("n",b.block_num) );
+                     _utxos.unspend( s.ref, s.source, s.output );
+                  }
+
+                  trx_id2num.remove( b.trx_ids[t-1] );
+                  meta_trxs.remove( trx_num( b.block_num, t-1 ) );
+                  if( _addresses.is_open() )
+                  {
+                     _addresses.remove( trx_num( b.block_num, t-1 ), trx );
+                  }
+               }
+               FC_ASSERT( spent == 0, "undo record does not match block ${n}", ("n",b.block_num) );
+
+               blk_id2num.remove( b.id() );
+               block_trxs.remove( b.block_num );
+               block_filters.remove( b.block_num );
+               utxo_commitments.remove( b.block_num );
+               block_undos.remove( b.block_num );
+               blocks.remove( b.block_num );
+            }
+
+            /**
+             *  Stages all writes to the chain and market databases so that a block
+             *  is applied with one WriteBatch per database.
+             */
+            void begin_batch()
+            {
+               blk_id2num.begin_batch();
+               trx_id2num.begin_batch();
+               meta_trxs.begin_batch();
+               blocks.begin_batch();
+               block_trxs.begin_batch();
+               block_filters.begin_batch();
+               utxo_commitments.begin_batch();
+               pruned_blocks.begin_batch();
+               block_undos.begin_batch();
+               _market_db.begin_batch();
+               _utxos.begin_batch();
+               if( _addresses.is_open() )
+               {
+                  _addresses.begin_batch();
+               }
+            }
+
+            /**
+             *  Every batch is appended to the journal, which is synced, before the first one
+             *  is committed and the databases are committed without a sync.  The journal keeps
+             *  each block until a checkpoint commits every database with a sync, so after a
+             *  crash or a power loss open() writes those blocks again and every database ends
+             *  at the same block.  That is one fsync per block, plus a sync of the directory
+             *  on the first block after a checkpoint.  Every JOURNAL_CHECKPOINT_INTERVAL blocks
+             *  the checkpoint adds one fsync per database and one of the directory.
+             */
+            void commit_batch()
+            {
+               _journal.write();
+               bool sync = _journal.size() >= JOURNAL_CHECKPOINT_INTERVAL;
+               _market_db.commit_batch( sync );
+               _utxos.commit_batch( sync );
+               if( _addresses.is_open() )
+               {
+                  _addresses.commit_batch( sync );
+               }
+               trx_id2num.commit_batch( sync );
+               meta_trxs.commit_batch( sync );
+               block_trxs.commit_batch( sync );
+               block_filters.commit_batch( sync );
+               utxo_commitments.commit_batch( sync );
+               pruned_blocks.commit_batch( sync );
+               block_undos.commit_batch( sync );
+               blk_id2num.commit_batch( sync );
+               blocks.commit_batch( sync );
+               _journal.committed();
+               if( sync )
+               {
+                  _journal.clear();
+               }
+            }
+
+            void abort_batch()
+            {
+               blk_id2num.abort_batch();
+               trx_id2num.abort_batch();
+               meta_trxs.abort_batch();
+               blocks.abort_batch();
+               block_trxs.abort_batch();
+               block_filters.abort_batch();
+               utxo_commitments.abort_batch();
+               pruned_blocks.abort_batch();
+               block_undos.abort_batch();
+               _market_db.abort_batch();
+               _utxos.abort_batch();
+               if( _addresses.is_open() )
+               {
+                  _addresses.abort_batch();
+               }
+            }
+
+            /**
+             *  Databases created before the utxo index existed only track spent outputs
+             *  in meta_trx::meta_outputs, populate the index from them.
+             */
+            void rebuild_utxos()
+            {
+               ilog( "building unspent output index" );
+               _utxos.begin_batch();
+               for( auto itr = meta_trxs.begin(); itr.valid(); ++itr )
+               {
+                  trx_num  tn   = itr.key();
+                  meta_trx mtrx = itr.value();
+                  auto trx_id   = mtrx.id();
+                  for( uint16_t i = 0; i < mtrx.outputs.size(); ++i )
+                  {
+                     if( i >= mtrx.meta_outputs.size() || !mtrx.meta_outputs[i].is_spent() )
+                     {
+                        _utxos.add( output_reference( trx_id, i ), tn, mtrx.outputs[i] );
+                     }
+                  }
+               }
+               _utxos.commit_batch( true );
+            }
+
+            /**
+             *  Loads the unspent outputs from the last snapshot if it was taken on this chain
+             *  and brings it up to the head by syncing every output touched by later blocks,
+             *  otherwise they are loaded from the database.  A replayed snapshot whose
+             *  commitment differs from the one recorded for the head is discarded.
+             */
+            void load_utxos()
+            {
+               uint32_t      height = 0;
+               block_id_type snapshot_id;
+               if( _utxos.load_snapshot( _utxo_snapshot, height, snapshot_id ) )
+               {
+                  if( height + 1 < _first_full_block )
+                  {
+                     wlog( "blocks after the utxo snapshot at block ${h} have been pruned", ("h",height) );
+                  }
+                  else if( height <= head_block.block_num && blocks.fetch( height ).id() == snapshot_id )
+                  {
+                     for( uint32_t n = height + 1; n <= head_block.block_num; ++n )
+                     {
+                        // the entry remembers its hash, so spent outputs need not be read back
+                        auto trx_ids = block_trxs.fetch( n );
+                        for( uint16_t t = 0; t < trx_ids.size(); ++t )
+                        {
+                           meta_trx mtrx = meta_trxs.fetch( trx_num( n, t ) );
+                           for( auto in = mtrx.inputs.begin(); in != mtrx.inputs.end(); ++in )
+                           {
+                              _utxos.sync( in->output_ref );
+                           }
+                           for( uint16_t i = 0; i < mtrx.outputs.size(); ++i )
+                           {
+                              _utxos.sync( output_reference( trx_ids[t], i ) );
+                           }
+                        }
+                     }
+                     ilog( "replayed blocks ${from} to ${to} onto the utxo snapshot", ("from",height+1)("to",head_block.block_num) );
+
+                     auto expected = utxo_commitments.fetch_optional( head_block.block_num );
+                     if( !expected || *expected == _utxos.commitment() )
+                     {
+                        return;
+                     }
+                     wlog( "the utxo snapshot replayed to block ${h} does not match its commitment",
+                           ("h",head_block.block_num) );
+                  }
+                  else
+                  {
+                     wlog( "utxo snapshot at block ${h} is not on this chain", ("h",height) );
+                  }
+               }
+               _utxos.load();
+
+               auto expected = utxo_commitments.fetch_optional( head_block.block_num );
+               if( expected && *expected != _utxos.commitment() )
+               {
+                  elog( "the unspent outputs do not match the commitment recorded for block ${h}",
+                        ("h",head_block.block_num) );
+               }
+            }
+
+            void save_utxo_snapshot()
+            {
+               try 
+               {
+                  _utxos.save_snapshot( _utxo_snapshot, head_block.block_num, head_block_id );
+               }
+               catch ( const fc::exception& e )
+               {
+                  wlog( "unable to save utxo snapshot\n${e}", ("e",e.to_detail_string()) );
+               }
+            }
+
+            /**
+             *  Discards the transactions of block_num whose outputs were all spent by block_num,
+             *  and the transactions of earlier blocks whose last output was spent in block_num
+             *  which are found through its undo record.  Nothing that was spent above block_num
+             *  is discarded, so popping any block above it never needs a pruned transaction.
+             *
+             *  @return false if block_num has no undo record, it was pruned already or was
+             *          stored before undo records were kept and is left as it is
+             */
+            bool prune_block( uint32_t block_num )
+            {
+               auto undo = block_undos.fetch_optional( block_num );
+               if( !undo )
+               {
+                  return false;
+               }
+
+               auto trx_ids = block_trxs.fetch( block_num );
+               uint32_t discarded = 0;
+               for( uint16_t t = 0; t < trx_ids.size(); ++t )
+               {
+                  if( prune_trx( trx_num( block_num, t ), trx_ids[t], block_num ) )
+                  {
+                     ++discarded;
+                  }
+               }
+               pruned_blocks.store( block_num, discarded );
+
+               for( auto s = undo->spent_outputs.begin(); s != undo->spent_outputs.end(); ++s )
+               {
+                  if( s->source.block_num < block_num && prune_trx( s->source, s->ref.trx_hash, block_num ) )
+                  {
+                     auto count = pruned_blocks.fetch_optional( s->source.block_num );
+                     pruned_blocks.store( s->source.block_num, (count ? *count : 0) + 1 );
+                  }
+               }
+
+               block_undos.remove( block_num );
+               block_filters.remove( block_num );
+               return true;
+            }
+
+            /** @return true if the trx at tn had every output spent by block_num and was discarded */
+            bool prune_trx( const trx_num& tn, const uint160& trx_id, uint32_t block_num )
+            {
+               auto mtrx = meta_trxs.fetch_optional( tn );
+               if( !mtrx )
+               {
+                  return false; // already pruned
+               }
+               mtrx->meta_outputs.resize( mtrx->outputs.size() );
+               _utxos.fetch_spends( tn, mtrx->meta_outputs );
+               for( auto out = mtrx->meta_outputs.begin(); out != mtrx->meta_outputs.end(); ++out )
+               {
+                  if( !out->is_spent() || out->trx_id.block_num > block_num )
+                  {
+                     return false;
+                  }
+               }
+
+               meta_trxs.remove( tn );
+               trx_id2num.remove( trx_id );
+               _utxos.remove_spends( tn, mtrx->outputs.size() );
+               return true;
+            }
+
+            /** prunes every block up to last that has not been pruned yet, one batch per block */
+            void prune_to( uint32_t last )
+            {
+               std::vector<uint32_t> unpruned;
+               for( auto itr = block_undos.begin(); itr.valid() && itr.key() <= last; ++itr )
+               {
+                  unpruned.push_back( itr.key() );
+               }
+               if( unpruned.size() )
+               {
+                  ilog( "pruning ${n} blocks up to block ${last}", ("n",unpruned.size())("last",last) );
+               }
+               for( auto n = unpruned.begin(); n != unpruned.end(); ++n )
+               {
+                  begin_batch();
+                  try 
+                  {
+                     prune_block( *n );
+                     commit_batch();
+                  }
+                  catch ( ... )
+                  {
+                     abort_batch();
+                     throw;
+                  }
+                  _first_full_block = *n + 1;
+               }
+            }
+
+            /** indexes the outputs of every transaction stored before the address index was created */
+            void rebuild_addresses()
+            {
+               ilog( "building address index" );
+               _addresses.begin_batch();
+               for( auto itr = meta_trxs.begin(); itr.valid(); ++itr )
+               {
+                  _addresses.add( itr.key(), itr.value() );
+               }
+               _addresses.commit_batch( true );
             }
 
             /**
              *  Pushes a new transaction into matched that pairs all bids/asks for a single quote/base pair
+             *
+             *  @return false if the market was too shallow to match, the result then depends
+             *          upon the total supply as well as the order book
              */
-            void match_orders( std::vector<signed_transaction>& matched,  asset::type quote, asset::type base, price_point& stats )
+            bool match_orders( std::vector<signed_transaction>& matched,  asset::type quote, asset::type base, price_point& stats )
             { try {
                ilog( "match orders.." );
                uint64_t initial_depth = 0;
@@ -190,7 +731,7 @@ namespace bts { namespace blockchain {
                   {
                      wlog( "initial depth of ${initial_depth} is less than 1% of supply ${supply}",
                             ("initial_depth",initial_depth)("supply", head_block.total_shares) );
-                     return;
+                     return false;
                   }
                }
                /** track how much of the order book has been consumed and stop if consumed depth 
@@ -242,6 +783,22 @@ namespace bts { namespace blockchain {
                trx_output working_ask;
                trx_output working_bid;
 
+               // the claims of the working orders, read once each time a new order is loaded
+               claim_by_bid_output  ask_claim;
+               claim_by_bid_output  bid_claim;
+               claim_by_long_output long_claim;
+               auto load_ask = [&]()
+               {
+                  working_ask = get_output( ask_itr->location );
+                  fetch_order_claim( ask_itr->location, working_ask, ask_claim );
+               };
+               auto load_bid = [&]()
+               {
+                  working_bid = get_output( bid_itr->location );
+                  fetch_order_claim( bid_itr->location, working_bid, bid_claim );
+                  fetch_order_claim( bid_itr->location, working_bid, long_claim );
+               };
+
                stats.from_block   = head_block.block_num;
                stats.to_block     = stats.from_block + 1;
                stats.from_time    = head_block.timestamp;
@@ -251,16 +808,16 @@ namespace bts { namespace blockchain {
 
                if( ask_itr != asks.end() )
                {
-                    working_ask   = get_output( ask_itr->location );
+                    load_ask();
                     if( working_ask.claim_func == claim_by_bid )
-                       stats.low_ask = working_ask.as<claim_by_bid_output>().ask_price;
+                       stats.low_ask = ask_claim.ask_price;
                }
                if( bid_itr != bids.rend() )
                {
-                   working_bid = get_output( bid_itr->location );
+                   load_bid();
 
                    if( working_ask.claim_func == claim_by_bid )
-                      stats.high_bid = working_ask.as<claim_by_bid_output>().ask_price;
+                      stats.high_bid = ask_claim.ask_price;
                    else if( working_ask.claim_func == claim_by_long )
                       stats.high_bid = working_ask.as<claim_by_long_output>().ask_price;
                }
@@ -284,7 +841,7 @@ namespace bts { namespace blockchain {
                   else             {  working_bid = get_output( bid_itr->location );  }
                   */
 
-                  claim_by_bid_output ask_claim = working_ask.as<claim_by_bid_output>();
+                  FC_ASSERT( working_ask.claim_func == claim_by_bid, "", ("ask", working_ask) );
 
                   wlog( "working bid: ${b}", ("b", working_bid ) );
                   wlog( "working ask: ${a}", ("a", working_ask ) );
@@ -293,7 +850,6 @@ namespace bts { namespace blockchain {
 
                   if( working_bid.claim_func == claim_by_long )
                   {
-                     auto long_claim = working_bid.as<claim_by_long_output>();
                      if( long_claim.ask_price < ask_claim.ask_price )
                      {
                         ilog( "\n\n  BID ${BID}  >>>>   ASK ${ASK}\n\n", ("BID",long_claim.ask_price)("ASK",ask_claim.ask_price) );
@@ -342,7 +898,7 @@ namespace bts { namespace blockchain {
                             market_trx.outputs.push_back( trx_output( claim_by_signature_output( ask_claim.pay_address ), pay_asker) );
                          pay_asker = asset(ULLCONST(0),pay_asker.unit);
                          ++ask_itr;
-                         if( ask_itr != asks.end() )  working_ask = get_output( ask_itr->location );
+                         if( ask_itr != asks.end() )  load_ask();
                      }
                      else // we have filled the bid (short sell) 
                      {
@@ -367,7 +923,7 @@ namespace bts { namespace blockchain {
                          loan_amount       = asset(ULLCONST(0),loan_amount.unit);
                          collateral_amount = asset();
                          ++bid_itr;
-                         if( bid_itr != bids.rend() ) working_bid = get_output( bid_itr->location );
+                         if( bid_itr != bids.rend() ) load_bid();
 
                          if( working_ask.amount.get_rounded_amount() == 0 )
                          {
@@ -379,13 +935,12 @@ namespace bts { namespace blockchain {
                             }
                             pay_asker = asset(ULLCONST(0),pay_asker.unit);
                             ++ask_itr;
-                            if( ask_itr != asks.end() )  working_ask = get_output( ask_itr->location );
+                            if( ask_itr != asks.end() )  load_ask();
                          }
                      }
                   }
                   else if( working_bid.claim_func == claim_by_bid )
                   {
-                     claim_by_bid_output bid_claim = working_bid.as<claim_by_bid_output>();
                      if( bid_claim.ask_price  < ask_claim.ask_price )
                      {
                         break; // exit the while loop, no more trades can occur
@@ -429,7 +984,7 @@ namespace bts { namespace blockchain {
                         }
                         pay_asker = asset(ULLCONST(0),pay_asker.unit);
                         ++ask_itr;
-                        if( ask_itr != asks.end() )  working_ask = get_output( ask_itr->location );
+                        if( ask_itr != asks.end() )  load_ask();
                      }
                      else // then we have filled the bid or we have filled BOTH
                      {
@@ -459,7 +1014,7 @@ namespace bts { namespace blockchain {
                         pay_bidder = asset(ULLCONST(0),pay_bidder.unit);
 
                         ++bid_itr;
-                        if( bid_itr != bids.rend() ) working_bid = get_output( bid_itr->location );
+                        if( bid_itr != bids.rend() ) load_bid();
 
                         if( working_ask.amount.get_rounded_amount() == 0 )
                         {
@@ -469,7 +1024,7 @@ namespace bts { namespace blockchain {
                               market_trx.outputs.push_back( trx_output( claim_by_signature_output( ask_claim.pay_address ), pay_asker) );
                            pay_asker = asset(ULLCONST(0),pay_asker.unit);
                            ++ask_itr;
-                           if( ask_itr != asks.end() )  working_ask = get_output( ask_itr->location );
+                           if( ask_itr != asks.end() )  load_ask();
                         }
                      }
                   }
@@ -482,16 +1037,16 @@ namespace bts { namespace blockchain {
 
                if( ask_itr != asks.end() )
                {
-                    working_ask   = get_output( ask_itr->location );
+                    load_ask();
                     if( working_ask.claim_func == claim_by_bid )
-                       stats.high_ask = working_ask.as<claim_by_bid_output>().ask_price;
+                       stats.high_ask = ask_claim.ask_price;
                }
                if( bid_itr != bids.rend() )
                {
-                   working_bid = get_output( bid_itr->location );
+                   load_bid();
 
                    if( working_ask.claim_func == claim_by_bid )
-                      stats.low_bid = working_ask.as<claim_by_bid_output>().ask_price;
+                      stats.low_bid = ask_claim.ask_price;
                    else if( working_ask.claim_func == claim_by_long )
                       stats.low_bid = working_ask.as<claim_by_long_output>().ask_price;
                }
@@ -517,22 +1072,26 @@ namespace bts { namespace blockchain {
                   ilog( "." );
                   price call_price;
                   if( working_bid.claim_func == claim_by_long )
-                     call_price = working_bid.as<claim_by_long_output>().ask_price;
+                     call_price = long_claim.ask_price;
                   else
-                     call_price = working_bid.as<claim_by_bid_output>().ask_price;
+                     call_price = bid_claim.ask_price;
                   
                   // all of these margin positions must accept the highest bid
                   auto margin_positions = _market_db.get_calls( call_price );
-                  ilog( "\n\nMARGIN POSITIONS:\n${p}\n\n", ("p", margin_positions ) );
+                  ilog( "${n} margin positions triggered at ${p}", ("n", margin_positions.size())("p",call_price) );
 
                   trx_output            working_call;
                   claim_by_cover_output cover_claim;
 
                   auto call_itr = margin_positions.begin();
-                  if( call_itr != margin_positions.end() )
+                  auto load_call = [&]()
                   {
                      working_call = get_output( call_itr->location );
-                     cover_claim  = working_call.as<claim_by_cover_output>();
+                     fetch_order_claim( call_itr->location, working_call, cover_claim );
+                  };
+                  if( call_itr != margin_positions.end() )
+                  {
+                     load_call();
                   }
 
                   while(  call_itr != margin_positions.end() && 
@@ -540,7 +1099,6 @@ namespace bts { namespace blockchain {
                   {
                       if( working_bid.claim_func == claim_by_long )
                       {
-                         auto long_claim = working_bid.as<claim_by_long_output>();
                          call_price         = long_claim.ask_price;
                          bid_payout_address = long_claim.pay_address;
 
@@ -564,7 +1122,7 @@ namespace bts { namespace blockchain {
 
                             // goto next bid
                             ++bid_itr;
-                            if( bid_itr != bids.rend() ) working_bid = get_output( bid_itr->location );
+                            if( bid_itr != bids.rend() ) load_bid();
                          }
                          else if( payoff < bid_usd )
                          { 
@@ -586,8 +1144,7 @@ namespace bts { namespace blockchain {
                             ++call_itr;
                             if( call_itr != margin_positions.end() )
                             {
-                               working_call = get_output( call_itr->location );
-                               cover_claim  = working_call.as<claim_by_cover_output>();
+                               load_call();
                             }
                          }
                          else // payoff == bidusd 
@@ -612,19 +1169,17 @@ namespace bts { namespace blockchain {
                             market_trx.inputs.push_back( bid_itr->location );
 
                             ++bid_itr;
-                            if( bid_itr != bids.rend() ) working_bid = get_output( bid_itr->location );
+                            if( bid_itr != bids.rend() ) load_bid();
 
                             ++call_itr;
                             if( call_itr != margin_positions.end() )
                             {
-                               working_call = get_output( call_itr->location );
-                               cover_claim  = working_call.as<claim_by_cover_output>();
+                               load_call();
                             }
                          }
                       }
                       else // claim by bid
                       {
-                         auto bid_claim     = working_bid.as<claim_by_bid_output>();
                          call_price         = bid_claim.ask_price;
                          bid_payout_address = bid_claim.pay_address;
 
@@ -644,7 +1199,7 @@ namespace bts { namespace blockchain {
 
                             // goto next bid
                             ++bid_itr;
-                            if( bid_itr != bids.rend() ) working_bid = get_output( bid_itr->location );
+                            if( bid_itr != bids.rend() ) load_bid();
                             pay_bidder = asset( 0.0, quote );
                          }
                          else if( payoff < bid_usd )
@@ -663,8 +1218,7 @@ namespace bts { namespace blockchain {
                             ++call_itr;
                             if( call_itr != margin_positions.end() )
                             {
-                               working_call = get_output( call_itr->location );
-                               cover_claim  = working_call.as<claim_by_cover_output>();
+                               load_call();
                             }
                          }
                          else // payoff == bid_usd
@@ -689,14 +1243,13 @@ namespace bts { namespace blockchain {
                             market_trx.inputs.push_back( bid_itr->location );
 
                             ++bid_itr;
-                            if( bid_itr != bids.rend() ) working_bid = get_output( bid_itr->location );
+                            if( bid_itr != bids.rend() ) load_bid();
                             pay_bidder = asset( 0.0, quote );
 
                             ++call_itr;
                             if( call_itr != margin_positions.end() )
                             {
-                               working_call = get_output( call_itr->location );
-                               cover_claim  = working_call.as<claim_by_cover_output>();
+                               load_call();
                             }
                          }
                       }
@@ -754,6 +1307,7 @@ namespace bts { namespace blockchain {
                    matched.push_back(market_trx);
                }
                //ilog( "done match orders.." );
+               return true;
             } FC_RETHROW_EXCEPTIONS( warn, "", ("quote",quote)("base",base) ) }
       };
     }
@@ -767,9 +1321,11 @@ namespace bts { namespace blockchain {
      {
      }
 
-     void blockchain_db::open( const fc::path& dir, bool create )
+     void blockchain_db::open( const fc::path& dir, bool create, bool index_addresses, uint32_t prune_depth )
      {
        try {
+         FC_ASSERT( prune_depth == 0 || prune_depth >= MIN_PRUNE_DEPTH, "prune depth must be at least ${min} blocks",
+                    ("min",MIN_PRUNE_DEPTH) );
          if( !fc::exists( dir ) )
          {
               if( !create )
@@ -779,12 +1335,49 @@ namespace bts { namespace blockchain {
               }
               fc::create_directories( dir );
          }
+         // writes left by a commit that was interrupted are applied as each database is added
+         my->_journal.open( dir / "journal" );
          my->blk_id2num.open( dir / "blk_id2num", create );
          my->trx_id2num.open( dir / "trx_id2num", create );
          my->meta_trxs.open(  dir / "meta_trxs",  create );
          my->blocks.open(     dir / "blocks",     create );
          my->block_trxs.open( dir / "block_trxs", create );
-         my->_market_db.open( dir / "market" );
+         my->block_undos.open( dir / "block_undos", create );
+         my->block_filters.open( dir / "block_filters", create );
+         my->utxo_commitments.open( dir / "utxo_commitments", create );
+         my->pruned_blocks.open( dir / "pruned_blocks", create );
+         my->_journal.add( "blk_id2num", my->blk_id2num );
+         my->_journal.add( "trx_id2num", my->trx_id2num );
+         my->_journal.add( "meta_trxs", my->meta_trxs );
+         my->_journal.add( "blocks", my->blocks );
+         my->_journal.add( "block_trxs", my->block_trxs );
+         my->_journal.add( "block_undos", my->block_undos );
+         my->_journal.add( "block_filters", my->block_filters );
+         my->_journal.add( "utxo_commitments", my->utxo_commitments );
+         my->_journal.add( "pruned_blocks", my->pruned_blocks );
+         auto impl = my.get();
+         my->_market_db.open( dir / "market", &my->_journal,
+                              [impl]( const market_order& m ) { return impl->fetch_order_amount( m ); } );
+
+         uint32_t last_pruned = 0;
+         my->_prune_depth      = prune_depth;
+         my->_first_full_block = my->pruned_blocks.last( last_pruned ) ? last_pruned + 1 : 0;
+         FC_ASSERT( prune_depth || my->_first_full_block == 0, 
+                    "${dir} has been pruned, it can only be opened with a prune depth", ("dir",dir) );
+
+         bool build_utxos = !fc::exists( dir / "utxos" );
+         my->_utxos.open( dir / "utxos", create, false, &my->_journal );
+         my->_utxo_snapshot = dir / "utxo_snapshot";
+         my->_block_store.open( dir / "block_store" );
+
+         bool build_addresses = !fc::exists( dir / "address_index" );
+         FC_ASSERT( prune_depth == 0 || (build_addresses && !index_addresses), 
+                    "the address index can not be kept by a pruned database" );
+         if( index_addresses || !build_addresses )
+         {
+            my->_addresses.open( dir / "address_index", true, &my->_journal );
+         }
+         my->_journal.end_recovery();
 
          
          // read the last block from the DB
@@ -792,6 +1385,38 @@ namespace bts { namespace blockchain {
          if( my->head_block.block_num != uint32_t(-1) )
          {
             my->head_block_id = my->head_block.id();
+            if( build_utxos )
+            {
+               my->rebuild_utxos();
+            }
+            else
+            {
+               my->load_utxos();
+            }
+            if( build_addresses && my->_addresses.is_open() )
+            {
+               my->rebuild_addresses();
+            }
+            // pruning was just enabled or its depth was reduced
+            if( prune_depth && my->head_block.block_num >= prune_depth )
+            {
+               my->prune_to( my->head_block.block_num - prune_depth );
+            }
+         }
+
+         // the block store is written outside of the leveldb batch, bring it in line with the head
+         // and drop the blocks that have been pruned since it was last written
+         uint32_t num_blocks = my->head_block.block_num + 1;
+         my->_block_store.truncate( num_blocks );
+         my->_block_store.discard_before( my->_first_full_block );
+         uint32_t first_missing = my->_block_store.empty() ? my->_first_full_block : my->_block_store.end_block();
+         if( first_missing < num_blocks )
+         {
+            ilog( "adding blocks ${n} to ${head} to the block store", ("n",first_missing)("head",num_blocks-1) );
+            for( uint32_t n = first_missing; n < num_blocks; ++n )
+            {
+               my->_block_store.append( n, fc::raw::pack( fetch_trx_block( n ) ) );
+            }
          }
 
        } FC_RETHROW_EXCEPTIONS( warn, "error loading blockchain database ${dir}", ("dir",dir)("create",create) );
@@ -799,11 +1424,22 @@ namespace bts { namespace blockchain {
 
      void blockchain_db::close()
      {
+        if( my->_utxos.is_open() && my->head_block.block_num != uint32_t(-1) )
+        {
+           my->save_utxo_snapshot();
+        }
         my->blk_id2num.close();
         my->trx_id2num.close();
         my->blocks.close();
         my->block_trxs.close();
+        my->block_undos.close();
+        my->block_filters.close();
+        my->utxo_commitments.close();
+        my->pruned_blocks.close();
         my->meta_trxs.close();
+        my->_utxos.close();
+        my->_block_store.close();
+        my->_addresses.close();
      }
 
     uint32_t blockchain_db::head_block_num()const
@@ -814,6 +1450,15 @@ namespace bts { namespace blockchain {
     {
        return my->head_block.id();
     }
+    uint32_t blockchain_db::first_full_block()const
+    {
+       return my->_first_full_block;
+    }
+
+    std::map<std::string,uint64_t> blockchain_db::bytes_written()const
+    {
+       return my->_journal.bytes_written();
+    }
 
 
     /**
@@ -845,7 +1490,9 @@ namespace bts { namespace blockchain {
 
     meta_trx    blockchain_db::fetch_trx( const trx_num& trx_id )
     { try {
-       return my->meta_trxs.fetch( trx_id );
+       meta_trx mtrx = my->meta_trxs.fetch( trx_id );
+       my->_utxos.fetch_spends( trx_id, mtrx.meta_outputs );
+       return mtrx;
     } FC_RETHROW_EXCEPTIONS( warn, "trx_id ${trx_id}", ("trx_id",trx_id) ) }
 
     uint32_t    blockchain_db::fetch_block_num( const block_id_type& block_id )
@@ -867,6 +1514,11 @@ namespace bts { namespace blockchain {
 
     trx_block  blockchain_db::fetch_trx_block( uint32_t block_num )
     { try {
+       FC_ASSERT( block_num >= my->_first_full_block, "block ${block} has been pruned", ("block",block_num) );
+       if( my->_block_store.contains( block_num ) )
+       {
+          return fc::raw::unpack<trx_block>( my->_block_store.fetch( block_num ) );
+       }
        trx_block fb = my->blocks.fetch(block_num);
        auto trx_ids = my->block_trxs.fetch( block_num );
        for( uint32_t i = 0; i < trx_ids.size(); ++i )
@@ -874,11 +1526,49 @@ namespace bts { namespace blockchain {
           auto trx_num = fetch_trx_num(trx_ids[i]);
           fb.trxs.push_back( fetch_trx( trx_num ) );
        }
-       // TODO: fetch each trx and add it to the trx block
-       //fb.trx_ids = my->block_trxs.fetch( block_num );
        return fb;
     } FC_RETHROW_EXCEPTIONS( warn, "block ${block}", ("block",block_num) ) }
 
+    std::vector<char> blockchain_db::fetch_packed_block( uint32_t block_num )
+    { try {
+       if( my->_block_store.contains( block_num ) )
+       {
+          return my->_block_store.fetch( block_num );
+       }
+       return fc::raw::pack( fetch_trx_block( block_num ) );
+    } FC_RETHROW_EXCEPTIONS( warn, "block ${block}", ("block",block_num) ) }
+
+    address_filter blockchain_db::fetch_address_filter( uint32_t block_num )
+    { try {
+       auto filter = my->block_filters.fetch_optional( block_num );
+       if( filter )
+       {
+          return *filter;
+       }
+       return address_filter(); // matches everything
+    } FC_RETHROW_EXCEPTIONS( warn, "block ${block}", ("block",block_num) ) }
+
+    fc::sha256 blockchain_db::get_utxo_commitment()const
+    {
+       return my->_utxos.commitment();
+    }
+
+    fc::sha256 blockchain_db::fetch_utxo_commitment( uint32_t block_num )
+    { try {
+       return my->utxo_commitments.fetch( block_num );
+    } FC_RETHROW_EXCEPTIONS( warn, "block ${block}", ("block",block_num) ) }
+
+    bool blockchain_db::has_address_index()const
+    {
+       return my->_addresses.is_open();
+    }
+
+    std::vector<output_location> blockchain_db::fetch_outputs( const output_owner& owner, uint32_t from_block_num )
+    { try {
+       FC_ASSERT( my->_addresses.is_open(), "the address index is not enabled" );
+       return my->_addresses.fetch( owner, from_block_num );
+    } FC_RETHROW_EXCEPTIONS( warn, "", ("owner",owner)("from_block_num",from_block_num) ) }
+
     signed_transaction blockchain_db::fetch_transaction( const transaction_id_type& id )
     { try {
           auto trx_num = fetch_trx_num(id);
@@ -887,6 +1577,13 @@ namespace bts { namespace blockchain {
 
 
     std::vector<meta_trx_input> blockchain_db::fetch_inputs( const std::vector<trx_input>& inputs, uint32_t head )
+    {
+       std::vector<meta_trx_input> rtn;
+       fetch_inputs( inputs, head, rtn );
+       return rtn;
+    }
+
+    void blockchain_db::fetch_inputs( const std::vector<trx_input>& inputs, uint32_t head, std::vector<meta_trx_input>& rtn )
     {
        try
        {
@@ -895,11 +1592,32 @@ namespace bts { namespace blockchain {
             head = head_block_num();
           }
 
-          std::vector<meta_trx_input> rtn;
+          rtn.clear();
           rtn.reserve( inputs.size() );
           for( uint32_t i = 0; i < inputs.size(); ++i )
           {
             try {
+             const utxo_entry* unspent = my->_utxos.find( inputs[i].output_ref );
+             if( unspent )
+             {
+                rtn.resize( rtn.size() + 1 );
+                meta_trx_input& metin = rtn.back();
+                metin.source       = unspent->source;
+                metin.output_num   = inputs[i].output_ref.output_idx;
+                if( unspent->claim_idx == utxo_entry::no_claim )
+                {
+                   metin.output    = my->_utxos.fetch_output( inputs[i].output_ref );
+                }
+                else
+                {
+                   // the claim stays in the utxo index, validation reads it with fetch_claim()
+                   metin.output.amount     = unspent->amount;
+                   metin.output.claim_func = claim_type_enum( unspent->claim_func );
+                }
+                continue;
+             }
+
+             // spent or unknown outputs, load the source transaction to report where it was spent
              trx_num tn   = fetch_trx_num( inputs[i].output_ref.trx_hash );
              meta_trx trx = fetch_trx( tn );
              
@@ -923,11 +1641,36 @@ namespace bts { namespace blockchain {
 
             } FC_RETHROW_EXCEPTIONS( warn, "error fetching input [${i}] ${in}", ("i",i)("in", inputs[i]) );
           }
-          return rtn;
        } FC_RETHROW_EXCEPTIONS( warn, "error fetching transaction inputs", ("inputs", inputs) );
     }
 
 
+    bool blockchain_db::fetch_claim( const output_reference& ref, claim_by_signature_output& claim )const
+    {
+       return my->_utxos.fetch_claim( ref, claim );
+    }
+
+    bool blockchain_db::fetch_claim( const output_reference& ref, claim_by_pts_output& claim )const
+    {
+       return my->_utxos.fetch_claim( ref, claim );
+    }
+
+    bool blockchain_db::fetch_claim( const output_reference& ref, claim_by_bid_output& claim )const
+    {
+       return my->_utxos.fetch_claim( ref, claim );
+    }
+
+    bool blockchain_db::fetch_claim( const output_reference& ref, claim_by_long_output& claim )const
+    {
+       return my->_utxos.fetch_claim( ref, claim );
+    }
+
+    bool blockchain_db::fetch_claim( const output_reference& ref, claim_by_cover_output& claim )const
+    {
+       return my->_utxos.fetch_claim( ref, claim );
+    }
+
+
     /**
      *  Validates that trx could be included in a future block, that
      *  all inputs are unspent, that it is valid for the current time,
@@ -938,7 +1681,8 @@ namespace bts { namespace blockchain {
      *
      *  @throw exception if trx can not be applied to the current chain state.
      */
-    trx_eval blockchain_db::evaluate_signed_transaction( const signed_transaction& trx, bool ignore_fees, bool is_market  )       
+    trx_eval blockchain_db::evaluate_signed_transaction( const signed_transaction& trx, bool ignore_fees, bool is_market,
+                                                         const std::unordered_set<address>* signers )       
     {
        try {
            FC_ASSERT( trx.inputs.size() || trx.outputs.size() );
@@ -953,34 +1697,36 @@ namespace bts { namespace blockchain {
            }
            */
 
-           trx_validation_state vstate( trx, this ); 
+           trx_validation_state& vstate = my->_validation_state;
+           vstate.reset( trx, this, true, -1, signers ); 
            vstate.allow_short_long_matching = is_market;
            vstate.prev_block_id1 = get_stake();
            vstate.prev_block_id2 = get_stake2();
            vstate.validate();
 
            trx_eval e;
+           const auto bts_balance = vstate.get_balance( asset::bts );
            if( my->head_block_id != block_id_type() )
            {
               // all transactions must pay at least some fee 
-              if( vstate.balance_sheet[asset::bts].out >= vstate.balance_sheet[asset::bts].in )
+              if( bts_balance.out >= bts_balance.in )
               {
                 
-                 FC_ASSERT( vstate.balance_sheet[asset::bts].out <= vstate.balance_sheet[asset::bts].in, 
+                 FC_ASSERT( bts_balance.out <= bts_balance.in, 
                             "All transactions must pay some fee",
-                 ("out", vstate.balance_sheet[asset::bts].out)("in",vstate.balance_sheet[asset::bts].in )
+                 ("out", bts_balance.out)("in",bts_balance.in )
                             );
               }
               else
               {
-                 e.fees = vstate.balance_sheet[asset::bts].in - vstate.balance_sheet[asset::bts].out;
+                 e.fees = bts_balance.in - bts_balance.out;
                  if( !ignore_fees )
                  {
                     FC_ASSERT( e.fees.get_rounded_amount() >= (get_fee_rate() * trx.size()).get_rounded_amount() );
                  }
               }
            }
-           e.total_spent += vstate.balance_sheet[asset::bts].in.get_rounded_amount() + vstate.balance_sheet[asset::bts].collat_in.get_rounded_amount();
+           e.total_spent += bts_balance.in.get_rounded_amount() + bts_balance.collat_in.get_rounded_amount();
            e.coindays_destroyed = vstate.total_cdd;
            e.invalid_coindays_destroyed = vstate.uncounted_cdd;
            return e;
@@ -992,13 +1738,17 @@ namespace bts { namespace blockchain {
     trx_eval blockchain_db::evaluate_signed_transactions( const std::vector<signed_transaction>& trxs, uint64_t ignore_first_n_fees )
     {
       try {
+        // signature recovery does not depend upon chain state, do it for all trxs in parallel
+        auto signers = recover_signed_addresses( trxs );
+        auto signers_of = [&]( uint32_t i ) { return signers[i] ? &*signers[i] : nullptr; };
+
         trx_eval total_eval;
         for( uint32_t i = 0; i < trxs.size(); ++i )
         {
             // ignore fees for the market trxs and for the mining transaction... assuming there is a mining trx??
             if( i < ignore_first_n_fees )
             {
-               total_eval += evaluate_signed_transaction( trxs[i], true, true );
+               total_eval += evaluate_signed_transaction( trxs[i], true, true, signers_of(i) );
             }
             bts::address mining_addr;
             if( i == trxs.size() - 1 ) // last trx..
@@ -1015,7 +1765,7 @@ namespace bts { namespace blockchain {
                            FC_ASSERT( trxs.back().outputs.size() == 1 ); // only allowed 1 output
                            FC_ASSERT( trxs.back().outputs.back().as<claim_by_signature_output>().owner == mining_addr ); // must match
 
-                           auto prev_eval = evaluate_signed_transaction( trxs[i-1], true );
+                           auto prev_eval = evaluate_signed_transaction( trxs[i-1], true, false, signers_of(i-1) );
 
                            auto rew = (total_eval.fees.get_rounded_amount() * prev_eval.coindays_destroyed )/
                                                 total_eval.coindays_destroyed;
@@ -1028,13 +1778,13 @@ namespace bts { namespace blockchain {
                }
                if( mining_addr == bts::address() ) // process like normal
                {
-                  total_eval += evaluate_signed_transaction( trxs[i], false );
+                  total_eval += evaluate_signed_transaction( trxs[i], false, false, signers_of(i) );
                }
             }
             else 
             {
                total_eval += evaluate_signed_transaction( trxs[i], 
-                                    (i == trxs.size()-1) || (i < ignore_first_n_fees) );
+                                    (i == trxs.size()-1) || (i < ignore_first_n_fees), false, signers_of(i) );
             }
         }
         ilog( "summary: ${totals}", ("totals",total_eval) );
@@ -1062,6 +1812,12 @@ namespace bts { namespace blockchain {
      *  Attempts to append block b to the block chain with the given trxs.
      */
     void blockchain_db::push_block( const trx_block& b )
+    {
+       fc::scoped_lock<fc::mutex> lock( my->_block_mutex );
+       do_push_block( b );
+    }
+
+    void blockchain_db::do_push_block( const trx_block& b )
     {
       try {
         FC_ASSERT( b.version      == 0                                                         );
@@ -1103,15 +1859,69 @@ namespace bts { namespace blockchain {
         
         wlog( "total_fees: ${tf}", ("tf", total_eval.fees ) );
 
-        my->store( b );
+        my->begin_batch();
+        try 
+        {
+           my->_block_undo = detail::block_undo();
+           my->_block_undo.prev_head_id = my->head_block_id;
+
+           my->store( b );
+
+           for( auto pt : order_stats )
+           {
+              my->_market_db.push_price_point( pt );
+           }
+
+           my->blk_id2num.store( b.id(), b.block_num );
+
+           my->_block_undo.market = my->_market_db.batch_undo();
+           my->block_undos.store( b.block_num, my->_block_undo );
 
-        for( auto pt : order_stats )
+           my->_block_store.truncate( b.block_num );
+           my->_block_store.append( b.block_num, fc::raw::pack( b ) );
+
+           bool pruned = false;
+           if( my->_prune_depth && b.block_num >= my->_prune_depth )
+           {
+              pruned = my->prune_block( b.block_num - my->_prune_depth );
+           }
+           my->commit_batch();
+           if( pruned )
+           {
+              my->_first_full_block = b.block_num - my->_prune_depth + 1;
+           }
+        }
+        catch ( ... )
         {
-           my->_market_db.push_price_point( pt );
+           my->abort_batch();
+           my->_block_store.truncate( b.block_num );
+           throw;
         }
 
-        my->blk_id2num.store( b.id(), b.block_num );
-        
+        my->head_block    = b;
+        my->head_block_id = b.id();
+
+        // once the pruned blocks at the front of the block store are as many as the blocks it
+        // has to serve they are dropped, so it holds at most twice the prune depth and every
+        // block is copied once more on average
+        if( my->_prune_depth && my->_first_full_block > my->_block_store.first_block() &&
+            my->_first_full_block - my->_block_store.first_block() >= my->_prune_depth )
+        {
+           try
+           {
+              my->_block_store.discard_before( my->_first_full_block );
+           }
+           catch ( const fc::exception& e )
+           {
+              // the block has been pushed, the pruned blocks are dropped again on the next open
+              wlog( "unable to drop pruned blocks from the block store: ${e}", ("e",e.to_detail_string()) );
+           }
+        }
+
+        if( b.block_num % SNAPSHOT_INTERVAL == 0 )
+        {
+           my->save_utxo_snapshot();
+        }
       } FC_RETHROW_EXCEPTIONS( warn, "unable to push block", ("b", b) );
     }
 
@@ -1121,9 +1931,109 @@ namespace bts { namespace blockchain {
      */
     void blockchain_db::pop_block( full_block& b, std::vector<signed_transaction>& trxs )
     {
-       FC_ASSERT( !"TODO: implement pop_block" );
+       fc::scoped_lock<fc::mutex> lock( my->_block_mutex );
+       do_pop_block( b, trxs );
     }
 
+    void blockchain_db::do_pop_block( full_block& b, std::vector<signed_transaction>& trxs )
+    { try {
+       FC_ASSERT( my->head_block.block_num != trx_num::invalid_block_id, "there is no block to pop" );
+       uint32_t block_num = my->head_block.block_num;
+
+       // blocks pushed before undo records were kept can not be popped
+       detail::block_undo undo = my->block_undos.fetch( block_num );
+       b = fetch_full_block( block_num );
+
+       trxs.clear();
+       trxs.reserve( b.trx_ids.size() );
+       for( uint16_t i = 0; i < b.trx_ids.size(); ++i )
+       {
+          trxs.push_back( my->meta_trxs.fetch( trx_num( block_num, i ) ) );
+       }
+
+       my->begin_batch();
+       try 
+       {
+          my->undo( b, trxs, undo );
+          my->commit_batch();
+       }
+       catch ( ... )
+       {
+          my->abort_batch();
+          throw;
+       }
+       my->_block_store.truncate( block_num );
+
+       if( block_num == 0 )
+       {
+          my->head_block = trx_block();
+       }
+       else
+       {
+          my->head_block = my->blocks.fetch( block_num - 1 );
+       }
+       my->head_block_id = undo.prev_head_id;
+    } FC_RETHROW_EXCEPTIONS( warn, "unable to pop block ${n}", ("n",head_block_num()) ) }
+
+    void blockchain_db::reorganize_to( const std::vector<trx_block>& fork, std::vector<signed_transaction>& orphaned_trxs )
+    { try {
+       fc::scoped_lock<fc::mutex> lock( my->_block_mutex );
+       FC_ASSERT( fork.size() > 0 );
+       FC_ASSERT( fork.front().block_num == 0 || fork.front().block_num - 1 <= head_block_num() );
+       if( fork.front().block_num > 0 )
+       {
+          FC_ASSERT( fetch_block_num( fork.front().prev ) == fork.front().block_num - 1, 
+                     "fork does not connect to this chain" );
+       }
+
+       std::vector<trx_block> popped;
+       while( head_block_num() != fork.front().block_num - 1 )
+       {
+          full_block                      b;
+          std::vector<signed_transaction> trxs;
+          do_pop_block( b, trxs );
+          popped.push_back( trx_block( b, trxs ) );
+       }
+       FC_ASSERT( my->head_block_id == fork.front().prev );
+
+       uint32_t pushed = 0;
+       try 
+       {
+          for( auto itr = fork.begin(); itr != fork.end(); ++itr )
+          {
+             do_push_block( *itr );
+             ++pushed;
+          }
+       }
+       catch ( const fc::exception& e )
+       {
+          wlog( "fork rejected at block ${n}, restoring the original chain\n${e}", 
+                ("n",fork.front().block_num + pushed)("e",e.to_detail_string()) );
+          full_block                      b;
+          std::vector<signed_transaction> trxs;
+          for( ; pushed > 0; --pushed )
+          {
+             do_pop_block( b, trxs );
+          }
+          for( auto itr = popped.rbegin(); itr != popped.rend(); ++itr )
+          {
+             do_push_block( *itr );
+          }
+          throw;
+       }
+
+       orphaned_trxs.clear();
+       for( auto itr = popped.rbegin(); itr != popped.rend(); ++itr )
+       {
+          orphaned_trxs.insert( orphaned_trxs.end(), itr->trxs.begin(), itr->trxs.end() );
+       }
+    } FC_RETHROW_EXCEPTIONS( warn, "unable to reorganize to fork", ("fork_size",fork.size()) ) }
+
+
+    fc::mutex& blockchain_db::block_mutex()
+    {
+       return my->_block_mutex;
+    }
 
     uint64_t blockchain_db::current_bitshare_supply()
     {
@@ -1132,23 +2042,58 @@ namespace bts { namespace blockchain {
 
     /**
      *  Generates transactions that match all compatiable bids, asks, and shorts for
-     *  all possible asset combinations and returns the result.
+     *  every asset pair with open orders and returns the result.  Pairs are visited
+     *  by base and then by quote, pairs with empty books have nothing to match and
+     *  record no price point.
      */
     std::vector<signed_transaction> blockchain_db::match_orders( std::vector<price_point>* stats )
     { try {
        std::vector<signed_transaction> matched;
-       for( uint32_t base = asset::bts; base < asset::count; ++base )
+       auto markets = my->_market_db.get_active_markets();
+
+       // only keep idle state for pairs that still have orders
+       decltype( my->_idle_markets ) idle_markets;
+       for( auto market = markets.begin(); market != markets.end(); ++market )
        {
-          for( uint32_t quote = base+1; quote < asset::count; ++quote )
+          uint64_t revision = my->_market_db.get_revision( market->first, market->second );
+
+          // nothing has changed in this market since it last failed to match
+          auto idle = my->_idle_markets.find( *market );
+          if( idle != my->_idle_markets.end() && idle->second.revision == revision )
+          {
+             if( stats )
+             {
+                price_point pt = idle->second.stats;
+                pt.from_block  = my->head_block.block_num;
+                pt.to_block    = pt.from_block + 1;
+                pt.from_time   = my->head_block.timestamp;
+                pt.to_time     = my->head_block.timestamp;
+                stats->push_back( pt );
+             }
+             idle_markets[*market] = idle->second;
+             continue;
+          }
+
+          price_point pt;
+          size_t      num_matched = matched.size();
+          bool        evaluated   = my->match_orders( matched, market->first, market->second, pt );
+          if( evaluated && matched.size() == num_matched )
           {
-              price_point pt;
-              my->match_orders( matched, asset::type(quote), asset::type(base), pt );
-              if( stats ) stats->push_back( pt );
+             auto& entry    = idle_markets[*market];
+             entry.revision = revision;
+             entry.stats    = pt;
           }
+          if( stats ) stats->push_back( pt );
        }
+       my->_idle_markets.swap( idle_markets );
        return matched;
     } FC_RETHROW_EXCEPTIONS( warn, "" ) }
 
+    void blockchain_db::clear_match_cache()
+    {
+       my->_idle_markets.clear();
+    }
+
     /**
      *  First step to creating a new block is to take all canidate transactions and 
      *  sort them by fees and filter out transactions that are not valid.  Then
@@ -1157,15 +2102,13 @@ namespace bts { namespace blockchain {
     trx_block  blockchain_db::generate_next_block( const std::vector<signed_transaction>& in_trxs )
     {
       try {
-         std::vector<signed_transaction> trxs = match_orders();
-         size_t num_orders = trxs.size();
-
          std::vector<trx_stat>  stats;
          stats.reserve(in_trxs.size());
          ilog( "." );
+         auto signers = recover_signed_addresses( in_trxs );
          for( uint32_t i = 0; i < in_trxs.size(); ++i )
          {
-            ilog( "trx: ${t} signed by ${s}", ( "t",in_trxs[i])("s",in_trxs[i].get_signed_addresses() ) );
+            ilog( "trx: ${t} signed by ${s}", ( "t",in_trxs[i])("s",signers[i] ) );
          }
          ilog( "." );
          
@@ -1175,7 +2118,7 @@ namespace bts { namespace blockchain {
             try 
             {
                 trx_stat s;
-                s.eval = evaluate_signed_transaction( in_trxs[i] );
+                s.eval = evaluate_signed_transaction( in_trxs[i], false, false, signers[i] ? &*signers[i] : nullptr );
                 ilog( "eval: ${eval}", ("eval",s.eval) );
 
                // TODO: enforce fees
@@ -1185,7 +2128,7 @@ namespace bts { namespace blockchain {
                         ("trx",in_trxs[i])("s",s.eval)("f", get_fee_rate()*in_trxs[i].size()) );
                   continue;
                 }
-                s.trx_idx = i + trxs.size(); // market trx will go first...
+                s.trx_idx = i;
                 stats.push_back( s );
             } 
             catch ( const fc::exception& e )
@@ -1195,13 +2138,31 @@ namespace bts { namespace blockchain {
          }
          ilog( "." );
 
-         // order the trx by fees (don't sort the market orders which are added next)
+         // order the trx by fees 
          std::sort( stats.begin(), stats.end() ); 
+
+         std::vector<signed_transaction> trxs;
+         std::vector<trx_eval>           evals;
+         trxs.reserve( stats.size() );
+         evals.reserve( stats.size() );
          for( uint32_t i = 0; i < stats.size(); ++i )
          {
            ilog( "sort ${i} => ${n}", ("i", i)("n",stats[i]) );
+           trxs.push_back( in_trxs[stats[i].trx_idx] );
+           evals.push_back( stats[i].eval );
          }
-         ilog( "." );
+         return generate_next_block( trxs, evals );
+
+      } FC_RETHROW_EXCEPTIONS( warn, "error generating new block" );
+    }
+
+    trx_block  blockchain_db::generate_next_block( const std::vector<signed_transaction>& in_trxs, 
+                                                   const std::vector<trx_eval>& evals )
+    {
+      try {
+         FC_ASSERT( in_trxs.size() == evals.size() );
+         std::vector<signed_transaction> trxs = match_orders();
+         size_t num_orders = trxs.size();
 
          // consume the outputs from the market order first
          std::unordered_set<output_reference> consumed_outputs;
@@ -1213,54 +2174,46 @@ namespace bts { namespace blockchain {
                           "output can only be referenced once", ("in",in)("output_ref",itr->inputs[in].output_ref) )
             }
          }
-         trxs.insert( trxs.end(), in_trxs.begin(), in_trxs.end() );
-         ilog( "trxs: ${t}", ("t",trxs) );
 
          // calculate the block size as we go
          fc::datastream<size_t>  block_size;
-         uint32_t conflicts = 0;
 
-         asset    total_fees;
-         uint64_t total_cdd = 0;
-         uint64_t invalid_cdd = 0;
-         uint64_t total_spent  = 0;
+         trx_eval totals;
+
+         std::vector<uint32_t> included;
+         included.reserve( in_trxs.size() );
 
          ilog( "." );
-         // insert other transactions
-         for( size_t i = 0; i < stats.size(); ++i )
+         // insert other transactions in the order given
+         for( size_t i = 0; i < in_trxs.size(); ++i )
          {
-            const signed_transaction& trx = trxs[stats[i].trx_idx]; 
+            const signed_transaction& trx = in_trxs[i]; 
+            bool conflict = false;
             for( size_t in = 0; in < trx.inputs.size(); ++in )
             {
                ilog( "input ${in}", ("in", trx.inputs[in]) );
 
                if( !consumed_outputs.insert( trx.inputs[in].output_ref ).second )
                {
-                    stats[i].trx_idx = uint16_t(-1); // mark it to be skipped, input conflict
                     wlog( "INPUT CONFLICT!" );
-                    ++conflicts;
-                    break; //in = trx.inputs.size(); // exit inner loop
+                    conflict = true;
+                    break; 
                }
             }
-            if( stats[i].trx_idx != uint16_t(-1) )
+            if( !conflict )
             {
                fc::raw::pack( block_size, trx );
                if( block_size.tellp() > MAX_BLOCK_TRXS_SIZE )
                {
-                  stats.resize(i); // this trx put us over the top, we can stop processing
-                                   // the other trxs.
-                  break;
+                  break; // this trx put us over the top, we can stop processing the other trxs.
                }
-               FC_ASSERT( i < stats.size() );
                ilog( "total fees ${tf} += ${fees},  total cdd ${tcdd} += ${cdd}", 
-                     ("tf", total_fees)
-                     ("fees",stats[i].eval.fees)
-                     ("tcdd",total_cdd)
-                     ("cdd",stats[i].eval.coindays_destroyed) );
-               total_fees   += stats[i].eval.fees;
-               total_cdd    += stats[i].eval.coindays_destroyed;
-               invalid_cdd  += stats[i].eval.invalid_coindays_destroyed;
-               total_spent  += stats[i].eval.total_spent;
+                     ("tf", totals.fees)
+                     ("fees",evals[i].fees)
+                     ("tcdd",totals.coindays_destroyed)
+                     ("cdd",evals[i].coindays_destroyed) );
+               totals += evals[i];
+               included.push_back( i );
             }
          }
          ilog( "." );
@@ -1274,27 +2227,34 @@ namespace bts { namespace blockchain {
         // asset miner_fees( (total_fees.amount).high_bits(), asset::bts );
         // wlog( "miner fees: ${t}", ("t", miner_fees) );
 
-         trx_block new_blk;
-         new_blk.trxs.reserve( 1 + stats.size() - conflicts + num_orders ); 
+         trx_block new_blk( generate_next_block_header( totals ) );
+         new_blk.trxs.reserve( 1 + included.size() + num_orders ); 
 
          // add all orders first
-         new_blk.trxs.insert( new_blk.trxs.begin(), trxs.begin(), trxs.begin() + num_orders );
+         new_blk.trxs.insert( new_blk.trxs.begin(), trxs.begin(), trxs.end() );
 
          // add all other transactions to the block
-         for( size_t i = 0; i < stats.size(); ++i )
+         for( size_t i = 0; i < included.size(); ++i )
          {
-           if( stats[i].trx_idx != uint16_t(-1) )
-           {
-             new_blk.trxs.push_back( trxs[ stats[i].trx_idx] );
-           }
+           new_blk.trxs.push_back( in_trxs[ included[i] ] );
          }
 
+         new_blk.trx_mroot = new_blk.calculate_merkle_root();
+
+         return new_blk;
+
+      } FC_RETHROW_EXCEPTIONS( warn, "error generating new block" );
+    }
+
+    block_header blockchain_db::generate_next_block_header( const trx_eval& totals )
+    { try {
+         block_header new_blk;
          new_blk.timestamp                 = fc::time_point::now();
          FC_ASSERT( new_blk.timestamp > my->head_block.timestamp );
 
          new_blk.block_num                 = head_block_num() + 1;
          new_blk.prev                      = my->head_block_id;
-         new_blk.total_shares              = my->head_block.total_shares - total_fees.amount.high_bits(); 
+         new_blk.total_shares              = my->head_block.total_shares - totals.fees.amount.high_bits(); 
 
          new_blk.next_difficulty           = my->head_block.next_difficulty;
          if( my->head_block.block_num > 144 )
@@ -1306,19 +2266,14 @@ namespace bts { namespace blockchain {
              auto cur_tar = my->head_block.next_difficulty;
              new_blk.next_difficulty = (cur_tar * 300 /* 300 sec per block */) / avg_sec_per_block;
          }
-         new_blk.total_cdd                 = total_cdd; 
+         new_blk.total_cdd                 = totals.coindays_destroyed; 
 
          new_blk.avail_coindays            = my->head_block.avail_coindays 
-                                             - total_cdd 
-                                             + my->head_block.total_shares - total_spent
-                                             - invalid_cdd;
-
-         new_blk.trx_mroot = new_blk.calculate_merkle_root();
-
+                                             - totals.coindays_destroyed 
+                                             + my->head_block.total_shares - totals.total_spent
+                                             - totals.invalid_coindays_destroyed;
          return new_blk;
-
-      } FC_RETHROW_EXCEPTIONS( warn, "error generating new block" );
-    }
+    } FC_RETHROW_EXCEPTIONS( warn, "", ("totals",totals) ) }
 
     uint64_t      blockchain_db::get_market_depth( asset::type quote )const
     {
@@ -1335,14 +2290,17 @@ namespace bts { namespace blockchain {
            auto working_bid = my->get_output( itr->location );
            if( working_bid.claim_func == claim_by_long )
            {
-              claim_by_long_output long_claim = working_bid.as<claim_by_long_output>();
+              claim_by_long_output long_claim;
+              my->fetch_order_claim( itr->location, working_bid, long_claim );
               d.shorts.push_back( short_data( long_claim.ask_price, working_bid.amount.get_rounded_amount()  ) );
               d.bids.push_back( bid_data( long_claim.ask_price, (working_bid.amount*long_claim.ask_price).get_rounded_amount()) );
               d.bids.back().is_short = true;
            }
            else
            {
-              claim_by_bid_output bid_claim = working_bid.as<claim_by_bid_output>();
+              FC_ASSERT( working_bid.claim_func == claim_by_bid, "", ("bid", working_bid) );
+              claim_by_bid_output bid_claim;
+              my->fetch_order_claim( itr->location, working_bid, bid_claim );
               d.bids.push_back( bid_data( bid_claim.ask_price, working_bid.amount.get_rounded_amount() ) );
            }
        }
@@ -1351,12 +2309,19 @@ namespace bts { namespace blockchain {
        for( auto itr = asks.begin(); itr != asks.end(); ++itr )
        {
            auto working_ask = my->get_output( itr->location );
-           claim_by_bid_output ask_claim = working_ask.as<claim_by_bid_output>();
+           FC_ASSERT( working_ask.claim_func == claim_by_bid, "", ("ask", working_ask) );
+           claim_by_bid_output ask_claim;
+           my->fetch_order_claim( itr->location, working_ask, ask_claim );
            d.asks.push_back( ask_data( ask_claim.ask_price, working_ask.amount.get_rounded_amount() ) );
        }
        return d;
     }
 
+    order_book blockchain_db::get_order_book( asset::type quote, asset::type base, uint32_t levels )
+    { try {
+       return my->_market_db.get_order_book( quote, base, levels );
+    } FC_RETHROW_EXCEPTIONS( warn, "", ("quote",quote)("base",base)("levels",levels) ) }
+
     std::string blockchain_db::dump_market( asset::type quote, asset::type base )
     {
       std::stringstream ss;
@@ -1413,10 +2378,18 @@ namespace bts { namespace blockchain {
                                                 uint32_t blocks_per_point  )
     { try {
        FC_ASSERT( quote != base );
-       if( quote > base ) std::swap( quote, base );
+       if( quote < base ) std::swap( quote, base );
        return my->_market_db.get_history( quote, base, from, to, blocks_per_point );
     } FC_RETHROW_EXCEPTIONS( warn, "", ("quote",quote)("base",base)("from",from)("to",to)("blocks_per_point",blocks_per_point) ) }
 
+    std::vector<price_point> blockchain_db::get_market_candles( asset::type quote, asset::type base, uint32_t resolution,
+                                                fc::time_point_sec from, fc::time_point_sec to )
+    { try {
+       FC_ASSERT( quote != base );
+       if( quote < base ) std::swap( quote, base );
+       return my->_market_db.get_candles( quote, base, resolution, from, to );
+    } FC_RETHROW_EXCEPTIONS( warn, "", ("quote",quote)("base",base)("resolution",resolution)("from",from)("to",to) ) }
+
 }  } // bts::blockchain
 
 
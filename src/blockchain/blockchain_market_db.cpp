@@ -5,6 +5,8 @@
 #include <fc/log/logger.hpp>
 
 #include <algorithm>
+#include <map>
+#include <set>
 
 struct price_point_key
 {
@@ -12,15 +14,15 @@ struct price_point_key
    bts::blockchain::asset::type base;
    fc::time_point_sec           timestamp;
 
+   price_point_key(){}
    price_point_key( bts::blockchain::asset::type q, bts::blockchain::asset::type b, fc::time_point_sec t )
    :quote(q),base(b),timestamp(t){}
 
    friend bool operator < ( const price_point_key& a, const price_point_key& b )
    {
-      if( a.quote >= b.quote )         return false;
-      if( a.base  >= b.base  )         return false;
-      if( a.timestamp >= b.timestamp ) return false;
-      return true;
+      if( a.quote != b.quote ) return a.quote < b.quote;
+      if( a.base  != b.base  ) return a.base  < b.base;
+      return a.timestamp < b.timestamp;
    }
 
    friend bool operator == ( const price_point_key& a, const price_point_key& b )
@@ -31,6 +33,79 @@ struct price_point_key
 
 FC_REFLECT( price_point_key, (quote)(base)(timestamp) )
 
+struct candle_key
+{
+   bts::blockchain::asset::type quote;
+   bts::blockchain::asset::type base;
+   uint32_t                     resolution; ///< seconds covered by the candle
+   fc::time_point_sec           bucket;     ///< start of the candle, a multiple of resolution
+
+   candle_key():resolution(0){}
+   candle_key( bts::blockchain::asset::type q, bts::blockchain::asset::type b, uint32_t r, fc::time_point_sec t )
+   :quote(q),base(b),resolution(r),bucket(t){}
+
+   friend bool operator < ( const candle_key& a, const candle_key& b )
+   {
+      if( a.quote      != b.quote      ) return a.quote      < b.quote;
+      if( a.base       != b.base       ) return a.base       < b.base;
+      if( a.resolution != b.resolution ) return a.resolution < b.resolution;
+      return a.bucket < b.bucket;
+   }
+
+   friend bool operator == ( const candle_key& a, const candle_key& b )
+   {
+      return a.quote == b.quote && a.base == b.base && a.resolution == b.resolution && a.bucket == b.bucket;
+   }
+};
+
+FC_REFLECT( candle_key, (quote)(base)(resolution)(bucket) )
+
+namespace bts { namespace db {
+   /** quote, base, timestamp so that the history of a pair is contiguous */
+   template<>
+   struct key_codec<price_point_key>
+   {
+      static const bool   is_order_preserving = true;
+      static const size_t encoded_size        = 1 + 1 + 4;
+
+      static void encode( const price_point_key& k, char* out )
+      {
+         key_encoding::encode_uint8( uint8_t(k.quote), out );
+         key_encoding::encode_uint8( uint8_t(k.base), out );
+         key_encoding::encode_uint32( k.timestamp.sec_since_epoch(), out );
+      }
+      static void decode( const char* in, price_point_key& k )
+      {
+         k.quote     = bts::blockchain::asset::type( key_encoding::decode_uint8( in ) );
+         k.base      = bts::blockchain::asset::type( key_encoding::decode_uint8( in ) );
+         k.timestamp = fc::time_point_sec( key_encoding::decode_uint32( in ) );
+      }
+   };
+
+   /** quote, base, resolution, bucket so that the candles of one resolution are contiguous */
+   template<>
+   struct key_codec<candle_key>
+   {
+      static const bool   is_order_preserving = true;
+      static const size_t encoded_size        = 1 + 1 + 4 + 4;
+
+      static void encode( const candle_key& k, char* out )
+      {
+         key_encoding::encode_uint8( uint8_t(k.quote), out );
+         key_encoding::encode_uint8( uint8_t(k.base), out );
+         key_encoding::encode_uint32( k.resolution, out );
+         key_encoding::encode_uint32( k.bucket.sec_since_epoch(), out );
+      }
+      static void decode( const char* in, candle_key& k )
+      {
+         k.quote      = bts::blockchain::asset::type( key_encoding::decode_uint8( in ) );
+         k.base       = bts::blockchain::asset::type( key_encoding::decode_uint8( in ) );
+         k.resolution = key_encoding::decode_uint32( in );
+         k.bucket     = fc::time_point_sec( key_encoding::decode_uint32( in ) );
+      }
+   };
+} } // bts::db
+
 struct depth_stats
 {
    depth_stats( uint64_t b = 0,
@@ -46,16 +121,376 @@ namespace bts { namespace blockchain {
 
   namespace detail
   {
+     const uint32_t candle_resolutions[]   = { 60*60, 4*60*60, 24*60*60, 7*24*60*60 };
+     const uint32_t num_candle_resolutions = sizeof(candle_resolutions) / sizeof(candle_resolutions[0]);
+
      class market_db_impl
      {
         public:
+           market_db_impl():_in_batch(false){}
+
            db::level_pod_map<market_order,uint32_t> _bids;
            db::level_pod_map<market_order,uint32_t> _asks;
            db::level_pod_map<margin_call,uint32_t>  _calls;
 
+           /**
+            *  The amount of every order in _bids and _asks, see market_db::insert_bid().
+            *  Kept apart so that books written before amounts were kept still open,
+            *  load_books() adds the missing amounts with _amount_of.
+            */
+           db::level_pod_map<market_order,uint64_t> _bid_amounts;
+           db::level_pod_map<market_order,uint64_t> _ask_amounts;
+           market_db::order_amount_func             _amount_of;
+
            db::level_pod_map<price_point_key, price_point> _price_history;
+           /** the price history rolled up at each of candle_resolutions */
+           db::level_pod_map<candle_key, price_point>      _candles;
 
            db::level_pod_map<asset::type,depth_stats> _depth;
+
+           /**
+            *  The order book is served from memory, the databases above only persist
+            *  it and are read once when opened.  Orders keep the database key order,
+            *  by price and then by output reference, because matching must visit
+            *  orders in exactly the same sequence on every node.
+            */
+           std::map<market_order,uint64_t>          _bid_book;
+           std::map<market_order,uint64_t>          _ask_book;
+           std::set<margin_call>                    _call_book;
+
+           /** 
+            *  The orders of each book summed by price, keyed by a market_order with 
+            *  the price of the level and a default location.
+            */
+           std::map<market_order,price_level>       _bid_levels;
+           std::map<market_order,price_level>       _ask_levels;
+
+           /** bumped whenever an order or call of the pair changes, keyed by (quote, base) */
+           std::map<std::pair<uint8_t,uint8_t>,uint64_t> _revisions;
+
+           /**
+            *  The number of bids, asks and calls in the books of every pair that has any,
+            *  keyed by (base, quote) so that it iterates in the order pairs are matched.
+            */
+           std::map<std::pair<uint8_t,uint8_t>,uint32_t> _open_orders;
+
+           /** prior state of everything changed by the current batch */
+           market_undo                              _undo;
+           bool                                     _in_batch;
+
+           void record_bid( const market_order& m )
+           {
+              if( _in_batch )
+              {
+                 auto itr = _bid_book.find( m );
+                 _undo.bids.push_back( itr == _bid_book.end() ? order_undo( m, false ) : order_undo( m, true, itr->second ) );
+              }
+           }
+           void record_ask( const market_order& m )
+           {
+              if( _in_batch )
+              {
+                 auto itr = _ask_book.find( m );
+                 _undo.asks.push_back( itr == _ask_book.end() ? order_undo( m, false ) : order_undo( m, true, itr->second ) );
+              }
+           }
+           void record_call( const margin_call& c )
+           {
+              if( _in_batch )
+              {
+                 _undo.calls.push_back( call_undo( c, _call_book.count( c ) != 0 ) );
+              }
+           }
+
+           void record_depth( asset::type quote_unit )
+           {
+              if( !_in_batch )
+              {
+                 return;
+              }
+              depth_undo d;
+              d.quote_unit = quote_unit;
+              auto stat = _depth.fetch_optional( quote_unit );
+              if( stat )
+              {
+                 d.existed   = true;
+                 d.bid_depth = stat->bid_depth;
+                 d.ask_depth = stat->ask_depth;
+              }
+              _undo.depth.push_back( d );
+           }
+
+           /** adds pt to the candle of every resolution that contains it */
+           void roll_up( const price_point& pt )
+           {
+              for( uint32_t i = 0; i < num_candle_resolutions; ++i )
+              {
+                 uint32_t   res = candle_resolutions[i];
+                 uint32_t   sec = pt.from_time.sec_since_epoch();
+                 candle_key key( pt.quote_volume.unit, pt.base_volume.unit, res, fc::time_point_sec( sec - sec % res ) );
+
+                 auto candle = _candles.fetch_optional( key );
+                 if( _in_batch )
+                 {
+                    candle_undo u;
+                    u.quote_unit = key.quote;
+                    u.base_unit  = key.base;
+                    u.resolution = key.resolution;
+                    u.bucket     = key.bucket;
+                    u.existed    = !!candle;
+                    if( candle )
+                    {
+                       u.candle = *candle;
+                    }
+                    _undo.candles.push_back( u );
+                 }
+                 if( candle )
+                 {
+                    *candle += pt;
+                    _candles.store( key, *candle );
+                 }
+                 else
+                 {
+                    _candles.store( key, pt );
+                 }
+              }
+           }
+
+           void touch( uint8_t a, uint8_t b )
+           {
+              ++_revisions[ std::make_pair( std::max( a, b ), std::min( a, b ) ) ];
+           }
+           void touch( const market_order& m )
+           {
+              touch( m.quote_unit.value, m.base_unit.value );
+           }
+           void touch( const margin_call& c )
+           {
+              touch( c.call_price.quote_unit.value, c.call_price.base_unit.value );
+           }
+
+           static std::pair<uint8_t,uint8_t> market_of( const market_order& m )
+           {
+              return std::make_pair( std::min<uint8_t>( m.quote_unit.value, m.base_unit.value ), 
+                                     std::max<uint8_t>( m.quote_unit.value, m.base_unit.value ) );
+           }
+           static std::pair<uint8_t,uint8_t> market_of( const margin_call& c )
+           {
+              return std::make_pair( std::min<uint8_t>( c.call_price.quote_unit.value, c.call_price.base_unit.value ), 
+                                     std::max<uint8_t>( c.call_price.quote_unit.value, c.call_price.base_unit.value ) );
+           }
+
+           static market_order level_of( const market_order& m )
+           {
+              market_order level;
+              level.base_unit  = m.base_unit;
+              level.quote_unit = m.quote_unit;
+              level.ratio      = m.ratio;
+              return level;
+           }
+
+           void close_order( const std::pair<uint8_t,uint8_t>& market )
+           {
+              auto itr = _open_orders.find( market );
+              if( --itr->second == 0 )
+              {
+                 _open_orders.erase( itr );
+              }
+           }
+
+           /** change the in memory book, its price levels and the open order count of the pair */
+           void order_insert( std::map<market_order,uint64_t>& book, std::map<market_order,price_level>& levels,
+                              const market_order& m, uint64_t amount )
+           {
+              order_erase( book, levels, m );
+              book.insert( std::make_pair( m, amount ) );
+              ++_open_orders[ market_of( m ) ];
+
+              price_level& level = levels[ level_of( m ) ];
+              level.level_price  = m.get_price();
+              level.amount      += amount;
+              ++level.orders;
+           }
+           void order_erase( std::map<market_order,uint64_t>& book, std::map<market_order,price_level>& levels,
+                             const market_order& m )
+           {
+              touch( m );
+              auto itr = book.find( m );
+              if( itr == book.end() )
+              {
+                 return;
+              }
+              auto level = levels.find( level_of( m ) );
+              level->second.amount -= itr->second;
+              if( --level->second.orders == 0 )
+              {
+                 levels.erase( level );
+              }
+              book.erase( itr );
+              close_order( market_of( m ) );
+           }
+           void call_insert( const margin_call& c )
+           {
+              touch( c );
+              if( _call_book.insert( c ).second )
+              {
+                 ++_open_orders[ market_of( c ) ];
+              }
+           }
+           void call_erase( const margin_call& c )
+           {
+              touch( c );
+              if( _call_book.erase( c ) )
+              {
+                 close_order( market_of( c ) );
+              }
+           }
+
+           /** change the book and the database together */
+           void store_bid( const market_order& m, uint64_t amount )
+           {
+              order_insert( _bid_book, _bid_levels, m, amount );
+              _bids.store( m, 0 );
+              _bid_amounts.store( m, amount );
+           }
+           void erase_bid( const market_order& m )
+           {
+              order_erase( _bid_book, _bid_levels, m );
+              _bids.remove( m );
+              _bid_amounts.remove( m );
+           }
+           void store_ask( const market_order& m, uint64_t amount )
+           {
+              order_insert( _ask_book, _ask_levels, m, amount );
+              _asks.store( m, 0 );
+              _ask_amounts.store( m, amount );
+           }
+           void erase_ask( const market_order& m )
+           {
+              order_erase( _ask_book, _ask_levels, m );
+              _asks.remove( m );
+              _ask_amounts.remove( m );
+           }
+
+           /** @return the amount of an order that was stored before amounts were kept */
+           uint64_t legacy_amount( const market_order& m )
+           {
+              FC_ASSERT( _amount_of, "the amount of order ${o} is not known", ("o",m) );
+              return _amount_of( m );
+           }
+           uint64_t undo_amount( const order_undo& u )
+           {
+              return u.amount != order_undo::unknown_amount ? u.amount : legacy_amount( u.order );
+           }
+
+           /** @return the amount of m from amounts, adding it if the order predates amounts */
+           uint64_t load_amount( db::level_pod_map<market_order,uint64_t>& amounts, const market_order& m,
+                                 uint32_t& added )
+           {
+              auto amount = amounts.fetch_optional( m );
+              if( !amount )
+              {
+                 amount = legacy_amount( m );
+                 amounts.store( m, *amount );
+                 ++added;
+              }
+              return *amount;
+           }
+           void store_call( const margin_call& c )
+           {
+              call_insert( c );
+              _calls.store( c, 0 );
+           }
+           void erase_call( const margin_call& c )
+           {
+              call_erase( c );
+              _calls.remove( c );
+           }
+
+           /** restores the in memory book after the database batch was discarded */
+           void revert_books( const market_undo& u )
+           {
+              for( auto itr = u.bids.rbegin(); itr != u.bids.rend(); ++itr )
+              {
+                 if( itr->existed )
+                 {
+                    order_insert( _bid_book, _bid_levels, itr->order, itr->amount );
+                 }
+                 else
+                 {
+                    order_erase( _bid_book, _bid_levels, itr->order );
+                 }
+              }
+              for( auto itr = u.asks.rbegin(); itr != u.asks.rend(); ++itr )
+              {
+                 if( itr->existed )
+                 {
+                    order_insert( _ask_book, _ask_levels, itr->order, itr->amount );
+                 }
+                 else
+                 {
+                    order_erase( _ask_book, _ask_levels, itr->order );
+                 }
+              }
+              for( auto itr = u.calls.rbegin(); itr != u.calls.rend(); ++itr )
+              {
+                 if( itr->existed )
+                 {
+                    call_insert( itr->call );
+                 }
+                 else
+                 {
+                    call_erase( itr->call );
+                 }
+              }
+           }
+
+           void load_books()
+           {
+              _bid_book.clear();
+              _ask_book.clear();
+              _call_book.clear();
+              _bid_levels.clear();
+              _ask_levels.clear();
+              _open_orders.clear();
+              uint32_t added = 0;
+              for( auto itr = _bids.begin(); itr.valid(); ++itr )
+              {
+                 order_insert( _bid_book, _bid_levels, itr.key(), load_amount( _bid_amounts, itr.key(), added ) );
+              }
+              for( auto itr = _asks.begin(); itr.valid(); ++itr )
+              {
+                 order_insert( _ask_book, _ask_levels, itr.key(), load_amount( _ask_amounts, itr.key(), added ) );
+              }
+              if( added )
+              {
+                 ilog( "stored the amounts of ${n} orders opened before amounts were kept", ("n",added) );
+              }
+              for( auto itr = _calls.begin(); itr.valid(); ++itr )
+              {
+                 call_insert( itr.key() );
+              }
+           }
+
+           /** @return the orders for the pair from the book in key order */
+           static std::vector<market_order> get_orders( const std::map<market_order,uint64_t>& book, 
+                                                        asset::type quote_unit, asset::type base_unit )
+           {
+              market_order mo;
+              mo.base_unit  = base_unit;
+              mo.quote_unit = quote_unit;
+
+              std::vector<market_order> orders;
+              for( auto itr = book.lower_bound( mo ); itr != book.end(); ++itr )
+              {
+                 if( itr->first.quote_unit != quote_unit || itr->first.base_unit != base_unit )
+                 {
+                    break;
+                 }
+                 orders.push_back( itr->first );
+              }
+              return orders;
+           }
      };
 
   } // namespace detail
@@ -137,32 +572,181 @@ namespace bts { namespace blockchain {
   market_db::~market_db()
   {}
 
-  void market_db::open( const fc::path& db_dir )
+  void market_db::open( const fc::path& db_dir, bts::db::write_journal* journal, const order_amount_func& amount_of )
   { try {
      fc::create_directories( db_dir / "bids" );
      fc::create_directories( db_dir / "asks" );
+     fc::create_directories( db_dir / "bid_amounts" );
+     fc::create_directories( db_dir / "ask_amounts" );
      fc::create_directories( db_dir / "calls" );
      fc::create_directories( db_dir / "price_history" );
+     fc::create_directories( db_dir / "candles" );
      fc::create_directories( db_dir / "depth" );
 
      my->_bids.open( db_dir / "bids" );
      my->_asks.open( db_dir / "asks" );
+     my->_bid_amounts.open( db_dir / "bid_amounts" );
+     my->_ask_amounts.open( db_dir / "ask_amounts" );
      my->_calls.open( db_dir / "calls" );
      my->_price_history.open( db_dir / "price_history" );
+     my->_candles.open( db_dir / "candles" );
      my->_depth.open( db_dir / "depth" );
+     if( journal )
+     {
+        journal->add( "market/bids", my->_bids );
+        journal->add( "market/asks", my->_asks );
+        journal->add( "market/bid_amounts", my->_bid_amounts );
+        journal->add( "market/ask_amounts", my->_ask_amounts );
+        journal->add( "market/calls", my->_calls );
+        journal->add( "market/price_history", my->_price_history );
+        journal->add( "market/candles", my->_candles );
+        journal->add( "market/depth", my->_depth );
+     }
+     my->_amount_of = amount_of;
+
+     my->load_books();
+
+     // price history recorded before candles were kept
+     if( !my->_candles.begin().valid() )
+     {
+        for( auto itr = my->_price_history.begin(); itr.valid(); ++itr )
+        {
+           my->roll_up( itr.value() );
+        }
+     }
   } FC_RETHROW_EXCEPTIONS( warn, "unable to open market db ${dir}", ("dir",db_dir) ) }
 
-  void market_db::insert_bid( const market_order& m, uint64_t depth )
+  void market_db::begin_batch()
+  {
+     my->_bids.begin_batch();
+     my->_asks.begin_batch();
+     my->_bid_amounts.begin_batch();
+     my->_ask_amounts.begin_batch();
+     my->_calls.begin_batch();
+     my->_price_history.begin_batch();
+     my->_candles.begin_batch();
+     my->_depth.begin_batch();
+     my->_undo     = market_undo();
+     my->_in_batch = true;
+  }
+
+  void market_db::commit_batch( bool sync )
+  { try {
+     my->_in_batch = false;
+     my->_undo     = market_undo();
+     my->_bids.commit_batch( sync );
+     my->_asks.commit_batch( sync );
+     my->_bid_amounts.commit_batch( sync );
+     my->_ask_amounts.commit_batch( sync );
+     my->_calls.commit_batch( sync );
+     my->_price_history.commit_batch( sync );
+     my->_candles.commit_batch( sync );
+     my->_depth.commit_batch( sync );
+  } FC_RETHROW_EXCEPTIONS( warn, "" ) }
+
+  void market_db::abort_batch()
+  {
+     my->_bids.abort_batch();
+     my->_asks.abort_batch();
+     my->_bid_amounts.abort_batch();
+     my->_ask_amounts.abort_batch();
+     my->_calls.abort_batch();
+     my->_price_history.abort_batch();
+     my->_candles.abort_batch();
+     my->_depth.abort_batch();
+     my->revert_books( my->_undo );
+     my->_undo     = market_undo();
+     my->_in_batch = false;
+  }
+
+  const market_undo& market_db::batch_undo()const
+  {
+     return my->_undo;
+  }
+
+  /**
+   *  Entries are restored in the reverse of the order they were recorded so
+   *  that an entry changed more than once ends up in its earliest state.
+   */
+  void market_db::undo( const market_undo& u )
+  { try {
+     for( auto itr = u.bids.rbegin(); itr != u.bids.rend(); ++itr )
+     {
+        if( itr->existed )
+        {
+           my->store_bid( itr->order, my->undo_amount( *itr ) );
+        }
+        else
+        {
+           my->erase_bid( itr->order );
+        }
+     }
+     for( auto itr = u.asks.rbegin(); itr != u.asks.rend(); ++itr )
+     {
+        if( itr->existed )
+        {
+           my->store_ask( itr->order, my->undo_amount( *itr ) );
+        }
+        else
+        {
+           my->erase_ask( itr->order );
+        }
+     }
+     for( auto itr = u.calls.rbegin(); itr != u.calls.rend(); ++itr )
+     {
+        if( itr->existed )
+        {
+           my->store_call( itr->call );
+        }
+        else
+        {
+           my->erase_call( itr->call );
+        }
+     }
+     for( auto itr = u.depth.rbegin(); itr != u.depth.rend(); ++itr )
+     {
+        if( itr->existed )
+        {
+           depth_stats stat;
+           stat.bid_depth = itr->bid_depth;
+           stat.ask_depth = itr->ask_depth;
+           my->_depth.store( itr->quote_unit, stat );
+        }
+        else
+        {
+           my->_depth.remove( itr->quote_unit );
+        }
+     }
+     for( auto itr = u.history.rbegin(); itr != u.history.rend(); ++itr )
+     {
+        my->_price_history.remove( price_point_key( itr->quote_unit, itr->base_unit, itr->from_time ) );
+     }
+     for( auto itr = u.candles.rbegin(); itr != u.candles.rend(); ++itr )
+     {
+        candle_key key( itr->quote_unit, itr->base_unit, itr->resolution, itr->bucket );
+        if( itr->existed )
+        {
+           my->_candles.store( key, itr->candle );
+        }
+        else
+        {
+           my->_candles.remove( key );
+        }
+     }
+  } FC_RETHROW_EXCEPTIONS( warn, "" ) }
+
+  void market_db::insert_bid( const market_order& m, uint64_t amount, uint64_t depth )
   {
+     my->record_bid( m );
      if( depth )
      {
-        auto itr = my->_depth.find( m.quote_unit );
-        if( itr.valid() )
+        my->record_depth( m.quote_unit );
+        auto stat = my->_depth.fetch_optional( m.quote_unit );
+        if( stat )
         {
-           auto stat = itr.value();
-           stat.bid_depth += depth;
+           stat->bid_depth += depth;
            ilog( "insert bid ${b} with depth ${d}", ("b",m)("d",depth) );
-           my->_depth.store( m.quote_unit, stat );
+           my->_depth.store( m.quote_unit, *stat );
         }
         else
         {
@@ -170,18 +754,19 @@ namespace bts { namespace blockchain {
            my->_depth.store( m.quote_unit, depth_stats( depth, 0) );
         }
      }
-     my->_bids.store( m, 0 );
+     my->store_bid( m, amount );
   }
-  void market_db::insert_ask( const market_order& m, uint64_t depth )
+  void market_db::insert_ask( const market_order& m, uint64_t amount, uint64_t depth )
   {
+     my->record_ask( m );
      if( depth )
      {
-        auto itr = my->_depth.find( m.quote_unit );
-        if( itr.valid() )
+        my->record_depth( m.quote_unit );
+        auto stat = my->_depth.fetch_optional( m.quote_unit );
+        if( stat )
         {
-           auto stat = itr.value();
-           stat.ask_depth += depth;
-           my->_depth.store( m.quote_unit, stat );
+           stat->ask_depth += depth;
+           my->_depth.store( m.quote_unit, *stat );
            ilog( "insert ask ${b} with depth ${d}", ("b",m)("d",depth) );
         }
         else
@@ -190,88 +775,120 @@ namespace bts { namespace blockchain {
            my->_depth.store( m.quote_unit, depth_stats( 0, depth) );
         }
      }
-     my->_asks.store( m, 0 );
+     my->store_ask( m, amount );
   }
   void market_db::remove_bid( const market_order& m, uint64_t depth )
   {
+     my->record_bid( m );
      if( depth )
      {
-        auto itr = my->_depth.find( m.quote_unit );
-        if( itr.valid() )
+        my->record_depth( m.quote_unit );
+        auto stat = my->_depth.fetch_optional( m.quote_unit );
+        if( stat )
         {
-           auto stat = itr.value();
-           FC_ASSERT( stat.bid_depth >= depth, "", ("stat",stat)("depth",depth) );
-           stat.bid_depth -= depth;
-           my->_depth.store( m.quote_unit, stat );
+           FC_ASSERT( stat->bid_depth >= depth, "", ("stat",*stat)("depth",depth) );
+           stat->bid_depth -= depth;
+           my->_depth.store( m.quote_unit, *stat );
         }
      }
-     my->_bids.remove(m);
+     my->erase_bid( m );
   }
   void market_db::remove_ask( const market_order& m, uint64_t depth )
   {
+     my->record_ask( m );
      if( depth )
      {
-        auto itr = my->_depth.find( m.quote_unit );
-        if( itr.valid() )
+        my->record_depth( m.quote_unit );
+        auto stat = my->_depth.fetch_optional( m.quote_unit );
+        if( stat )
         {
-           auto stat = itr.value();
-           FC_ASSERT( stat.ask_depth >= depth, "", ("stat",stat)("depth",depth) );
-           stat.ask_depth -= depth;
-           my->_depth.store( m.quote_unit, stat );
+           FC_ASSERT( stat->ask_depth >= depth, "", ("stat",*stat)("depth",depth) );
+           stat->ask_depth -= depth;
+           my->_depth.store( m.quote_unit, *stat );
         }
      }
-     my->_asks.remove(m);
+     my->erase_ask( m );
   }
   void market_db::insert_call( const margin_call& c, uint64_t depth )
   {
+     my->record_call( c );
      if( depth )
      {
-        auto itr = my->_depth.find( c.call_price.quote_unit );
-        if( itr.valid() )
+        my->record_depth( c.call_price.quote_unit );
+        auto stat = my->_depth.fetch_optional( c.call_price.quote_unit );
+        if( stat )
         {
-           auto stat = itr.value();
-           stat.bid_depth += depth;
-           my->_depth.store( c.call_price.quote_unit, stat );
+           stat->bid_depth += depth;
+           my->_depth.store( c.call_price.quote_unit, *stat );
         }
         else
         {
            my->_depth.store( c.call_price.quote_unit, depth_stats( depth, 0) );
         }
      }
-     my->_calls.store( c, 0 );
+     my->store_call( c );
   }
 
   void market_db::remove_call( const margin_call& c, uint64_t depth )
   {
+     my->record_call( c );
      if( depth )
      {
-        auto itr = my->_depth.find( c.call_price.quote_unit );
-        if( itr.valid() )
+        my->record_depth( c.call_price.quote_unit );
+        auto stat = my->_depth.fetch_optional( c.call_price.quote_unit );
+        if( stat )
         {
-           auto stat = itr.value();
-           FC_ASSERT( stat.bid_depth >= depth, "", ("stat",stat)("depth",depth) );
-           stat.bid_depth -= depth;
-           my->_depth.store( c.call_price.quote_unit, stat );
+           FC_ASSERT( stat->bid_depth >= depth, "", ("stat",*stat)("depth",depth) );
+           stat->bid_depth -= depth;
+           my->_depth.store( c.call_price.quote_unit, *stat );
         }
      }
-     my->_calls.remove( c ); // TODO... this side effect is not unwond in 
-                             // in the event of an exception..
+     my->erase_call( c );
+  }
+
+  uint64_t market_db::get_revision( asset::type quote, asset::type base )const
+  {
+     auto itr = my->_revisions.find( std::make_pair( std::max<uint8_t>( quote, base ), std::min<uint8_t>( quote, base ) ) );
+     if( itr == my->_revisions.end() )
+     {
+        return 0;
+     }
+     return itr->second;
+  }
+
+  std::vector< std::pair<asset::type,asset::type> > market_db::get_active_markets()const
+  {
+     std::vector< std::pair<asset::type,asset::type> > markets;
+     markets.reserve( my->_open_orders.size() );
+     for( auto itr = my->_open_orders.begin(); itr != my->_open_orders.end(); ++itr )
+     {
+        markets.push_back( std::make_pair( asset::type( itr->first.second ), asset::type( itr->first.first ) ) );
+     }
+     return markets;
   }
 
   uint64_t market_db::get_depth( asset::type quote_unit )
   {
-     auto itr = my->_depth.find( quote_unit );
-     if( itr.valid() )
+     auto stat = my->_depth.fetch_optional( quote_unit );
+     if( stat )
      {
-        auto stat = itr.value();
-        return std::min( stat.bid_depth, stat.ask_depth );
+        return std::min( stat->bid_depth, stat->ask_depth );
      }
      return 0;
   }
 
   void market_db::push_price_point( const price_point& pt )
   {
+     if( my->_in_batch )
+     {
+        history_undo h;
+        h.quote_unit = pt.quote_volume.unit;
+        h.base_unit  = pt.base_volume.unit;
+        h.from_time  = pt.from_time;
+        my->_undo.history.push_back( h );
+     }
      my->_price_history.store( price_point_key( pt.quote_volume.unit, pt.base_volume.unit, pt.from_time ), pt );
+     my->roll_up( pt );
   }
   
   /**
@@ -305,16 +922,51 @@ namespace bts { namespace blockchain {
           points.push_back( point_itr.value() );
           blocks_in_point = 1;
         }
+        ++point_itr;
      }
      return points;
   }
 
+  std::vector<price_point> market_db::get_candles( asset::type quote, asset::type base, uint32_t resolution, 
+                                                   fc::time_point_sec from, fc::time_point_sec to )
+  { try {
+     FC_ASSERT( std::find( detail::candle_resolutions, detail::candle_resolutions + detail::num_candle_resolutions, resolution ) 
+                != detail::candle_resolutions + detail::num_candle_resolutions, "unsupported candle resolution" );
+
+     uint32_t sec = from.sec_since_epoch();
+     std::vector<price_point> candles;
+     auto itr = my->_candles.lower_bound( candle_key( quote, base, resolution, fc::time_point_sec( sec - sec % resolution ) ) );
+     while( itr.valid() )
+     {
+        auto key = itr.key();
+        if( key.quote != quote || key.base != base || key.resolution != resolution || key.bucket > to ) 
+        {
+           break;
+        }
+        candles.push_back( itr.value() );
+        ++itr;
+     }
+     return candles;
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("quote",quote)("base",base)("resolution",resolution)("from",from)("to",to) ) }
+
   /** @pre quote > base  */
   fc::optional<market_order> market_db::get_highest_bid( asset::type quote, asset::type base )
   {
     FC_ASSERT( quote > base );
     fc::optional<market_order> highest_bid;
 
+    market_order mo;
+    mo.base_unit  = base;
+    mo.quote_unit = asset::type( uint8_t(quote) + 1 );
+    auto itr = my->_bid_book.lower_bound( mo );
+    if( itr != my->_bid_book.begin() )
+    {
+       --itr;
+       if( itr->first.quote_unit == quote && itr->first.base_unit == base )
+       {
+          highest_bid = itr->first;
+       }
+    }
     return highest_bid;
   }
   /** @pre quote > base  */
@@ -323,76 +975,82 @@ namespace bts { namespace blockchain {
     FC_ASSERT( quote > base );
     fc::optional<market_order> lowest_ask;
 
+    market_order mo;
+    mo.base_unit  = base;
+    mo.quote_unit = quote;
+    auto itr = my->_ask_book.lower_bound( mo );
+    if( itr != my->_ask_book.end() && itr->first.quote_unit == quote && itr->first.base_unit == base )
+    {
+       lowest_ask = itr->first;
+    }
     return lowest_ask;
   }
 
   std::vector<market_order> market_db::get_bids( asset::type quote_unit, asset::type base_unit )const
   {
      FC_ASSERT( quote_unit > base_unit );
-
-     std::vector<market_order> orders;
-     market_order mo;
-     mo.base_unit  = base_unit;
-     mo.quote_unit = quote_unit;
-
-     auto order_itr  = my->_bids.lower_bound( mo );
-     while( order_itr.valid() )
-     {
-        auto order = order_itr.key();
-        if( order.quote_unit != quote_unit || order.base_unit != base_unit )
-        {
-            return orders;
-        }
-        orders.push_back(order);
-        ++order_itr;
-     }
-     ilog( "order_itr is not valid!" );
-     return orders;
+     return detail::market_db_impl::get_orders( my->_bid_book, quote_unit, base_unit );
   }
 
+  /**
+   *  The call book is ordered by quote unit and then by call price, so the calls
+   *  triggered at call_price are the tail of the range of its quote unit.  They
+   *  are found with one lookup and returned from the highest call price down
+   *  without visiting any call that is not triggered.
+   */
   std::vector<margin_call>  market_db::get_calls( price call_price )const
   {
      ilog( "get_calls price: ${p}", ("p",call_price) );
      std::vector<margin_call> calls;
 
-     auto order_itr  = my->_calls.lower_bound( margin_call( call_price, output_reference() ) );
-     while( order_itr.valid() )
+     price next_unit( fc::uint128(0), call_price.base_unit, asset::type( uint8_t(call_price.quote_unit) + 1 ) );
+
+     auto first = my->_call_book.lower_bound( margin_call( call_price, output_reference() ) );
+     auto itr   = my->_call_book.lower_bound( margin_call( next_unit, output_reference() ) );
+     while( itr != first )
      {
-        auto call = order_itr.key();
-        ilog( "call ${c}", ("c",call) );
-        if( call.call_price.quote_unit != call_price.quote_unit )
-           break;
-        if( call.call_price < call_price )
-           break;
-        calls.push_back(call);
-        ++order_itr;
+        --itr;
+        calls.push_back( *itr );
      }
-     std::reverse( calls.begin(), calls.end() );
      return calls;
   }
 
   std::vector<market_order> market_db::get_asks( asset::type quote_unit, asset::type base_unit )const
   {
      FC_ASSERT( quote_unit > base_unit );
+     return detail::market_db_impl::get_orders( my->_ask_book, quote_unit, base_unit );
+  }
+
+  order_book market_db::get_order_book( asset::type quote_unit, asset::type base_unit, uint32_t levels )const
+  {
+     FC_ASSERT( quote_unit > base_unit );
+     order_book book;
 
-     std::vector<market_order> orders;
      market_order mo;
      mo.base_unit  = base_unit;
      mo.quote_unit = quote_unit;
+     for( auto itr = my->_ask_levels.lower_bound( mo ); 
+          itr != my->_ask_levels.end() && book.asks.size() < levels; ++itr )
+     {
+        if( itr->first.quote_unit != quote_unit || itr->first.base_unit != base_unit )
+        {
+           break;
+        }
+        book.asks.push_back( itr->second );
+     }
 
-     auto order_itr  = my->_asks.lower_bound( mo );
-     while( order_itr.valid() )
+     mo.quote_unit = asset::type( uint8_t(quote_unit) + 1 );
+     auto itr = my->_bid_levels.lower_bound( mo );
+     while( itr != my->_bid_levels.begin() && book.bids.size() < levels )
      {
-        auto order = order_itr.key();
-        if( order.quote_unit != quote_unit || order.base_unit != base_unit )
+        --itr;
+        if( itr->first.quote_unit != quote_unit || itr->first.base_unit != base_unit )
         {
-            return orders;
+           break;
         }
-        orders.push_back(order);
-        ++order_itr;
+        book.bids.push_back( itr->second );
      }
-     ilog( "order_itr is not valid!" );
-     return orders;
+     return book;
   }
 
 } } // bts::blockchain
@@ -86,13 +86,13 @@ namespace bts { namespace blockchain {
         out << "</td>\n";
         out << "<td width=\"33%\" align=\"right\" valign=\"top\" padding=10>\n";
         out << "<ol start=\"0\">\n";
-        for( uint32_t i = 0; i < state.trx.outputs.size(); ++i )
+        for( uint32_t i = 0; i < state.trx->outputs.size(); ++i )
         {
            out << "<li>\n";
            out << "<div>\n";
-           out << std::string(state.trx.outputs[i].amount);// << " " << fc::variant( state.trx.outputs[i].unit ).as_string();
-           out << "  <br/>" << fc::variant(state.trx.outputs[i].claim_func).as_string() <<"  ";
-           out << "  <br/>\n" << print_output( state.trx.outputs[i] ) <<" \n";
+           out << std::string(state.trx->outputs[i].amount);// << " " << fc::variant( state.trx->outputs[i].unit ).as_string();
+           out << "  <br/>" << fc::variant(state.trx->outputs[i].claim_func).as_string() <<"  ";
+           out << "  <br/>\n" << print_output( state.trx->outputs[i] ) <<" \n";
            if( mtrx.meta_outputs[i].is_spent() )
            {
               out << " SPENT Block #"<< mtrx.meta_outputs[i].trx_id.block_num;
@@ -107,19 +107,19 @@ namespace bts { namespace blockchain {
         out << "</td>\n";
         out << "<td valign=\"top\">\n";
         out << "<table width=\"100%\"><tr><th width=\"50%\" padding=10>Net In</th><th padding=10 width=\"50%\">Net Out</th></tr>\n";
-        for( uint32_t i = 0; i < state.balance_sheet.size(); ++i )
+        for( auto itr = state.balance_sheet.begin(); itr != state.balance_sheet.end(); ++itr )
         {
-           if( state.balance_sheet[i].in.amount  != fc::uint128(0) || 
-               state.balance_sheet[i].out.amount != fc::uint128(0)  )
+           if( itr->second.in.amount  != fc::uint128(0) || 
+               itr->second.out.amount != fc::uint128(0)  )
            {
               out <<"<tr>\n";
-              out <<"<td>"<< std::string(state.balance_sheet[i].in)<<"</td>";
-              out <<"<td>"<< std::string(state.balance_sheet[i].out)<<"</td>";
+              out <<"<td>"<< std::string(itr->second.in)<<"</td>";
+              out <<"<td>"<< std::string(itr->second.out)<<"</td>";
               out <<"</tr>";
            }
-           if( state.balance_sheet[i].in.amount > state.balance_sheet[i].out.amount   )
+           if( itr->second.in.amount > itr->second.out.amount   )
            {
-              out << "<tr><td colspan=2><hr/><br/> Fees: "<<std::string(state.balance_sheet[i].in - state.balance_sheet[i].out)<<"</td></tr>\n";
+              out << "<tr><td colspan=2><hr/><br/> Fees: "<<std::string(itr->second.in - itr->second.out)<<"</td></tr>\n";
            }
         }
         out << "</table>\n";
@@ -1,18 +1,27 @@
 #include <bts/blockchain/blockchain_wallet.hpp>
+#include <bts/blockchain/address_index.hpp>
+#include <bts/blockchain/address_filter.hpp>
 #include <bts/blockchain/asset.hpp>
 #include <bts/blockchain/block.hpp>
+#include <bts/blockchain/worker_threads.hpp>
 #include <bts/extended_address.hpp>
 #include <bts/config.hpp>
 #include <bts/pts_address.hpp>
 #include <bts/bitcoin_wallet.hpp>
 #include <unordered_map>
 #include <map>
+#include <set>
+#include <unordered_set>
 #include <fc/filesystem.hpp>
 #include <fc/io/raw.hpp>
 #include <fc/io/json.hpp>
 #include <fc/log/logger.hpp>
 #include <fc/reflect/variant.hpp>
 #include <fc/crypto/aes.hpp>
+#include <fc/thread/thread.hpp>
+#include <fc/thread/future.hpp>
+#include <fc/thread/mutex.hpp>
+#include <fc/thread/scoped_lock.hpp>
 #include <sstream>
 
 #include <iostream>
@@ -113,6 +122,22 @@ namespace bts { namespace blockchain {
 
    namespace detail 
    {
+      /** an input that spends one of our outputs or an output paid to us, found by scan_range() */
+      struct scan_match
+      {
+         scan_match( const output_reference& spent_ref )
+         :ref(spent_ref),is_input(true),spent(true){}
+
+         scan_match( const output_reference& out_ref, const output_index& oidx, const trx_output& o, bool is_spent )
+         :ref(out_ref),index(oidx),out(o),is_input(false),spent(is_spent){}
+
+         output_reference  ref;
+         output_index      index;
+         trx_output        out;
+         bool              is_input;
+         bool              spent;
+      };
+
       class wallet_impl
       {
           public:
@@ -157,6 +182,160 @@ namespace bts { namespace blockchain {
                    return total_bal;
               }
 
+              std::vector<output_owner> get_owners()const
+              {
+                   std::vector<output_owner> owners;
+                   owners.reserve( _data.recv_addresses.size() + _data.recv_pts_addresses.size() );
+                   for( auto itr = _data.recv_addresses.begin(); itr != _data.recv_addresses.end(); ++itr )
+                   {
+                      owners.push_back( output_owner( itr->first ) );
+                   }
+                   for( auto itr = _data.recv_pts_addresses.begin(); itr != _data.recv_pts_addresses.end(); ++itr )
+                   {
+                      owners.push_back( output_owner( itr->first ) );
+                   }
+                   return owners;
+              }
+
+              /** @return true if out is paid to one of our receive addresses */
+              bool is_mine( const trx_output& out )
+              {
+                   switch( out.claim_func )
+                   {
+                      case claim_by_pts:
+                         return _data.recv_pts_addresses.find( out.as<claim_by_pts_output>().owner ) != _data.recv_pts_addresses.end();
+                      case claim_by_signature:
+                         return _data.recv_addresses.find( out.as<claim_by_signature_output>().owner ) != _data.recv_addresses.end();
+                      case claim_by_bid:
+                         return _data.recv_addresses.find( out.as<claim_by_bid_output>().pay_address ) != _data.recv_addresses.end();
+                      case claim_by_long:
+                         return _data.recv_addresses.find( out.as<claim_by_long_output>().pay_address ) != _data.recv_addresses.end();
+                      case claim_by_cover:
+                         return _data.recv_addresses.find( out.as<claim_by_cover_output>().owner ) != _data.recv_addresses.end();
+                      case null_claim_type:
+                      default:
+                         FC_ASSERT( !"Invalid Claim Type" );
+                         return false;
+                   }
+              }
+
+              /** tracks one of our outputs as unspent, or marks it spent if trx shows it has been */
+              void record_output( wallet& self, const meta_trx& trx, const output_index& oidx )
+              {
+                   record_output( self, output_reference( trx.id(), oidx.output_idx ), oidx, 
+                                  trx.outputs[oidx.output_idx], trx.meta_outputs[oidx.output_idx].is_spent() );
+              }
+
+              void record_output( wallet& self, const output_reference& out_ref, const output_index& oidx, 
+                                  const trx_output& out, bool spent )
+              {
+                   if( spent )
+                   {
+                      self.mark_as_spent( out_ref );
+                   }
+                   else
+                   {
+                      _output_index_to_ref[oidx]    = out_ref;
+                      _output_ref_to_index[out_ref] = oidx;
+                      _unspent_outputs[oidx]        = out;
+                   }
+              }
+
+              /**
+               *  Reads blocks first to last - 1 and records, in order, the inputs that 
+               *  spend one of known_refs and the outputs that belong to us.  Only reads
+               *  wallet state so that several ranges may be scanned at once.
+               */
+              void scan_range( blockchain_db& chain, uint32_t first, uint32_t last,
+                               const std::vector<output_owner>& owners,
+                               const std::unordered_set<output_reference>& known_refs,
+                               std::vector<scan_match>& matches )
+              {
+                   for( uint32_t i = first; i < last; ++i )
+                   {
+                      if( !chain.fetch_address_filter( i ).may_contain_any( owners ) )
+                      {
+                         continue;
+                      }
+                      auto blk = chain.fetch_full_block( i );
+                      for( uint32_t trx_idx = 0; trx_idx < blk.trx_ids.size(); ++trx_idx )
+                      {
+                         auto trx = chain.fetch_trx( trx_num( i, trx_idx ) );
+                         for( uint32_t in_idx = 0; in_idx < trx.inputs.size(); ++in_idx )
+                         {
+                            if( known_refs.find( trx.inputs[in_idx].output_ref ) != known_refs.end() )
+                            {
+                               matches.push_back( scan_match( trx.inputs[in_idx].output_ref ) );
+                            }
+                         }
+                         for( uint32_t out_idx = 0; out_idx < trx.outputs.size(); ++out_idx )
+                         {
+                            if( is_mine( trx.outputs[out_idx] ) )
+                            {
+                               matches.push_back( scan_match( output_reference( blk.trx_ids[trx_idx], out_idx ),
+                                                              output_index( i, trx_idx, out_idx ),
+                                                              trx.outputs[out_idx],
+                                                              trx.meta_outputs[out_idx].is_spent() ) );
+                            }
+                         }
+                      }
+                   }
+              }
+
+              /**
+               *  Finds our outputs by looking up each receive address in the chain's
+               *  address index, only the transactions that pay us are fetched.
+               */
+              bool scan_address_index( wallet& self, blockchain_db& chain, uint32_t from_block_num, 
+                                       const scan_progress_callback& cb )
+              { try {
+                   bool found = false;
+                   auto head_block_num = chain.head_block_num();
+
+                   // outputs found by an earlier scan may have been spent after from_block_num
+                   std::vector<output_reference> spent;
+                   for( auto itr = _unspent_outputs.begin(); itr != _unspent_outputs.end(); ++itr )
+                   {
+                      if( itr->first.block_idx >= from_block_num || itr->first.block_idx > head_block_num )
+                      {
+                         continue;
+                      }
+                      auto trx = chain.fetch_trx( trx_num( itr->first.block_idx, itr->first.trx_idx ) );
+                      if( trx.meta_outputs[itr->first.output_idx].is_spent() )
+                      {
+                         spent.push_back( _output_index_to_ref[itr->first] );
+                      }
+                   }
+                   for( auto itr = spent.begin(); itr != spent.end(); ++itr )
+                   {
+                      self.mark_as_spent( *itr );
+                   }
+
+                   std::set<output_location> locations;
+                   auto owners = get_owners();
+                   for( auto itr = owners.begin(); itr != owners.end(); ++itr )
+                   {
+                      auto locs = chain.fetch_outputs( *itr, from_block_num );
+                      locations.insert( locs.begin(), locs.end() );
+                   }
+
+                   // locations are in chain order so each trx is fetched once
+                   meta_trx trx;
+                   trx_num  cur;
+                   for( auto itr = locations.begin(); itr != locations.end(); ++itr )
+                   {
+                      if( !(itr->source == cur) )
+                      {
+                         cur = itr->source;
+                         trx = chain.fetch_trx( cur );
+                         if( cb ) cb( cur.block_num, head_block_num, cur.trx_idx, cur.trx_idx + 1 );
+                      }
+                      record_output( self, trx, output_index( cur.block_num, cur.trx_idx, itr->output_idx ) );
+                      found = true;
+                   }
+                   return found;
+              } FC_RETHROW_EXCEPTIONS( warn, "", ("from_block_num",from_block_num) ) }
+
               std::vector<trx_input> collect_coindays( uint64_t request_cdd, asset& total_in, 
                                                        std::unordered_set<bts::address>& req_sigs, uint64_t& provided_cdd )
               {
@@ -1051,12 +1230,23 @@ namespace bts { namespace blockchain {
     */
    bool wallet::scan_chain( blockchain_db& chain, uint32_t from_block_num, scan_progress_callback cb )
    { try {
+       if( chain.has_address_index() )
+       {
+          return my->scan_address_index( *this, chain, from_block_num, cb );
+       }
+
        bool found = false;
        auto head_block_num = chain.head_block_num();
+       auto owners         = my->get_owners();
    //    ilog( "receive pts addr: ${recv_pts_addrs}", ("recv_pts_addrs",my->_data.recv_pts_addresses) );
        // for each block
        for( uint32_t i = from_block_num; i <= head_block_num; ++i )
        {
+          // the filter includes the owners of spent outputs, so skipping also misses no spends
+          if( !chain.fetch_address_filter( i ).may_contain_any( owners ) )
+          {
+             continue;
+          }
        //   ilog( "block: ${i}", ("i",i ) );
           auto blk = chain.fetch_full_block( i );
           // for each transaction
@@ -1076,145 +1266,10 @@ namespace bts { namespace blockchain {
               // for each output
               for( uint32_t out_idx = 0; out_idx < trx.outputs.size(); ++out_idx )
               {
-                  const trx_output& out   = trx.outputs[out_idx];
-                  const output_reference  out_ref( trx.id(),out_idx );
-                  const output_index      oidx( i, trx_idx, out_idx );
-                  switch( out.claim_func )
+                  if( my->is_mine( trx.outputs[out_idx] ) )
                   {
-                     case claim_by_pts:
-                     {
-                        auto owner = out.as<claim_by_pts_output>().owner;
-                        auto aitr  = my->_data.recv_pts_addresses.find(owner); //my_addresses.find(owner);
-                        if( aitr != my->_data.recv_pts_addresses.end() )
-                        {
-                            if( !trx.meta_outputs[out_idx].is_spent() )
-                            {
-                               my->_output_index_to_ref[oidx]    = out_ref;
-                               my->_output_ref_to_index[out_ref] = oidx;
-                               my->_unspent_outputs[oidx] = trx.outputs[out_idx];
-                            }
-                            else
-                            {
-                               mark_as_spent( out_ref ); //output_reference(trx.id(), out_idx ) );
-                               //my->_spent_outputs[output_reference( trx.id(), out_idx )] = trx.outputs[out_idx];
-                            }
-                           // std::cerr<<"found block["<<i<<"].trx["<<trx_idx<<"].output["<<out_idx<<"]  " << std::string(trx.id()) <<" => "<<std::string(owner)<<"\n";
-                           found = true;
-                        }
-                        break;
-                     }
-                     case claim_by_signature:
-                     {
-                        auto owner = out.as<claim_by_signature_output>().owner;
-                        auto aitr  = my->_data.recv_addresses.find(owner); //my_addresses.find(owner);
-                        if( aitr != my->_data.recv_addresses.end() )
-                        {
-                            if( !trx.meta_outputs[out_idx].is_spent() )
-                            {
-                               my->_output_index_to_ref[oidx]    = out_ref;
-                               my->_output_ref_to_index[out_ref] = oidx;
-                               my->_unspent_outputs[oidx] = trx.outputs[out_idx];
-                            }
-                            else
-                            {
-                               mark_as_spent( out_ref ); //output_reference(trx.id(), out_idx ) );
-                               //my->_spent_outputs[output_reference( trx.id(), out_idx )] = trx.outputs[out_idx];
-                            }
-                           // std::cerr<<"found block["<<i<<"].trx["<<trx_idx<<"].output["<<out_idx<<"]  " << std::string(trx.id()) <<" => "<<std::string(owner)<<"\n";
-                           found = true;
-                        }
-                        else
-                        {
-                            // std::cerr<<"skip block["<<i<<"].trx["<<trx_idx<<"].output["<<out_idx<<"] => "<<std::string(owner)<<"\n";
-                        }
-                        break;
-                     }
-                     case claim_by_bid:
-                     {
-                        auto bid = out.as<claim_by_bid_output>();
-                        auto aitr = my->_data.recv_addresses.find(bid.pay_address);
-                        if( aitr != my->_data.recv_addresses.end() )
-                        {
-                            found = true;
-                            if( trx.meta_outputs[out_idx].is_spent() )
-                            {
-                               mark_as_spent( out_ref );
-                               //my->_unspent_outputs.erase(out_ref);
-                              // my->_spent_outputs[out_ref] = trx.outputs[out_idx];
-                            }
-                            else
-                            {
-                               //my->_unspent_outputs[out_ref] = trx.outputs[out_idx];
-                               my->_output_index_to_ref[oidx]    = out_ref;
-                               my->_output_ref_to_index[out_ref] = oidx;
-                               my->_unspent_outputs[oidx] = trx.outputs[out_idx];
-                            }
-                        }
-                        else
-                        {
-                           // skip, it doesn't belong to me
-                        }
-                        break;
-                     }
-                     case claim_by_long:
-                     {
-                        auto short_sell = out.as<claim_by_long_output>();
-                        auto aitr = my->_data.recv_addresses.find(short_sell.pay_address);
-                        if( aitr != my->_data.recv_addresses.end() )
-                        {
-                            found = true;
-                            if( trx.meta_outputs[out_idx].is_spent() )
-                            {
-                               mark_as_spent( out_ref );
-                             //  my->_unspent_outputs.erase(out_ref);
-                             //  my->_spent_outputs[out_ref] = trx.outputs[out_idx];
-                            }
-                            else
-                            {
-                               my->_output_index_to_ref[oidx]    = out_ref;
-                               my->_output_ref_to_index[out_ref] = oidx;
-                               my->_unspent_outputs[oidx] = trx.outputs[out_idx];
-                            }
-                        }
-                        else
-                        {
-                           // skip, it doesn't belong to me
-                        }
-                        break;
-                     }
-                     case claim_by_cover:
-                     {
-                        auto cover = out.as<claim_by_cover_output>();
-                        auto aitr = my->_data.recv_addresses.find(cover.owner);
-                        if( aitr != my->_data.recv_addresses.end() )
-                        {
-                            found = true;
-                            if( trx.meta_outputs[out_idx].is_spent() )
-                            {
-                               mark_as_spent( out_ref );
-                               //my->_unspent_outputs.erase(out_ref);
-                               //my->_spent_outputs[out_ref] = trx.outputs[out_idx];
-                            }
-                            else
-                            {
-                               elog( "UNSPENT COVER DISCOVERED ${B}", ("B",out_ref) );
-                               //my->_unspent_outputs[out_ref] = trx.outputs[out_idx];
-                               my->_output_index_to_ref[oidx]    = out_ref;
-                               my->_output_ref_to_index[out_ref] = oidx;
-                               my->_unspent_outputs[oidx] = trx.outputs[out_idx];
-                            }
-                        }
-                        else
-                        {
-                           // skip, it doesn't belong to me
-                        }
-                        break;
-                     }
-
-                     case null_claim_type:
-                     default:
-                        FC_ASSERT( !"Invalid Claim Type" );
-                        break;
+                     my->record_output( *this, trx, output_index( i, trx_idx, out_idx ) );
+                     found = true;
                   }
               }
           }
@@ -1222,6 +1277,89 @@ namespace bts { namespace blockchain {
        return found;
    } FC_RETHROW_EXCEPTIONS( warn, "" ) }
 
+   bool wallet::parallel_scan_chain( blockchain_db& chain, uint32_t from_block_num, scan_progress_callback cb )
+   { try {
+       // the workers read the chain while this task waits, keep blocks from being applied meanwhile
+       fc::scoped_lock<fc::mutex> lock( chain.block_mutex() );
+       auto head_block_num = chain.head_block_num();
+       if( chain.has_address_index() || head_block_num == uint32_t(-1) || from_block_num >= head_block_num )
+       {
+          return scan_chain( chain, from_block_num, cb );
+       }
+
+       const std::vector<fc::thread*>& threads = worker_threads();
+       uint32_t num_blocks = head_block_num - from_block_num + 1;
+       uint32_t ranges     = std::min<uint32_t>( threads.size(), num_blocks );
+       uint32_t range_size = (num_blocks + ranges - 1) / ranges;
+
+       auto owners = my->get_owners();
+       std::unordered_set<output_reference> known_refs;
+       for( auto itr = my->_output_ref_to_index.begin(); itr != my->_output_ref_to_index.end(); ++itr )
+       {
+          known_refs.insert( itr->first );
+       }
+
+       std::vector< std::vector<detail::scan_match> > matches( ranges );
+       std::vector< fc::future<void> >               pending;
+       std::vector<uint32_t>                         range_last;
+       pending.reserve( ranges );
+       for( uint32_t r = 0; r < ranges; ++r )
+       {
+          uint32_t first = from_block_num + r * range_size;
+          uint32_t last  = std::min( first + range_size, head_block_num + 1 );
+          if( first >= last )
+          {
+             break;
+          }
+          range_last.push_back( last );
+          detail::wallet_impl* self = my.get();
+          std::vector<detail::scan_match>* result = &matches[r];
+          pending.push_back( threads[r]->async( [self,&chain,first,last,&owners,&known_refs,result]() {
+                                self->scan_range( chain, first, last, owners, known_refs, *result );
+                            } ) );
+       }
+
+       // apply each range in block order as soon as it is ready
+       bool found = false;
+       for( uint32_t r = 0; r < pending.size(); ++r )
+       {
+          try
+          {
+             pending[r].wait();
+          }
+          catch ( ... )
+          {
+             // the other ranges reference this frame, let them finish before unwinding
+             for( uint32_t o = r + 1; o < pending.size(); ++o )
+             {
+                try
+                {
+                   pending[o].wait();
+                }
+                catch ( ... )
+                {
+                }
+             }
+             throw;
+          }
+          for( auto itr = matches[r].begin(); itr != matches[r].end(); ++itr )
+          {
+             if( itr->is_input )
+             {
+                mark_as_spent( itr->ref );
+             }
+             else
+             {
+                my->record_output( *this, itr->ref, itr->index, itr->out, itr->spent );
+                found = true;
+             }
+          }
+          matches[r].clear();
+          if( cb ) cb( range_last[r] - 1, head_block_num, 0, 0 );
+       }
+       return found;
+   } FC_RETHROW_EXCEPTIONS( warn, "", ("from_block_num",from_block_num) ) }
+
    void wallet::dump()
    {
        std::cerr<<"===========================================================\n";
@@ -0,0 +1,343 @@
+#include <bts/blockchain/mempool.hpp>
+#include <fc/reflect/variant.hpp>
+#include <fc/log/logger.hpp>
+
+#include <algorithm>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace bts { namespace blockchain {
+
+   namespace detail
+   {
+      struct mempool_entry : public pending_transaction
+      {
+         mempool_entry():fees(0),eval_head(0),seq(0){}
+
+         uint64_t             fees;
+         uint32_t             eval_head; ///< head_block_num() when eval was calculated
+         uint64_t             seq;       ///< arrival order, older trxs win ties
+      };
+
+      /** highest fee per byte first */
+      struct fee_rate_greater
+      {
+         bool operator()( const mempool_entry* a, const mempool_entry* b )const
+         {
+            fc::uint128 a_rate = fc::uint128( a->fees ) * fc::uint128( b->size );
+            fc::uint128 b_rate = fc::uint128( b->fees ) * fc::uint128( a->size );
+            if( a_rate != b_rate )
+            {
+               return a_rate > b_rate;
+            }
+            return a->seq < b->seq;
+         }
+      };
+
+      class mempool_impl
+      {
+         public:
+            mempool_impl( blockchain_db& db, uint64_t max_size )
+            :_db(db),_max_size(max_size),_bytes(0),_next_seq(0),_removal_count(0){}
+
+            blockchain_db&                                                            _db;
+            uint64_t                                                                  _max_size;
+            uint64_t                                                                  _bytes;
+            uint64_t                                                                  _next_seq;
+            uint64_t                                                                  _removal_count;
+
+            std::unordered_map<transaction_id_type,std::unique_ptr<mempool_entry> >  _entries;
+            std::set<mempool_entry*,fee_rate_greater>                                 _by_fee_rate;
+            /** the pending trx spending each output */
+            std::unordered_map<output_reference,mempool_entry*>                       _spenders;
+
+            void insert( std::unique_ptr<mempool_entry> e )
+            {
+               for( auto in = e->trx.inputs.begin(); in != e->trx.inputs.end(); ++in )
+               {
+                  _spenders[in->output_ref] = e.get();
+               }
+               _by_fee_rate.insert( e.get() );
+               _bytes += e->size;
+               auto id = e->id;
+               _entries[id] = std::move(e);
+            }
+
+            void erase( mempool_entry* e )
+            {
+               for( auto in = e->trx.inputs.begin(); in != e->trx.inputs.end(); ++in )
+               {
+                  auto itr = _spenders.find( in->output_ref );
+                  if( itr != _spenders.end() && itr->second == e )
+                  {
+                     _spenders.erase( itr );
+                  }
+               }
+               _by_fee_rate.erase( e );
+               _bytes -= e->size;
+               ++_removal_count;
+               transaction_id_type id = e->id;
+               _entries.erase( id ); // deletes e
+            }
+
+            void erase_spender( const output_reference& ref )
+            {
+               auto itr = _spenders.find( ref );
+               if( itr != _spenders.end() )
+               {
+                  erase( itr->second );
+               }
+            }
+
+            void evict()
+            {
+               while( _bytes > _max_size && !_by_fee_rate.empty() )
+               {
+                  mempool_entry* lowest = *_by_fee_rate.rbegin();
+                  wlog( "mempool full, evicting ${id}", ("id",lowest->id) );
+                  erase( lowest );
+               }
+            }
+      };
+
+   } // namespace detail
+
+   mempool::mempool( blockchain_db& db, uint64_t max_size )
+   :my( new detail::mempool_impl( db, max_size ) )
+   {
+   }
+
+   mempool::~mempool(){}
+
+   bool mempool::add( const signed_transaction& trx )
+   { try {
+      auto id = trx.id();
+      if( my->_entries.find( id ) != my->_entries.end() )
+      {
+         return false;
+      }
+
+      std::unique_ptr<detail::mempool_entry> e( new detail::mempool_entry() );
+      e->trx       = trx;
+      e->id        = id;
+      e->size      = trx.size();
+      e->eval      = my->_db.evaluate_signed_transaction( trx ); // throws if invalid
+      e->eval_head = my->_db.head_block_num();
+      e->fees      = e->eval.fees.get_rounded_amount();
+      e->seq       = my->_next_seq++;
+
+      std::vector<detail::mempool_entry*> conflicts;
+      for( auto in = trx.inputs.begin(); in != trx.inputs.end(); ++in )
+      {
+         auto itr = my->_spenders.find( in->output_ref );
+         if( itr != my->_spenders.end() &&
+             std::find( conflicts.begin(), conflicts.end(), itr->second ) == conflicts.end() )
+         {
+            FC_ASSERT( detail::fee_rate_greater()( e.get(), itr->second ),
+                       "transaction conflicts with pending transaction ${id} which pays the same or higher fee",
+                       ("id",itr->second->id) );
+            conflicts.push_back( itr->second );
+         }
+      }
+      for( auto itr = conflicts.begin(); itr != conflicts.end(); ++itr )
+      {
+         ilog( "replacing pending transaction ${old} with ${new}", ("old",(*itr)->id)("new",id) );
+         my->erase( *itr );
+      }
+
+      my->insert( std::move(e) );
+      my->evict();
+      return contains( id );
+   } FC_RETHROW_EXCEPTIONS( warn, "unable to add transaction to the mempool", ("trx",trx) ) }
+
+   void mempool::remove( const transaction_id_type& id )
+   {
+      auto itr = my->_entries.find( id );
+      if( itr != my->_entries.end() )
+      {
+         my->erase( itr->second.get() );
+      }
+   }
+
+   bool mempool::contains( const transaction_id_type& id )const
+   {
+      return my->_entries.find( id ) != my->_entries.end();
+   }
+
+   void mempool::on_push_block( const trx_block& b )
+   {
+      for( auto trx = b.trxs.begin(); trx != b.trxs.end(); ++trx )
+      {
+         remove( trx->id() );
+      }
+      // any other trx spending the same outputs is now a double spend
+      for( auto trx = b.trxs.begin(); trx != b.trxs.end(); ++trx )
+      {
+         for( auto in = trx->inputs.begin(); in != trx->inputs.end(); ++in )
+         {
+            my->erase_spender( in->output_ref );
+         }
+      }
+   }
+
+   void mempool::on_pop_block( const std::vector<signed_transaction>& trxs )
+   {
+      for( auto trx = trxs.begin(); trx != trxs.end(); ++trx )
+      {
+         auto trx_id = trx->id();
+         for( uint16_t i = 0; i < trx->outputs.size(); ++i )
+         {
+            my->erase_spender( output_reference( trx_id, i ) );
+         }
+      }
+      for( auto trx = trxs.begin(); trx != trxs.end(); ++trx )
+      {
+         try
+         {
+            add( *trx );
+         }
+         catch ( const fc::exception& e )
+         {
+            ilog( "not returning ${id} to the mempool", ("id",trx->id()) );
+         }
+      }
+   }
+
+   void mempool::reorganize_to( const std::vector<trx_block>& fork )
+   { try {
+      std::vector<signed_transaction> orphaned;
+      my->_db.reorganize_to( fork, orphaned );
+
+      std::unordered_set<transaction_id_type> included;
+      for( auto blk = fork.begin(); blk != fork.end(); ++blk )
+      {
+         on_push_block( *blk );
+         for( auto trx = blk->trxs.begin(); trx != blk->trxs.end(); ++trx )
+         {
+            included.insert( trx->id() );
+         }
+      }
+
+      // trxs the fork included again keep their outputs and must not be returned
+      std::vector<signed_transaction> returned;
+      for( auto trx = orphaned.begin(); trx != orphaned.end(); ++trx )
+      {
+         if( included.find( trx->id() ) == included.end() )
+         {
+            returned.push_back( *trx );
+         }
+      }
+      on_pop_block( returned );
+   } FC_RETHROW_EXCEPTIONS( warn, "", ("fork_size",fork.size()) ) }
+
+   void mempool::select( std::vector<signed_transaction>& trxs, std::vector<trx_eval>& evals, uint64_t max_size )
+   {
+      std::vector<pending_transaction> selected;
+      select( selected, max_size );
+      trxs.reserve( trxs.size() + selected.size() );
+      evals.reserve( evals.size() + selected.size() );
+      for( auto itr = selected.begin(); itr != selected.end(); ++itr )
+      {
+         trxs.push_back( std::move(itr->trx) );
+         evals.push_back( itr->eval );
+      }
+   }
+
+   void mempool::select( std::vector<pending_transaction>& selected, uint64_t max_size )
+   { try {
+      uint32_t head     = my->_db.head_block_num();
+      uint64_t fee_rate = my->_db.get_fee_rate().get_rounded_amount();
+      uint64_t total    = 0;
+
+      std::vector<detail::mempool_entry*>                         invalid;
+      /** entries whose fees changed, they are moved in _by_fee_rate once the walk is done */
+      std::vector< std::pair<detail::mempool_entry*,uint64_t> >   repriced;
+      for( auto itr = my->_by_fee_rate.begin(); itr != my->_by_fee_rate.end() && total < max_size; ++itr )
+      {
+         detail::mempool_entry* e = *itr;
+         if( e->fees < fee_rate * e->size )
+         {
+            break; // every trx after this one pays less
+         }
+         if( total + e->size > max_size )
+         {
+            continue;
+         }
+         if( e->eval_head != head )
+         {
+            // coindays destroyed and the stake depend upon the head block
+            try
+            {
+               e->eval      = my->_db.evaluate_signed_transaction( e->trx );
+               e->eval_head = head;
+            }
+            catch ( const fc::exception& ex )
+            {
+               wlog( "dropping pending transaction ${id}\n${e}", ("id",e->id)("e",ex.to_detail_string()) );
+               invalid.push_back( e );
+               continue;
+            }
+            uint64_t fees = e->eval.fees.get_rounded_amount();
+            if( fees != e->fees )
+            {
+               repriced.push_back( std::make_pair( e, fees ) );
+               if( fees < fee_rate * e->size )
+               {
+                  continue;
+               }
+            }
+         }
+         selected.push_back( *e );
+         total += e->size;
+      }
+
+      for( auto itr = repriced.begin(); itr != repriced.end(); ++itr )
+      {
+         my->_by_fee_rate.erase( itr->first );
+         itr->first->fees = itr->second;
+         my->_by_fee_rate.insert( itr->first );
+      }
+      for( auto itr = invalid.begin(); itr != invalid.end(); ++itr )
+      {
+         my->erase( *itr );
+      }
+   } FC_RETHROW_EXCEPTIONS( warn, "" ) }
+
+   fc::optional<pending_transaction> mempool::get_pending( const transaction_id_type& id )const
+   {
+      auto itr = my->_entries.find( id );
+      if( itr == my->_entries.end() || itr->second->eval_head != my->_db.head_block_num() )
+      {
+         return fc::optional<pending_transaction>();
+      }
+      return pending_transaction( *itr->second );
+   }
+
+   std::vector<signed_transaction> mempool::get_transactions()const
+   {
+      std::vector<signed_transaction> trxs;
+      trxs.reserve( my->_by_fee_rate.size() );
+      for( auto itr = my->_by_fee_rate.begin(); itr != my->_by_fee_rate.end(); ++itr )
+      {
+         trxs.push_back( (*itr)->trx );
+      }
+      return trxs;
+   }
+
+   uint32_t mempool::size()const
+   {
+      return my->_entries.size();
+   }
+
+   uint64_t mempool::bytes()const
+   {
+      return my->_bytes;
+   }
+
+   uint64_t mempool::removal_count()const
+   {
+      return my->_removal_count;
+   }
+
+} } // bts::blockchain
@@ -0,0 +1,65 @@
+#include <bts/blockchain/signature_recovery.hpp>
+#include <bts/blockchain/worker_threads.hpp>
+#include <fc/thread/thread.hpp>
+#include <fc/thread/future.hpp>
+#include <fc/log/logger.hpp>
+
+#include <algorithm>
+
+namespace bts { namespace blockchain {
+
+   namespace detail
+   {
+      static void recover_range( const std::vector<signed_transaction>& trxs, 
+                                 std::vector< fc::optional<signer_set> >& result,
+                                 size_t first, size_t last )
+      {
+         for( size_t i = first; i < last; ++i )
+         {
+            try 
+            {
+               result[i] = trxs[i].get_signed_addresses();
+            } 
+            catch ( const fc::exception& e )
+            {
+               wlog( "unable to recover signatures of trx ${i}: ${e}", ("i",i)("e",e.to_string()) );
+            }
+         }
+      }
+   } // namespace detail
+
+   std::vector< fc::optional<signer_set> > recover_signed_addresses( const std::vector<signed_transaction>& trxs )
+   {
+      std::vector< fc::optional<signer_set> > result( trxs.size() );
+      if( trxs.size() < 2 )
+      {
+         detail::recover_range( trxs, result, 0, trxs.size() );
+         return result;
+      }
+
+      const std::vector<fc::thread*>& threads = worker_threads();
+      size_t chunks     = std::min( threads.size(), trxs.size() );
+      size_t chunk_size = (trxs.size() + chunks - 1) / chunks;
+
+      std::vector< fc::future<void> > pending;
+      pending.reserve( chunks );
+      for( size_t c = 0; c < chunks; ++c )
+      {
+         size_t first = c * chunk_size;
+         size_t last  = std::min( first + chunk_size, trxs.size() );
+         if( first >= last )
+         {
+            break;
+         }
+         pending.push_back( threads[c]->async( [&trxs,&result,first,last]() { 
+                                detail::recover_range( trxs, result, first, last ); 
+                            } ) );
+      }
+      for( auto itr = pending.begin(); itr != pending.end(); ++itr )
+      {
+         itr->wait();
+      }
+      return result;
+   }
+
+} } // bts::blockchain
@@ -0,0 +1,195 @@
+#include <bts/blockchain/signer_cache.hpp>
+#include <fc/crypto/city.hpp>
+#include <fc/optional.hpp>
+
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+namespace bts { namespace blockchain {
+
+   namespace detail
+   {
+      struct signature_key
+      {
+         fc::sha256                  digest;
+         fc::ecc::compact_signature  sig;
+
+         friend bool operator == ( const signature_key& a, const signature_key& b )
+         {
+            return a.digest == b.digest && a.sig == b.sig;
+         }
+      };
+
+      struct signature_key_hash
+      {
+         size_t operator()( const signature_key& k )const
+         {
+            // the digest is already a hash, mixing in the signature separates multi-sig trxs
+            return fc::city_hash64( (const char*)&k.digest, sizeof(k.digest) ) ^ 
+                   fc::city_hash64( (const char*)k.sig.data, sizeof(k.sig.data) );
+         }
+      };
+
+      struct recovered_signer
+      {
+         address                                      addr;
+         fc::optional< std::vector<pts_address> >     pts_addrs;
+      };
+
+      class signer_cache_impl
+      {
+         public:
+            typedef std::list< std::pair<signature_key,recovered_signer> >                         lru_list;
+            typedef std::unordered_map<signature_key, lru_list::iterator, signature_key_hash>      index_map;
+
+            signer_cache_impl( uint32_t max ):_max_entries(max),_hits(0),_misses(0){}
+
+            mutable std::mutex     _mutex;
+            lru_list               _lru; // most recently used first
+            index_map              _index;
+            uint32_t               _max_entries;
+            std::atomic<uint64_t>  _hits;
+            std::atomic<uint64_t>  _misses;
+
+            /** @pre _mutex is locked */
+            recovered_signer* find( const signature_key& k )
+            {
+               auto itr = _index.find( k );
+               if( itr == _index.end() )
+               {
+                  return nullptr;
+               }
+               _lru.splice( _lru.begin(), _lru, itr->second );
+               return &itr->second->second;
+            }
+
+            /** @pre _mutex is locked */
+            recovered_signer& insert( const signature_key& k, const recovered_signer& r )
+            {
+               auto existing = find( k );
+               if( existing )
+               {
+                  return *existing;
+               }
+               _lru.push_front( std::make_pair( k, r ) );
+               _index[k] = _lru.begin();
+               evict();
+               return _lru.front().second;
+            }
+
+            /** @pre _mutex is locked */
+            void evict()
+            {
+               while( _lru.size() > _max_entries )
+               {
+                  _index.erase( _lru.back().first );
+                  _lru.pop_back();
+               }
+            }
+      };
+
+      static std::vector<pts_address> pts_addresses_of( const fc::ecc::public_key& pub )
+      {
+         auto signed_key_data = pub.serialize();
+         std::vector<pts_address> r;
+         r.reserve( 4 );
+         // note: 56 is the version bit of protoshares
+         r.push_back( pts_address(fc::ecc::public_key( signed_key_data ),false,56) );
+         r.push_back( pts_address(fc::ecc::public_key( signed_key_data ),true,56) );
+         // note: 5 comes from en.bitcoin.it/wiki/Vanitygen where version bit is 0
+         r.push_back( pts_address(fc::ecc::public_key( signed_key_data ),false,0) );
+         r.push_back( pts_address(fc::ecc::public_key( signed_key_data ),true,0) );
+         return r;
+      }
+   } // namespace detail
+
+   signer_cache& signer_cache::instance()
+   {
+      static signer_cache cache;
+      return cache;
+   }
+
+   signer_cache::signer_cache( uint32_t max_entries )
+   :my( new detail::signer_cache_impl( max_entries ) )
+   {
+   }
+
+   signer_cache::~signer_cache(){}
+
+   address signer_cache::get_address( const fc::sha256& digest, const fc::ecc::compact_signature& sig )
+   {
+      detail::signature_key key;
+      key.digest = digest;
+      key.sig    = sig;
+      {
+         std::lock_guard<std::mutex> lock( my->_mutex );
+         auto cached = my->find( key );
+         if( cached )
+         {
+            ++my->_hits;
+            return cached->addr;
+         }
+      }
+      ++my->_misses;
+
+      // recover without holding the lock so that other threads may do the same
+      detail::recovered_signer r;
+      r.addr = address( fc::ecc::public_key( sig, digest ) );
+
+      std::lock_guard<std::mutex> lock( my->_mutex );
+      return my->insert( key, r ).addr;
+   }
+
+   std::vector<pts_address> signer_cache::get_pts_addresses( const fc::sha256& digest, const fc::ecc::compact_signature& sig )
+   {
+      detail::signature_key key;
+      key.digest = digest;
+      key.sig    = sig;
+      {
+         std::lock_guard<std::mutex> lock( my->_mutex );
+         auto cached = my->find( key );
+         if( cached && cached->pts_addrs )
+         {
+            ++my->_hits;
+            return *cached->pts_addrs;
+         }
+      }
+      ++my->_misses;
+
+      fc::ecc::public_key pub( sig, digest );
+      detail::recovered_signer r;
+      r.addr      = address( pub );
+      r.pts_addrs = detail::pts_addresses_of( pub );
+
+      std::lock_guard<std::mutex> lock( my->_mutex );
+      auto& entry = my->insert( key, r );
+      entry.pts_addrs = r.pts_addrs;
+      return *r.pts_addrs;
+   }
+
+   void signer_cache::set_max_entries( uint32_t max_entries )
+   {
+      std::lock_guard<std::mutex> lock( my->_mutex );
+      my->_max_entries = max_entries;
+      my->evict();
+   }
+
+   uint32_t signer_cache::size()const
+   {
+      std::lock_guard<std::mutex> lock( my->_mutex );
+      return my->_lru.size();
+   }
+
+   uint64_t signer_cache::hits()const   { return my->_hits;   }
+   uint64_t signer_cache::misses()const { return my->_misses; }
+
+   void signer_cache::clear()
+   {
+      std::lock_guard<std::mutex> lock( my->_mutex );
+      my->_lru.clear();
+      my->_index.clear();
+   }
+
+} } // bts::blockchain
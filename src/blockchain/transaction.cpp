@@ -1,5 +1,6 @@
 #include <bts/address.hpp>
 #include <bts/blockchain/transaction.hpp>
+#include <bts/blockchain/signer_cache.hpp>
 #include <fc/reflect/variant.hpp>
 #include <fc/io/raw.hpp>
 
@@ -20,7 +21,7 @@ namespace bts { namespace blockchain {
        std::unordered_set<address> r;
        for( auto itr = sigs.begin(); itr != sigs.end(); ++itr )
        {
-            r.insert( address(fc::ecc::public_key( *itr, dig )) );
+            r.insert( signer_cache::instance().get_address( dig, *itr ) );
        }
        return r;
    }
@@ -32,16 +33,8 @@ namespace bts { namespace blockchain {
        // add both compressed and uncompressed forms...
        for( auto itr = sigs.begin(); itr != sigs.end(); ++itr )
        {
-            auto signed_key_data = fc::ecc::public_key( *itr, dig ).serialize();
-            auto signed_key_point = fc::ecc::public_key( *itr, dig ).serialize_ecc_point();
-
-            
-            // note: 56 is the version bit of protoshares
-            r.insert( pts_address(fc::ecc::public_key( signed_key_data),false,56) );
-            r.insert( pts_address(fc::ecc::public_key( signed_key_data ),true,56) );
-            // note: 5 comes from en.bitcoin.it/wiki/Vanitygen where version bit is 0
-            r.insert( pts_address(fc::ecc::public_key( signed_key_data ),false,0) );
-            r.insert( pts_address(fc::ecc::public_key( signed_key_data ),true,0) );
+            auto pts_addrs = signer_cache::instance().get_pts_addresses( dig, *itr );
+            r.insert( pts_addrs.begin(), pts_addrs.end() );
        }
        ilog( "${signed_addr}", ("signed_addr",r) );
        return r;
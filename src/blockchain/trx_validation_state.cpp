@@ -8,34 +8,51 @@
 
 namespace bts  { namespace blockchain { 
 
-trx_validation_state::trx_validation_state( const signed_transaction& t, blockchain_db* d, bool enf, uint32_t h )
-:allow_short_long_matching(false),
- prev_block_id1(0),prev_block_id2(0),trx(t),total_cdd(0),uncounted_cdd(0),balance_sheet( asset::count ),db(d),enforce_unspent(enf),ref_head(h)
+trx_validation_state::trx_validation_state( const signed_transaction& t, blockchain_db* d, bool enf, uint32_t h,
+                                            const std::unordered_set<address>* signers )
 { 
-  inputs  = d->fetch_inputs( t.inputs, ref_head );
+  reset( t, d, enf, h, signers );
+}
+
+void trx_validation_state::reset( const signed_transaction& t, blockchain_db* d, bool enf, uint32_t h,
+                                  const std::unordered_set<address>* signers )
+{
+  allow_short_long_matching = false;
+  trx             = &t;
+  total_cdd       = 0;
+  uncounted_cdd   = 0;
+  prev_block_id1  = 0;
+  prev_block_id2  = 0;
+  db              = d;
+  enforce_unspent = enf;
+  ref_head        = h;
+  dividend_fees   = asset();
+  dividends       = asset();
+  balance_sheet.clear();
+  used_outputs.clear();
+  required_sigs.clear();
+
+  d->fetch_inputs( t.inputs, ref_head, inputs );
   if( ref_head == std::numeric_limits<uint32_t>::max()  )
   {
     ref_head = d->head_block_num();
   }
 
-  for( auto i = 0; i < asset::count; ++i )
+  if( signers )
   {
-    balance_sheet[i].in.unit          = (asset::type)i;
-    balance_sheet[i].neg_in.unit      = (asset::type)i;
-    balance_sheet[i].collat_in.unit   = (asset::bts);
-
-    balance_sheet[i].out.unit         = (asset::type)i;
-    balance_sheet[i].collat_out.unit  = (asset::bts);
-    balance_sheet[i].neg_out.unit     = (asset::type)i;
+    signed_addresses = *signers;
+  }
+  else
+  {
+    signed_addresses = t.get_signed_addresses();
   }
-  signed_addresses = t.get_signed_addresses();
 }
 
 void trx_validation_state::validate()
 {
   try
   {
-     FC_ASSERT( trx.inputs.size() == inputs.size() );
+     FC_ASSERT( trx->inputs.size() == inputs.size() );
      
      if( enforce_unspent )
      {
@@ -45,7 +62,7 @@ void trx_validation_state::validate()
           {
              FC_THROW_EXCEPTION( exception, 
                 "input [${iidx}] = references output which was already spent",
-                ("iidx",i)("input",trx.inputs[i])("output",inputs[i]) );
+                ("iidx",i)("input",trx->inputs[i])("output",inputs[i]) );
           }
        }
      }
@@ -53,30 +70,30 @@ void trx_validation_state::validate()
      for( uint32_t i = 0; i < inputs.size(); ++i )
      {
        try {
-         validate_input( inputs[i] ); 
+         validate_input( trx->inputs[i], inputs[i] ); 
        } FC_RETHROW_EXCEPTIONS( warn, "error validating input ${i}", ("i",i) );
      }
 
-     for( uint32_t i = 0; i < trx.outputs.size(); ++i )
+     for( uint32_t i = 0; i < trx->outputs.size(); ++i )
      {
        try {
-         validate_output( trx.outputs[i] ); 
+         validate_output( trx->outputs[i] ); 
        } FC_RETHROW_EXCEPTIONS( warn, "error validating output ${i}", ("i",i) );
      }
      
-     for( uint32_t i = 1; i < balance_sheet.size(); ++i )
+     for( auto itr = balance_sheet.begin(); itr != balance_sheet.end(); ++itr )
      {
-        if( balance_sheet[i].creates_money() )
+        if( itr->first != asset::bts && itr->second.creates_money() )
         {
             FC_THROW_EXCEPTION( exception, "input value ${in} does not match output value ${out}",
-                               ("in", std::string(balance_sheet[i].in))( "out", std::string(balance_sheet[i].out) ) );
+                               ("in", std::string(itr->second.in))( "out", std::string(itr->second.out) ) );
                            
         }
      }
 
      if( !signed_addresses.size() )
      {
-        signed_addresses =  trx.get_signed_addresses();
+        signed_addresses =  trx->get_signed_addresses();
      }
      std::vector<address> missing;
      for( auto itr  = required_sigs.begin(); itr != required_sigs.end(); ++itr )
@@ -102,24 +119,35 @@ void trx_validation_state::validate()
 } // validate 
 
 
-void trx_validation_state::validate_input( const meta_trx_input& in )
+template<typename ClaimType>
+ClaimType trx_validation_state::input_claim( const trx_input& ref, const meta_trx_input& in )const
+{
+     ClaimType claim;
+     if( !db->fetch_claim( ref.output_ref, claim ) )
+     {
+        claim = in.output.as<ClaimType>();
+     }
+     return claim;
+}
+
+void trx_validation_state::validate_input( const trx_input& ref, const meta_trx_input& in )
 {
      switch( in.output.claim_func )
      {
         case claim_by_signature:
-          validate_signature( in );
+          validate_signature( in, input_claim<claim_by_signature_output>( ref, in ) );
           return;
         case claim_by_pts:
-          validate_pts( in );
+          validate_pts( in, input_claim<claim_by_pts_output>( ref, in ) );
           return;
         case claim_by_bid:
-          validate_bid( in );
+          validate_bid( in, input_claim<claim_by_bid_output>( ref, in ) );
           return;
         case claim_by_long:
-          validate_long( in );
+          validate_long( in, input_claim<claim_by_long_output>( ref, in ) );
           return;
         case claim_by_cover:
-          validate_cover( in );
+          validate_cover( in, input_claim<claim_by_cover_output>( ref, in ) );
           return;
         case claim_by_opt_execute:
           validate_opt( in );
@@ -177,13 +205,38 @@ void trx_validation_state::validate_output( const trx_output& out )
      }
 } // validate_output
 
+trx_validation_state::asset_balance& trx_validation_state::balance( asset::type unit )
+{
+   for( auto itr = balance_sheet.begin(); itr != balance_sheet.end(); ++itr )
+   {
+      if( itr->first == unit )
+      {
+         return itr->second;
+      }
+   }
+   balance_sheet.push_back( std::make_pair( unit, asset_balance( unit ) ) );
+   return balance_sheet.back().second;
+}
+
+trx_validation_state::asset_balance trx_validation_state::get_balance( asset::type unit )const
+{
+   for( auto itr = balance_sheet.begin(); itr != balance_sheet.end(); ++itr )
+   {
+      if( itr->first == unit )
+      {
+         return itr->second;
+      }
+   }
+   return asset_balance( unit );
+}
+
 void trx_validation_state::validate_pts( const trx_output& o )
 {
    auto cbs = o.as<claim_by_pts_output>();
    ilog( "${cbs}", ("cbs",cbs));
    FC_ASSERT( cbs.owner != pts_address() );
 
-   balance_sheet[(asset::type)o.amount.unit].out += o.amount;
+   balance( (asset::type)o.amount.unit ).out += o.amount;
    
 }
 void trx_validation_state::validate_signature( const trx_output& o )
@@ -192,7 +245,7 @@ void trx_validation_state::validate_signature( const trx_output& o )
    ilog( "${cbs}", ("cbs",cbs));
    FC_ASSERT( cbs.owner != address() );
 
-   balance_sheet[(asset::type)o.amount.unit].out += o.amount;
+   balance( (asset::type)o.amount.unit ).out += o.amount;
    
 }
 void trx_validation_state::validate_bid( const trx_output& o )
@@ -205,7 +258,7 @@ void trx_validation_state::validate_bid( const trx_output& o )
    FC_ASSERT( bid.ask_price.base_unit != bid.ask_price.quote_unit );
    FC_ASSERT( bid.ask_price.base_unit.value < bid.ask_price.quote_unit.value );
 
-   balance_sheet[(asset::type)o.amount.unit].out += o.amount; 
+   balance( (asset::type)o.amount.unit ).out += o.amount; 
 }
 void trx_validation_state::validate_long( const trx_output& o )
 {
@@ -214,7 +267,7 @@ void trx_validation_state::validate_long( const trx_output& o )
    FC_ASSERT( long_claim.ask_price.base_unit != long_claim.ask_price.quote_unit );
    FC_ASSERT( long_claim.ask_price.base_unit.value < long_claim.ask_price.quote_unit.value );
 
-   balance_sheet[(asset::type)o.amount.unit].out += o.amount; 
+   balance( (asset::type)o.amount.unit ).out += o.amount; 
 
 }
 
@@ -230,11 +283,11 @@ void trx_validation_state::validate_cover( const trx_output& o )
    auto cover_claim = o.as<claim_by_cover_output>();
    try {
       auto payoff_unit = (asset::type)cover_claim.payoff.unit;
-      balance_sheet[(asset::type)o.amount.unit].out += o.amount;
-      balance_sheet[payoff_unit].neg_out += cover_claim.payoff;
-      if( balance_sheet[payoff_unit].collat_in != asset() )
+      balance( (asset::type)o.amount.unit ).out += o.amount;
+      balance( payoff_unit ).neg_out += cover_claim.payoff;
+      if( balance( payoff_unit ).collat_in != asset() )
       {
-         auto req_price =  balance_sheet[payoff_unit].collat_in / balance_sheet[payoff_unit].neg_in;
+         auto req_price =  balance( payoff_unit ).collat_in / balance( payoff_unit ).neg_in;
          // TODO: verify this should be <= instead of >=
          FC_ASSERT( req_price >= o.amount / cover_claim.payoff, "",
                     ("req_price",req_price)( "amnt", o.amount )( "payoff", cover_claim.payoff)("new_price", 
@@ -261,29 +314,28 @@ void trx_validation_state::validate_password( const trx_output& o )
 }
 
 
-void trx_validation_state::validate_pts( const meta_trx_input& in )
+void trx_validation_state::validate_pts( const meta_trx_input& in, const claim_by_pts_output& pts_claim )
 {
    try {
-      auto pts_claim = in.output.as<claim_by_pts_output>();
-      auto pts_addrs = trx.get_signed_pts_addresses();
-      auto addrs = trx.get_signed_addresses();
+      auto pts_addrs = trx->get_signed_pts_addresses();
+      auto addrs = trx->get_signed_addresses();
 
       FC_ASSERT( pts_addrs.find( pts_claim.owner ) != pts_addrs.end(),
                 "Unable to find signature by ${owner}", ("owner",pts_claim.owner)("signedby",pts_addrs)("addrs",addrs) );
 
-      balance_sheet[(asset::type)in.output.amount.unit].in += in.output.amount;
+      balance( (asset::type)in.output.amount.unit ).in += in.output.amount;
 
       if( in.output.amount.unit == asset::bts )
       {
          //  only count if trx proof of stake prev == one of the last two blocks
-         if( trx.stake == prev_block_id1 || trx.stake == prev_block_id2 )
+         if( trx->stake == prev_block_id1 || trx->stake == prev_block_id2 )
          {
             total_cdd += in.output.amount.get_rounded_amount() * (ref_head-in.source.block_num);
          }
          else
          {
             uncounted_cdd += in.output.amount.get_rounded_amount() * (ref_head-in.source.block_num);
-            wlog( "stake ${s} != ${a} || ${b}", ("s",trx.stake)("a",prev_block_id1)("b",prev_block_id2) );
+            wlog( "stake ${s} != ${a} || ${b}", ("s",trx->stake)("a",prev_block_id1)("b",prev_block_id2) );
          }
       }
    } FC_RETHROW_EXCEPTIONS( warn, "validating pts input ${i}", ("i",in) ) 
@@ -302,25 +354,24 @@ void trx_validation_state::validate_pts( const meta_trx_input& in )
  *        sourced from an unvested trx, the new trx is also 'unvested' until
  *        the most receint input is fully vested.
  */
-void trx_validation_state::validate_signature( const meta_trx_input& in )
+void trx_validation_state::validate_signature( const meta_trx_input& in, const claim_by_signature_output& cbs )
 {
    try {
-       auto cbs = in.output.as<claim_by_signature_output>();
        ilog( "${cbs}", ("cbs",cbs));
        required_sigs.insert( cbs.owner );
 
-       balance_sheet[(asset::type)in.output.amount.unit].in += in.output.amount; //output_bal;
+       balance( (asset::type)in.output.amount.unit ).in += in.output.amount; //output_bal;
        if( in.output.amount.unit == asset::bts )
        {
           //  only count if trx proof of stake prev == one of the last two blocks
-          if( trx.stake == prev_block_id1 || trx.stake == prev_block_id2 )
+          if( trx->stake == prev_block_id1 || trx->stake == prev_block_id2 )
           {
              total_cdd += in.output.amount.get_rounded_amount() * (ref_head-in.source.block_num);
           }
           else
           {
              uncounted_cdd += in.output.amount.get_rounded_amount() * (ref_head-in.source.block_num);
-             wlog( "stake ${s} != ${a} || ${b}", ("s",trx.stake)("a",prev_block_id1)("b",prev_block_id2) );
+             wlog( "stake ${s} != ${a} || ${b}", ("s",trx->stake)("a",prev_block_id1)("b",prev_block_id2) );
           }
        }
    } FC_RETHROW_EXCEPTIONS( warn, "validating signature input ${i}", ("i",in) );
@@ -336,11 +387,10 @@ void trx_validation_state::validate_signature( const meta_trx_input& in )
  *       - left-over-bid sent to new output with same terms.
  *       - accepted and change bids > min amount
  */
-void trx_validation_state::validate_bid( const meta_trx_input& in )
+void trx_validation_state::validate_bid( const meta_trx_input& in, const claim_by_bid_output& cbb )
 { try {
-    auto cbb = in.output.as<claim_by_bid_output>();
    
-    balance_sheet[(asset::type)in.output.amount.unit].in += in.output.amount;
+    balance( (asset::type)in.output.amount.unit ).in += in.output.amount;
 
     wlog( "      *** SIGNED BY ***     \n ${signed} \n ", ("signed", signed_addresses) );
 
@@ -349,7 +399,7 @@ void trx_validation_state::validate_bid( const meta_trx_input& in )
     {
        //balance_sheet[asset::bts].in += output_bal; 
 
-       balance_sheet[uint8_t(in.output.amount.unit)].in += in.output.amount;  
+       balance( (asset::type)in.output.amount.unit ).in += in.output.amount;  
     }
     else // someone else accepted the offer based upon the terms of the bid.
     {
@@ -368,7 +418,7 @@ void trx_validation_state::validate_bid( const meta_trx_input& in )
        else // look for change, must be a partial order
        {
          mark_output_as_used( split_order );
-         const trx_output& split_out = trx.outputs[split_order];
+         const trx_output& split_out = trx->outputs[split_order];
          auto split_claim = split_out.as<claim_by_bid_output>();
          ilog( "in  bid: ${claim} in: ${in}", ( "claim", cbb)("in",in) );
          ilog( "split bid: ${claim}", ( "claim", split_claim) );
@@ -398,17 +448,16 @@ void trx_validation_state::validate_bid( const meta_trx_input& in )
  *  by going long.   When taken as an input the output set must contain an
  *  unused cover output, along with the 
  */
-void trx_validation_state::validate_long( const meta_trx_input& in )
+void trx_validation_state::validate_long( const meta_trx_input& in, const claim_by_long_output& long_claim )
 { try {
-    auto long_claim = in.output.as<claim_by_long_output>();
     const asset& output_bal = in.output.amount; //( in.output.amount, in.output.unit );
-    balance_sheet[(asset::type)in.output.amount.unit].in += output_bal;
+    balance( (asset::type)in.output.amount.unit ).in += output_bal;
     
     if( signed_addresses.find( long_claim.pay_address ) != signed_addresses.end() )
     {
         // canceled orders can reclaim their dividends (assuming the order has been open long enough)
         //balance_sheet[asset::bts].in += output_bal;
-       balance_sheet[uint8_t(in.output.amount.unit)].in += output_bal;  
+       balance( (asset::type)in.output.amount.unit ).in += output_bal;  
     }
     else // someone else accepted the offer based on terms of the long
     {
@@ -427,7 +476,7 @@ void trx_validation_state::validate_long( const meta_trx_input& in )
        else // look for change
        {
          mark_output_as_used( split_order );
-         const trx_output& split_out = trx.outputs[split_order];
+         const trx_output& split_out = trx->outputs[split_order];
          auto split_claim = split_out.as<claim_by_long_output>();
          ilog( "in  bid: ${claim} in: ${in}", ( "claim", long_claim)("in",in) );
          ilog( "split bid: ${claim}", ( "claim", split_claim) );
@@ -455,16 +504,15 @@ void trx_validation_state::validate_long( const meta_trx_input& in )
     }
 } FC_RETHROW_EXCEPTIONS( warn, "", ("in",in) ) } // validate_long
 
-void trx_validation_state::validate_cover( const meta_trx_input& in )
+void trx_validation_state::validate_cover( const meta_trx_input& in, const claim_by_cover_output& cover_in )
 {
-   auto cover_in = in.output.as<claim_by_cover_output>();
     
-   balance_sheet[(asset::type)in.output.amount.unit].in += in.output.amount;
-   balance_sheet[(asset::type)cover_in.payoff.unit].neg_in += cover_in.payoff;
+   balance( (asset::type)in.output.amount.unit ).in += in.output.amount;
+   balance( (asset::type)cover_in.payoff.unit ).neg_in += cover_in.payoff;
    // track collateral for payoff unit
-   balance_sheet[(asset::type)cover_in.payoff.unit].collat_in += in.output.amount;
+   balance( (asset::type)cover_in.payoff.unit ).collat_in += in.output.amount;
 
-   if( trx.stake == prev_block_id1 || trx.stake == prev_block_id2 )
+   if( trx->stake == prev_block_id1 || trx->stake == prev_block_id2 )
    {
       total_cdd += in.output.amount.get_rounded_amount() * (ref_head-in.source.block_num);
    }
@@ -499,22 +547,22 @@ void trx_validation_state::mark_output_as_used( uint16_t output_number )
 uint16_t trx_validation_state::find_unused_sig_output( const address& owner, const asset& bal )
 { try {
   ilog( "find unused sig output ${o}  ${bal}", ("o", owner)("bal",bal) );
-  for( uint32_t i = 0; i < trx.outputs.size(); ++i )
+  for( uint32_t i = 0; i < trx->outputs.size(); ++i )
   {
      if( used_outputs.find(i) == used_outputs.end() )
      {
-        ilog( "out: ${i}", ("i",trx.outputs[i]) );
-        if( trx.outputs[i].claim_func == claim_by_signature )
+        ilog( "out: ${i}", ("i",trx->outputs[i]) );
+        if( trx->outputs[i].claim_func == claim_by_signature )
         {
-           //ilog( "amount: ${i} ==? ${r} ", ("i",trx.outputs[i].amount)("r",rounded_amount) );
-           //ilog( "round down amount: ${i} ==? ${r} ", ("i",trx.outputs[i].amount/10)("r",rounded_amount.amount.high_bits()/10) );
-           //auto delta = int64_t(trx.outputs[i].amount) - int64_t(bal.amount.high_bits());
+           //ilog( "amount: ${i} ==? ${r} ", ("i",trx->outputs[i].amount)("r",rounded_amount) );
+           //ilog( "round down amount: ${i} ==? ${r} ", ("i",trx->outputs[i].amount/10)("r",rounded_amount.amount.high_bits()/10) );
+           //auto delta = int64_t(trx->outputs[i].amount) - int64_t(bal.amount.high_bits());
            //ilog( "delta ${d}", ("d",delta) );
-           //if( abs(delta) < 5  && trx.outputs[i].unit == bal.unit )
-           if( trx.outputs[i].amount.unit == bal.unit &&
-               trx.outputs[i].amount.get_rounded_amount() == bal.get_rounded_amount() )
+           //if( abs(delta) < 5  && trx->outputs[i].unit == bal.unit )
+           if( trx->outputs[i].amount.unit == bal.unit &&
+               trx->outputs[i].amount.get_rounded_amount() == bal.get_rounded_amount() )
            {
-              if( trx.outputs[i].as<claim_by_signature_output>().owner == owner )
+              if( trx->outputs[i].as<claim_by_signature_output>().owner == owner )
               {
                  return i;
               }
@@ -531,17 +579,18 @@ uint16_t trx_validation_state::find_unused_sig_output( const address& owner, con
  */
 uint16_t trx_validation_state::find_unused_bid_output( const claim_by_bid_output& bid_claim )
 {
-  for( uint32_t i = 0; i < trx.outputs.size(); ++i )
+  for( uint32_t i = 0; i < trx->outputs.size(); ++i )
   {
      ilog( "${i} used: ${u}", ("i",i)("u", used_outputs) );
      auto used_out = used_outputs.find(i);
      if( used_out == used_outputs.end() )
      {
-        ilog( "out: ${i}", ("i",trx.outputs[i]) );
-        if( trx.outputs[i].claim_func == claim_by_bid )
+        ilog( "out: ${i}", ("i",trx->outputs[i]) );
+        if( trx->outputs[i].claim_func == claim_by_bid )
         {
-           ilog( "claim by bid ${i} ==? ${e} ", ("i",trx.outputs[i].as<claim_by_bid_output>())("e",bid_claim) );
-           if( trx.outputs[i].as<claim_by_bid_output>() == bid_claim )
+           auto out_claim = trx->outputs[i].as<claim_by_bid_output>();
+           ilog( "claim by bid ${i} ==? ${e} ", ("i",out_claim)("e",bid_claim) );
+           if( out_claim == bid_claim )
            {
               ilog( "return found! ${i}", ("i",i) );
               return i;
@@ -554,17 +603,18 @@ uint16_t trx_validation_state::find_unused_bid_output( const claim_by_bid_output
 
 uint16_t trx_validation_state::find_unused_long_output( const claim_by_long_output& long_claim )
 {
-  for( uint32_t i = 0; i < trx.outputs.size(); ++i )
+  for( uint32_t i = 0; i < trx->outputs.size(); ++i )
   {
      ilog( "${i} used: ${u}", ("i",i)("u", used_outputs) );
      auto used_out = used_outputs.find(i);
      if( used_out == used_outputs.end() )
      {
-        ilog( "out: ${i}", ("i",trx.outputs[i]) );
-        if( trx.outputs[i].claim_func == claim_by_long )
+        ilog( "out: ${i}", ("i",trx->outputs[i]) );
+        if( trx->outputs[i].claim_func == claim_by_long )
         {
-           ilog( "claim by long ${i} ==? ${e} ", ("i",trx.outputs[i].as<claim_by_long_output>())("e",long_claim) );
-           if( trx.outputs[i].as<claim_by_long_output>() == long_claim )
+           auto out_claim = trx->outputs[i].as<claim_by_long_output>();
+           ilog( "claim by long ${i} ==? ${e} ", ("i",out_claim)("e",long_claim) );
+           if( out_claim == long_claim )
            {
               ilog( "return found! ${i}", ("i",i) );
               return i;
@@ -576,17 +626,18 @@ uint16_t trx_validation_state::find_unused_long_output( const claim_by_long_outp
 }
 uint16_t trx_validation_state::find_unused_cover_output( const claim_by_cover_output& cover_claim, uint64_t min_collat )
 {
-  for( uint32_t i = 0; i < trx.outputs.size(); ++i )
+  for( uint32_t i = 0; i < trx->outputs.size(); ++i )
   {
      ilog( "${i} used: ${u}", ("i",i)("u", used_outputs) );
      auto used_out = used_outputs.find(i);
      if( used_out == used_outputs.end() )
      {
-        ilog( "out: ${i}", ("i",trx.outputs[i]) );
-        if( trx.outputs[i].claim_func == claim_by_cover )
+        ilog( "out: ${i}", ("i",trx->outputs[i]) );
+        if( trx->outputs[i].claim_func == claim_by_cover )
         {
-           ilog( "claim by cover ${i} ==? ${e} ", ("i",trx.outputs[i].as<claim_by_cover_output>())("e",cover_claim) );
-           if( trx.outputs[i].as<claim_by_cover_output>() == cover_claim && trx.outputs[i].amount.get_rounded_amount() >= min_collat ) 
+           auto out_claim = trx->outputs[i].as<claim_by_cover_output>();
+           ilog( "claim by cover ${i} ==? ${e} ", ("i",out_claim)("e",cover_claim) );
+           if( out_claim == cover_claim && trx->outputs[i].amount.get_rounded_amount() >= min_collat ) 
            {
               ilog( "return found! ${i}", ("i",i) );
               return i;
@@ -0,0 +1,719 @@
+#include <bts/blockchain/utxo_index.hpp>
+#include <bts/db/level_map.hpp>
+#include <bts/db/snapshot.hpp>
+#include <fc/crypto/sha256.hpp>
+#include <fc/io/raw.hpp>
+#include <fc/reflect/variant.hpp>
+#include <fc/log/logger.hpp>
+
+namespace bts { namespace blockchain {
+
+  namespace detail
+  {
+     /** bump whenever utxo_entry, a pooled claim type or the commitment changes */
+     const uint32_t utxo_snapshot_version = 4;
+
+     /** the hash of one unspent output that is summed into the commitment */
+     fc::sha256 utxo_hash( const output_reference& ref, const trx_num& source, const trx_output& out )
+     {
+        fc::sha256::encoder enc;
+        fc::raw::pack( enc, ref );
+        fc::raw::pack( enc, source );
+        fc::raw::pack( enc, out );
+        return enc.result();
+     }
+
+     /**
+      *  acc += h modulo 2^256 with both digests read as big endian integers, byte 0
+      *  is the most significant, so the sum does not depend on the host byte order
+      */
+     void add_hash( fc::sha256& acc, const fc::sha256& h )
+     {
+        unsigned char*       a = (unsigned char*)acc._hash;
+        const unsigned char* b = (const unsigned char*)h._hash;
+        uint32_t carry = 0;
+        for( int i = sizeof(acc._hash) - 1; i >= 0; --i )
+        {
+           uint32_t sum = uint32_t(a[i]) + b[i] + carry;
+           a[i]  = uint8_t(sum);
+           carry = sum >> 8;
+        }
+     }
+
+     /** acc -= h modulo 2^256, see add_hash() */
+     void subtract_hash( fc::sha256& acc, const fc::sha256& h )
+     {
+        unsigned char*       a = (unsigned char*)acc._hash;
+        const unsigned char* b = (const unsigned char*)h._hash;
+        uint32_t borrow = 0;
+        for( int i = sizeof(acc._hash) - 1; i >= 0; --i )
+        {
+           uint32_t sub = uint32_t(b[i]) + borrow;
+           borrow = a[i] < sub;
+           a[i]   = uint8_t(a[i] - sub);
+        }
+     }
+
+     /**
+      *  Open addressing hash table with linear probing.  Entries are stored
+      *  inline so a lookup touches one or two cache lines and removal uses
+      *  backward shifting so that no tombstones are left behind.
+      */
+     class utxo_table
+     {
+        public:
+           utxo_table():_size(0)
+           {
+              _slots.resize( 1024 );
+           }
+
+           const utxo_entry* find( const output_reference& ref )const
+           {
+              size_t mask = _slots.size() - 1;
+              for( size_t i = home( ref ); _slots[i].is_valid(); i = (i+1) & mask )
+              {
+                 if( _slots[i].ref == ref )
+                 {
+                    return &_slots[i];
+                 }
+              }
+              return nullptr;
+           }
+
+           void insert( const utxo_entry& e )
+           {
+              if( 2*(_size+1) > _slots.size() )
+              {
+                 grow();
+              }
+              size_t mask = _slots.size() - 1;
+              size_t i = home( e.ref );
+              while( _slots[i].is_valid() && !(_slots[i].ref == e.ref) )
+              {
+                 i = (i+1) & mask;
+              }
+              if( !_slots[i].is_valid() )
+              {
+                 ++_size;
+              }
+              _slots[i] = e;
+           }
+
+           bool erase( const output_reference& ref )
+           {
+              size_t mask = _slots.size() - 1;
+              size_t i = home( ref );
+              while( _slots[i].is_valid() && !(_slots[i].ref == ref) )
+              {
+                 i = (i+1) & mask;
+              }
+              if( !_slots[i].is_valid() )
+              {
+                 return false;
+              }
+
+              // shift back any entry in the probe sequence that would become unreachable
+              size_t j = i;
+              while( true )
+              {
+                 j = (j+1) & mask;
+                 if( !_slots[j].is_valid() )
+                 {
+                    break;
+                 }
+                 size_t k = home( _slots[j].ref );
+                 bool reachable = i <= j ? (i < k && k <= j) : (i < k || k <= j);
+                 if( !reachable )
+                 {
+                    _slots[i] = _slots[j];
+                    i = j;
+                 }
+              }
+              _slots[i] = utxo_entry();
+              --_size;
+              return true;
+           }
+
+           void clear()
+           {
+              _slots.clear();
+              _slots.resize( 1024 );
+              _size = 0;
+           }
+
+           uint64_t size()const { return _size; }
+
+           void save( bts::db::snapshot_writer& out )const
+           {
+              out.write_value( _size );
+              out.write( _slots );
+           }
+
+           void load( bts::db::snapshot_reader& in )
+           {
+              in.read_value( _size );
+              in.read( _slots );
+              FC_ASSERT( _slots.size() >= 1024 && (_slots.size() & (_slots.size() - 1)) == 0 );
+           }
+
+        private:
+           size_t home( const output_reference& ref )const
+           {
+              return std::hash<output_reference>()( ref ) & (_slots.size() - 1);
+           }
+
+           void grow()
+           {
+              std::vector<utxo_entry> old_slots( _slots.size() * 2 );
+              std::swap( old_slots, _slots );
+              _size = 0;
+              for( auto itr = old_slots.begin(); itr != old_slots.end(); ++itr )
+              {
+                 if( itr->is_valid() )
+                 {
+                    insert( *itr );
+                 }
+              }
+           }
+
+           std::vector<utxo_entry> _slots;
+           uint64_t                _size;
+     };
+
+     /**
+      *  Fixed size records of one claim type indexed by utxo_entry::claim_idx.  
+      *  Released slots are reused so the pool only grows with the peak number 
+      *  of unspent outputs of its type.
+      */
+     template<typename ClaimType>
+     class claim_pool
+     {
+        public:
+           uint32_t add( const ClaimType& claim )
+           {
+              if( _free.size() )
+              {
+                 uint32_t idx = _free.back();
+                 _free.pop_back();
+                 _claims[idx] = claim;
+                 return idx;
+              }
+              _claims.push_back( claim );
+              return uint32_t(_claims.size() - 1);
+           }
+
+           void release( uint32_t idx )
+           {
+              _free.push_back( idx );
+           }
+
+           const ClaimType& get( uint32_t idx )const
+           {
+              return _claims[idx];
+           }
+
+           void clear()
+           {
+              _claims.clear();
+              _free.clear();
+           }
+
+           void save( bts::db::snapshot_writer& out )const
+           {
+              out.write( _claims );
+              out.write( _free );
+           }
+
+           void load( bts::db::snapshot_reader& in )
+           {
+              in.read( _claims );
+              in.read( _free );
+           }
+
+        private:
+           std::vector<ClaimType> _claims;
+           std::vector<uint32_t>  _free;
+     };
+
+     class utxo_index_impl
+     {
+        public:
+           utxo_index_impl():_in_batch(false),_open(false){}
+
+           utxo_table                                                       _table;
+
+           claim_pool<claim_by_signature_output>                            _signature_claims;
+           claim_pool<claim_by_pts_output>                                  _pts_claims;
+           claim_pool<claim_by_bid_output>                                  _bid_claims;
+           claim_pool<claim_by_long_output>                                 _long_claims;
+           claim_pool<claim_by_cover_output>                                _cover_claims;
+
+           /** 
+            *  Slots released and allocated by the current batch, released slots are only
+            *  reused once the batch is committed so that abort_batch() can restore them.
+            */
+           std::vector<utxo_entry>                                          _released;
+           std::vector<utxo_entry>                                          _allocated;
+           bts::db::level_map<output_reference,unspent_output>              _unspent;
+           bts::db::level_map<output_location,meta_trx_output>              _spent;
+
+           /** prior state of each table entry changed by the current batch, invalid means absent */
+           std::vector< std::pair<output_reference,utxo_entry> >            _undo;
+
+           /** sum of utxo_hash() of every unspent output, and its value when the batch began */
+           fc::sha256                                                       _commitment;
+           fc::sha256                                                       _batch_commitment;
+           bool                                                             _in_batch;
+           bool                                                             _open;
+
+           void record_undo( const output_reference& ref )
+           {
+              if( !_in_batch )
+              {
+                 return;
+              }
+              const utxo_entry* prior = _table.find( ref );
+              _undo.push_back( std::make_pair( ref, prior ? *prior : utxo_entry() ) );
+           }
+
+           /** decodes the claim of out into the pool of its type, if it has one */
+           uint32_t add_claim( const trx_output& out )
+           {
+              uint32_t idx = utxo_entry::no_claim;
+              switch( out.claim_func )
+              {
+                 case claim_by_signature:
+                    idx = _signature_claims.add( out.as<claim_by_signature_output>() );
+                    break;
+                 case claim_by_pts:
+                    idx = _pts_claims.add( out.as<claim_by_pts_output>() );
+                    break;
+                 case claim_by_bid:
+                    idx = _bid_claims.add( out.as<claim_by_bid_output>() );
+                    break;
+                 case claim_by_long:
+                    idx = _long_claims.add( out.as<claim_by_long_output>() );
+                    break;
+                 case claim_by_cover:
+                    idx = _cover_claims.add( out.as<claim_by_cover_output>() );
+                    break;
+                 default:
+                    break;
+              }
+              return idx;
+           }
+
+           void release_claim( const utxo_entry& e )
+           {
+              if( e.claim_idx == utxo_entry::no_claim )
+              {
+                 return;
+              }
+              switch( e.claim_func )
+              {
+                 case claim_by_signature:
+                    _signature_claims.release( e.claim_idx );
+                    break;
+                 case claim_by_pts:
+                    _pts_claims.release( e.claim_idx );
+                    break;
+                 case claim_by_bid:
+                    _bid_claims.release( e.claim_idx );
+                    break;
+                 case claim_by_long:
+                    _long_claims.release( e.claim_idx );
+                    break;
+                 case claim_by_cover:
+                    _cover_claims.release( e.claim_idx );
+                    break;
+                 default:
+                    break;
+              }
+           }
+
+           void insert( const utxo_entry& e )
+           {
+              _table.insert( e );
+              if( _in_batch )
+              {
+                 _allocated.push_back( e );
+              }
+           }
+           void erase( const utxo_entry& e )
+           {
+              _table.erase( e.ref );
+              if( _in_batch )
+              {
+                 _released.push_back( e );
+              }
+              else
+              {
+                 release_claim( e );
+              }
+           }
+
+           void load()
+           {
+              _table.clear();
+              clear_pools();
+              _commitment = fc::sha256();
+              for( auto itr = _unspent.begin(); itr.valid(); ++itr )
+              {
+                 unspent_output out = itr.value();
+                 utxo_entry e;
+                 e.ref        = itr.key();
+                 e.source     = out.source;
+                 e.amount     = out.output.amount;
+                 e.claim_func = uint8_t(out.output.claim_func);
+                 e.claim_idx  = add_claim( out.output );
+                 e.hash       = utxo_hash( e.ref, out.source, out.output );
+                 add_hash( _commitment, e.hash );
+                 _table.insert( e );
+              }
+           }
+
+           void clear_pools()
+           {
+              _signature_claims.clear();
+              _pts_claims.clear();
+              _bid_claims.clear();
+              _long_claims.clear();
+              _cover_claims.clear();
+              _released.clear();
+              _allocated.clear();
+           }
+
+           template<typename ClaimType>
+           bool fetch_claim( const claim_pool<ClaimType>& pool, const output_reference& ref, ClaimType& claim )const
+           {
+              const utxo_entry* e = _table.find( ref );
+              if( e == nullptr || e->claim_func != ClaimType::type || e->claim_idx == utxo_entry::no_claim )
+              {
+                 return false;
+              }
+              claim = pool.get( e->claim_idx );
+              return true;
+           }
+
+           template<typename ClaimType>
+           static trx_output make_output( const claim_pool<ClaimType>& pool, const utxo_entry& e )
+           {
+              return trx_output( pool.get( e.claim_idx ), e.amount );
+           }
+     };
+
+  } // namespace detail
+
+  utxo_index::utxo_index()
+  :my( new detail::utxo_index_impl() )
+  {
+  }
+
+  utxo_index::~utxo_index(){}
+
+  void utxo_index::open( const fc::path& dir, bool create, bool load_outputs, bts::db::write_journal* journal )
+  { try {
+     fc::create_directories( dir );
+     my->_unspent.open( dir / "unspent", create );
+     my->_spent.open( dir / "spent", create );
+     if( journal )
+     {
+        journal->add( "utxos/unspent", my->_unspent );
+        journal->add( "utxos/spent", my->_spent );
+     }
+
+     my->_table.clear();
+     my->clear_pools();
+     my->_open = true;
+     if( load_outputs )
+     {
+        load();
+     }
+  } FC_RETHROW_EXCEPTIONS( warn, "unable to open utxo index ${dir}", ("dir",dir) ) }
+
+  void utxo_index::load()
+  { try {
+     my->load();
+     ilog( "loaded ${n} unspent outputs", ("n",my->_table.size()) );
+  } FC_RETHROW_EXCEPTIONS( warn, "" ) }
+
+  bool utxo_index::load_snapshot( const fc::path& file, uint32_t& height, block_id_type& head_id )
+  {
+     bts::db::snapshot_reader in;
+     if( !in.open( file, detail::utxo_snapshot_version ) )
+     {
+        return false;
+     }
+     try
+     {
+        height = in.height();
+        in.read_value( head_id );
+        in.read_value( my->_commitment );
+        my->_table.load( in );
+        my->_signature_claims.load( in );
+        my->_pts_claims.load( in );
+        my->_bid_claims.load( in );
+        my->_long_claims.load( in );
+        my->_cover_claims.load( in );
+        ilog( "loaded ${n} unspent outputs from the snapshot at block ${h}", ("n",my->_table.size())("h",height) );
+        return true;
+     }
+     catch ( const fc::exception& e )
+     {
+        wlog( "unable to load utxo snapshot ${file}\n${e}", ("file",file)("e",e.to_detail_string()) );
+        my->_table.clear();
+        my->clear_pools();
+        return false;
+     }
+  }
+
+  void utxo_index::save_snapshot( const fc::path& file, uint32_t height, const block_id_type& head_id )const
+  { try {
+     FC_ASSERT( !my->_in_batch );
+     bts::db::snapshot_writer out( file, detail::utxo_snapshot_version, height );
+     out.write_value( head_id );
+     out.write_value( my->_commitment );
+     my->_table.save( out );
+     my->_signature_claims.save( out );
+     my->_pts_claims.save( out );
+     my->_bid_claims.save( out );
+     my->_long_claims.save( out );
+     my->_cover_claims.save( out );
+     out.commit();
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("file",file)("height",height) ) }
+
+  void utxo_index::sync( const output_reference& ref )
+  { try {
+     FC_ASSERT( !my->_in_batch );
+     const utxo_entry* e = my->_table.find( ref );
+     auto unspent = my->_unspent.fetch_optional( ref );
+     if( e != nullptr && !unspent )
+     {
+        detail::subtract_hash( my->_commitment, e->hash );
+        my->erase( *e );
+     }
+     else if( e == nullptr && unspent )
+     {
+        utxo_entry n;
+        n.ref        = ref;
+        n.source     = unspent->source;
+        n.amount     = unspent->output.amount;
+        n.claim_func = uint8_t(unspent->output.claim_func);
+        n.claim_idx  = my->add_claim( unspent->output );
+        n.hash       = detail::utxo_hash( ref, unspent->source, unspent->output );
+        my->insert( n );
+        detail::add_hash( my->_commitment, n.hash );
+     }
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("ref",ref) ) }
+
+  fc::sha256 utxo_index::commitment()const
+  {
+     return my->_commitment;
+  }
+
+  void utxo_index::close()
+  {
+     my->_unspent.close();
+     my->_spent.close();
+     my->_table.clear();
+     my->clear_pools();
+     my->_open = false;
+  }
+
+  bool utxo_index::is_open()const
+  {
+     return my->_open;
+  }
+
+  void utxo_index::begin_batch()
+  {
+     my->_unspent.begin_batch();
+     my->_spent.begin_batch();
+     my->_undo.clear();
+     my->_released.clear();
+     my->_allocated.clear();
+     my->_batch_commitment = my->_commitment;
+     my->_in_batch = true;
+  }
+
+  void utxo_index::commit_batch( bool sync )
+  {
+     my->_in_batch = false;
+     my->_undo.clear();
+     for( auto itr = my->_released.begin(); itr != my->_released.end(); ++itr )
+     {
+        my->release_claim( *itr );
+     }
+     my->_released.clear();
+     my->_allocated.clear();
+     my->_unspent.commit_batch( sync );
+     my->_spent.commit_batch( sync );
+  }
+
+  void utxo_index::abort_batch()
+  {
+     my->_unspent.abort_batch();
+     my->_spent.abort_batch();
+     for( auto itr = my->_undo.rbegin(); itr != my->_undo.rend(); ++itr )
+     {
+        if( itr->second.is_valid() )
+        {
+           my->_table.insert( itr->second );
+        }
+        else
+        {
+           my->_table.erase( itr->first );
+        }
+     }
+     for( auto itr = my->_allocated.begin(); itr != my->_allocated.end(); ++itr )
+     {
+        my->release_claim( *itr );
+     }
+     my->_commitment = my->_batch_commitment;
+     my->_undo.clear();
+     my->_released.clear();
+     my->_allocated.clear();
+     my->_in_batch = false;
+  }
+
+  void utxo_index::add( const output_reference& ref, const trx_num& source, const trx_output& out )
+  { try {
+     utxo_entry e;
+     e.ref        = ref;
+     e.source     = source;
+     e.amount     = out.amount;
+     e.claim_func = uint8_t(out.claim_func);
+     e.hash       = detail::utxo_hash( ref, source, out );
+
+     my->record_undo( ref );
+     const utxo_entry* prior = my->_table.find( ref );
+     if( prior )
+     {
+        detail::subtract_hash( my->_commitment, prior->hash );
+        my->erase( *prior );
+     }
+     e.claim_idx  = my->add_claim( out );
+     my->insert( e );
+     my->_unspent.store( ref, unspent_output( source, out ) );
+     detail::add_hash( my->_commitment, e.hash );
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("ref",ref)("source",source) ) }
+
+  utxo_entry utxo_index::spend( const output_reference& ref, const meta_trx_output& spent_by )
+  { try {
+     const utxo_entry* e = my->_table.find( ref );
+     FC_ASSERT( e != nullptr, "output is not unspent" );
+     utxo_entry removed = *e;
+     detail::subtract_hash( my->_commitment, removed.hash );
+
+     my->record_undo( ref );
+     my->erase( removed );
+     my->_unspent.remove( ref );
+     my->_spent.store( output_location( removed.source, ref.output_idx ), spent_by );
+     return removed;
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("ref",ref)("spent_by",spent_by) ) }
+
+  void utxo_index::remove( const output_reference& ref )
+  { try {
+     const utxo_entry* e = my->_table.find( ref );
+     FC_ASSERT( e != nullptr, "output is not unspent" );
+     detail::subtract_hash( my->_commitment, e->hash );
+
+     my->record_undo( ref );
+     my->erase( *e );
+     my->_unspent.remove( ref );
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("ref",ref) ) }
+
+  void utxo_index::unspend( const output_reference& ref, const trx_num& source, const trx_output& out )
+  { try {
+     FC_ASSERT( my->_table.find( ref ) == nullptr, "output is already unspent" );
+
+     my->_spent.remove( output_location( source, ref.output_idx ) );
+     add( ref, source, out );
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("ref",ref)("source",source) ) }
+
+  const utxo_entry* utxo_index::find( const output_reference& ref )const
+  {
+     return my->_table.find( ref );
+  }
+
+  trx_output utxo_index::fetch_output( const output_reference& ref )
+  { try {
+     const utxo_entry* e = my->_table.find( ref );
+     if( e != nullptr && e->claim_idx != utxo_entry::no_claim )
+     {
+        switch( e->claim_func )
+        {
+           case claim_by_signature:
+              return detail::utxo_index_impl::make_output( my->_signature_claims, *e );
+           case claim_by_pts:
+              return detail::utxo_index_impl::make_output( my->_pts_claims, *e );
+           case claim_by_bid:
+              return detail::utxo_index_impl::make_output( my->_bid_claims, *e );
+           case claim_by_long:
+              return detail::utxo_index_impl::make_output( my->_long_claims, *e );
+           case claim_by_cover:
+              return detail::utxo_index_impl::make_output( my->_cover_claims, *e );
+           default:
+              break;
+        }
+     }
+     return my->_unspent.fetch( ref ).output;
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("ref",ref) ) }
+
+  bool utxo_index::fetch_claim( const output_reference& ref, claim_by_signature_output& claim )const
+  {
+     return my->fetch_claim( my->_signature_claims, ref, claim );
+  }
+
+  bool utxo_index::fetch_claim( const output_reference& ref, claim_by_pts_output& claim )const
+  {
+     return my->fetch_claim( my->_pts_claims, ref, claim );
+  }
+
+  bool utxo_index::fetch_claim( const output_reference& ref, claim_by_bid_output& claim )const
+  {
+     return my->fetch_claim( my->_bid_claims, ref, claim );
+  }
+
+  bool utxo_index::fetch_claim( const output_reference& ref, claim_by_long_output& claim )const
+  {
+     return my->fetch_claim( my->_long_claims, ref, claim );
+  }
+
+  bool utxo_index::fetch_claim( const output_reference& ref, claim_by_cover_output& claim )const
+  {
+     return my->fetch_claim( my->_cover_claims, ref, claim );
+  }
+
+  void utxo_index::fetch_spends( const trx_num& source, std::vector<meta_trx_output>& meta_outputs )
+  { try {
+     auto itr = my->_spent.lower_bound( output_location( source, 0 ) );
+     while( itr.valid() )
+     {
+        output_location loc = itr.key();
+        if( !(loc.source == source) )
+        {
+           break;
+        }
+        if( loc.output_idx < meta_outputs.size() )
+        {
+           meta_outputs[loc.output_idx] = itr.value();
+        }
+        ++itr;
+     }
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("source",source) ) }
+
+  void utxo_index::remove_spends( const trx_num& source, uint16_t num_outputs )
+  { try {
+     for( uint16_t i = 0; i < num_outputs; ++i )
+     {
+        my->_spent.remove( output_location( source, i ) );
+     }
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("source",source) ) }
+
+  uint64_t utxo_index::size()const
+  {
+     return my->_table.size();
+  }
+
+} } // bts::blockchain
@@ -0,0 +1,60 @@
+#include <bts/blockchain/worker_threads.hpp>
+#include <fc/thread/thread.hpp>
+#include <fc/thread/mutex.hpp>
+#include <fc/thread/scoped_lock.hpp>
+
+#include <algorithm>
+#include <thread>
+
+namespace bts { namespace blockchain {
+
+   namespace detail
+   {
+      /**
+       *  Creating an fc::thread yields, so the pool is built under an fc::mutex
+       *  which blocks other tasks until the whole pool exists.
+       */
+      class worker_pool
+      {
+         public:
+            fc::mutex                  _mutex;
+            std::vector<fc::thread*>   _threads;
+      };
+
+      static worker_pool& pool()
+      {
+         static worker_pool p;
+         return p;
+      }
+   } // namespace detail
+
+   const std::vector<fc::thread*>& worker_threads()
+   {
+      detail::worker_pool& p = detail::pool();
+      fc::scoped_lock<fc::mutex> lock( p._mutex );
+      if( p._threads.empty() )
+      {
+         uint32_t count = std::max( 1u, std::thread::hardware_concurrency() );
+         std::vector<fc::thread*> threads;
+         for( uint32_t i = 0; i < count; ++i )
+         {
+            threads.push_back( new fc::thread( "worker" ) );
+         }
+         p._threads.swap( threads );
+      }
+      return p._threads;
+   }
+
+   void shutdown_worker_threads()
+   {
+      detail::worker_pool& p = detail::pool();
+      fc::scoped_lock<fc::mutex> lock( p._mutex );
+      for( auto itr = p._threads.begin(); itr != p._threads.end(); ++itr )
+      {
+         (*itr)->quit();
+         delete *itr;
+      }
+      p._threads.clear();
+   }
+
+} } // bts::blockchain
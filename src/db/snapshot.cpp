@@ -0,0 +1,196 @@
+#include <bts/db/snapshot.hpp>
+#include <fc/crypto/city.hpp>
+#include <fc/log/logger.hpp>
+
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <stdio.h>
+
+#ifdef WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace bts { namespace db {
+
+  namespace detail
+  {
+     const uint32_t snapshot_magic = 0x42545353; // "BTSS"
+
+     struct snapshot_header
+     {
+        uint32_t    magic;
+        uint32_t    version;
+        uint32_t    height;
+        uint32_t    reserved;
+        uint64_t    body_size;
+        fc::uint128 checksum;
+     };
+
+     struct section_header
+     {
+        uint32_t element_size;
+        uint32_t reserved;
+        uint64_t count;
+     };
+
+     class snapshot_reader_impl
+     {
+        public:
+           snapshot_reader_impl():_pos(0){}
+
+           boost::interprocess::file_mapping   _file;
+           boost::interprocess::mapped_region  _region;
+           snapshot_header                     _header;
+           const char*                         _body;
+           uint64_t                            _pos;
+     };
+
+  } // namespace detail
+
+  bool sync_file( int fd )
+  {
+#ifdef WIN32
+     return _commit( fd ) == 0;
+#else
+     return fsync( fd ) == 0;
+#endif
+  }
+
+  void sync_directory( const fc::path& dir )
+  {
+#ifndef WIN32
+     int fd = ::open( dir == fc::path() ? "." : dir.to_native_ansi_path().c_str(), O_RDONLY );
+     FC_ASSERT( fd >= 0, "unable to open ${dir}", ("dir",dir) );
+     bool ok = fsync( fd ) == 0;
+     ::close( fd );
+     FC_ASSERT( ok, "unable to sync ${dir}", ("dir",dir) );
+#endif
+  }
+
+  snapshot_writer::snapshot_writer( const fc::path& file, uint32_t version, uint32_t height )
+  :_file(file),_version(version),_height(height)
+  {
+  }
+
+  snapshot_writer::~snapshot_writer(){}
+
+  void snapshot_writer::write_section( const char* data, uint32_t element_size, uint64_t count )
+  {
+     detail::section_header s;
+     s.element_size = element_size;
+     s.reserved     = 0;
+     s.count        = count;
+
+     size_t pos = _body.size();
+     _body.resize( pos + sizeof(s) + element_size * count );
+     memcpy( &_body[pos], (const char*)&s, sizeof(s) );
+     if( count )
+     {
+        memcpy( &_body[pos + sizeof(s)], data, element_size * count );
+     }
+  }
+
+  void snapshot_writer::commit()
+  { try {
+     detail::snapshot_header h;
+     h.magic     = detail::snapshot_magic;
+     h.version   = _version;
+     h.height    = _height;
+     h.reserved  = 0;
+     h.body_size = _body.size();
+     h.checksum  = fc::city_hash128( _body.data(), _body.size() );
+
+     fc::path tmp = _file.parent_path() / (_file.filename().generic_string() + ".tmp");
+     FILE* out = fopen( tmp.to_native_ansi_path().c_str(), "wb" );
+     FC_ASSERT( out != nullptr, "unable to create snapshot" );
+     bool ok = fwrite( (const char*)&h, sizeof(h), 1, out ) == 1 &&
+               ( _body.empty() || fwrite( _body.data(), _body.size(), 1, out ) == 1 ) &&
+               fflush( out ) == 0 && sync_file( fileno( out ) );
+     fclose( out );
+     FC_ASSERT( ok, "unable to write snapshot" );
+
+     boost::filesystem::rename( tmp, _file );
+     sync_directory( _file.parent_path() );
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("file",_file)("height",_height) ) }
+
+  snapshot_reader::snapshot_reader()
+  :my( new detail::snapshot_reader_impl() )
+  {
+  }
+
+  snapshot_reader::~snapshot_reader(){}
+
+  bool snapshot_reader::open( const fc::path& file, uint32_t version )
+  {
+     close();
+     if( !fc::exists( file ) || boost::filesystem::file_size( file ) < sizeof(detail::snapshot_header) )
+     {
+        return false;
+     }
+     try
+     {
+        my->_file   = boost::interprocess::file_mapping( file.to_native_ansi_path().c_str(), boost::interprocess::read_only );
+        my->_region = boost::interprocess::mapped_region( my->_file, boost::interprocess::read_only );
+     }
+     catch ( const boost::interprocess::interprocess_exception& e )
+     {
+        wlog( "unable to map snapshot ${file}: ${e}", ("file",file)("e",e.what()) );
+        return false;
+     }
+
+     const char* data = (const char*)my->_region.get_address();
+     memcpy( (char*)&my->_header, data, sizeof(my->_header) );
+     my->_body = data + sizeof(my->_header);
+     my->_pos  = 0;
+
+     if( my->_header.magic != detail::snapshot_magic || my->_header.version != version ||
+         my->_header.body_size != my->_region.get_size() - sizeof(my->_header) )
+     {
+        wlog( "ignoring snapshot ${file} with version ${v}", ("file",file)("v",my->_header.version) );
+        close();
+        return false;
+     }
+     if( fc::city_hash128( my->_body, my->_header.body_size ) != my->_header.checksum )
+     {
+        wlog( "ignoring snapshot ${file} with a bad checksum", ("file",file) );
+        close();
+        return false;
+     }
+     return true;
+  }
+
+  void snapshot_reader::close()
+  {
+     my->_region = boost::interprocess::mapped_region();
+     my->_file   = boost::interprocess::file_mapping();
+     my->_pos    = 0;
+  }
+
+  uint32_t snapshot_reader::height()const
+  {
+     return my->_header.height;
+  }
+
+  const char* snapshot_reader::read_section( uint32_t element_size, uint64_t& count )
+  {
+     FC_ASSERT( my->_pos + sizeof(detail::section_header) <= my->_header.body_size );
+     detail::section_header s;
+     memcpy( (char*)&s, my->_body + my->_pos, sizeof(s) );
+     my->_pos += sizeof(s);
+
+     FC_ASSERT( s.element_size == element_size, "snapshot section has elements of ${s} bytes, expected ${e}",
+                ("s",s.element_size)("e",element_size) );
+     FC_ASSERT( my->_pos + s.element_size * s.count <= my->_header.body_size );
+
+     const char* data = my->_body + my->_pos;
+     my->_pos += s.element_size * s.count;
+     count = s.count;
+     return data;
+  }
+
+} } // bts::db
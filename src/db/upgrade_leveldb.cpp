@@ -1,4 +1,5 @@
 #include <bts/db/upgrade_leveldb.hpp>
+#include <leveldb/write_batch.h>
 #include <boost/filesystem.hpp>
 #include <fc/log/logger.hpp>
 #include <fstream>
@@ -77,3 +78,65 @@ void UpgradeDbIfNecessary(fc::path dir, leveldb::DB* dbase, const char* record_t
 
   }
 }
+
+bool UpgradeDbKeysIfNecessary(fc::path dir, const leveldb::Status& open_status, const leveldb::Options& legacy_options, TUpgradeDbKeyFunction convert_key)
+{
+  if (open_status.ok() || open_status.ToString().find("does not match existing comparator") == std::string::npos)
+    return false;
+
+  ilog("Upgrading key format of database ${db}",("db",dir.to_native_ansi_path()));
+  fc::path upgraded_dir( dir.to_native_ansi_path() + ".key_upgrade" );
+  fc::path legacy_dir( dir.to_native_ansi_path() + ".legacy_keys" );
+  boost::filesystem::remove_all(upgraded_dir);
+
+  {
+    leveldb::Options legacy_opts = legacy_options;
+    legacy_opts.create_if_missing = false;
+    leveldb::DB* legacy_ptr = nullptr;
+    auto status = leveldb::DB::Open(legacy_opts, dir.to_native_ansi_path(), &legacy_ptr);
+    if (!status.ok())
+      FC_THROW_EXCEPTION( exception, "unable to open ${db} with legacy comparator: ${msg}", ("db",dir)("msg",status.ToString()) );
+    std::unique_ptr<leveldb::DB> legacy_db(legacy_ptr);
+
+    leveldb::Options upgraded_opts;
+    upgraded_opts.create_if_missing = true;
+    upgraded_opts.error_if_exists   = true;
+    leveldb::DB* upgraded_ptr = nullptr;
+    status = leveldb::DB::Open(upgraded_opts, upgraded_dir.to_native_ansi_path(), &upgraded_ptr);
+    if (!status.ok())
+      FC_THROW_EXCEPTION( exception, "unable to create ${db}: ${msg}", ("db",upgraded_dir)("msg",status.ToString()) );
+    std::unique_ptr<leveldb::DB> upgraded_db(upgraded_ptr);
+
+    std::unique_ptr<leveldb::Iterator> legacy_itr( legacy_db->NewIterator(leveldb::ReadOptions()) );
+    leveldb::WriteBatch batch;
+    uint32_t batch_count = 0;
+    for (legacy_itr->SeekToFirst(); legacy_itr->Valid(); legacy_itr->Next())
+    {
+      batch.Put( convert_key(legacy_itr->key()), legacy_itr->value() );
+      if (++batch_count == 1000)
+      {
+        status = upgraded_db->Write( leveldb::WriteOptions(), &batch );
+        if (!status.ok())
+          FC_THROW_EXCEPTION( exception, "database error: ${msg}", ("msg", status.ToString() ) );
+        batch.Clear();
+        batch_count = 0;
+      }
+    }
+    if (!legacy_itr->status().ok())
+      FC_THROW_EXCEPTION( exception, "database error: ${msg}", ("msg", legacy_itr->status().ToString() ) );
+    status = upgraded_db->Write( leveldb::WriteOptions(), &batch );
+    if (!status.ok())
+      FC_THROW_EXCEPTION( exception, "database error: ${msg}", ("msg", status.ToString() ) );
+  }
+
+  fc::path record_type_filename = dir / "RECORD_TYPE";
+  if (boost::filesystem::exists( record_type_filename ))
+    boost::filesystem::copy_file( record_type_filename, upgraded_dir / "RECORD_TYPE" );
+
+  //only discard the legacy database once the upgraded one is in place
+  boost::filesystem::remove_all(legacy_dir);
+  boost::filesystem::rename(dir, legacy_dir);
+  boost::filesystem::rename(upgraded_dir, dir);
+  boost::filesystem::remove_all(legacy_dir);
+  return true;
+}
@@ -0,0 +1,265 @@
+#include <bts/db/write_journal.hpp>
+#include <bts/db/snapshot.hpp>
+#include <fc/crypto/city.hpp>
+#include <fc/exception/exception.hpp>
+#include <fc/io/raw.hpp>
+#include <fc/reflect/reflect.hpp>
+#include <fc/log/logger.hpp>
+
+#include <boost/filesystem.hpp>
+
+#include <fstream>
+#include <vector>
+
+#include <stdio.h>
+#include <string.h>
+
+namespace bts { namespace db {
+
+  namespace detail
+  {
+     const uint32_t journal_version = 2;
+
+     struct journal_write
+     {
+        std::string                key;
+        fc::optional<std::string>  value;
+     };
+
+     struct journal_entry
+     {
+        std::string                 name;
+        std::vector<journal_write>  writes;
+     };
+
+     /** precedes the packed std::vector<journal_entry> of every commit in the journal */
+     struct record_header
+     {
+        uint32_t    version;
+        uint32_t    reserved;
+        uint64_t    size;
+        fc::uint128 checksum;
+     };
+
+     struct journal_database
+     {
+        std::string                                  name;
+        std::function<const staged_writes*()>        pending;
+        std::function<void( const staged_writes& )>  apply;
+     };
+
+     class write_journal_impl
+     {
+        public:
+           write_journal_impl():_out(nullptr),_size(0),_pending(false){}
+           ~write_journal_impl() { close_file(); }
+
+           fc::path                              _file;
+           FILE*                                 _out;
+           std::vector<journal_database>         _databases;
+           std::map<std::string, staged_writes>  _recovered;
+           std::map<std::string, uint64_t>       _bytes_written;
+           uint32_t                              _size;
+           bool                                  _pending;
+
+           void close_file()
+           {
+              if( _out )
+              {
+                 fclose( _out );
+                 _out = nullptr;
+              }
+           }
+
+           void remove_file()
+           {
+              close_file();
+              if( fc::exists( _file ) )
+              {
+                 fc::remove( _file );
+                 sync_directory( _file.parent_path() );
+              }
+           }
+     };
+  } // namespace detail
+
+} } // bts::db
+
+FC_REFLECT( bts::db::detail::journal_write, (key)(value) )
+FC_REFLECT( bts::db::detail::journal_entry, (name)(writes) )
+
+namespace bts { namespace db {
+
+  write_journal::write_journal()
+  :my( new detail::write_journal_impl() )
+  {
+  }
+
+  write_journal::~write_journal(){}
+
+  void write_journal::open( const fc::path& file )
+  { try {
+     my->close_file();
+     my->_file = file;
+     my->_databases.clear();
+     my->_recovered.clear();
+     my->_bytes_written.clear();
+     my->_size    = 0;
+     my->_pending = false;
+
+     if( !fc::exists( file ) )
+     {
+        return;
+     }
+     std::vector<char> data( boost::filesystem::file_size( file ) );
+     if( data.size() )
+     {
+        std::ifstream in( file.to_native_ansi_path().c_str(), std::ios::binary );
+        in.read( data.data(), data.size() );
+        FC_ASSERT( in.good(), "unable to read journal" );
+     }
+
+     // the commits are applied in order so that every key ends at its last value
+     uint32_t commits = 0;
+     size_t   pos     = 0;
+     while( pos + sizeof(detail::record_header) <= data.size() )
+     {
+        detail::record_header h;
+        memcpy( (char*)&h, &data[pos], sizeof(h) );
+        const char* body = &data[pos] + sizeof(h);
+        if( h.version != detail::journal_version || h.size > data.size() - pos - sizeof(h) ||
+            fc::city_hash128( body, h.size ) != h.checksum )
+        {
+           break;
+        }
+
+        std::vector<detail::journal_entry> entries;
+        fc::raw::unpack( std::vector<char>( body, body + h.size ), entries );
+        for( auto itr = entries.begin(); itr != entries.end(); ++itr )
+        {
+           auto& writes = my->_recovered[itr->name];
+           for( auto w = itr->writes.begin(); w != itr->writes.end(); ++w )
+           {
+              writes[w->key] = w->value;
+           }
+        }
+        pos += sizeof(h) + h.size;
+        ++commits;
+     }
+     if( pos != data.size() )
+     {
+        wlog( "ignoring a partially written commit at the end of ${file}", ("file",file) );
+     }
+     if( commits )
+     {
+        wlog( "completing ${c} commits to ${n} databases from ${file}", ("c",commits)("n",my->_recovered.size())("file",file) );
+     }
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("file",file) ) }
+
+  void write_journal::add_database( const std::string& name,
+                                    std::function<const staged_writes*()> pending,
+                                    std::function<void( const staged_writes& )> apply )
+  {
+     auto itr = my->_recovered.find( name );
+     if( itr != my->_recovered.end() )
+     {
+        apply( itr->second );
+        my->_recovered.erase( itr );
+     }
+     detail::journal_database db;
+     db.name    = name;
+     db.pending = pending;
+     db.apply   = apply;
+     my->_databases.push_back( db );
+  }
+
+  void write_journal::end_recovery()
+  {
+     for( auto itr = my->_recovered.begin(); itr != my->_recovered.end(); ++itr )
+     {
+        wlog( "journal has ${n} writes for ${name} which was not opened", ("n",itr->second.size())("name",itr->first) );
+     }
+     my->_recovered.clear();
+     my->remove_file();
+  }
+
+  void write_journal::write()
+  { try {
+     FC_ASSERT( !my->_pending, "the previous commit did not complete, the database must be reopened" );
+
+     std::vector<detail::journal_entry> entries;
+     for( auto itr = my->_databases.begin(); itr != my->_databases.end(); ++itr )
+     {
+        const staged_writes* writes = itr->pending();
+        if( !writes || writes->empty() )
+        {
+           continue;
+        }
+        entries.resize( entries.size() + 1 );
+        entries.back().name = itr->name;
+        entries.back().writes.reserve( writes->size() );
+        uint64_t& bytes = my->_bytes_written[itr->name];
+        for( auto w = writes->begin(); w != writes->end(); ++w )
+        {
+           detail::journal_write jw;
+           jw.key   = w->first;
+           jw.value = w->second;
+           entries.back().writes.push_back( jw );
+           bytes += w->first.size() + (w->second ? w->second->size() : 0);
+        }
+     }
+     if( entries.empty() )
+     {
+        return;
+     }
+
+     auto body = fc::raw::pack( entries );
+     detail::record_header h;
+     h.version  = detail::journal_version;
+     h.reserved = 0;
+     h.size     = body.size();
+     h.checksum = fc::city_hash128( body.data(), body.size() );
+
+     // a record that fails part way would hide the records after it, the database must be reopened
+     my->_pending = true;
+     bool created = false;
+     if( !my->_out )
+     {
+        created  = !fc::exists( my->_file );
+        my->_out = fopen( my->_file.to_native_ansi_path().c_str(), "ab" );
+        FC_ASSERT( my->_out != nullptr, "unable to open journal" );
+     }
+     bool ok = fwrite( (const char*)&h, sizeof(h), 1, my->_out ) == 1 &&
+               fwrite( body.data(), body.size(), 1, my->_out ) == 1 &&
+               fflush( my->_out ) == 0 && sync_file( fileno( my->_out ) );
+     FC_ASSERT( ok, "unable to write journal" );
+     if( created )
+     {
+        sync_directory( my->_file.parent_path() );
+     }
+     ++my->_size;
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("file",my->_file) ) }
+
+  void write_journal::committed()
+  {
+     my->_pending = false;
+  }
+
+  uint32_t write_journal::size()const
+  {
+     return my->_size;
+  }
+
+  const std::map<std::string, uint64_t>& write_journal::bytes_written()const
+  {
+     return my->_bytes_written;
+  }
+
+  void write_journal::clear()
+  { try {
+     my->remove_file();
+     my->_size    = 0;
+     my->_pending = false;
+  } FC_RETHROW_EXCEPTIONS( warn, "", ("file",my->_file) ) }
+
+} } // bts::db
@@ -0,0 +1,185 @@
+/**
+ *  Times the per block market work and the per transaction balance sheet as
+ *  the number of assets grows to 256, using synthetic asset units since
+ *  asset::type only names four of them.
+ *
+ *  For every asset count the market_db is given orders in
+ *
+ *    all_pairs - every asset traded against bts
+ *    3_pairs   - only three pairs, spread over the whole range of units
+ *
+ *  and one pass over get_active_markets() is timed, reading the revision and
+ *  the best bid and ask of every active pair the way match_orders() decides
+ *  which pairs to evaluate.  The balance sheet of trx_validation_state is
+ *  timed for transactions touching 1 and 4 assets out of all of them.  Both
+ *  should depend on the pairs and assets in use, not on how many exist.
+ *
+ *  Every result is printed as one json object per line:
+ *
+ *    {"type":"market","case":"256_assets","op":"3_pairs","active_pairs":3,"iterations":...,"ns_per_op":...}
+ *
+ *  Usage: asset_scale_bench [MIN_MSEC_PER_CASE]   (default 200)
+ */
+#include <bts/blockchain/blockchain_market_db.hpp>
+#include <bts/blockchain/trx_validation_state.hpp>
+#include <fc/crypto/ripemd160.hpp>
+#include <fc/filesystem.hpp>
+#include <fc/io/json.hpp>
+#include <fc/log/logger.hpp>
+#include <fc/reflect/variant.hpp>
+#include <fc/string.hpp>
+#include <fc/variant_object.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <stdlib.h>
+
+#include "bench_common.hpp"
+
+using namespace bts::blockchain;
+
+const uint32_t orders_per_side = 8;
+
+template<typename Functor>
+void run( const std::string& type, uint32_t assets, const std::string& op, uint64_t active, Functor f )
+{
+   auto t = time_case( f );
+   std::cout << fc::json::to_string( fc::mutable_variant_object( "type", type )
+                                        ( "case", fc::to_string( uint64_t(assets) ) + "_assets" )
+                                        ( "op", op )
+                                        ( type == "market" ? "active_pairs" : "touched_assets", active )
+                                        ( "iterations", t.iterations )
+                                        ( "ns_per_op", t.ns_per_op() ) ) << "\n";
+}
+
+/** asks below 1.0 and bids above it so that every pair would cross */
+void add_orders( market_db& db, asset::type quote, uint32_t& next_output )
+{
+   for( uint32_t i = 0; i < orders_per_side; ++i )
+   {
+      fc::uint128 bid_ratio = fc::uint128( uint64_t(1100 + i) ) * fc::uint128( uint64_t(1) << 54 );
+      fc::uint128 ask_ratio = fc::uint128( uint64_t(900 - i) ) * fc::uint128( uint64_t(1) << 54 );
+      uint32_t    bid_id = next_output++;
+      uint32_t    ask_id = next_output++;
+      db.insert_bid( market_order( price( bid_ratio, asset::bts, quote ),
+                                   output_reference( fc::ripemd160::hash( (char*)&bid_id, sizeof(bid_id) ), 0 ) ), 1000, 1000 );
+      db.insert_ask( market_order( price( ask_ratio, asset::bts, quote ),
+                                   output_reference( fc::ripemd160::hash( (char*)&ask_id, sizeof(ask_id) ), 0 ) ), 1000, 1000 );
+   }
+}
+
+/** the lookups match_orders() makes for every active pair before it evaluates one */
+uint64_t match_pass( market_db& db )
+{
+   uint64_t found   = 0;
+   auto     markets = db.get_active_markets();
+   for( auto market = markets.begin(); market != markets.end(); ++market )
+   {
+      found += db.get_revision( market->first, market->second );
+      found += db.get_highest_bid( market->first, market->second ).valid();
+      found += db.get_lowest_ask( market->first, market->second ).valid();
+   }
+   return found;
+}
+
+void bench_market( uint32_t assets )
+{
+   std::vector<asset::type> spread;
+   spread.push_back( asset::type( 1 ) );
+   spread.push_back( asset::type( std::max<uint32_t>( 2, assets / 2 ) ) );
+   spread.push_back( asset::type( assets - 1 ) );
+
+   struct
+   {
+      const char*              name;
+      std::vector<asset::type> quotes;
+   } cases[2];
+   cases[0].name = "all_pairs";
+   for( uint32_t q = 1; q < assets; ++q )
+   {
+      cases[0].quotes.push_back( asset::type( q ) );
+   }
+   cases[1].name   = "3_pairs";
+   cases[1].quotes = spread;
+
+   for( uint32_t c = 0; c < 2; ++c )
+   {
+      fc::temp_directory dir;
+      market_db          db;
+      db.open( dir.path() / "market" );
+
+      uint32_t next_output = 0;
+      db.begin_batch();
+      for( auto q = cases[c].quotes.begin(); q != cases[c].quotes.end(); ++q )
+      {
+         add_orders( db, *q, next_output );
+      }
+      db.commit_batch();
+
+      run( "market", assets, cases[c].name, db.get_active_markets().size(), [&]()
+      {
+         bench_sink += match_pass( db );
+      });
+   }
+}
+
+/** the balance sheet of a transaction with two inputs and two outputs in each of touched assets */
+void bench_balance_sheet( uint32_t assets )
+{
+   const uint32_t touched[] = { 1, 4 };
+   for( uint32_t t = 0; t < sizeof(touched)/sizeof(touched[0]); ++t )
+   {
+      std::vector<asset::type> units;
+      for( uint32_t u = 0; u < touched[t]; ++u )
+      {
+         units.push_back( asset::type( (assets - 1) * (u + 1) / touched[t] ) );
+      }
+
+      trx_validation_state state;
+      run( "balance_sheet", assets, fc::to_string( uint64_t(touched[t]) ) + "_assets_touched", touched[t], [&]()
+      {
+         state.balance_sheet.clear();
+         for( auto u = units.begin(); u != units.end(); ++u )
+         {
+            state.balance( *u ).in  += asset( uint64_t(500), *u );
+            state.balance( *u ).in  += asset( uint64_t(500), *u );
+            state.balance( *u ).out += asset( uint64_t(600), *u );
+            state.balance( *u ).out += asset( uint64_t(400), *u );
+         }
+         for( auto itr = state.balance_sheet.begin(); itr != state.balance_sheet.end(); ++itr )
+         {
+            bench_sink += itr->second.creates_money();
+         }
+      });
+   }
+}
+
+int main( int argc, char** argv )
+{
+   if( argc >= 2 )
+   {
+      min_usec_per_case = atoi( argv[1] ) * 1000ll;
+   }
+
+   // the market and the balance sheet log on every change, keep that out of the timings
+   configure_bench_logging( "asset_scale_bench.log" );
+
+   try {
+      const uint32_t asset_counts[] = { 4, 16, 64, 256 };
+      for( uint32_t a = 0; a < sizeof(asset_counts)/sizeof(asset_counts[0]); ++a )
+      {
+         bench_market( asset_counts[a] );
+         bench_balance_sheet( asset_counts[a] );
+      }
+   }
+   catch ( const fc::exception& e )
+   {
+      elog( "${e}", ("e", e.to_detail_string() ) );
+      std::cerr << e.to_detail_string() << "\n";
+      return 1;
+   }
+   return 0;
+}
@@ -0,0 +1,75 @@
+#pragma once
+/**
+ *  Helpers shared by the benchmarks in this directory.  Every benchmark is a
+ *  single source file, so the globals below are defined here.
+ */
+#include <fc/crypto/elliptic.hpp>
+#include <fc/crypto/sha256.hpp>
+#include <fc/log/file_appender.hpp>
+#include <fc/log/logger.hpp>
+#include <fc/log/logger_config.hpp>
+#include <fc/reflect/variant.hpp>
+#include <fc/string.hpp>
+#include <fc/time.hpp>
+
+#include <string>
+
+/** results are folded in here so the optimizer can not drop the work */
+volatile uint64_t bench_sink = 0;
+
+/** every case is repeated until it has run this long */
+int64_t min_usec_per_case = 200000;
+
+struct bench_timing
+{
+   bench_timing():iterations(0),elapsed_usec(0){}
+
+   uint64_t iterations;
+   int64_t  elapsed_usec;
+
+   double ns_per_op()const   { return double(elapsed_usec) * 1000.0 / iterations; }
+   double ops_per_sec()const { return iterations * 1000000.0 / elapsed_usec;     }
+};
+
+/** calls f in batches of 16 until min_usec_per_case has passed */
+template<typename Functor>
+bench_timing time_case( Functor f )
+{
+   const uint32_t batch = 16;
+   bench_timing   t;
+   auto           start = fc::time_point::now();
+   do
+   {
+      for( uint32_t i = 0; i < batch; ++i )
+      {
+         f();
+      }
+      t.iterations  += batch;
+      t.elapsed_usec = (fc::time_point::now() - start).count();
+   } while( t.elapsed_usec < min_usec_per_case );
+   return t;
+}
+
+/** the same key for the same i on every run */
+fc::ecc::private_key bench_key( uint32_t i )
+{
+   std::string seed = "bench" + fc::to_string( uint64_t(i) );
+   return fc::ecc::private_key::generate_from_seed( fc::sha256::hash( seed.c_str(), seed.size() ) );
+}
+
+/** logs only errors and only to file, the chain and market log on every operation and would skew the timings */
+void configure_bench_logging( const std::string& file )
+{
+   fc::file_appender::config ac;
+   ac.filename = file;
+   ac.truncate = true;
+   ac.flush    = true;
+   fc::logging_config log_cfg;
+   log_cfg.appenders.push_back( fc::appender_config( "default", "file", fc::variant(ac) ) );
+   fc::logger_config dlc;
+   dlc.level = fc::log_level::error;
+   dlc.name  = "default";
+   dlc.appenders.push_back( "default" );
+   log_cfg.loggers.push_back( dlc );
+   fc::configure_logging( log_cfg );
+}
@@ -0,0 +1,346 @@
+#define BOOST_TEST_MODULE ChainReorgTests
+#include <boost/test/unit_test.hpp>
+#include <bts/blockchain/blockchain_db.hpp>
+#include <bts/blockchain/block.hpp>
+#include <bts/blockchain/outputs.hpp>
+#include <bts/blockchain/worker_threads.hpp>
+#include <bts/config.hpp>
+#include <fc/crypto/elliptic.hpp>
+#include <fc/crypto/sha256.hpp>
+#include <fc/exception/exception.hpp>
+#include <fc/filesystem.hpp>
+#include <fc/io/json.hpp>
+#include <fc/log/logger.hpp>
+#include <fc/reflect/variant.hpp>
+#include <fc/string.hpp>
+#include <fc/variant_object.hpp>
+
+#include <string>
+#include <vector>
+
+using namespace bts::blockchain;
+
+/**
+ *  Checks that popping blocks and reorganizing to a fork leave the database in
+ *  exactly the state a fresh replay of the resulting chain produces, and that
+ *  a fork which is rejected partway through leaves the original chain in place.
+ *
+ *  The main chain is blocks 1 to 6 after the genesis block, the fork replaces
+ *  blocks 4 to 6 with blocks 4 to 7.  Every block spends three genesis outputs
+ *  with a transfer, an ask and a short so the undo of spends, order books and
+ *  covers is exercised.
+ */
+
+const uint32_t num_keys    = 32;
+const uint64_t per_key     = 1000ll * COIN;
+const uint32_t fork_block  = 4;
+
+struct worker_threads_fixture
+{
+   ~worker_threads_fixture() { shutdown_worker_threads(); }
+};
+BOOST_GLOBAL_FIXTURE( worker_threads_fixture );
+
+fc::ecc::private_key test_key( uint32_t i )
+{
+   std::string seed = "reorg" + fc::to_string( uint64_t(i) );
+   return fc::ecc::private_key::generate_from_seed( fc::sha256::hash( seed.c_str(), seed.size() ) );
+}
+
+bts::address test_address( uint32_t i )
+{
+   return bts::address( test_key( i ).get_public_key() );
+}
+
+/** the blocks shared by every test, generated once because of the proof of work */
+struct test_chains
+{
+   trx_block               genesis;
+   std::vector<trx_block>  main_chain; ///< blocks 1 to 6
+   std::vector<trx_block>  fork;       ///< blocks 4 to 7, replacing 4 to 6 of main_chain
+};
+
+/** fills in the timestamp, fee and proof of work that push_block checks */
+void seal_block( blockchain_db& db, trx_block& blk, const fc::time_point& timestamp )
+{
+   blk.timestamp = timestamp;
+   blk.next_fee  = block_header::calculate_next_fee( db.get_fee_rate().get_rounded_amount(), blk.block_size() );
+   if( blk.block_num > 0 )
+   {
+      auto required = blk.get_required_difficulty( db.current_difficulty(), db.available_coindays() );
+      while( blk.get_difficulty() < required )
+      {
+         ++blk.noncea;
+         FC_ASSERT( blk.noncea < (1u << 24), "unable to meet the required difficulty ${r}", ("r",required) );
+      }
+   }
+}
+
+/** spends the genesis output of key and pays to, asks or shorts with half of it */
+signed_transaction spend_genesis( blockchain_db& db, const transaction_id_type& genesis_trx,
+                                  uint32_t key, uint32_t kind, uint32_t to )
+{
+   signed_transaction trx;
+   trx.version = 0;
+   trx.inputs.push_back( trx_input( claim_by_signature_input(), output_reference( genesis_trx, key ) ) );
+
+   // the fee is generous so that the size estimate does not have to be exact
+   uint64_t fee   = db.get_fee_rate().get_rounded_amount() * 2000;
+   uint64_t order = (per_key - fee) / 2;
+   if( kind == 0 )
+   {
+      trx.outputs.push_back( trx_output( claim_by_signature_output( test_address( to ) ), asset( order, asset::bts ) ) );
+   }
+   else if( kind == 1 )
+   {
+      trx.outputs.push_back( trx_output( claim_by_bid_output( test_address( to ), price( 0.95, asset::bts, asset::usd ) ),
+                                         asset( order, asset::bts ) ) );
+   }
+   else
+   {
+      trx.outputs.push_back( trx_output( claim_by_long_output( test_address( to ), price( 1.05, asset::bts, asset::usd ) ),
+                                         asset( order, asset::bts ) ) );
+   }
+   trx.outputs.push_back( trx_output( claim_by_signature_output( test_address( key ) ), asset( per_key - fee - order, asset::bts ) ) );
+   trx.sign( test_key( key ) );
+   return trx;
+}
+
+/**
+ *  Generates and pushes blocks first to first + count - 1 on db, block n spends
+ *  the genesis outputs of keys first_key + 3 * (n - first) and the two after it.
+ */
+std::vector<trx_block> generate_blocks( blockchain_db& db, const fc::time_point& start, const trx_block& genesis,
+                                        uint32_t first, uint32_t count, uint32_t first_key, uint32_t time_offset_sec )
+{
+   std::vector<trx_block> blocks;
+   for( uint32_t n = first; n < first + count; ++n )
+   {
+      uint32_t key = first_key + 3 * (n - first);
+      std::vector<signed_transaction> trxs;
+      for( uint32_t kind = 0; kind < 3; ++kind )
+      {
+         trxs.push_back( spend_genesis( db, genesis.trxs.front().id(), key + kind, kind, (key + kind + 1) % num_keys ) );
+      }
+      auto blk = db.generate_next_block( trxs );
+      BOOST_REQUIRE( blk.block_num == n );
+      BOOST_REQUIRE( blk.trxs.size() >= trxs.size() );
+      seal_block( db, blk, start + fc::seconds( BLOCK_INTERVAL * 60 * n + time_offset_sec ) );
+      db.push_block( blk );
+      blocks.push_back( blk );
+   }
+   return blocks;
+}
+
+const test_chains& chains()
+{
+   static test_chains chains;
+   if( chains.genesis.trxs.size() )
+   {
+      return chains;
+   }
+
+   // far enough in the past that every block can be 5 minutes after its predecessor
+   fc::time_point start = fc::time_point::now() - fc::seconds( BLOCK_INTERVAL * 60 * 10 );
+
+   trx_block& genesis = chains.genesis;
+   genesis.version      = 0;
+   genesis.block_num    = 0;
+   genesis.total_shares = per_key * num_keys;
+   signed_transaction coinbase;
+   coinbase.version = 0;
+   for( uint32_t i = 0; i < num_keys; ++i )
+   {
+      coinbase.outputs.push_back( trx_output( claim_by_signature_output( test_address( i ) ), asset( per_key, asset::bts ) ) );
+   }
+   genesis.trxs.push_back( coinbase );
+   genesis.trx_mroot = genesis.calculate_merkle_root();
+
+   {
+      fc::temp_directory dir;
+      blockchain_db      db;
+      db.open( dir.path() / "chain" );
+      seal_block( db, genesis, start );
+      db.push_block( genesis );
+      chains.main_chain = generate_blocks( db, start, genesis, 1, 6, 0, 0 );
+   }
+   {
+      // the fork spends other outputs and is a minute later so none of its blocks match the main chain
+      fc::temp_directory dir;
+      blockchain_db      db;
+      db.open( dir.path() / "chain" );
+      db.push_block( genesis );
+      for( uint32_t n = 1; n < fork_block; ++n )
+      {
+         db.push_block( chains.main_chain[n-1] );
+      }
+      chains.fork = generate_blocks( db, start, genesis, fork_block, 4, 18, 60 );
+   }
+   return chains;
+}
+
+/** the head, the utxo commitment, every order book and where every output of the chain was spent */
+std::string chain_state( blockchain_db& db )
+{
+   fc::mutable_variant_object state;
+   state( "head_block_num", db.head_block_num() )
+        ( "head_block_id", db.head_block_id() )
+        ( "utxo_commitment", db.get_utxo_commitment() );
+   for( uint32_t q = 1; q < asset::count; ++q )
+   {
+      state( "market_" + fc::to_string( uint64_t(q) ), db.get_market( asset::type( q ), asset::bts ) );
+   }
+   std::vector<meta_trx> trxs;
+   for( uint32_t n = 0; n <= db.head_block_num(); ++n )
+   {
+      auto blk = db.fetch_full_block( n );
+      for( uint16_t i = 0; i < blk.trx_ids.size(); ++i )
+      {
+         trxs.push_back( db.fetch_trx( trx_num( n, i ) ) );
+      }
+   }
+   state( "trxs", trxs );
+   return fc::json::to_string( fc::variant( state ) );
+}
+
+/** the state of a new database that has only been given blocks */
+std::string replay_state( const std::vector<trx_block>& blocks )
+{
+   fc::temp_directory dir;
+   blockchain_db      db;
+   db.open( dir.path() / "chain" );
+   for( auto itr = blocks.begin(); itr != blocks.end(); ++itr )
+   {
+      db.push_block( *itr );
+   }
+   return chain_state( db );
+}
+
+/** genesis and main_chain blocks 1 to last */
+std::vector<trx_block> main_prefix( uint32_t last )
+{
+   std::vector<trx_block> blocks( 1, chains().genesis );
+   blocks.insert( blocks.end(), chains().main_chain.begin(), chains().main_chain.begin() + last );
+   return blocks;
+}
+
+BOOST_AUTO_TEST_CASE( pop_block_matches_replay )
+{
+  try {
+    fc::temp_directory dir;
+    blockchain_db      db;
+    db.open( dir.path() / "chain" );
+    auto blocks = main_prefix( chains().main_chain.size() );
+    for( auto itr = blocks.begin(); itr != blocks.end(); ++itr )
+    {
+       db.push_block( *itr );
+    }
+    BOOST_REQUIRE( chain_state( db ) == replay_state( blocks ) );
+
+    while( db.head_block_num() >= fork_block )
+    {
+       full_block                      popped;
+       std::vector<signed_transaction> trxs;
+       db.pop_block( popped, trxs );
+       BOOST_REQUIRE( popped.id() == blocks.back().id() );
+       BOOST_REQUIRE( trxs.size() == blocks.back().trxs.size() );
+       for( uint32_t i = 0; i < trxs.size(); ++i )
+       {
+          BOOST_REQUIRE( trxs[i].id() == blocks.back().trxs[i].id() );
+       }
+       blocks.pop_back();
+       BOOST_REQUIRE( chain_state( db ) == replay_state( blocks ) );
+    }
+
+    // the popped blocks can be pushed again
+    for( uint32_t n = fork_block; n <= chains().main_chain.size(); ++n )
+    {
+       db.push_block( chains().main_chain[n-1] );
+       blocks.push_back( chains().main_chain[n-1] );
+    }
+    BOOST_REQUIRE( chain_state( db ) == replay_state( blocks ) );
+  }
+  catch ( const fc::exception& e )
+  {
+    elog( "${e}", ("e",e.to_detail_string()) );
+    throw;
+  }
+}
+
+BOOST_AUTO_TEST_CASE( reorganize_matches_replay )
+{
+  try {
+    fc::temp_directory dir;
+    blockchain_db      db;
+    db.open( dir.path() / "chain" );
+    auto original = main_prefix( chains().main_chain.size() );
+    for( auto itr = original.begin(); itr != original.end(); ++itr )
+    {
+       db.push_block( *itr );
+    }
+
+    std::vector<signed_transaction> orphaned;
+    db.reorganize_to( chains().fork, orphaned );
+
+    auto blocks = main_prefix( fork_block - 1 );
+    blocks.insert( blocks.end(), chains().fork.begin(), chains().fork.end() );
+    BOOST_REQUIRE( db.head_block_id() == chains().fork.back().id() );
+    BOOST_REQUIRE( chain_state( db ) == replay_state( blocks ) );
+
+    // the transactions of the replaced blocks in chain order
+    std::vector<signed_transaction> expected;
+    for( uint32_t n = fork_block; n <= chains().main_chain.size(); ++n )
+    {
+       expected.insert( expected.end(), chains().main_chain[n-1].trxs.begin(), chains().main_chain[n-1].trxs.end() );
+    }
+    BOOST_REQUIRE( orphaned.size() == expected.size() );
+    for( uint32_t i = 0; i < orphaned.size(); ++i )
+    {
+       BOOST_REQUIRE( orphaned[i].id() == expected[i].id() );
+    }
+
+    // and back again
+    std::vector<trx_block> back( chains().main_chain.begin() + fork_block - 1, chains().main_chain.end() );
+    db.reorganize_to( back, orphaned );
+    BOOST_REQUIRE( chain_state( db ) == replay_state( original ) );
+  }
+  catch ( const fc::exception& e )
+  {
+    elog( "${e}", ("e",e.to_detail_string()) );
+    throw;
+  }
+}
+
+BOOST_AUTO_TEST_CASE( rejected_fork_restores_chain )
+{
+  try {
+    fc::temp_directory dir;
+    blockchain_db      db;
+    db.open( dir.path() / "chain" );
+    auto original = main_prefix( chains().main_chain.size() );
+    for( auto itr = original.begin(); itr != original.end(); ++itr )
+    {
+       db.push_block( *itr );
+    }
+    auto before = chain_state( db );
+
+    // the first three blocks of the fork are applied before the last one is rejected
+    std::vector<trx_block> bad_fork = chains().fork;
+    bad_fork.back().next_fee += 1;
+    std::vector<signed_transaction> orphaned;
+    BOOST_REQUIRE_THROW( db.reorganize_to( bad_fork, orphaned ), fc::exception );
+
+    BOOST_REQUIRE( db.head_block_id() == original.back().id() );
+    BOOST_REQUIRE( chain_state( db ) == before );
+    BOOST_REQUIRE( chain_state( db ) == replay_state( original ) );
+
+    // the restored chain still accepts the valid fork
+    db.reorganize_to( chains().fork, orphaned );
+    BOOST_REQUIRE( db.head_block_id() == chains().fork.back().id() );
+  }
+  catch ( const fc::exception& e )
+  {
+    elog( "${e}", ("e",e.to_detail_string()) );
+    throw;
+  }
+}
@@ -0,0 +1,580 @@
+/**
+ *  Replays a synthetic chain into an empty blockchain_db and reports how fast
+ *  blocks are applied.
+ *
+ *  The chain is generated first by a second blockchain_db that is fed random
+ *  transfers, asks (claim_by_bid) and shorts (claim_by_long) signed by a fixed
+ *  set of keys.  Covers are created by the market whenever shorts and asks
+ *  cross.  Only the replay is timed, the generator just provides valid blocks.
+ *
+ *  Usage: chain_replay_bench [--option value]...
+ *
+ *    --blocks N     blocks to generate after the genesis block   (200)
+ *    --trxs N       transactions offered per block               (50)
+ *    --fan-in N     inputs spent by every transfer               (2)
+ *    --fan-out N    outputs created by every transfer            (2)
+ *    --transfer N   relative weight of transfers                 (70)
+ *    --ask N        relative weight of asks                      (15)
+ *    --short N      relative weight of shorts                    (15)
+ *    --markets N    number of quote units orders are spread over (1)
+ *    --keys N       number of keys that own the genesis balances (256)
+ *    --seed N       seed of the random generator                 (1)
+ *    --save FILE    write the generated blocks to FILE
+ *    --load FILE    replay the blocks in FILE instead of generating a chain
+ *
+ *  For example --trxs 100 --transfer 0 --ask 0 --short 100 --blocks 1000
+ *  places 100k shorts in the usd market.
+ *
+ *  Before every block is pushed one match_orders() is timed on the replayed
+ *  books, outside of the block apply time.  It is timed once with the pairs
+ *  that were idle at the last block skipped, the way a node runs it, and
+ *  again after clear_match_cache() with every pair evaluated.
+ *
+ *  To compare match_orders with a build that predates the in memory books and
+ *  the idle pair cache, save a chain with --save, build this file against that
+ *  library with BTS_BENCH_BASELINE defined and replay the same chain with
+ *  --load.  The baseline has no cache, so its single timing is reported as the
+ *  full cost.
+ */
+#include <bts/blockchain/blockchain_db.hpp>
+#include <bts/blockchain/block.hpp>
+#include <bts/blockchain/outputs.hpp>
+#ifndef BTS_BENCH_BASELINE
+#include <bts/blockchain/worker_threads.hpp>
+#endif
+#include <bts/config.hpp>
+#include <fc/crypto/elliptic.hpp>
+#include <fc/filesystem.hpp>
+#include <fc/io/raw.hpp>
+#include <fc/log/logger.hpp>
+#include <fc/reflect/variant.hpp>
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <set>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <stdlib.h>
+
+#include "bench_common.hpp"
+
+using namespace bts::blockchain;
+
+#ifdef BTS_BENCH_BASELINE
+/** the baseline library has no worker pool to join */
+void shutdown_worker_threads(){}
+#endif
+
+struct bench_config
+{
+   bench_config()
+   :blocks(200),trxs_per_block(50),fan_in(2),fan_out(2),
+    transfer_weight(70),ask_weight(15),short_weight(15),
+    markets(1),keys(256),seed(1){}
+
+   uint32_t blocks;
+   uint32_t trxs_per_block;
+   uint32_t fan_in;
+   uint32_t fan_out;
+   uint32_t transfer_weight;
+   uint32_t ask_weight;
+   uint32_t short_weight;
+   uint32_t markets;
+   uint32_t keys;
+   uint32_t seed;
+   std::string save;
+   std::string load;
+};
+
+/** an unspent claim_by_signature output owned by one of the generator keys */
+struct wallet_output
+{
+   output_reference ref;
+   uint64_t         amount;
+   uint32_t         key;
+};
+
+/** a transaction offered to the generator and the wallet outputs it spends */
+struct pending_trx
+{
+   signed_transaction          trx;
+   std::vector<wallet_output>  spent;
+   std::vector<wallet_output>  created;
+};
+
+class chain_generator
+{
+   public:
+      chain_generator( const bench_config& cfg )
+      :_cfg(cfg),_rand(cfg.seed),_match_usec(0),_matched(0)
+      {
+         for( uint32_t i = 0; i < _cfg.keys; ++i )
+         {
+            _keys.push_back( bench_key( i ) );
+            _addresses.push_back( bts::address( _keys.back().get_public_key() ) );
+         }
+         // far enough in the past that every block can be 5 minutes after its
+         // predecessor, which also keeps the difficulty from retargeting
+         _start = fc::time_point::now() - fc::seconds( BLOCK_INTERVAL * 60 * (_cfg.blocks + 2) );
+         _chain.open( _dir.path() / "chain" );
+      }
+
+      void generate()
+      {
+         auto genesis = create_genesis();
+         push( genesis );
+         for( uint32_t b = 0; b < _cfg.blocks; ++b )
+         {
+            std::vector<pending_trx> pending;
+            for( uint32_t t = 0; t < _cfg.trxs_per_block; ++t )
+            {
+               pending_trx p;
+               if( next_trx( p ) )
+               {
+                  pending.push_back( std::move(p) );
+               }
+            }
+
+            std::vector<signed_transaction> trxs;
+            trxs.reserve( pending.size() );
+            for( auto itr = pending.begin(); itr != pending.end(); ++itr )
+            {
+               trxs.push_back( itr->trx );
+            }
+
+            auto start = fc::time_point::now();
+            _matched  += _chain.match_orders().size();
+            _match_usec += (fc::time_point::now() - start).count();
+
+            auto blk = _chain.generate_next_block( trxs );
+            push( blk );
+            update_wallet( blk, pending );
+         }
+      }
+
+      blockchain_db& chain()            { return _chain; }
+      uint64_t       match_usec()const  { return _match_usec; }
+      uint64_t       matched()const     { return _matched;    }
+      uint64_t       wallet_size()const { return _wallet.size(); }
+
+   private:
+      trx_block create_genesis()
+      {
+         const uint64_t per_key = 1000000ll * COIN / _cfg.keys;
+
+         trx_block b;
+         b.version      = 0;
+         b.block_num    = 0;
+         b.total_shares = per_key * _cfg.keys;
+
+         signed_transaction coinbase;
+         coinbase.version = 0;
+         for( uint32_t i = 0; i < _cfg.keys; ++i )
+         {
+            coinbase.outputs.push_back( trx_output( claim_by_signature_output( _addresses[i] ), asset( per_key, asset::bts ) ) );
+            if( coinbase.outputs.size() == 0xff || i + 1 == _cfg.keys )
+            {
+               for( uint32_t o = 0; o < coinbase.outputs.size(); ++o )
+               {
+                  wallet_output w;
+                  w.ref    = output_reference( coinbase.id(), o );
+                  w.amount = per_key;
+                  w.key    = i + 1 + o - coinbase.outputs.size();
+                  _wallet.push_back( w );
+               }
+               b.trxs.push_back( coinbase );
+               coinbase.outputs.clear();
+            }
+         }
+         b.trx_mroot = b.calculate_merkle_root();
+         return b;
+      }
+
+      /** fills in the timestamp, fee and proof of work that push_block checks */
+      void push( trx_block& blk )
+      {
+         blk.timestamp = _start + fc::seconds( BLOCK_INTERVAL * 60 * blk.block_num );
+         blk.next_fee  = block_header::calculate_next_fee( _chain.get_fee_rate().get_rounded_amount(), blk.block_size() );
+         if( blk.block_num > 0 )
+         {
+            auto required = blk.get_required_difficulty( _chain.current_difficulty(), _chain.available_coindays() );
+            while( blk.get_difficulty() < required )
+            {
+               ++blk.noncea;
+               FC_ASSERT( blk.noncea < (1u << 24), "unable to meet the required difficulty ${r}", ("r",required) );
+            }
+         }
+         _chain.push_block( blk );
+      }
+
+      /** estimates the signed size of trx to pay the fee before it is signed */
+      uint64_t fee_for( const signed_transaction& trx, uint32_t num_signers )
+      {
+         uint64_t size = fc::raw::pack_size( trx ) + num_signers * (sizeof(fc::ecc::compact_signature) + 1) + 16;
+         return _chain.get_fee_rate().get_rounded_amount() * size;
+      }
+
+      bool take_inputs( pending_trx& p, uint32_t count )
+      {
+         while( p.spent.size() < count && _wallet.size() )
+         {
+            p.spent.push_back( _wallet.front() );
+            _wallet.pop_front();
+         }
+         for( auto itr = p.spent.begin(); itr != p.spent.end(); ++itr )
+         {
+            p.trx.inputs.push_back( trx_input( claim_by_signature_input(), itr->ref ) );
+         }
+         return p.spent.size() > 0;
+      }
+
+      void sign( pending_trx& p )
+      {
+         std::unordered_set<uint32_t> signers;
+         for( auto itr = p.spent.begin(); itr != p.spent.end(); ++itr )
+         {
+            if( signers.insert( itr->key ).second )
+            {
+               p.trx.sign( _keys[itr->key] );
+            }
+         }
+         auto id = p.trx.id();
+         for( uint32_t o = 0; o < p.created.size(); ++o )
+         {
+            p.created[o].ref.trx_hash = id;
+         }
+      }
+
+      uint64_t total_in( const pending_trx& p )const
+      {
+         uint64_t total = 0;
+         for( auto itr = p.spent.begin(); itr != p.spent.end(); ++itr )
+         {
+            total += itr->amount;
+         }
+         return total;
+      }
+
+      void add_change( pending_trx& p, uint64_t amount )
+      {
+         wallet_output w;
+         w.amount = amount;
+         w.key    = _rand() % _cfg.keys;
+         w.ref.output_idx = p.trx.outputs.size();
+         p.trx.outputs.push_back( trx_output( claim_by_signature_output( _addresses[w.key] ), asset( amount, asset::bts ) ) );
+         p.created.push_back( w );
+      }
+
+      bool next_trx( pending_trx& p )
+      {
+         uint32_t total_weight = _cfg.transfer_weight + _cfg.ask_weight + _cfg.short_weight;
+         if( total_weight == 0 )
+         {
+            return false;
+         }
+         uint32_t pick = _rand() % total_weight;
+         if( pick < _cfg.transfer_weight )
+         {
+            return next_transfer( p );
+         }
+         return next_order( p, pick < _cfg.transfer_weight + _cfg.ask_weight );
+      }
+
+      bool next_transfer( pending_trx& p )
+      {
+         if( !take_inputs( p, _cfg.fan_in ) )
+         {
+            return false;
+         }
+         // the output amounts are fixed size, so placeholders give the final size
+         for( uint32_t o = 0; o < _cfg.fan_out; ++o )
+         {
+            p.trx.outputs.push_back( trx_output( claim_by_signature_output( _addresses[0] ), asset( uint64_t(0), asset::bts ) ) );
+         }
+         uint64_t fee = fee_for( p.trx, p.spent.size() );
+         p.trx.outputs.clear();
+         if( total_in( p ) < 4 * fee + _cfg.fan_out )
+         {
+            return false; // dust is left unspent
+         }
+
+         uint64_t remaining = total_in( p ) - fee;
+         for( uint32_t o = 0; o < _cfg.fan_out; ++o )
+         {
+            add_change( p, o + 1 == _cfg.fan_out ? remaining : remaining / (_cfg.fan_out - o) );
+            remaining -= p.created.back().amount;
+         }
+         sign( p );
+         return true;
+      }
+
+      /** places half of one input on the book, the rest comes back as change */
+      bool next_order( pending_trx& p, bool is_ask )
+      {
+         if( !take_inputs( p, 1 ) )
+         {
+            return false;
+         }
+         // a claim_by_long output packs larger than a bid, size the fee for it
+         const bts::address& pay_to = _addresses[ _rand() % _cfg.keys ];
+         p.trx.outputs.push_back( trx_output( claim_by_long_output( pay_to, price( 1.0, asset::bts, asset::usd ) ), asset( uint64_t(0), asset::bts ) ) );
+         p.trx.outputs.push_back( trx_output( claim_by_signature_output( pay_to ), asset( uint64_t(0), asset::bts ) ) );
+         uint64_t fee = fee_for( p.trx, 1 );
+         p.trx.outputs.clear();
+         if( total_in( p ) < 4 * fee )
+         {
+            return false; // dust is left unspent
+         }
+
+         asset::type quote = asset::type( 1 + _rand() % std::max<uint32_t>( 1, std::min<uint32_t>( _cfg.markets, asset::count - 1 ) ) );
+         uint64_t    order = (total_in( p ) - fee) / 2;
+
+         // asks sell below 1.0 and shorts buy above it so the books cross
+         double spread = (_rand() % 1000) / 10000.0;
+         if( is_ask )
+         {
+            p.trx.outputs.push_back( trx_output( claim_by_bid_output( pay_to, price( 1.0 - spread, asset::bts, quote ) ),
+                                                 asset( order, asset::bts ) ) );
+         }
+         else
+         {
+            p.trx.outputs.push_back( trx_output( claim_by_long_output( pay_to, price( 1.0 + spread, asset::bts, quote ) ),
+                                                 asset( order, asset::bts ) ) );
+         }
+         add_change( p, total_in( p ) - fee - order );
+         sign( p );
+         return true;
+      }
+
+      /** outputs of included trxs can be spent, inputs of dropped ones are returned */
+      void update_wallet( const trx_block& blk, const std::vector<pending_trx>& pending )
+      {
+         std::set<transaction_id_type> included;
+         for( auto itr = blk.trxs.begin(); itr != blk.trxs.end(); ++itr )
+         {
+            included.insert( itr->id() );
+         }
+         for( auto itr = pending.begin(); itr != pending.end(); ++itr )
+         {
+            if( included.count( itr->trx.id() ) )
+            {
+               _wallet.insert( _wallet.end(), itr->created.begin(), itr->created.end() );
+            }
+            else
+            {
+               _wallet.insert( _wallet.begin(), itr->spent.begin(), itr->spent.end() );
+            }
+         }
+      }
+
+      bench_config                        _cfg;
+      std::mt19937                        _rand;
+      std::vector<fc::ecc::private_key>   _keys;
+      std::vector<bts::address>           _addresses;
+      std::deque<wallet_output>           _wallet;
+      fc::time_point                      _start;
+      fc::temp_directory                  _dir;
+      blockchain_db                       _chain;
+      uint64_t                            _match_usec;
+      uint64_t                            _matched;
+};
+
+/** bytes on disk below p */
+uint64_t directory_size( const fc::path& p )
+{
+   uint64_t size = 0;
+   boost::filesystem::recursive_directory_iterator itr( p ), end;
+   for( ; itr != end; ++itr )
+   {
+      if( boost::filesystem::is_regular_file( itr->status() ) )
+      {
+         size += boost::filesystem::file_size( itr->path() );
+      }
+   }
+   return size;
+}
+
+bool parse_args( int argc, char** argv, bench_config& cfg )
+{
+   for( int i = 1; i < argc; i += 2 )
+   {
+      if( i + 1 >= argc )
+      {
+         return false;
+      }
+      std::string opt = argv[i];
+      uint32_t    val = atoi( argv[i+1] );
+      if(      opt == "--blocks"   ) cfg.blocks          = val;
+      else if( opt == "--trxs"     ) cfg.trxs_per_block  = val;
+      else if( opt == "--fan-in"   ) cfg.fan_in          = std::max<uint32_t>( 1, val );
+      else if( opt == "--fan-out"  ) cfg.fan_out         = std::max<uint32_t>( 1, std::min<uint32_t>( 0xff, val ) );
+      else if( opt == "--transfer" ) cfg.transfer_weight = val;
+      else if( opt == "--ask"      ) cfg.ask_weight      = val;
+      else if( opt == "--short"    ) cfg.short_weight    = val;
+      else if( opt == "--markets"  ) cfg.markets         = val;
+      else if( opt == "--keys"     ) cfg.keys            = std::max<uint32_t>( 1, val );
+      else if( opt == "--seed"     ) cfg.seed            = val;
+      else if( opt == "--save"     ) cfg.save            = argv[i+1];
+      else if( opt == "--load"     ) cfg.load            = argv[i+1];
+      else return false;
+   }
+   return true;
+}
+
+int main( int argc, char** argv )
+{
+   bench_config cfg;
+   if( !parse_args( argc, argv, cfg ) )
+   {
+      std::cerr << "Usage: " << argv[0] << " [--blocks N] [--trxs N] [--fan-in N] [--fan-out N] [--transfer N]"
+                << " [--ask N] [--short N] [--markets N] [--keys N] [--seed N] [--save FILE] [--load FILE]\n";
+      return 1;
+   }
+
+   // the chain logs every trx it evaluates, keep that out of the timings
+   configure_bench_logging( "chain_replay_bench.log" );
+
+   try {
+      std::vector<trx_block> blocks;
+      uint64_t               gen_match_usec = 0;
+      uint64_t               gen_matched    = 0;
+      uint64_t               gen_wallet     = 0;
+      if( cfg.load.size() )
+      {
+         std::ifstream in( cfg.load.c_str(), std::ios::binary );
+         std::vector<char> data( (std::istreambuf_iterator<char>( in )), std::istreambuf_iterator<char>() );
+         FC_ASSERT( data.size(), "unable to read ${file}", ("file",cfg.load) );
+         blocks = fc::raw::unpack< std::vector<trx_block> >( data );
+         std::cout << "loaded " << blocks.size() << " blocks from " << cfg.load << "\n";
+      }
+      else
+      {
+         chain_generator gen( cfg );
+         std::cout << "generating " << cfg.blocks << " blocks...\n";
+         gen.generate();
+         for( uint32_t n = 0; n <= gen.chain().head_block_num(); ++n )
+         {
+            blocks.push_back( gen.chain().fetch_trx_block( n ) );
+         }
+         gen_match_usec = gen.match_usec();
+         gen_matched    = gen.matched();
+         gen_wallet     = gen.wallet_size();
+      }
+      if( cfg.save.size() )
+      {
+         auto data = fc::raw::pack( blocks );
+         std::ofstream out( cfg.save.c_str(), std::ios::binary );
+         out.write( data.data(), data.size() );
+         FC_ASSERT( out.good(), "unable to write ${file}", ("file",cfg.save) );
+      }
+
+      fc::temp_directory replay_dir;
+      blockchain_db      replay;
+      replay.open( replay_dir.path() / "chain" );
+
+      uint64_t              num_trxs    = 0;
+      uint64_t              market_trxs = 0;
+      uint64_t              cached_usec = 0;
+      uint64_t              full_usec   = 0;
+      std::vector<uint64_t> latency;
+      latency.reserve( blocks.size() );
+
+      auto start = fc::time_point::now();
+      for( auto blk = blocks.begin(); blk != blocks.end(); ++blk )
+      {
+         num_trxs += blk->trxs.size();
+
+         // the books as they are before the block, the state block producers match
+         if( blk->block_num > 0 )
+         {
+            auto match_start = fc::time_point::now();
+#ifdef BTS_BENCH_BASELINE
+            // there is no idle pair cache, every call evaluates every pair
+            market_trxs += replay.match_orders().size();
+            full_usec   += (fc::time_point::now() - match_start).count();
+#else
+            replay.match_orders();
+            cached_usec += (fc::time_point::now() - match_start).count();
+
+            replay.clear_match_cache();
+            match_start  = fc::time_point::now();
+            market_trxs += replay.match_orders().size();
+            full_usec   += (fc::time_point::now() - match_start).count();
+#endif
+         }
+
+         auto blk_start = fc::time_point::now();
+         replay.push_block( *blk );
+         latency.push_back( (fc::time_point::now() - blk_start).count() );
+      }
+      double elapsed = (fc::time_point::now() - start).count() / 1000000.0;
+      double apply   = 0;
+      for( auto l = latency.begin(); l != latency.end(); ++l )
+      {
+         apply += *l / 1000000.0;
+      }
+      std::sort( latency.begin(), latency.end() );
+      uint32_t matched_blocks = std::max<uint32_t>( 1, latency.size() - 1 );
+
+      std::cout << std::fixed << std::setprecision(2);
+      std::cout << "blocks:           " << latency.size() << "\n";
+      std::cout << "transactions:     " << num_trxs << "\n";
+      std::cout << "elapsed:          " << elapsed << " sec, " << apply << " sec applying blocks\n";
+      std::cout << "blocks/sec:       " << latency.size() / apply << "\n";
+      std::cout << "trx/sec:          " << num_trxs / apply << "\n";
+      std::cout << "p50 block apply:  " << latency[ latency.size() / 2 ] / 1000.0 << " ms\n";
+      std::cout << "p99 block apply:  " << latency[ latency.size() * 99 / 100 ] / 1000.0 << " ms\n";
+      std::cout << std::setprecision(3);
+#ifndef BTS_BENCH_BASELINE
+      std::cout << "match_orders:     " << cached_usec / 1000.0 / matched_blocks << " ms/block, idle pairs skipped\n";
+#endif
+      std::cout << "match_orders full:" << full_usec / 1000.0 / matched_blocks << " ms/block, "
+                                       << market_trxs << " market trxs\n";
+      if( cfg.load.empty() )
+      {
+         std::cout << "generator matching " << gen_match_usec / 1000.0 / std::max<uint32_t>( 1, cfg.blocks ) << " ms/block, "
+                                          << gen_matched << " market trxs\n";
+         std::cout << "unspent in wallet " << gen_wallet << "\n";
+      }
+
+#ifndef BTS_BENCH_BASELINE
+      // the bytes of the batches each store committed during the replay
+      std::cout << "bytes written per store:\n";
+      auto written = replay.bytes_written();
+      for( auto w = written.begin(); w != written.end(); ++w )
+      {
+         std::cout << "   " << std::setw(20) << std::left << w->first
+                   << std::right << std::setw(12) << w->second / 1024 << " KB\n";
+      }
+#endif
+
+      std::cout << "on disk size per store:\n";
+      fc::directory_iterator store( replay_dir.path() / "chain" );
+      while( store != fc::directory_iterator() )
+      {
+         auto p = *store;
+         uint64_t size = fc::is_directory( p ) ? directory_size( p ) : boost::filesystem::file_size( p );
+         std::cout << "   " << std::setw(16) << std::left << p.filename().generic_string()
+                   << std::right << std::setw(12) << size / 1024 << " KB\n";
+         ++store;
+      }
+   }
+   catch ( const fc::exception& e )
+   {
+      elog( "${e}", ("e", e.to_detail_string() ) );
+      std::cerr << e.to_detail_string() << "\n";
+      shutdown_worker_threads();
+      return 1;
+   }
+   shutdown_worker_threads();
+   return 0;
+}
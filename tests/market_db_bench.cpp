@@ -0,0 +1,160 @@
+/**
+ *  Fills a market_db with margin calls and checks that get_calls() returns
+ *  exactly the triggered tail, every call at or above the call price from
+ *  the highest down, while timing the inserts and the lookups.
+ *
+ *  Calls are spread over the usd and btc quote units with random call prices
+ *  and are inserted in batches the size of a busy block.  The expected tail is
+ *  computed from a sorted copy of the usd calls for a range of call prices
+ *  from above the highest call, which triggers nothing, to the lowest.
+ *
+ *  Usage: market_db_bench [--calls N] [--batch N] [--lookups N] [--seed N]
+ *
+ *    --calls N      margin calls inserted                      (100000)
+ *    --batch N      calls inserted per batch                   (1000)
+ *    --lookups N    get_calls() per call price that is timed   (20)
+ *    --seed N       seed of the random generator               (1)
+ */
+#include <bts/blockchain/blockchain_market_db.hpp>
+#include <fc/crypto/ripemd160.hpp>
+#include <fc/exception/exception.hpp>
+#include <fc/filesystem.hpp>
+#include <fc/log/logger.hpp>
+#include <fc/reflect/variant.hpp>
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <stdlib.h>
+
+#include "bench_common.hpp"
+
+using namespace bts::blockchain;
+
+struct bench_config
+{
+   bench_config():calls(100000),batch(1000),lookups(20),seed(1){}
+
+   uint32_t calls;
+   uint32_t batch;
+   uint32_t lookups;
+   uint32_t seed;
+};
+
+bool parse_args( int argc, char** argv, bench_config& cfg )
+{
+   for( int i = 1; i < argc; i += 2 )
+   {
+      if( i + 1 >= argc )
+      {
+         return false;
+      }
+      std::string opt = argv[i];
+      uint32_t    val = atoi( argv[i+1] );
+      if(      opt == "--calls"   ) cfg.calls   = val;
+      else if( opt == "--batch"   ) cfg.batch   = std::max<uint32_t>( 1, val );
+      else if( opt == "--lookups" ) cfg.lookups = std::max<uint32_t>( 1, val );
+      else if( opt == "--seed"    ) cfg.seed    = val;
+      else return false;
+   }
+   return true;
+}
+
+/** the calls in sorted triggered at call_price, highest first, found without market_db */
+std::vector<margin_call> expected_calls( const std::vector<margin_call>& sorted, const price& call_price )
+{
+   auto first = std::lower_bound( sorted.begin(), sorted.end(), margin_call( call_price, output_reference() ) );
+   return std::vector<margin_call>( std::vector<margin_call>::const_reverse_iterator( sorted.end() ),
+                                    std::vector<margin_call>::const_reverse_iterator( first ) );
+}
+
+int main( int argc, char** argv )
+{
+   bench_config cfg;
+   if( !parse_args( argc, argv, cfg ) )
+   {
+      std::cerr << "Usage: " << argv[0] << " [--calls N] [--batch N] [--lookups N] [--seed N]\n";
+      return 1;
+   }
+
+   // market_db logs every lookup, keep that out of the timings
+   configure_bench_logging( "market_db_bench.log" );
+
+   try {
+      std::mt19937       rand( cfg.seed );
+      fc::temp_directory dir;
+      market_db          db;
+      db.open( dir.path() / "market" );
+
+      std::vector<margin_call> usd_calls;
+      usd_calls.reserve( cfg.calls );
+
+      auto start = fc::time_point::now();
+      for( uint32_t i = 0; i < cfg.calls; )
+      {
+         db.begin_batch();
+         for( uint32_t b = 0; b < cfg.batch && i < cfg.calls; ++b, ++i )
+         {
+            // every other call is in btc so that the usd range has neighbours on both sides
+            asset::type quote = (i % 2) ? asset::btc : asset::usd;
+            fc::uint128 ratio = fc::uint128( uint64_t(1 + rand() % 1000000) ) * fc::uint128( uint64_t(1) << 40 );
+            margin_call call( price( ratio, asset::bts, quote ), output_reference( fc::ripemd160::hash( (char*)&i, sizeof(i) ), 0 ) );
+            db.insert_call( call, 1 );
+            if( quote == asset::usd )
+            {
+               usd_calls.push_back( call );
+            }
+         }
+         db.commit_batch();
+      }
+      double insert_sec = (fc::time_point::now() - start).count() / 1000000.0;
+      std::sort( usd_calls.begin(), usd_calls.end() );
+
+      std::cout << std::fixed << std::setprecision(3);
+      std::cout << "calls inserted:   " << cfg.calls << " in " << insert_sec << " sec, "
+                << cfg.calls / insert_sec << " calls/sec\n";
+      std::cout << std::setw(12) << "triggered" << std::setw(16) << "usec/get_calls" << "\n";
+
+      // from a price above every call, which triggers none, down to the lowest call, which triggers all
+      const uint32_t steps = 10;
+      for( uint32_t s = 0; s <= steps; ++s )
+      {
+         price call_price( fc::uint128( uint64_t(1000001) ) * fc::uint128( uint64_t(1) << 40 ), asset::bts, asset::usd );
+         if( s > 0 && usd_calls.size() )
+         {
+            size_t idx = std::min( usd_calls.size() - 1, usd_calls.size() - usd_calls.size() * s / steps );
+            call_price = usd_calls[idx].call_price;
+         }
+
+         auto expected = expected_calls( usd_calls, call_price );
+         auto actual   = db.get_calls( call_price );
+         FC_ASSERT( actual.size() == expected.size(), "triggered tail has ${a} calls, expected ${e}",
+                    ("a",actual.size())("e",expected.size())("price",call_price) );
+         for( size_t c = 0; c < actual.size(); ++c )
+         {
+            FC_ASSERT( actual[c] == expected[c] && actual[c].call_price.base_unit == expected[c].call_price.base_unit,
+                       "call ${c} of the triggered tail differs", ("c",c)("actual",actual[c])("expected",expected[c]) );
+         }
+
+         start = fc::time_point::now();
+         for( uint32_t l = 0; l < cfg.lookups; ++l )
+         {
+            actual = db.get_calls( call_price );
+         }
+         double usec = double( (fc::time_point::now() - start).count() ) / cfg.lookups;
+         std::cout << std::setw(12) << actual.size() << std::setw(16) << usec << "\n";
+      }
+      std::cout << "every triggered tail matched\n";
+   }
+   catch ( const fc::exception& e )
+   {
+      elog( "${e}", ("e", e.to_detail_string() ) );
+      std::cerr << e.to_detail_string() << "\n";
+      return 1;
+   }
+   return 0;
+}
@@ -0,0 +1,216 @@
+/**
+ *  Times fc::raw pack and unpack, id/digest and merkle root calculations for
+ *  representative sizes of the types that are serialized on hot paths.
+ *
+ *  Every result is printed as one json object per line:
+ *
+ *    {"type":"trx_block","case":"100_trxs","op":"pack","bytes":...,"iterations":...,"ns_per_op":...}
+ *
+ *  Usage: serialization_bench [MIN_MSEC_PER_CASE]   (default 200)
+ */
+#include <bts/blockchain/block.hpp>
+#include <bts/blockchain/outputs.hpp>
+#include <bts/blockchain/transaction.hpp>
+#include <bts/bitname/bitname_block.hpp>
+#include <bts/bitchat/bitchat_private_message.hpp>
+#include <bts/network/message.hpp>
+#include <fc/io/json.hpp>
+#include <fc/io/raw.hpp>
+#include <fc/log/logger.hpp>
+#include <fc/reflect/variant.hpp>
+#include <fc/string.hpp>
+#include <fc/variant_object.hpp>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <stdlib.h>
+
+#include "bench_common.hpp"
+
+using namespace bts::blockchain;
+
+template<typename Functor>
+void run( const std::string& type, const std::string& name, const std::string& op, size_t bytes, Functor f )
+{
+   auto t = time_case( f );
+   std::cout << fc::json::to_string( fc::mutable_variant_object( "type", type )
+                                        ( "case", name )
+                                        ( "op", op )
+                                        ( "bytes", uint64_t(bytes) )
+                                        ( "iterations", t.iterations )
+                                        ( "ns_per_op", t.ns_per_op() ) ) << "\n";
+}
+
+/** pack and unpack, every type is measured with these */
+template<typename T>
+void run_raw( const std::string& type, const std::string& name, const T& value )
+{
+   std::vector<char> packed = fc::raw::pack( value );
+   run( type, name, "pack", packed.size(), [&]()
+   {
+      bench_sink += fc::raw::pack( value ).size();
+   });
+   run( type, name, "pack_size", packed.size(), [&]()
+   {
+      bench_sink += fc::raw::pack_size( value );
+   });
+   run( type, name, "unpack", packed.size(), [&]()
+   {
+      T tmp = fc::raw::unpack<T>( packed );
+      bench_sink += sizeof(tmp);
+   });
+}
+
+signed_transaction make_transaction( uint32_t num_inputs, uint32_t num_outputs )
+{
+   signed_transaction trx;
+   trx.version = 0;
+   for( uint32_t i = 0; i < num_inputs; ++i )
+   {
+      trx.inputs.push_back( trx_input( claim_by_signature_input(),
+                                       output_reference( fc::ripemd160::hash( (char*)&i, sizeof(i) ), i % 4 ) ) );
+   }
+   for( uint32_t i = 0; i < num_outputs; ++i )
+   {
+      trx.outputs.push_back( trx_output( claim_by_signature_output( bts::address( bench_key(i).get_public_key() ) ),
+                                         asset( uint64_t(1000 + i), asset::bts ) ) );
+   }
+   for( uint32_t i = 0; i < num_inputs; ++i )
+   {
+      trx.sign( bench_key( 1000 + i ) );
+   }
+   return trx;
+}
+
+void bench_transactions()
+{
+   const uint32_t sizes[][2] = { {1,2}, {4,4}, {16,16} };
+   for( uint32_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); ++s )
+   {
+      auto trx  = make_transaction( sizes[s][0], sizes[s][1] );
+      auto name = fc::to_string( uint64_t(sizes[s][0]) ) + "_in_" + fc::to_string( uint64_t(sizes[s][1]) ) + "_out";
+      run_raw( "signed_transaction", name, trx );
+      run( "signed_transaction", name, "id", trx.size(), [&]()
+      {
+         bench_sink += trx.id()._hash[0];
+      });
+      run( "signed_transaction", name, "digest", trx.size(), [&]()
+      {
+         bench_sink += trx.digest()._hash[0];
+      });
+   }
+}
+
+void bench_trx_blocks()
+{
+   auto trx = make_transaction( 2, 2 );
+   const uint32_t sizes[] = { 10, 100, 1000 };
+   for( uint32_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); ++s )
+   {
+      trx_block blk;
+      blk.version   = 0;
+      blk.block_num = 1;
+      for( uint32_t i = 0; i < sizes[s]; ++i )
+      {
+         trx.valid_after = fc::time_point_sec( i ); // unique ids
+         blk.trxs.push_back( trx );
+      }
+      blk.trx_mroot = blk.calculate_merkle_root();
+
+      auto name = fc::to_string( uint64_t(sizes[s]) ) + "_trxs";
+      run_raw( "trx_block", name, blk );
+      run( "trx_block", name, "id", sizeof(block_header), [&]()
+      {
+         bench_sink += blk.id()._hash[0];
+      });
+      run( "trx_block", name, "merkle_root", blk.block_size(), [&]()
+      {
+         bench_sink += blk.calculate_merkle_root()._hash[0];
+      });
+      run( "trx_block", name, "block_size", blk.block_size(), [&]()
+      {
+         bench_sink += blk.block_size();
+      });
+   }
+}
+
+void bench_name_blocks()
+{
+   const uint32_t sizes[] = { 0, 100, 1000 };
+   for( uint32_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); ++s )
+   {
+      bts::bitname::name_block blk;
+      blk.master_key = bench_key( 0 ).get_public_key().serialize();
+      blk.active_key = blk.master_key;
+      for( uint32_t i = 0; i < sizes[s]; ++i )
+      {
+         bts::bitname::name_trx trx;
+         trx.name_hash  = 1000 + i;
+         trx.master_key = bench_key( i ).get_public_key().serialize();
+         trx.active_key = trx.master_key;
+         blk.name_trxs.push_back( trx );
+      }
+      blk.trxs_hash = blk.calc_trxs_hash();
+
+      auto name = fc::to_string( uint64_t(sizes[s]) ) + "_names";
+      run_raw( "name_block", name, blk );
+      run( "name_block", name, "id", fc::raw::pack_size( bts::bitname::name_header(blk) ), [&]()
+      {
+         bench_sink += blk.id()._hash[0];
+      });
+      run( "name_block", name, "trxs_hash", fc::raw::pack_size( blk ), [&]()
+      {
+         bench_sink += blk.calc_trxs_hash().low_bits();
+      });
+   }
+}
+
+void bench_encrypted_messages()
+{
+   const uint32_t sizes[] = { 256, 4096, 65536 };
+   for( uint32_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); ++s )
+   {
+      bts::bitchat::encrypted_message msg;
+      msg.timestamp = fc::time_point::now();
+      msg.dh_key    = bench_key( s ).get_public_key();
+      msg.data.resize( sizes[s] );
+      for( uint32_t i = 0; i < msg.data.size(); ++i )
+      {
+         msg.data[i] = char(i * 31);
+      }
+
+      auto name = fc::to_string( uint64_t(sizes[s]) ) + "_bytes";
+      run_raw( "encrypted_message", name, msg );
+      run( "encrypted_message", name, "id", fc::raw::pack_size( msg ), [&]()
+      {
+         bench_sink += msg.id().low_bits();
+      });
+      run( "encrypted_message", name, "network_message", fc::raw::pack_size( msg ), [&]()
+      {
+         bts::network::message m( msg );
+         bench_sink += m.data.size();
+      });
+   }
+}
+
+int main( int argc, char** argv )
+{
+   if( argc >= 2 )
+   {
+      min_usec_per_case = atoi( argv[1] ) * 1000ll;
+   }
+   try {
+      bench_transactions();
+      bench_trx_blocks();
+      bench_name_blocks();
+      bench_encrypted_messages();
+   }
+   catch ( const fc::exception& e )
+   {
+      elog( "${e}", ("e", e.to_detail_string() ) );
+      return 1;
+   }
+   return 0;
+}
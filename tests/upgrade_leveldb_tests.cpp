@@ -0,0 +1,270 @@
+#define BOOST_TEST_MODULE UpgradeLevelDbTests
+#include <boost/test/unit_test.hpp>
+#include <bts/blockchain/address_index.hpp>
+#include <bts/blockchain/blockchain_db.hpp>
+#include <bts/blockchain/blockchain_market_db.hpp>
+#include <bts/blockchain/utxo_index.hpp>
+#include <bts/db/level_map.hpp>
+#include <fc/crypto/ripemd160.hpp>
+#include <fc/exception/exception.hpp>
+#include <fc/filesystem.hpp>
+#include <fc/io/raw.hpp>
+#include <fc/log/logger.hpp>
+#include <fc/string.hpp>
+
+#include <leveldb/db.h>
+
+#include <limits>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <string.h>
+
+using namespace bts::blockchain;
+
+/**
+ *  Databases created before a key type had a key_codec hold fc::raw packed keys
+ *  sorted by level_map's reflection based key_compare.  level_map::open() has to
+ *  rewrite them through UpgradeDbKeysIfNecessary() into the key_codec encoding.
+ *
+ *  For every key type with a key_codec a database is written the old way, with
+ *  values chosen where the fc::raw bytes and the encoded bytes sort differently
+ *  (little endian integers, negative times), and then opened with level_map.
+ *  Iteration must visit every key in operator< order and fetch() must find the
+ *  value of every key.
+ */
+
+/** the comparator level_map used for every key type, it must keep the name */
+template<typename Key>
+class legacy_key_compare : public leveldb::Comparator
+{
+   public:
+     int Compare( const leveldb::Slice& a, const leveldb::Slice& b )const
+     {
+        Key ak,bk;
+        fc::datastream<const char*> dsa( a.data(), a.size() );
+        fc::raw::unpack( dsa, ak );
+        fc::datastream<const char*> dsb( b.data(), b.size() );
+        fc::raw::unpack( dsb, bk );
+
+        if( ak  < bk ) return -1;
+        if( ak == bk ) return 0;
+        return 1;
+     }
+
+     const char* Name()const { return "key_compare"; }
+     void FindShortestSeparator( std::string*, const leveldb::Slice& )const{}
+     void FindShortSuccessor( std::string* )const{};
+};
+
+fc::ripemd160 test_hash( uint32_t i )
+{
+   return fc::ripemd160::hash( (char*)&i, sizeof(i) );
+}
+
+template<typename Key>
+void check_upgrade( const std::vector<Key>& keys )
+{
+   fc::temp_directory dir;
+   fc::path           db_dir = dir.path() / "db";
+
+   std::map<Key,std::string> expected;
+   {
+      legacy_key_compare<Key> compare;
+      leveldb::Options opts;
+      opts.create_if_missing = true;
+      opts.comparator        = &compare;
+      leveldb::DB* ptr = nullptr;
+      auto status = leveldb::DB::Open( opts, db_dir.to_native_ansi_path(), &ptr );
+      BOOST_REQUIRE( status.ok() );
+      std::unique_ptr<leveldb::DB> legacy_db( ptr );
+
+      for( uint32_t i = 0; i < keys.size(); ++i )
+      {
+         std::string value        = "value" + fc::to_string( uint64_t(i) );
+         auto        packed_key   = fc::raw::pack( keys[i] );
+         auto        packed_value = fc::raw::pack( value );
+         status = legacy_db->Put( leveldb::WriteOptions(), leveldb::Slice( packed_key.data(), packed_key.size() ),
+                                  leveldb::Slice( packed_value.data(), packed_value.size() ) );
+         BOOST_REQUIRE( status.ok() );
+         expected[keys[i]] = value;
+      }
+   }
+   BOOST_REQUIRE( expected.size() == keys.size() );
+
+   bts::db::level_map<Key,std::string> map;
+   map.open( db_dir );
+
+   auto exp = expected.begin();
+   for( auto itr = map.begin(); itr.valid(); ++itr, ++exp )
+   {
+      BOOST_REQUIRE( exp != expected.end() );
+      BOOST_REQUIRE( itr.key() == exp->first );
+      BOOST_REQUIRE( itr.value() == exp->second );
+   }
+   BOOST_REQUIRE( exp == expected.end() );
+
+   for( exp = expected.begin(); exp != expected.end(); ++exp )
+   {
+      BOOST_REQUIRE( map.fetch( exp->first ) == exp->second );
+   }
+   map.close();
+
+   // nothing is left of the conversion and the database now opens with the bytewise comparator
+   BOOST_REQUIRE( !fc::exists( fc::path( db_dir.generic_string() + ".key_upgrade" ) ) );
+   BOOST_REQUIRE( !fc::exists( fc::path( db_dir.generic_string() + ".legacy_keys" ) ) );
+   {
+      leveldb::Options opts;
+      leveldb::DB* ptr = nullptr;
+      auto status = leveldb::DB::Open( opts, db_dir.to_native_ansi_path(), &ptr );
+      BOOST_REQUIRE( status.ok() );
+      delete ptr;
+   }
+
+   map.open( db_dir );
+   BOOST_REQUIRE( map.fetch( expected.begin()->first ) == expected.begin()->second );
+}
+
+/** fc::raw packs integers little endian, so these sort differently by byte */
+std::vector<uint32_t> test_uint32s()
+{
+   std::vector<uint32_t> v;
+   const uint32_t edges[] = { 0, 1, 0xff, 0x100, 0x101, 0xffff, 0x10000, 0x1000000, 0x7fffffff, 0x80000000, 0xffffffff };
+   v.insert( v.end(), edges, edges + sizeof(edges)/sizeof(edges[0]) );
+   for( uint32_t i = 0; i < 64; ++i )
+   {
+      v.push_back( test_hash( i )._hash[0] );
+   }
+   return v;
+}
+
+std::vector<trx_num> test_trx_nums()
+{
+   std::vector<trx_num> v;
+   auto nums = test_uint32s();
+   for( uint32_t i = 0; i < nums.size(); ++i )
+   {
+      v.push_back( trx_num( nums[i], 0 ) );
+      v.push_back( trx_num( nums[i], uint16_t( 0x100 + i ) ) );
+      v.push_back( trx_num( nums[i], 0xffff ) );
+   }
+   return v;
+}
+
+std::vector<output_reference> test_output_references()
+{
+   std::vector<output_reference> v;
+   for( uint32_t i = 0; i < 32; ++i )
+   {
+      v.push_back( output_reference( test_hash( i ), 0 ) );
+      v.push_back( output_reference( test_hash( i ), uint8_t( 1 + i ) ) );
+      v.push_back( output_reference( test_hash( i ), 0xff ) );
+   }
+   return v;
+}
+
+BOOST_AUTO_TEST_CASE( upgrade_uint32_keys )
+{
+   check_upgrade( test_uint32s() );
+}
+
+BOOST_AUTO_TEST_CASE( upgrade_time_point_keys )
+{
+   // the encoding flips the sign bit, negative times must still sort first
+   std::vector<fc::time_point> v;
+   const int64_t edges[] = { std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::min() + 1,
+                             -0x100000000ll, -0x100ll, -1, 0, 1, 0xff, 0x100, 0x100000000ll,
+                             1400000000ll * 1000000, std::numeric_limits<int64_t>::max() };
+   for( uint32_t i = 0; i < sizeof(edges)/sizeof(edges[0]); ++i )
+   {
+      v.push_back( fc::time_point( fc::microseconds( edges[i] ) ) );
+   }
+   for( uint32_t i = 0; i < 64; ++i )
+   {
+      int64_t t = int64_t( (uint64_t(test_hash( i )._hash[0]) << 32) | test_hash( i )._hash[1] );
+      v.push_back( fc::time_point( fc::microseconds( t ) ) );
+   }
+   check_upgrade( v );
+}
+
+BOOST_AUTO_TEST_CASE( upgrade_ripemd160_keys )
+{
+   std::vector<fc::ripemd160> v;
+   for( uint32_t i = 0; i < 64; ++i )
+   {
+      v.push_back( test_hash( i ) );
+   }
+   v.push_back( fc::ripemd160() );
+   check_upgrade( v );
+}
+
+BOOST_AUTO_TEST_CASE( upgrade_output_reference_keys )
+{
+   check_upgrade( test_output_references() );
+}
+
+BOOST_AUTO_TEST_CASE( upgrade_trx_num_keys )
+{
+   check_upgrade( test_trx_nums() );
+}
+
+BOOST_AUTO_TEST_CASE( upgrade_output_location_keys )
+{
+   std::vector<output_location> v;
+   auto nums = test_trx_nums();
+   for( uint32_t i = 0; i < nums.size(); ++i )
+   {
+      v.push_back( output_location( nums[i], uint8_t( i ) ) );
+   }
+   check_upgrade( v );
+}
+
+BOOST_AUTO_TEST_CASE( upgrade_address_output_key_keys )
+{
+   std::vector<address_output_key> v;
+   auto nums = test_trx_nums();
+   for( uint32_t i = 0; i < nums.size(); ++i )
+   {
+      output_owner owner;
+      owner.type = uint8_t( i % 2 );
+      auto h = test_hash( i / 4 );
+      memcpy( owner.addr.data, &h, sizeof(h) );
+      v.push_back( address_output_key( owner, output_location( nums[i], uint8_t( i ) ) ) );
+   }
+   check_upgrade( v );
+}
+
+BOOST_AUTO_TEST_CASE( upgrade_market_order_keys )
+{
+   std::vector<market_order> v;
+   auto refs = test_output_references();
+   for( uint32_t i = 0; i < refs.size(); ++i )
+   {
+      auto         h = test_hash( i );
+      fc::uint128  ratio( uint64_t( h._hash[0] ) << (i % 32), uint64_t( h._hash[1] ) << 24 | h._hash[2] );
+      market_order order;
+      order.base_unit  = asset::type( i % 2 );
+      order.quote_unit = asset::type( 1 + i % (asset::count - 1) );
+      order.ratio      = i % 5 ? ratio : fc::uint128( uint64_t(1), uint64_t(0) );
+      order.location   = refs[i];
+      v.push_back( order );
+   }
+   check_upgrade( v );
+}
+
+BOOST_AUTO_TEST_CASE( upgrade_margin_call_keys )
+{
+   // key_compare ignores the base unit of the call price, so it is always bts
+   std::vector<margin_call> v;
+   auto refs = test_output_references();
+   for( uint32_t i = 0; i < refs.size(); ++i )
+   {
+      auto         h = test_hash( i );
+      fc::uint128  ratio( uint64_t( h._hash[0] ) << (i % 32), uint64_t( h._hash[1] ) << 24 | h._hash[2] );
+      v.push_back( margin_call( price( i % 5 ? ratio : fc::uint128( uint64_t(1), uint64_t(0) ),
+                                       asset::bts, asset::type( 1 + i % (asset::count - 1) ) ), refs[i] ) );
+   }
+   check_upgrade( v );
+}
@@ -0,0 +1,175 @@
+/**
+ *  Times the validation of transactions that spend outputs of a genesis block,
+ *  the loop blockchain_db runs for every transaction it evaluates.
+ *
+ *  Signatures are recovered once up front and passed in, so only validation is
+ *  measured.  Each transaction size is validated three ways:
+ *
+ *    fresh_state - a new trx_validation_state for every transaction
+ *    reset_state - one trx_validation_state reset for every transaction
+ *    evaluate    - blockchain_db::evaluate_signed_transaction(), which resets
+ *                  the state it keeps and also checks the fees
+ *
+ *  Every result is printed as one json object per line:
+ *
+ *    {"type":"validation","case":"4_in_2_out","op":"reset_state","iterations":...,"ns_per_op":...,"trx_per_sec":...}
+ *
+ *  Usage: validation_bench [MIN_MSEC_PER_CASE]   (default 200)
+ */
+#include <bts/blockchain/blockchain_db.hpp>
+#include <bts/blockchain/block.hpp>
+#include <bts/blockchain/outputs.hpp>
+#include <bts/blockchain/trx_validation_state.hpp>
+#include <bts/blockchain/worker_threads.hpp>
+#include <bts/config.hpp>
+#include <fc/filesystem.hpp>
+#include <fc/io/json.hpp>
+#include <fc/log/logger.hpp>
+#include <fc/reflect/variant.hpp>
+#include <fc/string.hpp>
+#include <fc/variant_object.hpp>
+
+#include <iostream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <stdlib.h>
+
+#include "bench_common.hpp"
+
+using namespace bts::blockchain;
+
+const uint32_t num_keys    = 64;
+const uint64_t per_key     = 1000ll * COIN;
+
+template<typename Functor>
+void run( const std::string& name, const std::string& op, Functor f )
+{
+   auto t = time_case( f );
+   std::cout << fc::json::to_string( fc::mutable_variant_object( "type", "validation" )
+                                        ( "case", name )
+                                        ( "op", op )
+                                        ( "iterations", t.iterations )
+                                        ( "ns_per_op", t.ns_per_op() )
+                                        ( "trx_per_sec", t.ops_per_sec() ) ) << "\n";
+}
+
+/** pays per_key to each of the bench keys, the outputs every transaction spends */
+trx_block push_genesis( blockchain_db& db )
+{
+   trx_block b;
+   b.version      = 0;
+   b.block_num    = 0;
+   b.total_shares = per_key * num_keys;
+
+   signed_transaction coinbase;
+   coinbase.version = 0;
+   for( uint32_t i = 0; i < num_keys; ++i )
+   {
+      coinbase.outputs.push_back( trx_output( claim_by_signature_output( bts::address( bench_key(i).get_public_key() ) ),
+                                              asset( per_key, asset::bts ) ) );
+   }
+   b.trxs.push_back( coinbase );
+   b.trx_mroot = b.calculate_merkle_root();
+   b.timestamp = fc::time_point::now() - fc::seconds( BLOCK_INTERVAL * 60 );
+   b.next_fee  = block_header::calculate_next_fee( db.get_fee_rate().get_rounded_amount(), b.block_size() );
+   db.push_block( b );
+   return b;
+}
+
+/** spends the genesis outputs first to first + num_inputs - 1 */
+signed_transaction make_transaction( blockchain_db& db, const transaction_id_type& genesis_trx,
+                                     uint32_t first, uint32_t num_inputs, uint32_t num_outputs )
+{
+   signed_transaction trx;
+   trx.version = 0;
+   for( uint32_t i = 0; i < num_inputs; ++i )
+   {
+      trx.inputs.push_back( trx_input( claim_by_signature_input(), output_reference( genesis_trx, first + i ) ) );
+   }
+
+   // the fee is generous so that the size estimate does not have to be exact
+   uint64_t fee     = db.get_fee_rate().get_rounded_amount() * (1000 + 200 * (num_inputs + num_outputs));
+   uint64_t each    = (per_key * num_inputs - fee) / num_outputs;
+   for( uint32_t o = 0; o < num_outputs; ++o )
+   {
+      trx.outputs.push_back( trx_output( claim_by_signature_output( bts::address( bench_key(o).get_public_key() ) ),
+                                         asset( each, asset::bts ) ) );
+   }
+   for( uint32_t i = 0; i < num_inputs; ++i )
+   {
+      trx.sign( bench_key( first + i ) );
+   }
+   return trx;
+}
+
+void bench_validation( blockchain_db& db, const transaction_id_type& genesis_trx )
+{
+   const uint32_t sizes[][2] = { {1,2}, {4,2}, {16,4} };
+   for( uint32_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); ++s )
+   {
+      // a handful of distinct transactions so the loop does not revisit one set of inputs
+      std::vector<signed_transaction>               trxs;
+      std::vector< std::unordered_set<address> >    signers;
+      for( uint32_t first = 0; first + sizes[s][0] <= num_keys && trxs.size() < 4; first += sizes[s][0] )
+      {
+         trxs.push_back( make_transaction( db, genesis_trx, first, sizes[s][0], sizes[s][1] ) );
+         signers.push_back( trxs.back().get_signed_addresses() );
+      }
+
+      auto     name = fc::to_string( uint64_t(sizes[s][0]) ) + "_in_" + fc::to_string( uint64_t(sizes[s][1]) ) + "_out";
+      uint32_t next = 0;
+
+      run( name, "fresh_state", [&]()
+      {
+         uint32_t t = next++ % trxs.size();
+         trx_validation_state state( trxs[t], &db, true, -1, &signers[t] );
+         state.validate();
+         bench_sink += state.inputs.size();
+      });
+
+      trx_validation_state reused;
+      run( name, "reset_state", [&]()
+      {
+         uint32_t t = next++ % trxs.size();
+         reused.reset( trxs[t], &db, true, -1, &signers[t] );
+         reused.validate();
+         bench_sink += reused.inputs.size();
+      });
+
+      run( name, "evaluate", [&]()
+      {
+         uint32_t t = next++ % trxs.size();
+         bench_sink += db.evaluate_signed_transaction( trxs[t], false, false, &signers[t] ).total_spent;
+      });
+   }
+}
+
+int main( int argc, char** argv )
+{
+   if( argc >= 2 )
+   {
+      min_usec_per_case = atoi( argv[1] ) * 1000ll;
+   }
+
+   // validation logs every input and output, keep that out of the timings
+   configure_bench_logging( "validation_bench.log" );
+
+   try {
+      fc::temp_directory dir;
+      blockchain_db      db;
+      db.open( dir.path() / "chain" );
+      auto genesis = push_genesis( db );
+      bench_validation( db, genesis.trxs.front().id() );
+   }
+   catch ( const fc::exception& e )
+   {
+      elog( "${e}", ("e", e.to_detail_string() ) );
+      std::cerr << e.to_detail_string() << "\n";
+      shutdown_worker_threads();
+      return 1;
+   }
+   shutdown_worker_threads();
+   return 0;
+}